@@ -0,0 +1,130 @@
+/*
+ * sdmac-collect
+ * -------------
+ * Reads the metrics stream sent by "sdmac -e" from a serial port (or a
+ * pty) and shows each frame with rolling aggregates over the last
+ * SDM_ROLLING frames. With -c, output is CSV for feeding a dashboard.
+ */
+#define _DEFAULT_SOURCE
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "sdmac_host.h"
+
+static volatile sig_atomic_t stop;
+
+static void
+handle_signal(int sig)
+{
+    (void) sig;
+    stop = 1;
+}
+
+static void
+usage(void)
+{
+    fprintf(stderr,
+            "usage: sdmac-collect [-c] [-b <baud>] [-n <frames>] "
+            "[-t <secs>] <port>\n"
+            "    -b  baud rate (default 9600)\n"
+            "    -c  CSV output\n"
+            "    -n  stop after the specified number of frames\n"
+            "    -t  stop if no frame arrives within secs (default 30)\n");
+    exit(1);
+}
+
+int
+main(int argc, char **argv)
+{
+    uint8_t       frame[SDM_FRAME_MAX];
+    sdm_decoder_t dec;
+    sdm_rolling_t roll;
+    sdm_rollup_t  sum;
+    sdm_stats_t   st;
+    uint          baud = 9600;
+    uint          max_frames = 0;
+    uint          timeout = 30;
+    int           csv = 0;
+    int           rc = 0;
+    int           opt;
+    int           fd;
+
+    while ((opt = getopt(argc, argv, "b:cn:t:")) != -1) {
+        switch (opt) {
+            case 'b':
+                baud = atoi(optarg);
+                break;
+            case 'c':
+                csv = 1;
+                break;
+            case 'n':
+                max_frames = atoi(optarg);
+                break;
+            case 't':
+                timeout = atoi(optarg);
+                break;
+            default:
+                usage();
+        }
+    }
+    if (optind + 1 != argc)
+        usage();
+
+    fd = sdm_serial_open(argv[optind], baud);
+    if (fd < 0)
+        return (1);
+    signal(SIGINT, handle_signal);
+    signal(SIGTERM, handle_signal);
+    sdm_decode_init(&dec);
+    sdm_rolling_init(&roll);
+
+    if (csv)
+        printf("seq,uptime,interval_ms,requests,read_kb,write_kb,lat_avg,"
+               "lat_max,errors,cpu_pct,dropped,chip_free_kb,fast_free_mb,"
+               "roll_kbps,roll_reqs,roll_cpu_pct,roll_lat_max\n");
+    else
+        printf("   SEQ  UPTIME  REQS RD_KB WR_KB AVG_US MAX_US ERR CPU "
+               "| ROLLING KB/s REQ/s CPU MAX_US\n");
+    fflush(stdout);
+
+    while (!stop && ((max_frames == 0) || (roll.frames < max_frames))) {
+        int len = sdm_decode_read(&dec, fd, frame, timeout * 1000);
+
+        if (len == 0) {
+            fprintf(stderr, "No frame in %u seconds\n", timeout);
+            rc = 1;
+            break;
+        }
+        if (len < 0) {
+            if (!stop) {
+                perror(argv[optind]);
+                rc = 1;
+            }
+            break;
+        }
+        if (sdm_stats_parse(frame, &st) != 0)
+            continue;  // Not a metrics frame
+        sdm_rolling_add(&roll, &st);
+        sdm_rolling_get(&roll, &sum);
+        if (csv)
+            printf("%u,%u,%u,%u,%u,%u,%u,%u,%u,%u,%u,%u,%u,%u,%u,%u,%u\n",
+                   st.seq, st.uptime, st.interval_ms, st.requests,
+                   st.read_kb, st.write_kb, st.lat_avg, st.lat_max,
+                   st.errors, st.cpu_pct, st.dropped, st.chip_free,
+                   st.fast_free, sum.kbps, sum.requests, sum.cpu_pct,
+                   sum.lat_max);
+        else
+            printf("%6u %7u %5u %5u %5u %6u %6u %3u %3u | %12u %5u %3u "
+                   "%6u\n", st.seq, st.uptime, st.requests, st.read_kb,
+                   st.write_kb, st.lat_avg, st.lat_max, st.errors,
+                   st.cpu_pct, sum.kbps, sum.requests, sum.cpu_pct,
+                   sum.lat_max);
+        fflush(stdout);
+    }
+    fprintf(stderr, "%u frames, %u lost, %u CRC errors, %u bytes skipped\n",
+            roll.frames, roll.lost, dec.crc_errors, dec.skipped);
+    close(fd);
+    return (rc);
+}
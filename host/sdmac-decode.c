@@ -0,0 +1,42 @@
+/*
+ * sdmac-decode
+ * ------------
+ * Decodes "sdmac -S" register snapshot files on Linux, giving the same
+ * output as "sdmac -D". Any number of files may be given; each is mapped
+ * and walked record by record, so large collections stream through the
+ * page cache. The decoding is sdmac.c's own, compiled for the host (see
+ * the Makefile).
+ */
+#define main sdmac_main
+#include "../sdmac.c"
+#undef main
+
+#include <unistd.h>
+
+static void
+usage(void)
+{
+    fprintf(stderr, "usage: sdmac-decode [-b] <snapshot file>...\n"
+                    "    -b  one line per snapshot and a summary\n");
+    exit(1);
+}
+
+int
+main(int argc, char **argv)
+{
+    uint brief = 0;
+    int  opt;
+
+    while ((opt = getopt(argc, argv, "b")) != -1) {
+        switch (opt) {
+            case 'b':
+                brief++;
+                break;
+            default:
+                usage();
+        }
+    }
+    if (optind == argc)
+        usage();
+    return (snap_decode(argv + optind, argc - optind, brief));
+}
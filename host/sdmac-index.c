@@ -0,0 +1,530 @@
+/*
+ * sdmac-index
+ * -----------
+ * Keeps an index of "sdmac -S" snapshot files on Linux and answers the
+ * "sdmac -Q" queries from it, for collections too large to rescan for
+ * every query.
+ *
+ *     sdmac-index [-j <threads>] <dir> add <snapshot file>...
+ *     sdmac-index <dir> query <key>
+ *
+ * The index directory holds one file per column (see idx_cols[]), each a
+ * packed array of that snapshot field in host byte order, and a sources
+ * file listing each snapshot file with the number of bytes of it which
+ * have been indexed. Snapshot files only grow (-S appends to them), so a
+ * later add parses only what was appended since. Files are parsed by a
+ * pool of threads, each mapping its file with snap_load(); rows are then
+ * appended in command line order. The sources file also holds the row
+ * count and is replaced by rename() after the columns are written, so
+ * an interrupted add leaves the previous index intact, and the next add
+ * drops any column data past that count.
+ *
+ * Snapshots are parsed and grouped by sdmac.c's own code, compiled for
+ * the host (see the Makefile).
+ */
+#define main sdmac_main
+#include "../sdmac.c"
+#undef main
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+
+#define IDX_MAGIC    "sdmac-index 1"
+#define IDX_SOURCES  "sources"
+
+typedef struct {
+    const char *name;
+    size_t      offset;  // Field in snap_t
+    size_t      width;
+} idx_col_t;
+
+#define IDX_COL(field) \
+        { #field, offsetof(snap_t, field), sizeof (((snap_t *) 0)->field) }
+
+/* The fields which queries group by or report */
+static const idx_col_t idx_cols[] = {
+    IDX_COL(time),
+    IDX_COL(label),
+    IDX_COL(ctrl_type),
+    IDX_COL(ramsey_ver),
+    IDX_COL(sdmac_version),
+    IDX_COL(sdmac_rev),
+    IDX_COL(wd_level),
+    IDX_COL(wd_microcode),
+    IDX_COL(wdc_khz),
+    IDX_COL(drive),
+    IDX_COL(kbps),
+};
+
+typedef struct {
+    char *path;  // Absolute path of the snapshot file
+    long  done;  // Bytes of it indexed
+} idx_source_t;
+
+typedef struct {
+    const char   *dir;
+    uint64_t      rows;
+    uint          nsources;
+    idx_source_t *sources;
+} idx_t;
+
+typedef struct {
+    uint          source;  // Entry in sources
+    idx_source_t *src;
+    long          end;   // Offset after the last record parsed
+    uint64_t      rows;  // Records parsed
+    uint8_t      *cols[ARRAY_SIZE(idx_cols)];
+    int           rc;
+} idx_job_t;
+
+typedef struct {
+    pthread_mutex_t lock;
+    idx_job_t      *jobs;
+    uint            njobs;
+    uint            next;  // Next job to be taken
+} idx_pool_t;
+
+static void
+usage(void)
+{
+    fprintf(stderr,
+            "usage: sdmac-index [-j <threads>] <dir> add <snapshot file>...\n"
+            "       sdmac-index <dir> query <key>\n"
+            "    -j  parser threads (default one per CPU)\n"
+            "keys: ramsey, sdmac, wdc, clock, drive\n");
+    exit(1);
+}
+
+static void
+idx_path(char *buf, size_t len, const idx_t *idx, const char *name)
+{
+    snprintf(buf, len, "%s/%s", idx->dir, name);
+}
+
+/*
+ * idx_open
+ * --------
+ * Reads the sources file of an index. A missing directory or sources
+ * file is an empty index. Returns 0 on success.
+ */
+static int
+idx_open(idx_t *idx, const char *dir)
+{
+    char  path[PATH_MAX];
+    char  line[PATH_MAX + 32];
+    FILE *fp;
+
+    memset(idx, 0, sizeof (*idx));
+    idx->dir = dir;
+    idx_path(path, sizeof (path), idx, IDX_SOURCES);
+    fp = fopen(path, "r");
+    if (fp == NULL)
+        return ((errno == ENOENT) ? 0 : 1);
+    if ((fgets(line, sizeof (line), fp) == NULL) ||
+        (sscanf(line, IDX_MAGIC " %" SCNu64, &idx->rows) != 1)) {
+        printf("%s is not an sdmac-index sources file\n", path);
+        fclose(fp);
+        return (1);
+    }
+    while (fgets(line, sizeof (line), fp) != NULL) {
+        idx_source_t *src;
+        long          done;
+        int           pos;
+
+        line[strcspn(line, "\n")] = '\0';
+        if (sscanf(line, "%ld %n", &done, &pos) != 1) {
+            printf("%s: invalid line: %s\n", path, line);
+            fclose(fp);
+            return (1);
+        }
+        src = realloc(idx->sources, (idx->nsources + 1) * sizeof (*src));
+        if (src == NULL) {
+            fclose(fp);
+            return (1);
+        }
+        idx->sources = src;
+        src = &idx->sources[idx->nsources++];
+        src->path = strdup(line + pos);
+        src->done = done;
+    }
+    fclose(fp);
+    return (0);
+}
+
+/* Replaces the sources file, which commits the rows appended to columns */
+static int
+idx_commit(const idx_t *idx)
+{
+    char  path[PATH_MAX];
+    char  tmp[PATH_MAX];
+    FILE *fp;
+    uint  pos;
+    int   rc;
+
+    idx_path(path, sizeof (path), idx, IDX_SOURCES);
+    idx_path(tmp, sizeof (tmp), idx, IDX_SOURCES ".new");
+    fp = fopen(tmp, "w");
+    if (fp == NULL) {
+        printf("Failed to create %s\n", tmp);
+        return (1);
+    }
+    fprintf(fp, IDX_MAGIC " %" PRIu64 "\n", idx->rows);
+    for (pos = 0; pos < idx->nsources; pos++) {
+        fprintf(fp, "%ld %s\n", idx->sources[pos].done,
+                idx->sources[pos].path);
+    }
+    rc = (fflush(fp) != 0) || (fsync(fileno(fp)) != 0);
+    rc |= (fclose(fp) != 0);
+    if ((rc == 0) && (rename(tmp, path) != 0))
+        rc = 1;
+    if (rc != 0)
+        printf("Failed to write %s\n", path);
+    return (rc);
+}
+
+/*
+ * Returns the number of the source entry for a snapshot file, adding it
+ * if new, or -1 on failure. Adding may move the sources array.
+ */
+static int
+idx_source(idx_t *idx, const char *filename)
+{
+    idx_source_t *src;
+    char          path[PATH_MAX];
+    uint          pos;
+
+    if (realpath(filename, path) == NULL) {
+        printf("Failed to open %s\n", filename);
+        return (-1);
+    }
+    for (pos = 0; pos < idx->nsources; pos++)
+        if (strcmp(idx->sources[pos].path, path) == 0)
+            return (pos);
+    src = realloc(idx->sources, (idx->nsources + 1) * sizeof (*src));
+    if (src == NULL)
+        return (-1);
+    idx->sources = src;
+    src = &idx->sources[idx->nsources];
+    src->path = strdup(path);
+    src->done = 0;
+    return (idx->nsources++);
+}
+
+/*
+ * idx_parse
+ * ---------
+ * Parses the records of a snapshot file which are not yet indexed into
+ * the job's column buffers.
+ */
+static void
+idx_parse(idx_job_t *job)
+{
+    const char *name = job->src->path;
+    snap_t      snap;
+    uint8_t    *buf;
+    long        len;
+    long        off = job->src->done;
+    size_t      max;
+    uint        col;
+    int         got;
+
+    job->end = off;
+    buf = snap_load(name, &len);
+    if (buf == NULL) {
+        job->rc = 1;
+        return;
+    }
+    if (len < off) {
+        printf("%s: shorter than when it was indexed\n", name);
+        snap_unload(buf, len);
+        job->rc = 1;
+        return;
+    }
+    max = (len - off) / SNAP_MIN_SIZE;
+    for (col = 0; (col < ARRAY_SIZE(idx_cols)) && (max != 0); col++) {
+        job->cols[col] = malloc(max * idx_cols[col].width);
+        if (job->cols[col] == NULL) {
+            printf("Out of memory\n");
+            snap_unload(buf, len);
+            job->rc = 1;
+            return;
+        }
+    }
+    while ((got = snap_next(buf, len, &off, &snap)) > 0) {
+        for (col = 0; col < ARRAY_SIZE(idx_cols); col++) {
+            const idx_col_t *ic = &idx_cols[col];
+            memcpy(job->cols[col] + job->rows * ic->width,
+                   (uint8_t *) &snap + ic->offset, ic->width);
+        }
+        job->rows++;
+        job->end = off;
+    }
+    if (got < 0) {
+        /* The good records before this are kept; an add resumes here */
+        printf("%s: bad snapshot at offset %ld\n", name, off);
+        job->rc = 1;
+    }
+    snap_unload(buf, len);
+}
+
+static void *
+idx_worker(void *arg)
+{
+    idx_pool_t *pool = arg;
+
+    for (;;) {
+        idx_job_t *job = NULL;
+
+        pthread_mutex_lock(&pool->lock);
+        if (pool->next < pool->njobs)
+            job = &pool->jobs[pool->next++];
+        pthread_mutex_unlock(&pool->lock);
+        if (job == NULL)
+            return (NULL);
+        idx_parse(job);
+    }
+}
+
+/*
+ * idx_append
+ * ----------
+ * Appends the parsed rows of every job to the column files, after
+ * dropping any rows an interrupted add left past the committed count.
+ */
+static int
+idx_append(const idx_t *idx, idx_job_t *jobs, uint njobs)
+{
+    char path[PATH_MAX];
+    uint col;
+    uint pos;
+
+    for (col = 0; col < ARRAY_SIZE(idx_cols); col++) {
+        const idx_col_t *ic = &idx_cols[col];
+        int              fd;
+        int              rc = 0;
+
+        idx_path(path, sizeof (path), idx, ic->name);
+        fd = open(path, O_WRONLY | O_CREAT, 0644);
+        if ((fd < 0) || (ftruncate(fd, idx->rows * ic->width) != 0) ||
+            (lseek(fd, 0, SEEK_END) < 0)) {
+            printf("Failed to open %s\n", path);
+            if (fd >= 0)
+                close(fd);
+            return (1);
+        }
+        for (pos = 0; (pos < njobs) && (rc == 0); pos++) {
+            size_t   left = jobs[pos].rows * ic->width;
+            uint8_t *data = jobs[pos].cols[col];
+
+            while ((left != 0) && (rc == 0)) {
+                ssize_t len = write(fd, data, left);
+                if (len > 0) {
+                    data += len;
+                    left -= len;
+                } else if ((len < 0) && (errno == EINTR)) {
+                    continue;
+                } else {
+                    rc = 1;
+                }
+            }
+        }
+        if ((rc != 0) || (fsync(fd) != 0)) {
+            printf("Failed to write %s\n", path);
+            close(fd);
+            return (1);
+        }
+        close(fd);
+    }
+    return (0);
+}
+
+/*
+ * idx_add
+ * -------
+ * Indexes the records added to the snapshot files since they were last
+ * indexed, parsing the files with a pool of threads.
+ */
+static int
+idx_add(const char *dir, char **files, uint nfiles, uint nthreads)
+{
+    idx_t       idx;
+    idx_pool_t  pool;
+    pthread_t  *threads;
+    uint64_t    added = 0;
+    char        path[PATH_MAX];
+    uint        pos;
+    uint        col;
+    int         lock;
+    int         rc = 0;
+
+    if ((mkdir(dir, 0755) != 0) && (errno != EEXIST)) {
+        printf("Failed to create %s\n", dir);
+        return (1);
+    }
+    snprintf(path, sizeof (path), "%s/lock", dir);
+    lock = open(path, O_RDWR | O_CREAT, 0644);
+    if ((lock < 0) || (flock(lock, LOCK_EX) != 0)) {
+        printf("Failed to lock %s\n", path);
+        return (1);
+    }
+    if (idx_open(&idx, dir) != 0) {
+        close(lock);
+        return (1);
+    }
+
+    memset(&pool, 0, sizeof (pool));
+    pthread_mutex_init(&pool.lock, NULL);
+    pool.jobs = calloc(nfiles, sizeof (*pool.jobs));
+    threads   = calloc(nthreads, sizeof (*threads));
+    if ((pool.jobs == NULL) || (threads == NULL)) {
+        printf("Out of memory\n");
+        close(lock);
+        return (1);
+    }
+    for (pos = 0; pos < nfiles; pos++) {
+        int  source = idx_source(&idx, files[pos]);
+        uint job;
+
+        if (source < 0) {
+            rc = 1;
+            continue;
+        }
+        for (job = 0; job < pool.njobs; job++)
+            if (pool.jobs[job].source == (uint) source)
+                break;  // Named twice
+        if (job == pool.njobs)
+            pool.jobs[pool.njobs++].source = source;
+    }
+    for (pos = 0; pos < pool.njobs; pos++)
+        pool.jobs[pos].src = &idx.sources[pool.jobs[pos].source];
+
+    if (nthreads > pool.njobs)
+        nthreads = pool.njobs;
+    for (pos = 0; pos < nthreads; pos++)
+        pthread_create(&threads[pos], NULL, idx_worker, &pool);
+    for (pos = 0; pos < nthreads; pos++)
+        pthread_join(threads[pos], NULL);
+
+    if (idx_append(&idx, pool.jobs, pool.njobs) == 0) {
+        for (pos = 0; pos < pool.njobs; pos++) {
+            idx_job_t *job = &pool.jobs[pos];
+            rc |= job->rc;
+            job->src->done = job->end;
+            added += job->rows;
+        }
+        idx.rows += added;
+        rc |= idx_commit(&idx);
+        printf("%" PRIu64 " snapshots added from %u files; %" PRIu64
+               " indexed\n", added, pool.njobs, idx.rows);
+    } else {
+        rc = 1;
+    }
+
+    for (pos = 0; pos < pool.njobs; pos++)
+        for (col = 0; col < ARRAY_SIZE(idx_cols); col++)
+            free(pool.jobs[pos].cols[col]);
+    free(pool.jobs);
+    free(threads);
+    for (pos = 0; pos < idx.nsources; pos++)
+        free(idx.sources[pos].path);
+    free(idx.sources);
+    close(lock);
+    return (rc);
+}
+
+/*
+ * idx_query
+ * ---------
+ * Groups every indexed snapshot by key, as "sdmac -Q" does, from the
+ * mapped column files.
+ */
+static int
+idx_query(const char *dir, const char *key)
+{
+    query_group_t *grps;
+    uint8_t       *cols[ARRAY_SIZE(idx_cols)];
+    long           lens[ARRAY_SIZE(idx_cols)];
+    snap_t         snap;
+    idx_t          idx;
+    char           path[PATH_MAX];
+    uint64_t       row;
+    uint           ngrps = 0;
+    uint           col;
+    uint           pos;
+    int            rc = 0;
+
+    if (query_check_key(key) || (idx_open(&idx, dir) != 0))
+        return (1);
+    grps = calloc(QUERY_MAX_GROUPS, sizeof (*grps));
+    if (grps == NULL) {
+        printf("Failed to allocate query groups\n");
+        return (1);
+    }
+    memset(cols, 0, sizeof (cols));
+    for (col = 0; (col < ARRAY_SIZE(idx_cols)) && (idx.rows != 0); col++) {
+        idx_path(path, sizeof (path), &idx, idx_cols[col].name);
+        cols[col] = host_map_file(path, &lens[col]);
+        if ((cols[col] == NULL) ||
+            ((uint64_t) lens[col] < idx.rows * idx_cols[col].width)) {
+            printf("%s is missing or short\n", path);
+            rc = 1;
+            break;
+        }
+    }
+
+    memset(&snap, 0, sizeof (snap));
+    for (row = 0; (row < idx.rows) && (rc == 0); row++) {
+        for (col = 0; col < ARRAY_SIZE(idx_cols); col++) {
+            const idx_col_t *ic = &idx_cols[col];
+            memcpy((uint8_t *) &snap + ic->offset,
+                   cols[col] + row * ic->width, ic->width);
+        }
+        rc = query_group(grps, &ngrps, &snap, key);
+    }
+    if (rc == 0)
+        query_show(grps, ngrps, idx.rows, key);
+
+    for (col = 0; col < ARRAY_SIZE(idx_cols); col++)
+        if (cols[col] != NULL)
+            host_unmap_file(cols[col], lens[col]);
+    for (pos = 0; pos < ngrps; pos++)
+        for (col = 0; col < ARRAY_SIZE(grps[pos].kbps); col++)
+            free(grps[pos].kbps[col]);
+    free(grps);
+    for (pos = 0; pos < idx.nsources; pos++)
+        free(idx.sources[pos].path);
+    free(idx.sources);
+    return (rc);
+}
+
+int
+main(int argc, char **argv)
+{
+    long nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+    int  opt;
+
+    while ((opt = getopt(argc, argv, "+j:")) != -1) {
+        switch (opt) {
+            case 'j':
+                nthreads = atoi(optarg);
+                break;
+            default:
+                usage();
+        }
+    }
+    if ((nthreads < 1) || (optind + 3 > argc))
+        usage();
+    if (strcmp(argv[optind + 1], "add") == 0)
+        return (idx_add(argv[optind], argv + optind + 2, argc - optind - 2,
+                        nthreads));
+    if ((strcmp(argv[optind + 1], "query") == 0) && (optind + 3 == argc))
+        return (idx_query(argv[optind], argv[optind + 2]));
+    usage();
+    return (1);
+}
@@ -0,0 +1,187 @@
+/*
+ * sdmac-remote
+ * ------------
+ * Drives "sdmac -g" on an Amiga from Linux. The commands on the command
+ * line are sent in order; each prints one line of output. The exit code
+ * is 0 if every command succeeded and every test passed.
+ *
+ * Example benchmark matrix:
+ *     for kb in 16 64 256; do
+ *         sdmac-remote /dev/ttyUSB0 bench 6 $kb 4 results
+ *     done
+ */
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "sdmac_host.h"
+
+static void
+usage(void)
+{
+    fprintf(stderr,
+            "usage: sdmac-remote [-b <baud>] [-t <msec>] [-r <retries>] "
+            "<port> <command>...\n"
+            "    -b  baud rate (default 9600)\n"
+            "    -r  retries after a timeout (default %u)\n"
+            "    -t  reply timeout in msec (default %u)\n"
+            "commands:\n"
+            "    ping                       show the agent version\n"
+            "    r <reg>                    read WDC register (hex)\n"
+            "    w <reg> <value>            write WDC register (hex)\n"
+            "    burst <first> <count>      read registers (hex)\n"
+            "    test <name>                run a named test\n"
+            "    bench <unit> <kb> <depth>  run the -b benchmark\n"
+            "    results                    show benchmark results\n"
+            "    quit                       stop the agent\n",
+            SDM_AG_RETRIES, SDM_AG_TIMEOUT_MS);
+    exit(1);
+}
+
+/* Parses a number, exiting with usage if it is not entirely valid */
+static uint
+parse_num(const char *str, int base)
+{
+    char          *end;
+    unsigned long  value = strtoul(str, &end, base);
+
+    if ((*str == '\0') || (*end != '\0') || (value > 0xffff)) {
+        fprintf(stderr, "Invalid number \"%s\"\n", str);
+        usage();
+    }
+    return (value);
+}
+
+/*
+ * run_command
+ * -----------
+ * Runs the command at argv[0], returning the number of arguments used.
+ * *rc is set non-zero on failure.
+ */
+static int
+run_command(sdm_agent_t *ag, char **argv, int argc, int *rc)
+{
+    const char *cmd = argv[0];
+    uint8_t     values[255];
+    uint        value;
+    uint        pos;
+    int         err;
+
+#define NEED_ARGS(n) do { if (argc < (n) + 1) usage(); } while (0)
+
+    if (strcmp(cmd, "ping") == 0) {
+        char version[256];
+        err = sdm_agent_ping(ag, version, sizeof (version));
+        if (err == 0)
+            printf("%s\n", version);
+        argc = 1;
+    } else if (strcmp(cmd, "r") == 0) {
+        NEED_ARGS(1);
+        err = sdm_agent_reg_read(ag, parse_num(argv[1], 16), values);
+        if (err == 0)
+            printf("%02x\n", values[0]);
+        argc = 2;
+    } else if (strcmp(cmd, "w") == 0) {
+        NEED_ARGS(2);
+        value = parse_num(argv[2], 16);
+        if (value > 0xff)
+            usage();
+        err = sdm_agent_reg_write(ag, parse_num(argv[1], 16), value);
+        if (err == 0)
+            printf("ok\n");
+        argc = 3;
+    } else if (strcmp(cmd, "burst") == 0) {
+        NEED_ARGS(2);
+        value = parse_num(argv[2], 16);
+        err = sdm_agent_burst_read(ag, parse_num(argv[1], 16), value,
+                                   values);
+        if (err == 0) {
+            for (pos = 0; pos < value; pos++)
+                printf("%s%02x", (pos == 0) ? "" : " ", values[pos]);
+            printf("\n");
+        }
+        argc = 3;
+    } else if (strcmp(cmd, "test") == 0) {
+        NEED_ARGS(1);
+        err = sdm_agent_test(ag, argv[1], &value);
+        if (err == 0) {
+            printf("%s: %s\n", argv[1], (value == 0) ? "PASS" : "FAIL");
+            if (value != 0)
+                *rc = 1;
+        }
+        argc = 2;
+    } else if (strcmp(cmd, "bench") == 0) {
+        NEED_ARGS(3);
+        err = sdm_agent_bench(ag, parse_num(argv[1], 10),
+                              parse_num(argv[2], 10),
+                              parse_num(argv[3], 10), &value);
+        if (err == 0) {
+            printf("bench: %s\n", (value == 0) ? "done" : "failed");
+            if (value != 0)
+                *rc = 1;
+        }
+        argc = 4;
+    } else if (strcmp(cmd, "results") == 0) {
+        sdm_results_t res;
+        err = sdm_agent_results(ag, &res);
+        if (err == 0)
+            printf("CMD_READ %u HD_SCSICMD %u direct %u KB/s  %s\n",
+                   res.kbps[0], res.kbps[1], res.kbps[2], res.drive);
+        argc = 1;
+    } else if (strcmp(cmd, "quit") == 0) {
+        err = sdm_agent_quit(ag);
+        if (err == 0)
+            printf("ok\n");
+        argc = 1;
+    } else {
+        fprintf(stderr, "Unknown command \"%s\"\n", cmd);
+        usage();
+    }
+    if (err != 0) {
+        printf("%s: %s\n", cmd, sdm_agent_strerror(err));
+        *rc = 1;
+    }
+    return (argc);
+}
+
+int
+main(int argc, char **argv)
+{
+    sdm_agent_t ag;
+    uint        baud = 9600;
+    uint        timeout = SDM_AG_TIMEOUT_MS;
+    uint        retries = SDM_AG_RETRIES;
+    int         rc = 0;
+    int         opt;
+    int         fd;
+
+    while ((opt = getopt(argc, argv, "+b:r:t:")) != -1) {
+        switch (opt) {
+            case 'b':
+                baud = atoi(optarg);
+                break;
+            case 'r':
+                retries = atoi(optarg);
+                break;
+            case 't':
+                timeout = atoi(optarg);
+                break;
+            default:
+                usage();
+        }
+    }
+    if (optind + 2 > argc)
+        usage();
+
+    fd = sdm_serial_open(argv[optind], baud);
+    if (fd < 0)
+        return (1);
+    sdm_agent_init(&ag, fd);
+    ag.timeout_ms = timeout;
+    ag.retries    = retries;
+    for (optind++; optind < argc; )
+        optind += run_command(&ag, argv + optind, argc - optind, &rc);
+    close(fd);
+    return (rc);
+}
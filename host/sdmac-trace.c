@@ -0,0 +1,28 @@
+/*
+ * sdmac-trace
+ * -----------
+ * Analyzes "sdmac -T" scsi.device trace dumps on Linux, giving the same
+ * report as "sdmac -A". sdmac.c is compiled for the host here (see the
+ * Makefile), so the analysis is the Amiga code itself.
+ */
+#define main sdmac_main
+#include "../sdmac.c"
+#undef main
+
+int
+main(int argc, char **argv)
+{
+    int arg;
+    int rc = 0;
+
+    if (argc < 2) {
+        fprintf(stderr, "usage: sdmac-trace <dump>...\n");
+        return (1);
+    }
+    for (arg = 1; arg < argc; arg++) {
+        if (argc > 2)
+            printf("%s%s:\n", (arg == 1) ? "" : "\n", argv[arg]);
+        rc |= trace_analyze(argv[arg]);
+    }
+    return (rc);
+}
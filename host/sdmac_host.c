@@ -0,0 +1,571 @@
+/*
+ * sdmac_host.c
+ * ------------
+ * Linux side of the sdmac serial protocols: the metrics stream decoder
+ * and the remote test agent client. See sdmac_host.h.
+ */
+#define _DEFAULT_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include "sdmac_host.h"
+
+uint16_t
+sdm_crc16(const uint8_t *data, uint len)
+{
+    uint16_t crc = 0xffff;
+    uint     bit;
+
+    while (len-- > 0) {
+        crc ^= *(data++) << 8;
+        for (bit = 0; bit < 8; bit++)
+            crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : (crc << 1);
+    }
+    return (crc);
+}
+
+uint8_t *
+sdm_put32(uint8_t *ptr, uint32_t value)
+{
+    ptr[0] = value >> 24;
+    ptr[1] = value >> 16;
+    ptr[2] = value >> 8;
+    ptr[3] = value;
+    return (ptr + 4);
+}
+
+uint8_t *
+sdm_put16(uint8_t *ptr, uint16_t value)
+{
+    ptr[0] = value >> 8;
+    ptr[1] = value;
+    return (ptr + 2);
+}
+
+uint32_t
+sdm_get32(const uint8_t *ptr)
+{
+    return (((uint32_t) ptr[0] << 24) | (ptr[1] << 16) | (ptr[2] << 8) |
+            ptr[3]);
+}
+
+uint16_t
+sdm_get16(const uint8_t *ptr)
+{
+    return ((ptr[0] << 8) | ptr[1]);
+}
+
+/*
+ * sdm_frame
+ * ---------
+ * Builds a frame of the specified type and payload in buf, which must
+ * hold SDM_FRAME_MAX bytes. Returns the frame length.
+ */
+uint
+sdm_frame(uint8_t *buf, uint type, const void *payload, uint plen)
+{
+    buf[0] = SDM_SYNC0;
+    buf[1] = SDM_SYNC1;
+    buf[2] = plen;
+    buf[3] = type;
+    if (plen != 0)
+        memcpy(buf + 4, payload, plen);
+    sdm_put16(buf + 4 + plen, sdm_crc16(buf + 2, plen + 2));
+    return (4 + plen + 2);
+}
+
+/*
+ * sdm_serial_open
+ * ---------------
+ * Opens a serial port or pty in raw 8N1 mode without flow control at the
+ * specified baud rate. Returns the file descriptor, or -1 on failure.
+ */
+int
+sdm_serial_open(const char *path, uint baud)
+{
+    struct termios tio;
+    speed_t        speed;
+    int            fd;
+
+    switch (baud) {
+        case 1200:   speed = B1200;   break;
+        case 2400:   speed = B2400;   break;
+        case 4800:   speed = B4800;   break;
+        case 9600:   speed = B9600;   break;
+        case 19200:  speed = B19200;  break;
+        case 38400:  speed = B38400;  break;
+        case 57600:  speed = B57600;  break;
+        case 115200: speed = B115200; break;
+        default:
+            fprintf(stderr, "Unsupported baud rate %u\n", baud);
+            return (-1);
+    }
+
+    fd = open(path, O_RDWR | O_NOCTTY);
+    if (fd < 0) {
+        perror(path);
+        return (-1);
+    }
+    if (tcgetattr(fd, &tio) != 0) {
+        perror(path);
+        close(fd);
+        return (-1);
+    }
+    cfmakeraw(&tio);
+    tio.c_cflag &= ~(CSTOPB | PARENB | CRTSCTS);
+    tio.c_cflag |= CS8 | CLOCAL | CREAD;
+    tio.c_iflag &= ~(IXON | IXOFF | IXANY);
+    tio.c_cc[VMIN]  = 1;
+    tio.c_cc[VTIME] = 0;
+    cfsetispeed(&tio, speed);
+    cfsetospeed(&tio, speed);
+    if (tcsetattr(fd, TCSANOW, &tio) != 0) {
+        perror(path);
+        close(fd);
+        return (-1);
+    }
+    return (fd);
+}
+
+void
+sdm_decode_init(sdm_decoder_t *dec)
+{
+    memset(dec, 0, sizeof (*dec));
+}
+
+/* Returns the number of bytes sdm_decode_feed() will currently accept */
+uint
+sdm_decode_space(const sdm_decoder_t *dec)
+{
+    return (sizeof (dec->buf) - (dec->tail - dec->head));
+}
+
+/*
+ * sdm_decode_feed
+ * ---------------
+ * Adds received bytes to the decoder. Returns the number of bytes taken,
+ * which is less than len if the buffer is full; call sdm_decode_next()
+ * to make room.
+ */
+uint
+sdm_decode_feed(sdm_decoder_t *dec, const uint8_t *data, uint len)
+{
+    uint space;
+
+    if (dec->head != 0) {
+        memmove(dec->buf, dec->buf + dec->head, dec->tail - dec->head);
+        dec->tail -= dec->head;
+        dec->head = 0;
+    }
+    space = sizeof (dec->buf) - dec->tail;
+    if (len > space)
+        len = space;
+    memcpy(dec->buf + dec->tail, data, len);
+    dec->tail += len;
+    return (len);
+}
+
+/*
+ * sdm_decode_next
+ * ---------------
+ * Copies the next frame with a valid CRC to frame, which must hold
+ * SDM_FRAME_MAX bytes. Returns the frame length, or 0 if more data is
+ * needed.
+ */
+uint
+sdm_decode_next(sdm_decoder_t *dec, uint8_t *frame)
+{
+    while (dec->tail - dec->head >= 4 + 2) {
+        const uint8_t *ptr = dec->buf + dec->head;
+        uint           len;
+
+        if ((ptr[0] != SDM_SYNC0) || (ptr[1] != SDM_SYNC1)) {
+            dec->head++;
+            dec->skipped++;
+            continue;
+        }
+        len = 4 + ptr[2] + 2;
+        if (dec->tail - dec->head < len)
+            return (0);  // Wait for the rest of the frame
+        if (sdm_crc16(ptr + 2, ptr[2] + 2) != sdm_get16(ptr + len - 2)) {
+            dec->head++;  // Bad frame or false sync: resync
+            dec->skipped++;
+            dec->crc_errors++;
+            continue;
+        }
+        memcpy(frame, ptr, len);
+        dec->head += len;
+        dec->frames++;
+        return (len);
+    }
+    return (0);
+}
+
+/*
+ * sdm_decode_read
+ * ---------------
+ * Reads from fd until the decoder has a complete frame, which is copied
+ * to frame. Returns the frame length, 0 if none arrived within msec
+ * milliseconds, or -1 on a read error or end of file.
+ */
+int
+sdm_decode_read(sdm_decoder_t *dec, int fd, uint8_t *frame, uint msec)
+{
+    struct timespec start;
+    struct timespec now;
+    uint8_t         data[SDM_FRAME_MAX];
+    uint            len;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    while ((len = sdm_decode_next(dec, frame)) == 0) {
+        struct pollfd pfd = { fd, POLLIN, 0 };
+        uint          elapsed;
+        ssize_t       got;
+        uint          want;
+        int           rc;
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        elapsed = (now.tv_sec - start.tv_sec) * 1000 +
+                  (now.tv_nsec - start.tv_nsec) / 1000000;
+        if (elapsed >= msec)
+            return (0);
+        rc = poll(&pfd, 1, msec - elapsed);
+        if ((rc < 0) && (errno == EINTR))
+            continue;
+        if (rc < 0)
+            return (-1);
+        if (rc == 0)
+            return (0);
+
+        want = sdm_decode_space(dec);
+        if (want > sizeof (data))
+            want = sizeof (data);
+        got = read(fd, data, want);
+        if ((got < 0) && ((errno == EINTR) || (errno == EAGAIN)))
+            continue;
+        if (got <= 0)
+            return (-1);
+        sdm_decode_feed(dec, data, got);
+    }
+    return (len);
+}
+
+/*
+ * sdm_stats_parse
+ * ---------------
+ * Extracts the statistics from a metrics frame. Returns -1 if the frame
+ * is some other type or too short.
+ */
+int
+sdm_stats_parse(const uint8_t *frame, sdm_stats_t *st)
+{
+    const uint8_t *payload = frame + 4;
+
+    if ((frame[3] != SDM_TYPE_STATS) || (frame[2] < SDM_STATS_PAYLOAD))
+        return (-1);
+    st->seq         = sdm_get32(payload + 0);
+    st->uptime      = sdm_get32(payload + 4);
+    st->interval_ms = sdm_get32(payload + 8);
+    st->requests    = sdm_get32(payload + 12);
+    st->read_kb     = sdm_get32(payload + 16);
+    st->write_kb    = sdm_get32(payload + 20);
+    st->lat_avg     = sdm_get32(payload + 24);
+    st->lat_max     = sdm_get32(payload + 28);
+    st->errors      = sdm_get16(payload + 32);
+    st->cpu_pct     = payload[34];
+    st->dropped     = payload[35];
+    st->chip_free   = sdm_get16(payload + 36);
+    st->fast_free   = sdm_get16(payload + 38);
+    return (0);
+}
+
+void
+sdm_rolling_init(sdm_rolling_t *roll)
+{
+    memset(roll, 0, sizeof (*roll));
+}
+
+/*
+ * sdm_rolling_add
+ * ---------------
+ * Adds a frame to the rolling window, replacing the oldest once the
+ * window is full. Gaps in the sequence numbers are counted as lost.
+ */
+void
+sdm_rolling_add(sdm_rolling_t *roll, const sdm_stats_t *st)
+{
+    if ((roll->frames != 0) && (st->seq != roll->next_seq))
+        roll->lost += st->seq - roll->next_seq;
+    roll->next_seq = st->seq + 1;
+    roll->hist[roll->frames % SDM_ROLLING] = *st;
+    roll->frames++;
+    if (roll->count < SDM_ROLLING)
+        roll->count++;
+}
+
+void
+sdm_rolling_get(const sdm_rolling_t *roll, sdm_rollup_t *sum)
+{
+    uint64_t kb = 0;
+    uint64_t ms = 0;
+    uint64_t reqs = 0;
+    uint     cpu = 0;
+    uint     pos;
+
+    memset(sum, 0, sizeof (*sum));
+    for (pos = 0; pos < roll->count; pos++) {
+        const sdm_stats_t *st = &roll->hist[pos];
+
+        kb   += st->read_kb + st->write_kb;
+        ms   += st->interval_ms;
+        reqs += st->requests;
+        cpu  += st->cpu_pct;
+        sum->errors += st->errors;
+        if (sum->lat_max < st->lat_max)
+            sum->lat_max = st->lat_max;
+    }
+    if (ms != 0) {
+        sum->kbps     = kb * 1000 / ms;
+        sum->requests = reqs * 1000 / ms;
+    }
+    if (roll->count != 0)
+        sum->cpu_pct = cpu / roll->count;
+}
+
+void
+sdm_agent_init(sdm_agent_t *ag, int fd)
+{
+    memset(ag, 0, sizeof (*ag));
+    ag->fd         = fd;
+    ag->timeout_ms = SDM_AG_TIMEOUT_MS;
+    ag->long_ms    = SDM_AG_BENCH_MS;
+    ag->retries    = SDM_AG_RETRIES;
+    sdm_decode_init(&ag->dec);
+}
+
+static int
+write_all(int fd, const uint8_t *buf, uint len)
+{
+    while (len > 0) {
+        ssize_t done = write(fd, buf, len);
+        if ((done < 0) && (errno == EINTR))
+            continue;
+        if (done <= 0)
+            return (-1);
+        buf += done;
+        len -= done;
+    }
+    return (0);
+}
+
+/*
+ * sdm_agent_call
+ * --------------
+ * Sends a request to the agent and waits up to msec for the reply,
+ * retrying after a timeout. The reply payload is copied to rep, which
+ * must hold 255 bytes. Returns the reply payload length, or a negated
+ * SDM_ERR code.
+ */
+int
+sdm_agent_call(sdm_agent_t *ag, uint type, const uint8_t *req, uint len,
+               uint8_t *rep, uint msec)
+{
+    uint8_t frame[SDM_FRAME_MAX];
+    uint8_t got[SDM_FRAME_MAX];
+    uint    flen = sdm_frame(frame, type, req, len);
+    uint    attempt;
+    int     rc;
+
+    for (attempt = 0; attempt <= ag->retries; attempt++) {
+        tcflush(ag->fd, TCIFLUSH);
+        sdm_decode_init(&ag->dec);
+        if (write_all(ag->fd, frame, flen) != 0)
+            return (-SDM_ERR_IO);
+        while ((rc = sdm_decode_read(&ag->dec, ag->fd, got, msec)) > 0) {
+            if (got[3] == (type | SDM_AG_REPLY)) {
+                memcpy(rep, got + 4, got[2]);
+                return (got[2]);
+            }
+            if ((got[3] == SDM_AG_ERROR) && (got[2] == 2) &&
+                (got[4] == type))
+                return ((got[5] != 0) ? -got[5] : -SDM_ERR_REPLY);
+            /* Not for this request, such as a late reply: keep waiting */
+        }
+        if (rc < 0)
+            return (-SDM_ERR_IO);
+        ag->timeouts++;
+    }
+    return (-SDM_ERR_TIMEOUT);
+}
+
+const char *
+sdm_agent_strerror(int rc)
+{
+    switch (-rc) {
+        case 0:                return ("success");
+        case SDM_ERR_LENGTH:   return ("bad request length");
+        case SDM_ERR_UNKNOWN:  return ("unknown request or test");
+        case SDM_ERR_RANGE:    return ("parameter out of range");
+        case SDM_ERR_HARDWARE: return ("not supported by this hardware");
+        case SDM_ERR_TIMEOUT:  return ("no reply");
+        case SDM_ERR_IO:       return ("serial port error");
+        case SDM_ERR_REPLY:    return ("unexpected reply");
+        default:               return ("unknown error");
+    }
+}
+
+/* Copies the agent's version string to version, truncating to size */
+int
+sdm_agent_ping(sdm_agent_t *ag, char *version, uint size)
+{
+    uint8_t rep[255];
+    int     rc = sdm_agent_call(ag, SDM_AG_PING, NULL, 0, rep,
+                                ag->timeout_ms);
+
+    if (rc < 0)
+        return (rc);
+    if ((uint) rc >= size)
+        rc = size - 1;
+    memcpy(version, rep, rc);
+    version[rc] = '\0';
+    return (0);
+}
+
+int
+sdm_agent_reg_read(sdm_agent_t *ag, uint reg, uint8_t *value)
+{
+    uint8_t req[1] = { reg };
+    uint8_t rep[255];
+    int     rc;
+
+    if (reg > 0xff)
+        return (-SDM_ERR_RANGE);
+    rc = sdm_agent_call(ag, SDM_AG_REG_READ, req, sizeof (req), rep,
+                        ag->timeout_ms);
+    if (rc < 0)
+        return (rc);
+    if (rc != 1)
+        return (-SDM_ERR_REPLY);
+    *value = rep[0];
+    return (0);
+}
+
+int
+sdm_agent_reg_write(sdm_agent_t *ag, uint reg, uint8_t value)
+{
+    uint8_t req[2] = { reg, value };
+    uint8_t rep[255];
+    int     rc;
+
+    if (reg > 0xff)
+        return (-SDM_ERR_RANGE);
+    rc = sdm_agent_call(ag, SDM_AG_REG_WRITE, req, sizeof (req), rep,
+                        ag->timeout_ms);
+    return ((rc <= 0) ? rc : -SDM_ERR_REPLY);
+}
+
+/* Reads count consecutive registers starting at first into values */
+int
+sdm_agent_burst_read(sdm_agent_t *ag, uint first, uint count,
+                     uint8_t *values)
+{
+    uint8_t req[2] = { first, count };
+    uint8_t rep[255];
+    int     rc;
+
+    if ((first > 0xff) || (count == 0) || (count > 0xff))
+        return (-SDM_ERR_RANGE);
+    rc = sdm_agent_call(ag, SDM_AG_BURST_READ, req, sizeof (req), rep,
+                        ag->timeout_ms);
+    if (rc < 0)
+        return (rc);
+    if ((uint) rc != count)
+        return (-SDM_ERR_REPLY);
+    memcpy(values, rep, count);
+    return (0);
+}
+
+/* Runs a named test; failed is set to the number of failures */
+int
+sdm_agent_test(sdm_agent_t *ag, const char *name, uint *failed)
+{
+    uint8_t rep[255];
+    uint    len = strlen(name);
+    int     rc;
+
+    if ((len == 0) || (len > 255))
+        return (-SDM_ERR_RANGE);
+    rc = sdm_agent_call(ag, SDM_AG_TEST, (const uint8_t *) name, len, rep,
+                        ag->long_ms);
+    if (rc < 0)
+        return (rc);
+    if (rc != 2)
+        return (-SDM_ERR_REPLY);
+    *failed = sdm_get16(rep);
+    return (0);
+}
+
+/*
+ * sdm_agent_bench
+ * ---------------
+ * Runs the -b comparison on unit (target + 10 * LUN) in kb KB requests
+ * with depth outstanding. status is zero if every path completed; fetch
+ * the figures with sdm_agent_results().
+ */
+int
+sdm_agent_bench(sdm_agent_t *ag, uint unit, uint kb, uint depth,
+                uint *status)
+{
+    uint8_t req[4];
+    uint8_t rep[255];
+    int     rc;
+
+    if ((unit > 0xff) || (kb > 0xffff) || (depth > 0xff))
+        return (-SDM_ERR_RANGE);
+    req[0] = unit;
+    sdm_put16(req + 1, kb);
+    req[3] = depth;
+    rc = sdm_agent_call(ag, SDM_AG_BENCH, req, sizeof (req), rep,
+                        ag->long_ms);
+    if (rc < 0)
+        return (rc);
+    if (rc != 1)
+        return (-SDM_ERR_REPLY);
+    *status = rep[0];
+    return (0);
+}
+
+int
+sdm_agent_results(sdm_agent_t *ag, sdm_results_t *res)
+{
+    uint8_t rep[255];
+    uint    pos;
+    int     rc;
+
+    rc = sdm_agent_call(ag, SDM_AG_RESULTS, NULL, 0, rep, ag->timeout_ms);
+    if (rc < 0)
+        return (rc);
+    if (rc != 3 * 4 + SDM_DRIVE_LEN)
+        return (-SDM_ERR_REPLY);
+    for (pos = 0; pos < 3; pos++)
+        res->kbps[pos] = sdm_get32(rep + pos * 4);
+    memcpy(res->drive, rep + 3 * 4, SDM_DRIVE_LEN);
+    res->drive[SDM_DRIVE_LEN] = '\0';
+    return (0);
+}
+
+/* Stops the agent; it does not answer further requests */
+int
+sdm_agent_quit(sdm_agent_t *ag)
+{
+    uint8_t rep[255];
+    int     rc;
+
+    rc = sdm_agent_call(ag, SDM_AG_QUIT, NULL, 0, rep, ag->timeout_ms);
+    return ((rc <= 0) ? rc : -SDM_ERR_REPLY);
+}
@@ -0,0 +1,160 @@
+/*
+ * sdmac_host.h
+ * ------------
+ * Linux side of the sdmac serial protocols: the -e metrics stream and the
+ * -g remote test agent. Both use the same frame layout:
+ *     A5 5A  <len>  <type>  <payload: len bytes>  <CRC-16 hi> <CRC-16 lo>
+ * with CRC-16/CCITT-FALSE over len, type, and payload. All payload fields
+ * are big-endian. The definitions here must match those in sdmac.c.
+ */
+#ifndef SDMAC_HOST_H
+#define SDMAC_HOST_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#define SDM_SYNC0          0xa5
+#define SDM_SYNC1          0x5a
+#define SDM_FRAME_MAX      (4 + 255 + 2)
+
+#define SDM_TYPE_STATS     1
+#define SDM_STATS_PAYLOAD  40
+#define SDM_ROLLING        60  // Frames in rolling aggregates
+
+/* Remote test agent (sdmac -g) request types; see agent_request() */
+#define SDM_AG_PING        0x01
+#define SDM_AG_REG_READ    0x02
+#define SDM_AG_REG_WRITE   0x03
+#define SDM_AG_BURST_READ  0x04
+#define SDM_AG_TEST        0x05
+#define SDM_AG_BENCH       0x06
+#define SDM_AG_RESULTS     0x07
+#define SDM_AG_QUIT        0x08
+#define SDM_AG_REPLY       0x80
+#define SDM_AG_ERROR       0xff
+
+/*
+ * Errors from the sdm_agent calls, returned negated. 1 to 4 are sent by
+ * the agent; the rest are detected by the client.
+ */
+#define SDM_ERR_LENGTH     1   // Payload length wrong for request
+#define SDM_ERR_UNKNOWN    2   // Unknown request type or test name
+#define SDM_ERR_RANGE      3   // Parameter out of range
+#define SDM_ERR_HARDWARE   4   // Not supported by this controller
+#define SDM_ERR_TIMEOUT    16  // No reply after all retries
+#define SDM_ERR_IO         17  // Serial port read or write failed
+#define SDM_ERR_REPLY      18  // Reply payload not as expected
+
+#define SDM_AG_TIMEOUT_MS  2000    // Default per attempt
+#define SDM_AG_BENCH_MS    300000  // Default for tests and benchmarks
+#define SDM_AG_RETRIES     2       // Default attempts after a timeout
+#define SDM_DRIVE_LEN      24      // INQUIRY vendor, product, revision
+
+/*
+ * Decoder for a byte stream of frames. Data is added with
+ * sdm_decode_feed(), then frames are taken with sdm_decode_next() until
+ * it returns 0. Bytes which are not part of a frame with a valid CRC are
+ * skipped, one at a time, until the next sync pattern.
+ */
+typedef struct {
+    uint8_t  buf[2 * SDM_FRAME_MAX];
+    uint     head;        // First unconsumed byte in buf
+    uint     tail;        // End of data in buf
+    uint32_t frames;      // Valid frames returned
+    uint32_t crc_errors;  // Sync found but CRC did not match
+    uint32_t skipped;     // Bytes discarded while resynchronizing
+} sdm_decoder_t;
+
+/* Contents of an SDM_TYPE_STATS frame; see met_stats_t in sdmac.c */
+typedef struct {
+    uint32_t seq;          // Frame sequence number
+    uint32_t uptime;       // Seconds since metrics started
+    uint32_t interval_ms;  // Length of this interval
+    uint32_t requests;     // scsi.device requests completed
+    uint32_t read_kb;      // KB read
+    uint32_t write_kb;     // KB written
+    uint32_t lat_avg;      // Average request latency (usec)
+    uint32_t lat_max;      // Maximum request latency (usec)
+    uint16_t errors;       // Requests completed with io_Error set
+    uint8_t  cpu_pct;      // CPU use
+    uint8_t  dropped;      // Requests not seen to complete
+    uint16_t chip_free;    // Free chip memory (KB)
+    uint16_t fast_free;    // Free fast memory (MB)
+} sdm_stats_t;
+
+/* The last SDM_ROLLING stats frames, and sequence gaps seen */
+typedef struct {
+    sdm_stats_t hist[SDM_ROLLING];
+    uint        count;     // Valid entries in hist
+    uint32_t    frames;    // Frames added
+    uint32_t    lost;      // Frames missing from the sequence
+    uint32_t    next_seq;
+} sdm_rolling_t;
+
+/* Aggregates over the frames in an sdm_rolling_t */
+typedef struct {
+    uint32_t kbps;         // Read plus write throughput
+    uint32_t requests;     // Requests per second
+    uint32_t lat_max;      // Maximum latency (usec)
+    uint32_t errors;       // Total errors
+    uint     cpu_pct;      // Average CPU use
+} sdm_rollup_t;
+
+/*
+ * Client for the remote test agent. The agent does not answer a frame
+ * with a bad CRC, so a request with no reply is sent again, up to
+ * retries more times. Replies carry no sequence number: input is
+ * flushed before each request so a late reply to an earlier request is
+ * not taken for the current one.
+ */
+typedef struct {
+    int           fd;
+    uint          timeout_ms;  // Per attempt for quick requests
+    uint          long_ms;     // Per attempt for tests and benchmarks
+    uint          retries;
+    uint32_t      timeouts;    // Attempts which got no reply
+    sdm_decoder_t dec;
+} sdm_agent_t;
+
+/* Benchmark results: KB/s for CMD_READ, HD_SCSICMD, and direct DMA */
+typedef struct {
+    uint32_t kbps[3];
+    char     drive[SDM_DRIVE_LEN + 1];
+} sdm_results_t;
+
+uint16_t sdm_crc16(const uint8_t *data, uint len);
+uint8_t *sdm_put32(uint8_t *ptr, uint32_t value);
+uint8_t *sdm_put16(uint8_t *ptr, uint16_t value);
+uint32_t sdm_get32(const uint8_t *ptr);
+uint16_t sdm_get16(const uint8_t *ptr);
+uint sdm_frame(uint8_t *buf, uint type, const void *payload, uint plen);
+
+int sdm_serial_open(const char *path, uint baud);
+
+void sdm_decode_init(sdm_decoder_t *dec);
+uint sdm_decode_feed(sdm_decoder_t *dec, const uint8_t *data, uint len);
+uint sdm_decode_space(const sdm_decoder_t *dec);
+uint sdm_decode_next(sdm_decoder_t *dec, uint8_t *frame);
+int sdm_decode_read(sdm_decoder_t *dec, int fd, uint8_t *frame, uint msec);
+
+int sdm_stats_parse(const uint8_t *frame, sdm_stats_t *st);
+void sdm_rolling_init(sdm_rolling_t *roll);
+void sdm_rolling_add(sdm_rolling_t *roll, const sdm_stats_t *st);
+void sdm_rolling_get(const sdm_rolling_t *roll, sdm_rollup_t *sum);
+
+void sdm_agent_init(sdm_agent_t *ag, int fd);
+int sdm_agent_call(sdm_agent_t *ag, uint type, const uint8_t *req,
+                   uint len, uint8_t *rep, uint msec);
+const char *sdm_agent_strerror(int rc);
+int sdm_agent_ping(sdm_agent_t *ag, char *version, uint size);
+int sdm_agent_reg_read(sdm_agent_t *ag, uint reg, uint8_t *value);
+int sdm_agent_reg_write(sdm_agent_t *ag, uint reg, uint8_t value);
+int sdm_agent_burst_read(sdm_agent_t *ag, uint first, uint count,
+                         uint8_t *values);
+int sdm_agent_test(sdm_agent_t *ag, const char *name, uint *failed);
+int sdm_agent_bench(sdm_agent_t *ag, uint unit, uint kb, uint depth,
+                    uint *status);
+int sdm_agent_results(sdm_agent_t *ag, sdm_results_t *res);
+int sdm_agent_quit(sdm_agent_t *ag);
+
+#endif /* SDMAC_HOST_H */
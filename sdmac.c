@@ -20,6 +20,7 @@ const char *version = "\0$VER: SDMAC " VER " ("__DATE__") 
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
+#include <stddef.h>
 #include <libraries/expansionbase.h>
 #include <clib/expansion_protos.h>
 #include <inline/exec.h>
@@ -29,7 +30,14 @@ const char *version = "\0$VER: SDMAC " VER " ("__DATE__") 
 #include <exec/interrupts.h>
 #include <exec/execbase.h>
 #include <exec/lists.h>
+#include <exec/io.h>
+#include <devices/scsidisk.h>
+#include <devices/serial.h>
+#include <devices/trackdisk.h>
+#include <hardware/intbits.h>
 #include <inline/timer.h>
+#include <inline/cia.h>
+#include <hardware/cia.h>
 
 #define ROM_BASE       0x00f80000 // Kickstart ROM base address
 
@@ -102,6 +110,7 @@ const char *version = "\0$VER: SDMAC " VER " ("__DATE__") 
 #define WDC_CMD_ABORT           0x01 // Abort
 #define WDC_CMD_DISCONNECT      0x04 // Disconnect
 #define WDC_CMD_SELECT_WITH_ATN 0x06 // Select with Attention
+#define WDC_CMD_SEL_ATN_XFER    0x08 // Select with Attention and Transfer
 #define WDC_CMD_DISCONNECT_MSG  0x04 // Send Disconnect Message
 #define WDC_CMD_TRANSFER_INFO   0x20 // Transfer Info
 #define WDC_CMD_GET_REGISTER    0x44 // Read register (CDB1) into CDB2
@@ -109,6 +118,7 @@ const char *version = "\0$VER: SDMAC " VER " ("__DATE__") 
 
 #define WDC_CONTROL_IDI         0x04 // Intermediate Disconnect Interrupt
 #define WDC_CONTROL_EDI         0x08 // Ending Disconnect Interrupt
+#define WDC_CONTROL_DMA         0x80 // DMA bus mode
 
 #define WDC_AUXST_DBR           0x01 // Data Buffer Ready
 #define WDC_AUXST_PE            0x02 // Parity Error
@@ -118,6 +128,7 @@ const char *version = "\0$VER: SDMAC " VER " ("__DATE__") 
 #define WDC_AUXST_INT           0x80 // Interrupt Pending
 
 #define WDC_SSTAT_SEL_COMPLETE  0x11  // Select complete (initiator)
+#define WDC_SSTAT_SAT_COMPLETE  0x16  // Select-and-Transfer complete
 #define WDC_SSTAT_SEL_TIMEOUT   0x42  // Select timeout
 
 #define WDC_PHASE_DATA_OUT  0x00
@@ -146,7 +157,7 @@ const char *version = "\0$VER: SDMAC " VER " ("__DATE__") 
 #define SDMAC_CONTR_IODX   0x01 // Reserved (0)
 #define SDMAC_CONTR_DMADIR 0x02 // DMA Data direction (0=Read, 1=Write)
 #define SDMAC_CONTR_INTEN  0x04 // Interrupt enable
-//#define SDMAC_CONTR_PMODE  0x08 // Peripheral mode (1=SCSI)
+#define SDMAC_CONTR_PMODE  0x08 // Peripheral mode (1=SCSI)
 #define SDMAC_CONTR_RESET  0x10 // WDC Peripheral reset (Strobe)
 #define SDMAC_CONTR_TCE    0x20 // Terminal count enable
 //#define SDMAC_CONTR_0x40   0x40 // Reserved (6)
@@ -171,6 +182,21 @@ const char *version = "\0$VER: SDMAC " VER " ("__DATE__") 
 #define ARRAY_SIZE(x)  ((sizeof (x) / sizeof ((x)[0])))
 #define BIT(x)         (1U << (x))
 
+/*
+ * Trace and snapshot files are written in Amiga (big-endian) byte order.
+ * These convert a field to or from that order, which is only needed
+ * when the decoders run on a little-endian host (see host/).
+ */
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+#define BE16(x)        __builtin_bswap16(x)
+#define BE32(x)        __builtin_bswap32(x)
+#define BE64(x)        __builtin_bswap64(x)
+#else
+#define BE16(x)        (x)
+#define BE32(x)        (x)
+#define BE64(x)        (x)
+#endif
+
 /* These macros support nesting of interrupt disable state */
 #define INTERRUPTS_DISABLE() if (irq_disabled++ == 0) \
                                  Disable()  /* Disable interrupts */
@@ -204,8 +230,16 @@ typedef struct scsi_test_unit_ready {
         uint8_t control;
 } scsi_test_unit_ready_t;
 
+#define SCSI_REQUEST_SENSE              0x03
+#define SCSI_INQUIRY                    0x12
+#define SCSI_START_STOP_UNIT            0x1b
+
+#define SCSI_STATUS_GOOD                0x00
+#define SCSI_STATUS_CHECK_CONDITION     0x02
+
 extern struct ExecBase *SysBase;
 struct Device          *TimerBase = NULL;
+struct ExpansionBase   *ExpansionBase = NULL;
 
 typedef unsigned int uint;
 
@@ -213,6 +247,97 @@ static uint8_t     irq_disabled      = 0;
 static uint8_t     flag_debug        = 0;
 static const char *sdmac_fail_reason = "";
 static uint        wdc_khz;
+static uint32_t    wdc_accesses;  // WDC register reads and writes
+
+/*
+ * WD33C93 host controllers
+ *
+ * The WD33C93 is reached through a pair of byte registers (SASR and SCMD)
+ * in the DMA controller's address space. The offsets of those registers
+ * and of the DMA controller's own interrupt status and control registers
+ * differ between the A3000 SDMAC and the Zorro II boards, so all WDC
+ * access goes through the currently selected controller.
+ */
+#define CTRL_A3000  0  // A3000 motherboard SDMAC
+#define CTRL_A2091  1  // A2091 / A590 DMAC
+#define CTRL_GVP    2  // GVP Series II
+
+typedef struct {
+    const char *name;     // Controller description
+    uint32_t    base;     // Base physical address
+    uint16_t    sasr_r;   // WDC auxiliary status / index read (byte)
+    uint16_t    sasr_w;   // WDC register index write (byte)
+    uint16_t    scmd;     // WDC register data (byte)
+    uint16_t    istr;     // DMAC Interrupt Status (byte), 0 if none
+    uint16_t    contr;    // DMAC Control Register (byte)
+    uint16_t    clr_int;  // DMAC Clear Interrupts strobe (byte), 0 if none
+    uint8_t     type;     // CTRL_A3000, CTRL_A2091, or CTRL_GVP
+    uint8_t     fsel;     // WDC OWN_ID input clock divisor select bits
+    uint8_t     reset;    // Control register WDC reset bit, 0 if none
+    uint8_t     inten;    // Control register interrupt enable bit
+} wdc_ctrl_t;
+
+static const wdc_ctrl_t ctrl_types[] = {
+    /* name            base        sasr_r sasr_w scmd istr contr clr_int */
+    { "A3000 SDMAC",   SDMAC_BASE, 0x41, 0x49, 0x43, 0x1f, 0x0b, 0x1b,
+      CTRL_A3000, 0x40,     // 12-15 MHz WDC clock
+      SDMAC_CONTR_RESET, SDMAC_CONTR_INTEN },
+    { "A2091/A590",    0,          0x91, 0x91, 0x93, 0x41, 0x43, 0xe5,
+      CTRL_A2091, 0x00,     // 7-10 MHz WDC clock
+      0x40, 0x10 },         // CNTR PREST, INTEN
+    { "GVP Series II", 0,          0x61, 0x61, 0x63, 0x00, 0x41, 0x00,
+      CTRL_GVP,   0x40,     // 12-15 MHz WDC clock on most boards
+      0x00, 0x08 },         // No reset bit; INT_ENABLE
+};
+
+/* Zorro II autoconfig IDs of boards with a WD33C93 */
+static const struct {
+    uint16_t manufacturer;
+    uint8_t  product;
+    uint8_t  type;
+} zorro_wdc_boards[] = {
+    { 514,  2,  CTRL_A2091 },  // Commodore A590/A2091 (early)
+    { 514,  3,  CTRL_A2091 },  // Commodore A590/A2091
+    { 2017, 11, CTRL_GVP },    // GVP Series II
+};
+
+#define MAX_CONTROLLERS 8
+static wdc_ctrl_t        ctrl_list[MAX_CONTROLLERS];
+static uint              ctrl_count = 0;
+static const wdc_ctrl_t *ctrl       = &ctrl_types[CTRL_A3000];
+
+#define CTRL_REG(off)  ADDR8(ctrl->base + (off))
+
+/*
+ * Bus accessors
+ *
+ * WDC register access, the -M address map, the SCSI bus reset, and the
+ * direct transfer path (scsi_xfer_cmd() and its interrupt server) go
+ * through these rather than CTRL_REG() and ADDR32(), so that host test
+ * builds (see tests/) can run them against the simulated SDMAC address
+ * space in tests/sim_bus.c.
+ * Amiga builds access the bus directly.
+ */
+#ifndef SDMAC_HOST_TEST
+#define BUS_READ8(addr)           (*ADDR8(addr))
+#define BUS_READ16(addr)          (*ADDR16(addr))
+#define BUS_READ32(addr)          (*ADDR32(addr))
+#define BUS_WRITE8(addr, value)   (*ADDR8(addr) = (value))
+#define BUS_WRITE32(addr, value)  (*ADDR32(addr) = (value))
+#else
+uint8_t  sim_bus_read8(uint32_t addr);
+uint16_t sim_bus_read16(uint32_t addr);
+uint32_t sim_bus_read32(uint32_t addr);
+void     sim_bus_write8(uint32_t addr, uint8_t value);
+void     sim_bus_write32(uint32_t addr, uint32_t value);
+#define BUS_READ8(addr)           sim_bus_read8(addr)
+#define BUS_READ16(addr)          sim_bus_read16(addr)
+#define BUS_READ32(addr)          sim_bus_read32(addr)
+#define BUS_WRITE8(addr, value)   sim_bus_write8((addr), (value))
+#define BUS_WRITE32(addr, value)  sim_bus_write32((addr), (value))
+#endif
+#define CTRL_READ(off)            BUS_READ8(ctrl->base + (off))
+#define CTRL_WRITE(off, value)    BUS_WRITE8(ctrl->base + (off), (value))
 
 #define DUMP_WORDS_AND_LONGS
 #ifdef DUMP_WORDS_AND_LONGS
@@ -373,15 +498,51 @@ is_user_abort(void)
  * Haven't located ATN, BSY, RST, ACK
  */
 
+/*
+ * WDC index access methods
+ *
+ * The A3000 SDMAC takes the WDC register index as a byte write to
+ * SDMAC_SASR_B2 or a longword write to SDMAC_SASRW. Which one works, and
+ * which is faster, depends on the CPU card (see get_wdc_reg()), so
+ * wdc_index_select() tries each at startup and keeps the fastest one
+ * which passes a pattern test. The Zorro II boards only have the byte
+ * register.
+ */
+#define WDC_INDEX_BYTE 0  // Byte write to ctrl->sasr_w (SDMAC_SASR_B2)
+#define WDC_INDEX_LONG 1  // Longword write to SDMAC_SASRW
+
+static const char * const wdc_index_names[] = {
+    "SDMAC_SASR_B2 byte", "SDMAC_SASRW long"
+};
+static uint wdc_index_method = WDC_INDEX_BYTE;
+static uint wdc_index_ns[ARRAY_SIZE(wdc_index_names)];  // 0 = failed
+
+static const char *
+cpu_name(void)
+{
+    UWORD attn = SysBase->AttnFlags;
+
+    if (attn & AFF_68060)
+        return ("68060");
+    if (attn & AFF_68040)
+        return ("68040");
+    if (attn & AFF_68030)
+        return ("68030");
+    if (attn & AFF_68020)
+        return ("68020");
+    if (attn & AFF_68010)
+        return ("68010");
+    return ("68000");
+}
+
 static void
 set_wdc_index(uint8_t value)
 {
-#undef USE_LONGWORD_SASR
-#ifdef USE_LONGWORD_SASR
-    *ADDR32(SDMAC_SASRW) = value;
-#else
-    *ADDR8(SDMAC_SASR_B2) = value;
-#endif
+    if ((wdc_index_method == WDC_INDEX_LONG) && (ctrl->type == CTRL_A3000)) {
+        BUS_WRITE32(SDMAC_SASRW, value);
+        return;
+    }
+    CTRL_WRITE(ctrl->sasr_w, value);
 }
 
 /*
@@ -393,18 +554,19 @@ set_wdc_index(uint8_t value)
  * Which window access register to use is messy due to the A3000
  * architecture which made properly-designed 68040 cards fail to access
  * SDMAC registers as bytes, and a work-around for a 68030 write-allocate
- * cache bug.
+ * cache bug. The index write method is chosen by wdc_index_select().
  */
 static uint8_t
 get_wdc_reg(uint8_t reg)
 {
     uint8_t value;
     uint8_t oindex;
+    wdc_accesses++;
     INTERRUPTS_DISABLE();
-    oindex = *ADDR8(SDMAC_SASR_B);
+    oindex = CTRL_READ(ctrl->sasr_r);
     set_wdc_index(reg);
 
-    value = *ADDR8(SDMAC_SCMD);
+    value = CTRL_READ(ctrl->scmd);
 
     set_wdc_index(oindex);
     INTERRUPTS_ENABLE();
@@ -420,11 +582,12 @@ static void
 set_wdc_reg(uint8_t reg, uint8_t value)
 {
     uint8_t oindex;
+    wdc_accesses++;
     INTERRUPTS_DISABLE();
-    oindex = *ADDR8(SDMAC_SASR_B);
+    oindex = CTRL_READ(ctrl->sasr_r);
     set_wdc_index(reg);
 
-    *ADDR8(SDMAC_SCMD) = value;
+    CTRL_WRITE(ctrl->scmd, value);
 
     set_wdc_index(oindex);
     INTERRUPTS_ENABLE();
@@ -439,13 +602,14 @@ static void
 set_wdc_reg24(uint8_t reg, uint value)
 {
     uint8_t oindex;
+    wdc_accesses++;
     INTERRUPTS_DISABLE();
-    oindex = *ADDR8(SDMAC_SASR_B);
+    oindex = CTRL_READ(ctrl->sasr_r);
     set_wdc_index(reg);
 
-    *ADDR8(SDMAC_SCMD) = (uint8_t) (value >> 24);
-    *ADDR8(SDMAC_SCMD) = (uint8_t) (value >> 18);
-    *ADDR8(SDMAC_SCMD) = (uint8_t) value;
+    CTRL_WRITE(ctrl->scmd, (uint8_t) (value >> 16));
+    CTRL_WRITE(ctrl->scmd, (uint8_t) (value >> 8));
+    CTRL_WRITE(ctrl->scmd, (uint8_t) value);
 
     set_wdc_index(oindex);
     INTERRUPTS_ENABLE();
@@ -827,6 +991,8 @@ show_regs(uint extended)
     uint32_t value;
     printf("\nREG VALUE    NAME           DESCRIPTION\n");
     for (pos = 0; pos < ARRAY_SIZE(sdmac_reglist); pos++) {
+        if (ctrl->type != CTRL_A3000)
+            break;  // Only the WDC registers are known for Zorro boards
         if (sdmac_reglist[pos].type == WO)
             continue; // Skip this register
         SUPERVISOR_STATE_ENTER();  // Needed for RAMSEY_VER register
@@ -886,11 +1052,45 @@ show_regs(uint extended)
     }
 }
 
-/* CIA_USEC rounds up 1 value to at least one CIA tick */
-#define CIA_USEC(x) (((x) * 715909 + 284091) / 1000000)
+#define ECLOCK_NTSC 715909
+#define ECLOCK_PAL  709379
+
+static uint cia_freq = ECLOCK_NTSC;  // E clock rate, from timer.device
+
+/* Converts microseconds to CIA ticks, rounding up */
+static uint
+cia_usec(uint usec)
+{
+    return (((uint64_t) usec * cia_freq + 999999) / 1000000);
+}
 
-#define CIAA_TBLO        ADDR8(0x00bfe601)
-#define CIAA_TBHI        ADDR8(0x00bfe701)
+/*
+ * CIA timer
+ *
+ * cia_ticks() reads a 16-bit CIA timer which counts down at the E clock
+ * rate. The timer is allocated through ciab.resource or ciaa.resource
+ * and run continuously from $ffff, so no other program can stop or
+ * reload it underneath a measurement. If no timer is free, the low 16
+ * bits of the timer.device E clock (negated, so it also counts down)
+ * are used instead. That ticks at the same rate but costs more to read.
+ */
+#define CIAA_BASE        0x00bfe001
+#define CIAB_BASE        0x00bfd000
+#define CIA_TALO         0x0400
+#define CIA_TAHI         0x0500
+#define CIA_TBLO         0x0600
+#define CIA_TBHI         0x0700
+#define CIA_CRA          0x0e00
+#define CIA_CRB          0x0f00
+#define CIA_CR_KEEP(bit) ((bit) ? 0x80 : 0xc0)  // ALARM; SPMODE, TODIN
+
+static volatile uint8_t *cia_tlo;     // Allocated timer, NULL if none
+static volatile uint8_t *cia_thi;
+static volatile uint8_t *cia_cr;
+static struct Library   *cia_res;
+static uint              cia_bit;
+static struct Interrupt  cia_int;
+static const char       *cia_name = "timer.device E clock";
 
 static uint
 cia_ticks(void)
@@ -899,9 +1099,15 @@ cia_ticks(void)
     uint8_t hi2;
     uint8_t lo;
 
-    hi1 = *CIAA_TBHI;
-    lo  = *CIAA_TBLO;
-    hi2 = *CIAA_TBHI;
+    if (cia_thi == NULL) {
+        struct EClockVal ev;
+        (void) ReadEClock(&ev);
+        return ((uint16_t) -ev.ev_lo);
+    }
+
+    hi1 = *cia_thi;
+    lo  = *cia_tlo;
+    hi2 = *cia_thi;
 
     /*
      * The below operation will provide the same effect as:
@@ -932,23 +1138,495 @@ cia_spin(unsigned int ticks)
     }
 }
 
+/*
+ * get_eclock_freq
+ * ---------------
+ * Returns the E clock frequency (CIA tick rate) as reported by timer.device.
+ */
 static uint
-scsi_wait(uint8_t cond, uint wait_for_set)
+get_eclock_freq(void)
 {
-    uint    timeout;
-    uint8_t auxst;
+    struct EClockVal now;
+
+    if (TimerBase == NULL)
+        TimerBase = (struct Device *) FindName(&SysBase->DeviceList, TIMERNAME);
+    return (ReadEClock(&now));
+}
+
+/*
+ * eclock_ticks
+ * ------------
+ * Returns the low 32 bits of the E clock count. Unlike cia_ticks(), this
+ * can time intervals of more than a few dozen milliseconds, and it may
+ * be called from interrupts.
+ */
+static uint32_t
+eclock_ticks(void)
+{
+    struct EClockVal ev;
+    (void) ReadEClock(&ev);
+    return (ev.ev_lo);
+}
+
+/* qsort() comparison for uint32_t values */
+static int
+cmp_uint32(const void *a, const void *b)
+{
+    uint32_t va = *(const uint32_t *) a;
+    uint32_t vb = *(const uint32_t *) b;
+    return ((va > vb) - (va < vb));
+}
+
+static void
+cia_timer_int(void)
+{
+    /* The timer interrupt is disabled; this only claims the timer */
+}
+
+/*
+ * cia_timer_alloc
+ * ---------------
+ * Allocates the first free CIA timer and starts it counting down from
+ * $ffff in continuous mode. Leaves cia_ticks() on the E clock if none
+ * is free.
+ */
+static void
+cia_timer_alloc(void)
+{
+    static const struct {
+        const char *resname;
+        uint32_t    base;
+        uint        bit;
+        const char *name;
+    } timers[] = {
+        { CIABNAME, CIAB_BASE, CIAICRB_TA, "CIA-B timer A" },
+        { CIABNAME, CIAB_BASE, CIAICRB_TB, "CIA-B timer B" },
+        { CIAANAME, CIAA_BASE, CIAICRB_TB, "CIA-A timer B" },
+        { CIAANAME, CIAA_BASE, CIAICRB_TA, "CIA-A timer A" },
+    };
+    uint pos;
+
+    cia_freq = get_eclock_freq();  // Also sets TimerBase for the fallback
+    if (cia_freq == 0)
+        cia_freq = ECLOCK_NTSC;
+    memset(&cia_int, 0, sizeof (cia_int));
+    cia_int.is_Node.ln_Type = NT_INTERRUPT;
+    cia_int.is_Node.ln_Name = "sdmac timer";
+    cia_int.is_Code         = cia_timer_int;
+
+    for (pos = 0; pos < ARRAY_SIZE(timers); pos++) {
+        struct Library *res = OpenResource(timers[pos].resname);
+        uint            bit = timers[pos].bit;
+        uint32_t        base = timers[pos].base;
+
+        if ((res == NULL) || (AddICRVector(res, bit, &cia_int) != NULL))
+            continue;  // Not present or in use
+        AbleICR(res, BIT(bit));  // Disable its interrupt
+
+        cia_res = res;
+        cia_bit = bit;
+        cia_name = timers[pos].name;
+        cia_tlo = ADDR8(base + (bit ? CIA_TBLO : CIA_TALO));
+        cia_thi = ADDR8(base + (bit ? CIA_TBHI : CIA_TAHI));
+        cia_cr  = ADDR8(base + (bit ? CIA_CRB : CIA_CRA));
+
+        *cia_cr &= CIA_CR_KEEP(bit);  // Stop; count E clock
+        *cia_tlo = 0xff;
+        *cia_thi = 0xff;
+        *cia_cr  = (*cia_cr & CIA_CR_KEEP(bit)) |
+                   CIACRAF_LOAD | CIACRAF_START;  // Continuous
+        return;
+    }
+}
+
+static void
+cia_timer_free(void)
+{
+    if (cia_thi == NULL)
+        return;
+    *cia_cr &= CIA_CR_KEEP(cia_bit);  // Stop
+    cia_thi = NULL;
+    RemICRVector(cia_res, cia_bit, &cia_int);
+}
+
+/*
+ * cia_timer_show
+ * --------------
+ * Reports the measurement timer in use and the cost of reading each
+ * available time source.
+ */
+static void
+cia_timer_show(void)
+{
+    volatile uint8_t *thi = cia_thi;
+    uint              efreq = get_eclock_freq();
+    uint              src;
+    uint16_t          t1;
+    uint16_t          t2;
+
+    printf("Measurement timer:   %s at %u Hz (%s)\n", cia_name, efreq,
+           (efreq < (ECLOCK_NTSC + ECLOCK_PAL) / 2) ? "PAL" : "NTSC");
+    printf("  Source                 ns per read\n");
+    for (src = 0; src < 2; src++) {
+        uint32_t start;
+        uint32_t ticks;
+        uint     pos;
+
+        if ((src == 0) && (thi == NULL))
+            continue;
+        cia_thi = (src == 0) ? thi : NULL;
+        Forbid();
+        start = eclock_ticks();
+        for (pos = 0; pos < 1000; pos++)
+            (void) cia_ticks();
+        ticks = eclock_ticks() - start;
+        Permit();
+        printf("  %-22s %11u\n", (src == 0) ? cia_name : "timer.device E clock",
+               (uint) ((uint64_t) ticks * 1000000 / efreq));
+    }
+    cia_thi = thi;
+
+    /* Earlier versions read CIA-A timer B without allocating it */
+    if ((thi == NULL) || (cia_tlo != ADDR8(CIAA_BASE + CIA_TBLO))) {
+        t1 = *ADDR8(CIAA_BASE + CIA_TBHI) << 8;
+        Delay(1);
+        t2 = *ADDR8(CIAA_BASE + CIA_TBHI) << 8;
+        printf("  CIA-A timer B (not allocated) is %s\n",
+               (t1 == t2) ? "stopped" : "running");
+    }
+}
+
+/*
+ * Streaming statistics
+ *
+ * A stat_t summarizes any number of samples in constant memory, without
+ * floating point (the A3000 may have no FPU): count, min, max, mean and
+ * variance by Welford's method, P-squared (Jain and Chlamtac) estimates
+ * of the STAT_QUANTILES quantiles in stat_pct[], and a histogram with
+ * one bucket per power of two. Mean, standard deviation, and quantiles
+ * are kept and returned as fixed point with STAT_FRAC fraction bits.
+ *
+ * Samples are clamped to STAT_VALUE_MAX, which keeps the variance sums
+ * within 64 bits. That is plenty for cia_ticks() intervals (16 bits)
+ * and for request latencies in E clock ticks up to about 1.4 seconds.
+ */
+#define STAT_FRAC          8
+#define STAT_ONE           (1 << STAT_FRAC)
+#define STAT_VALUE_MAX     ((1 << 20) - 1)
+#define STAT_MEAN_FRAC     24  // Mean is kept more precisely
+#define STAT_QUANTILES     3
+#define STAT_HIST_BUCKETS  21  // Bucket b holds values of bit length b
+
+/* Quantiles in hundredths of a percent */
+static const uint16_t stat_pct[STAT_QUANTILES] = { 5000, 9000, 9900 };
+
+typedef struct {
+    int32_t q[5];          // Marker heights (fixed point)
+    int32_t n[5];          // Marker positions, 1-based
+    int64_t np[5];         // Desired marker positions (16.16)
+} p2_t;
+
+typedef struct {
+    uint32_t count;        // Samples added
+    uint32_t min;          // Smallest sample
+    uint32_t max;          // Largest sample
+    int64_t  mean;         // Running mean (STAT_MEAN_FRAC fixed point)
+    uint64_t m2;           // Sum of squared deviations (2 x STAT_FRAC)
+    p2_t     p2[STAT_QUANTILES];
+    uint32_t hist[STAT_HIST_BUCKETS];
+} stat_t;
+
+static uint32_t
+isqrt64(uint64_t value)
+{
+    uint64_t root = 0;
+    uint64_t bit = 1ULL << 62;
+
+    while (bit > value)
+        bit >>= 2;
+    while (bit != 0) {
+        if (value >= root + bit) {
+            value -= root + bit;
+            root = (root >> 1) + bit;
+        } else {
+            root >>= 1;
+        }
+        bit >>= 2;
+    }
+    return (root);
+}
+
+static void
+stat_init(stat_t *st)
+{
+    memset(st, 0, sizeof (*st));
+    st->min = STAT_VALUE_MAX;
+}
+
+/* Piecewise-parabolic prediction of marker i moved by ds (+1 or -1) */
+static int32_t
+p2_parabolic(const p2_t *p2, uint i, int ds)
+{
+    const int32_t *q = p2->q;
+    const int32_t *n = p2->n;
+    int64_t        a;
+    int64_t        b;
+
+    a = (int64_t) (n[i] - n[i - 1] + ds) * (q[i + 1] - q[i]) /
+        (n[i + 1] - n[i]);
+    b = (int64_t) (n[i + 1] - n[i] - ds) * (q[i] - q[i - 1]) /
+        (n[i] - n[i - 1]);
+    return (q[i] + ds * (a + b) / (n[i + 1] - n[i - 1]));
+}
+
+/*
+ * p2_add
+ * ------
+ * Adds fixed point sample x, the count'th sample, to the P-squared
+ * estimator of quantile pct. The first five samples are kept sorted.
+ */
+static void
+p2_add(p2_t *p2, uint pct, int32_t x, uint32_t count)
+{
+    int32_t *q = p2->q;
+    int32_t *n = p2->n;
+    int64_t  p = (int64_t) pct * 65536 / 10000;
+    uint     i;
+    uint     k;
+
+    if (count <= 5) {
+        for (i = count - 1; (i > 0) && (q[i - 1] > x); i--)
+            q[i] = q[i - 1];
+        q[i] = x;
+        if (count == 5) {
+            for (i = 0; i < 5; i++)
+                n[i] = i + 1;
+            p2->np[0] = 1 << 16;
+            p2->np[1] = (1 << 16) + 2 * p;
+            p2->np[2] = (1 << 16) + 4 * p;
+            p2->np[3] = (3 << 16) + 2 * p;
+            p2->np[4] = 5 << 16;
+        }
+        return;
+    }
+
+    if (x < q[0]) {
+        q[0] = x;
+        k = 0;
+    } else if (x >= q[4]) {
+        q[4] = x;
+        k = 3;
+    } else {
+        for (k = 0; x >= q[k + 1]; k++)
+            ;
+    }
+    for (i = k + 1; i < 5; i++)
+        n[i]++;
+    p2->np[1] += p / 2;
+    p2->np[2] += p;
+    p2->np[3] += (65536 + p) / 2;
+    p2->np[4] += 65536;
+
+    for (i = 1; i < 4; i++) {
+        int64_t d = p2->np[i] - ((int64_t) n[i] << 16);
+        int     ds;
+        int32_t qp;
+
+        if (!(((d >= 65536) && (n[i + 1] - n[i] > 1)) ||
+              ((d <= -65536) && (n[i - 1] - n[i] < -1))))
+            continue;
+        ds = (d > 0) ? 1 : -1;
+        qp = p2_parabolic(p2, i, ds);
+        if ((q[i - 1] < qp) && (qp < q[i + 1]))
+            q[i] = qp;
+        else
+            q[i] += ds * (q[i + ds] - q[i]) / (n[i + ds] - n[i]);
+        n[i] += ds;
+    }
+}
+
+static void
+stat_add(stat_t *st, uint32_t value)
+{
+    int64_t x;
+    int64_t delta;
+    uint    bucket;
+    uint    pos;
+
+    if (value > STAT_VALUE_MAX)
+        value = STAT_VALUE_MAX;
+    st->count++;
+    if (st->min > value)
+        st->min = value;
+    if (st->max < value)
+        st->max = value;
+
+    /*
+     * Welford. The mean carries extra fraction bits so that truncation
+     * in delta / count does not bias it over many samples. The two
+     * deltas always have the same sign.
+     */
+    x = (int64_t) value << STAT_MEAN_FRAC;
+    delta = x - st->mean;
+    st->mean += delta / (int64_t) st->count;
+    delta = (delta >> (STAT_MEAN_FRAC - STAT_FRAC)) *
+            ((x - st->mean) >> (STAT_MEAN_FRAC - STAT_FRAC));
+    if (delta > 0)
+        st->m2 += delta;
+    x >>= STAT_MEAN_FRAC - STAT_FRAC;
+
+    for (bucket = 0; (value >> bucket) != 0; bucket++)
+        ;
+    st->hist[bucket]++;
+
+    for (pos = 0; pos < STAT_QUANTILES; pos++)
+        p2_add(&st->p2[pos], stat_pct[pos], x, st->count);
+}
+
+/* Mean, as fixed point */
+static uint32_t
+stat_mean(const stat_t *st)
+{
+    return (st->mean >> (STAT_MEAN_FRAC - STAT_FRAC));
+}
+
+/* Sample standard deviation, as fixed point */
+static uint32_t
+stat_stddev(const stat_t *st)
+{
+    if (st->count < 2)
+        return (0);
+    return (isqrt64(st->m2 / (st->count - 1)));
+}
+
+/* Estimate of quantile stat_pct[which], as fixed point */
+static uint32_t
+stat_quantile(const stat_t *st, uint which)
+{
+    const p2_t *p2 = &st->p2[which];
+
+    if (st->count == 0)
+        return (0);
+    if (st->count < 5)
+        return (p2->q[(st->count - 1) * stat_pct[which] / 10000]);
+    return (p2->q[2]);
+}
+
+/* Converts a fixed point E clock tick count to microseconds */
+static uint
+stat_usec(uint32_t fx, uint efreq)
+{
+    return (((uint64_t) fx * 1000000 / efreq + STAT_ONE / 2) >> STAT_FRAC);
+}
+
+/*
+ * stat_show_hist
+ * --------------
+ * Displays the non-empty histogram buckets of samples in E clock ticks.
+ */
+static void
+stat_show_hist(const stat_t *st, uint efreq)
+{
+    uint bucket;
+
+    for (bucket = 0; bucket < STAT_HIST_BUCKETS; bucket++) {
+        uint32_t top = (1U << bucket) - 1;
+        if (st->hist[bucket] == 0)
+            continue;
+        printf("    <= %6u usec %6u\n",
+               stat_usec(top << STAT_FRAC, efreq), st->hist[bucket]);
+    }
+}
+
+/*
+ * WDC command timeouts
+ *
+ * Until the WDC input clock is known, scsi_wait() allows 500 ms. After
+ * that, the limit is the longest selection timeout which will be
+ * programmed plus 25%, and at least SCSI_WAIT_MIN_USEC, which covers a
+ * soft reset (about 8 ms on a WD33C93A) with margin. Waits are timed in
+ * E clock ticks, so they are the same length on PAL and NTSC machines.
+ * Data phase waits depend on the transfer length rather than selection,
+ * so they use scsi_wait_limit() with their own limit.
+ */
+#define SCSI_WAIT_MAX_USEC 500000
+#define SCSI_WAIT_MIN_USEC 20000
+#define SCSI_POLL_USEC     14
+#define SCSI_SEL_MSEC      250  // Selection timeout for commands we issue
+
+static uint scsi_wait_usec = SCSI_WAIT_MAX_USEC;
+
+/*
+ * scsi_wait_calibrate
+ * -------------------
+ * Sets the scsi_wait() timeout from the WDC clock and the longer of
+ * SCSI_SEL_MSEC and saved_tperiod, the timeout period scsi.device uses
+ * (0 if not known). The TPERIOD register itself is not used, as
+ * calc_wdc_clock() leaves its own short test value there.
+ */
+static void
+scsi_wait_calibrate(uint saved_tperiod)
+{
+    uint64_t sel_usec;
+    uint     tperiod = SBIC_TIMEOUT(SCSI_SEL_MSEC);
+
+    if (wdc_khz < 1000) {
+        scsi_wait_usec = SCSI_WAIT_MAX_USEC;
+        return;
+    }
+    if (tperiod < saved_tperiod)
+        tperiod = saved_tperiod;
+    /*
+     * Each TPERIOD unit is 80000 input clocks (80 msec at 1 MHz), the
+     * inverse of SBIC_TIMEOUT(), so this is tperiod * 80000 / wdc_khz
+     * in msec.
+     */
+    sel_usec = (uint64_t) tperiod * 80 * 1000000 / wdc_khz;
+    sel_usec += sel_usec / 4;
+    if (sel_usec < SCSI_WAIT_MIN_USEC)
+        sel_usec = SCSI_WAIT_MIN_USEC;
+    if (sel_usec > SCSI_WAIT_MAX_USEC * 4)
+        sel_usec = SCSI_WAIT_MAX_USEC * 4;
+    scsi_wait_usec = sel_usec;
+}
+
+/*
+ * scsi_wait_limit
+ * ---------------
+ * Polls AUXST until a bit in cond is set (wait_for_set) or all are
+ * clear, for at most usec microseconds. Returns AUXST, or 0x100 on
+ * timeout.
+ */
+static uint
+scsi_wait_limit(uint8_t cond, uint wait_for_set, uint usec)
+{
+    uint     limit = cia_usec(usec);
+    uint     poll = cia_usec(SCSI_POLL_USEC);
+    uint     waited = 0;
+    uint16_t last = cia_ticks();
+    uint16_t now;
+    uint8_t  auxst;
 
-    for (timeout = 25000; timeout > 0; timeout--) {  // up to 500ms
-        cia_spin(10);
+    while (waited < limit) {
+        cia_spin(poll);
         auxst = get_wdc_reg(WDC_AUXST);
         if (wait_for_set && ((auxst & cond) != 0))
             return (auxst);
         else if ((wait_for_set == 0) && ((auxst & cond) == 0))
             return (auxst);
+        now = cia_ticks();
+        waited += (uint16_t) (last - now);  // ticks count down
+        last = now;
     }
     return (0x100);  // timeout
 }
 
+static uint
+scsi_wait(uint8_t cond, uint wait_for_set)
+{
+    return (scsi_wait_limit(cond, wait_for_set, scsi_wait_usec));
+}
+
 static uint8_t
 scsi_wait_cip(void)
 {
@@ -959,6 +1637,28 @@ scsi_wait_cip(void)
     return (auxst);
 }
 
+/*
+ * wdc_int_pending
+ * ---------------
+ * Returns non-zero if the WDC is signaling an interrupt. The DMA
+ * controller's interrupt status register is used when the board has
+ * one, as it can be polled without disturbing the WDC register index.
+ */
+static uint
+wdc_int_pending(void)
+{
+    if (ctrl->istr != 0)
+        return (CTRL_READ(ctrl->istr) & SDMAC_ISTR_INT_S);
+    return (get_wdc_reg(WDC_AUXST) & WDC_AUXST_INT);
+}
+
+static void
+dmac_clear_int(void)
+{
+    if (ctrl->clr_int != 0)
+        CTRL_WRITE(ctrl->clr_int, 0);
+}
+
 /*
  * get_wdc_reg_extended
  * --------------------
@@ -1035,1474 +1735,7354 @@ set_wdc_reg_extended(uint reg, uint8_t value)
         printf("[fail: %02x]", scsi_stat);
 }
 
+static uint wdc_ext_cmds = 0;  // GET_REGISTER commands issued by batch reads
 
-static void
-scsi_hard_reset(void)
+/* AUXST bits which mean scsi.device owns the WDC */
+#define WDC_AUXST_OWNED (WDC_AUXST_INT | WDC_AUXST_BSY | WDC_AUXST_CIP)
+
+#define WDC_EXT_OK      0  // wdc_ext_read() succeeded
+#define WDC_EXT_FAIL    1  // WDC did not report success
+#define WDC_EXT_BUSY    2  // WDC in use, so no command was issued
+
+/*
+ * wdc_ext_read
+ * ------------
+ * Issues a single GET_REGISTER command. The caller is responsible for
+ * saving and restoring CDB1 and CDB2, and for disabling interrupts.
+ * If the WDC is busy or has an interrupt pending, it belongs to
+ * scsi.device. No command is issued then, as reading the completion
+ * status would consume the status scsi.device is waiting for.
+ * Returns WDC_EXT_OK, WDC_EXT_FAIL, or WDC_EXT_BUSY.
+ */
+static uint
+wdc_ext_read(uint reg, uint8_t *value)
 {
-    uint8_t value;
+    uint8_t scsi_stat;
+
+    if (get_wdc_reg(WDC_AUXST) & WDC_AUXST_OWNED)
+        return (WDC_EXT_BUSY);
+    set_wdc_reg(WDC_CDB1, reg);
+    set_wdc_reg(WDC_CMD, WDC_CMD_GET_REGISTER);
+    wdc_ext_cmds++;
+    scsi_wait_cip();
+    scsi_stat = get_wdc_reg(WDC_SCSI_STAT);  // Clears our own interrupt
+    *value = get_wdc_reg(WDC_CDB2);
+    if (scsi_stat != (WDC_CMD_GET_REGISTER | 0x10))
+        return (WDC_EXT_FAIL);
+    return (WDC_EXT_OK);
+}
+
+/*
+ * get_wdc_regs_extended
+ * ---------------------
+ * Acquires a range of WD33C93B internal registers. CDB1 and CDB2 are
+ * saved once before the batch and restored once after it, rather than
+ * around every register as get_wdc_reg_extended() does. The batch
+ * stops if scsi.device starts using the WDC, and SCSI_STAT is not read
+ * while an interrupt is pending.
+ * Returns the number of registers which could not be read.
+ */
+static uint
+get_wdc_regs_extended(uint first, uint count, uint8_t *buf)
+{
+    uint8_t reg3;
+    uint8_t reg4;
+    uint    cmds = wdc_ext_cmds;
+    uint    reg;
+    uint    fails = 0;
+    uint    rc = WDC_EXT_OK;
+
     INTERRUPTS_DISABLE();
-    value = *ADDR8(SDMAC_CONTR);
-    *ADDR8(SDMAC_CONTR) = 0;  // Disable interrupts
-    cia_spin(CIA_USEC(10));
-    *ADDR8(SDMAC_CONTR) = SDMAC_CONTR_RESET;
-    cia_spin(CIA_USEC(10));
-    *ADDR8(SDMAC_CONTR) = 0;
-    cia_spin(CIA_USEC(10));
-    *ADDR8(SDMAC_CONTR) = value;
+    reg3 = get_wdc_reg(WDC_CDB1);
+    reg4 = get_wdc_reg(WDC_CDB2);
+    for (reg = first; reg < first + count; reg++, buf++) {
+        if (reg >= 0x40) {
+            rc = wdc_ext_read(reg, buf);
+            if (rc == WDC_EXT_BUSY)
+                break;
+            fails += rc;
+        } else if ((reg == WDC_SCSI_STAT) &&
+                   (get_wdc_reg(WDC_AUXST) & WDC_AUXST_INT)) {
+            *buf = 0;
+            fails++;
+        } else {
+            *buf = get_wdc_reg(reg);
+        }
+    }
+    if (wdc_ext_cmds != cmds) {
+        set_wdc_reg(WDC_CDB1, reg3);
+        set_wdc_reg(WDC_CDB2, reg4);
+    }
     INTERRUPTS_ENABLE();
+    if (rc == WDC_EXT_BUSY) {
+        memset(buf, 0, first + count - reg);
+        fails += first + count - reg;
+    }
+    return (fails);
 }
 
-static int
-scsi_soft_reset(uint enhanced_features)
+/*
+ * show_wdc_extended
+ * -----------------
+ * Dumps the WD33C93B extended register space 0x40-0xff twice, marking
+ * with '*' any register which changed between the two dumps. Live pin
+ * and state machine registers are expected to change on a busy bus.
+ */
+static void
+show_wdc_extended(void)
 {
-#undef RESET_WDC_OWN
-#ifdef RESET_WDC_OWN
-    uint8_t wdc_own;
-#endif
-    uint8_t wdc_new_own;
-    uint auxst;
+    static uint8_t dump1[0xc0];
+    static uint8_t dump2[0xc0];
+    uint           fails;
+    uint           changed = 0;
+    uint           pos;
+
+    wdc_ext_cmds = 0;
+    fails  = get_wdc_regs_extended(0x40, sizeof (dump1), dump1);
+    fails += get_wdc_regs_extended(0x40, sizeof (dump2), dump2);
+
+    printf("\nWDC extended registers 40-ff (* changed between reads)\n");
+    for (pos = 0; pos < sizeof (dump2); pos++) {
+        uint8_t diff = (dump1[pos] != dump2[pos]);
+        if ((pos & 0xf) == 0)
+            printf("%s%02x:", (pos == 0) ? "" : "\n", pos + 0x40);
+        printf(" %02x%c", dump2[pos], diff ? '*' : ' ');
+        changed += diff;
+    }
+    printf("\n%u changed, %u GET_REGISTER commands", changed, wdc_ext_cmds);
+    if (fails)
+        printf(", %u failed (not WD33C93B, or WDC in use?)", fails);
+    printf("\n");
+}
 
-    INTERRUPTS_DISABLE();
+/*
+ * SDMAC address space map
+ *
+ * The SDMAC and Ramsey only partially decode their address space, so
+ * registers appear at more than one address (SDMAC_WTC_ALT and friends
+ * at +0x100 are examples). The map sweeps $dd0000-$ddffff in 0x80 byte
+ * windows. Each window is first timed to see whether accesses there
+ * complete normally or only by bus timeout. For windows which respond,
+ * a signature is written to each of several known read/write registers
+ * at its normal address and read back at the same offset in the window
+ * as a long, word, and byte. A register is aliased in the window only
+ * if two different signatures both read back. Nothing but the known
+ * registers is ever written. They and the WDC register index are saved
+ * and restored within each window while interrupts are disabled, so
+ * scsi.device never sees a signature.
+ *
+ * The result is shown as runs of windows with identical behavior.
+ */
+#define MAP_WINDOW      0x80
+#define MAP_WINDOWS     (0x10000 / MAP_WINDOW)
+#define MAP_TIME_READS  4
+#define MAP_SLOW_FACTOR 4     // Slower than base by this much is timeout
 
-    wdc_new_own =  0x40 |  // Input clock divisor 3 (FS0) for 14 MHz clock
-                   0x00 |  // 0x08 to enable advanced features
-                   0x07;   // SCSI bus id
-    if (enhanced_features)
-        wdc_new_own |= 0x08;  // EAF: Enable Advanced Features
-    if (enhanced_features > 1)
-        wdc_new_own |= 0x20;  // RAF: Really Advanced Features
+#define MAP_W_LONG      BIT(0)
+#define MAP_W_WORD      BIT(1)
+#define MAP_W_BYTE      BIT(2)
 
-    /* Clear previous command status */
-    (void) get_wdc_reg(WDC_AUXST);
-    (void) get_wdc_reg(WDC_SCSI_STAT);
+#define MAP_SIG_WDC     3     // Index of WDC register in map_sigs[]
 
-#ifdef RESET_WDC_OWN
-    wdc_own = get_wdc_reg(WDC_OWN_ID);
-#endif
-    set_wdc_reg(WDC_OWN_ID, wdc_new_own);
-    set_wdc_reg(WDC_CMD, WDC_CMD_RESET);
+typedef struct {
+    const char *name;   // Register name
+    uint32_t    addr;   // Normal address of register
+    uint32_t    mask;   // Bits which hold their value
+} map_sig_t;
+
+static const map_sig_t map_sigs[] = {
+    { "WTC",     SDMAC_WTC,     0x00ffffff },
+    { "ACR",     RAMSEY_ACR,    0xfffffffc },
+    { "SSPBDAT", SDMAC_SSPBDAT, 0x000000ff },
+    { "WDC",     SDMAC_SCMD,    0x000000ff },  // WDC_CDB1 via SCMD window
+};
 
-    /* Wait for Command-In-Progress to clear */
-    auxst = scsi_wait(WDC_AUXST_CIP, 0);
+typedef struct {
+    uint16_t ticks;                       // CIA ticks for timed reads
+    uint8_t  widths[ARRAY_SIZE(map_sigs)]; // MAP_W_* which read back
+} map_window_t;
 
-    /* WD33C93A takes about 8ms to fully complete soft reset */
-    if (auxst != 0x100)
-        auxst = scsi_wait(WDC_AUXST_INT, 1);
+static void
+map_sig_write(const map_sig_t *sig, uint32_t value)
+{
+    if (sig == &map_sigs[MAP_SIG_WDC]) {
+        set_wdc_index(WDC_CDB1);
+        BUS_WRITE8(sig->addr, value);
+    } else {
+        BUS_WRITE32(sig->addr, value);
+    }
+    (void) BUS_READ32(ROM_BASE);  // flush bus access
+}
 
-#ifdef RESET_WDC_OWN
-    set_wdc_reg(WDC_OWN_ID, wdc_own);
-#endif
-    set_wdc_reg(WDC_SYNC_TX, 0);
+/* Returns the MAP_W_* widths at which value reads back at addr */
+static uint
+map_sig_check(const map_sig_t *sig, uint32_t addr, uint32_t value)
+{
+    uint widths = 0;
+
+    value &= sig->mask;
+    if (sig == &map_sigs[MAP_SIG_WDC]) {
+        set_wdc_index(WDC_CDB1);
+        if (BUS_READ8(addr) == value)
+            widths |= MAP_W_BYTE;
+        return (widths);
+    }
+    if ((BUS_READ32(addr) & sig->mask) == value)
+        widths |= MAP_W_LONG;
+    if ((BUS_READ16(addr + 2) & sig->mask) == (value & 0xffff))
+        widths |= MAP_W_WORD;
+    if ((BUS_READ8(addr + 3) & sig->mask) == (value & 0xff))
+        widths |= MAP_W_BYTE;
+    return (widths);
+}
+
+static void
+map_save(uint32_t *saved)
+{
+    saved[0] = BUS_READ32(SDMAC_WTC);
+    saved[1] = BUS_READ32(RAMSEY_ACR);
+    saved[2] = BUS_READ32(SDMAC_SSPBDAT);
+    saved[MAP_SIG_WDC] = get_wdc_reg(WDC_CDB1);
+}
+
+static void
+map_restore(const uint32_t *saved)
+{
+    BUS_WRITE32(SDMAC_WTC, saved[0]);
+    BUS_WRITE32(RAMSEY_ACR, saved[1]);
+    BUS_WRITE32(SDMAC_SSPBDAT, saved[2]);
+    set_wdc_reg(WDC_CDB1, saved[MAP_SIG_WDC]);
+}
+
+static uint16_t
+map_time_window(uint32_t base)
+{
+    uint16_t start;
+    uint     pos;
+
+    start = cia_ticks();
+    for (pos = 0; pos < MAP_TIME_READS; pos++)
+        (void) BUS_READ32(base + (SDMAC_REVISION - SDMAC_BASE));
+    return ((uint16_t) (start - cia_ticks()));
+}
+
+static void
+map_sweep(map_window_t *map)
+{
+    uint32_t saved[ARRAY_SIZE(map_sigs)];
+    uint16_t base_ticks;
+    uint8_t  oindex;
+    uint     win;
+    uint     sig;
 
+    SUPERVISOR_STATE_ENTER();  // Needed for Ramsey ACR
+    INTERRUPTS_DISABLE();
+    base_ticks = map_time_window(SDMAC_BASE);
     INTERRUPTS_ENABLE();
 
-    if (auxst == 0x100) {
-        if (irq_disabled)
-            Enable();
-        printf("reset timeout\n");
-        if (irq_disabled)
-            Disable();
-        return (1);
+    for (win = 1; win < MAP_WINDOWS; win++) {
+        uint32_t base = SDMAC_BASE + win * MAP_WINDOW;
+
+        INTERRUPTS_DISABLE();
+        map[win].ticks = map_time_window(base);
+        if (map[win].ticks <= base_ticks * MAP_SLOW_FACTOR) {
+            oindex = CTRL_READ(ctrl->sasr_r);
+            map_save(saved);
+            for (sig = 0; sig < ARRAY_SIZE(map_sigs); sig++) {
+                const map_sig_t *ms = &map_sigs[sig];
+                uint32_t addr = base + (ms->addr - SDMAC_BASE);
+                uint32_t value = 0xa5c33c5a ^ (win << 8);
+                uint     widths;
+
+                map_sig_write(ms, value);
+                widths = map_sig_check(ms, addr, value);
+                if (widths != 0) {
+                    map_sig_write(ms, ~value);
+                    widths &= map_sig_check(ms, addr, ~value);
+                }
+                map[win].widths[sig] = widths;
+            }
+            map_restore(saved);
+            set_wdc_index(oindex);
+        }
+        INTERRUPTS_ENABLE();
     }
-    return (0);
+    SUPERVISOR_STATE_EXIT();
+
+    map[0].ticks = base_ticks;
 }
 
-__attribute__((noinline))
-uint8_t
-get_sdmac_version(void)
+static int
+map_same(const map_window_t *a, const map_window_t *b, uint16_t base_ticks)
 {
-    uint32_t ovalue;
-    uint32_t rvalue;
-    uint8_t  istr = *ADDR8(SDMAC_ISTR);
-    uint     pass;
-    uint     sdmac_version = 2;
+    uint slow_a = (a->ticks > base_ticks * MAP_SLOW_FACTOR);
+    uint slow_b = (b->ticks > base_ticks * MAP_SLOW_FACTOR);
+    if (slow_a != slow_b)
+        return (0);
+    return (memcmp(a->widths, b->widths, sizeof (a->widths)) == 0);
+}
 
-    sdmac_fail_reason = "";
-    if ((istr & SDMAC_ISTR_FIFOE) && (istr & SDMAC_ISTR_FIFOF)) {
-        sdmac_fail_reason = "FIFO register test fail";
-        if (flag_debug)
-            printf(">> SDMAC_ISTR %02x has both FIFOE and FIFOF set\n", istr);
-        return (0);  // Can not be both full and empty
+static void
+map_show_window(const map_window_t *map, uint16_t base_ticks)
+{
+    uint sig;
+    uint found = 0;
+
+    if (map->ticks > base_ticks * MAP_SLOW_FACTOR) {
+        printf("bus timeout (%u usec/read)\n",
+               (uint) (((uint64_t) map->ticks * 1000000 / cia_freq +
+                        MAP_TIME_READS / 2) / MAP_TIME_READS));
+        return;
     }
+    for (sig = 0; sig < ARRAY_SIZE(map_sigs); sig++) {
+        uint8_t widths = map->widths[sig];
+        if (widths == 0)
+            continue;
+        printf("%s%s %s%s%s", found++ ? ", " : "", map_sigs[sig].name,
+               (widths & MAP_W_LONG) ? "L" : "",
+               (widths & MAP_W_WORD) ? "W" : "",
+               (widths & MAP_W_BYTE) ? "B" : "");
+    }
+    printf("%s\n", found ? "" : "responds, no alias");
+}
 
+/*
+ * map_sdmac_space
+ * ---------------
+ * Sweeps the SDMAC address space and shows the alias map.
+ */
+static void
+map_sdmac_space(void)
+{
+    map_window_t *map;
+    uint16_t      base_ticks;
+    uint32_t      start = eclock_ticks();
+    uint          efreq = get_eclock_freq();
+    uint          msec;
+    uint          win;
+    uint          first;
+
+    map = AllocMem(sizeof (*map) * MAP_WINDOWS, MEMF_PUBLIC | MEMF_CLEAR);
+    if (map == NULL) {
+        printf("Failed to allocate map\n");
+        return;
+    }
+    map_sweep(map);
+    msec = (uint64_t) (eclock_ticks() - start) * 1000 / efreq;
+    base_ticks = map[0].ticks;
+
+    printf("\nSDMAC address map (%u byte windows, swept in %u ms)\n"
+           "Registers which read back at each width (L=long W=word B=byte)\n",
+           MAP_WINDOW, msec);
+    for (first = 0; first < MAP_WINDOWS; first = win) {
+        for (win = first + 1; (first != 0) && (win < MAP_WINDOWS); win++)
+            if (!map_same(&map[first], &map[win], base_ticks))
+                break;
+        printf("  %06x-%06x ", SDMAC_BASE + first * MAP_WINDOW,
+               SDMAC_BASE + win * MAP_WINDOW - 1);
+        if (first == 0)
+            printf("registers\n");
+        else
+            map_show_window(&map[first], base_ticks);
+    }
+    FreeMem(map, sizeof (*map) * MAP_WINDOWS);
+}
 
-    /* Probe for SDMAC version */
-    for (pass = 0; pass < 6; pass++) {
-        uint32_t wvalue;
-        switch (pass) {
-            case 0: wvalue = 0x00000000; break;
-            case 1: wvalue = 0xffffffff; break;
-            case 2: wvalue = 0xa5a5a5a5; break;
-            case 3: wvalue = 0x5a5a5a5a; break;
-            case 4: wvalue = 0xc2c2c3c3; break;
-            case 5: wvalue = 0x3c3c3c3c; break;
-        }
+/*
+ * Register watch
+ *
+ * Samples a set of SDMAC and WDC registers at a fixed rate and records
+ * only changes, as (time, register, new value), in a preallocated ring.
+ * Time is kept by extending the 16-bit CIA timer to 32 bits, which is
+ * cheap enough to read on every sample. When the ring fills, the oldest
+ * changes are overwritten; per-register transition counts still cover
+ * the whole run.
+ *
+ * WDC registers are read through the index register, so they should be
+ * watched with this task at a lower priority than scsi.device (the
+ * default), which then never has its own index/data sequence split.
+ */
+#define WATCH_MAX_REGS   8
+#define WATCH_RING       16384
+#define WATCH_DEF_REGS   "SDMAC_ISTR,WDC_AUXST"
+#define WATCH_DEF_HZ     10000
+#define WATCH_ABORT_HZ   10    // ^C checks per second, at any rate
 
-        INTERRUPTS_DISABLE();
-        ovalue = *ADDR32(SDMAC_WTC);
-        *ADDR32(SDMAC_WTC) = wvalue;
-#define FORCE_READ(x) asm volatile ("" : : "r" (x));
-        /* Push out write and buffer something else on the bus */
-        (void) *ADDR32(RAMSEY_VER);
-        rvalue = *ADDR32(SDMAC_WTC);
-        *ADDR32(SDMAC_WTC) = ovalue;
-        INTERRUPTS_ENABLE();
+typedef struct {
+    const reglist_t *reg;      // Register description
+    uint             is_wdc;   // Read through WDC index
+    uint32_t         value;    // Last value seen
+    uint32_t         first;    // Value at start
+    uint32_t         changes;  // Transitions seen
+} watch_reg_t;
 
-        if (flag_debug)
-            printf(">> SDMAC_WTC wvalue=%08x rvalue=%08x\n", wvalue, rvalue);
+typedef struct {
+    uint32_t ticks;  // CIA ticks since start
+    uint32_t value;  // New value
+    uint8_t  reg;    // Index in watch register set
+} watch_change_t;
 
-        if (rvalue == wvalue) {
-            /* At least some bits of this register are read-only in SDMAC */
-            if ((wvalue != 0x00000000) && (wvalue != 0xffffffff)) {
-                sdmac_fail_reason = "read-only register bits not read-only";
-                return (0);
-            }
-        } else if (((rvalue ^ wvalue) & 0x00ffffff) == 0) {
-            /* SDMAC-02 */
-        } else if ((rvalue & BIT(2)) == 0) {
-            /* SDMAC-04 possibly */
-            if (wvalue & BIT(2)) {
-                /* SDMAC-04 bit 2 is always 0 */
-                sdmac_version = 4;
+typedef struct {
+    watch_reg_t     regs[WATCH_MAX_REGS];
+    uint            nregs;
+    watch_change_t *ring;
+    uint32_t        head;     // Total changes recorded
+} watch_t;
+
+/*
+ * watch_parse_regs
+ * ----------------
+ * Fills in the watch register set from a comma-separated list of
+ * register names. Returns non-zero if a name is unknown or can't be
+ * read without side effects.
+ */
+static int
+watch_parse_regs(watch_t *w, const char *list)
+{
+    char        name[32];
+    const char *ptr = list;
+    uint        len;
+    uint        pos;
+
+    w->nregs = 0;
+    while (*ptr != '\0') {
+        const reglist_t *reg = NULL;
+        uint             is_wdc = 0;
+
+        for (len = 0; (ptr[len] != ',') && (ptr[len] != '\0'); len++)
+            ;
+        if ((len == 0) || (len >= sizeof (name)) ||
+            (w->nregs >= WATCH_MAX_REGS)) {
+            printf("Invalid register list %s\n", list);
+            return (1);
+        }
+        memcpy(name, ptr, len);
+        name[len] = '\0';
+        ptr += len + (ptr[len] == ',');
+
+        for (pos = 0; pos < ARRAY_SIZE(sdmac_reglist); pos++)
+            if (strcmp(name, sdmac_reglist[pos].name) == 0)
+                reg = &sdmac_reglist[pos];
+        for (pos = 0; (reg == NULL) && (pos < ARRAY_SIZE(wd_reglist)); pos++) {
+            if (strcmp(name, wd_reglist[pos].name) == 0) {
+                reg = &wd_reglist[pos];
+                is_wdc = 1;
             }
-        } else {
-            /* SDMAC-04 bit 2 should never be 1 */
-            sdmac_fail_reason = "bit corruption in WTC register";
-            return (0);
         }
+        if (reg == NULL) {
+            printf("Unknown register %s\n", name);
+            return (1);
+        }
+        if ((reg->type == WO) || (reg->addr == SDMAC_SCMD) ||
+            (reg->addr == SDMAC_SASR_B) || (strncmp(name, "Ramsey", 6) == 0) ||
+            (is_wdc && (reg->addr == WDC_DATA))) {
+            printf("Register %s can't be watched\n", name);
+            return (1);
+        }
+        if ((is_wdc == 0) && (ctrl->type != CTRL_A3000)) {
+            printf("Register %s is only available for A3000 SDMAC\n", name);
+            return (1);
+        }
+        w->regs[w->nregs].reg    = reg;
+        w->regs[w->nregs].is_wdc = is_wdc;
+        w->nregs++;
     }
-    return (sdmac_version);  // SDMAC-02 WTC bits 0-23 are writable
+    return (0);
 }
 
-static uint8_t
-get_ramsey_version(void)
+static uint32_t
+watch_read(const watch_reg_t *wr)
 {
-    uint8_t version;
-    SUPERVISOR_STATE_ENTER();
-    INTERRUPTS_DISABLE();
-    version = *ADDR8(RAMSEY_VER);
-    INTERRUPTS_ENABLE();
-    SUPERVISOR_STATE_EXIT();
-    return (version);
+    if (wr->is_wdc)
+        return (get_wdc_reg(wr->reg->addr));
+    switch (wr->reg->width) {
+        case BYTE:
+            return (*ADDR8(wr->reg->addr));
+        case WORD:
+            return (*ADDR16(wr->reg->addr));
+        default:
+        case LONG:
+            return (*ADDR32(wr->reg->addr));
+    }
 }
 
-static uint8_t
-get_ramsey_control(void)
+/* Records a sample of register reg, storing it only if it changed */
+static void
+watch_record(watch_t *w, uint reg, uint32_t value, uint32_t ticks)
 {
-    uint8_t control;
-    SUPERVISOR_STATE_ENTER();
-    INTERRUPTS_DISABLE();
-    control = *ADDR8(RAMSEY_CTRL);
-    INTERRUPTS_ENABLE();
-    SUPERVISOR_STATE_EXIT();
-    return (control);
+    watch_reg_t    *wr = &w->regs[reg];
+    watch_change_t *ch;
+
+    if (value == wr->value)
+        return;
+    wr->value = value;
+    wr->changes++;
+    ch = &w->ring[w->head++ % WATCH_RING];
+    ch->ticks = ticks;
+    ch->value = value;
+    ch->reg   = reg;
 }
 
-static int ramsey_rev = 0;
+static void
+watch_show(watch_t *w, uint32_t ticks, uint32_t samples)
+{
+    uint32_t first = (w->head > WATCH_RING) ? w->head - WATCH_RING : 0;
+    uint32_t pos;
+    uint     reg;
+    uint     msec = (uint64_t) ticks * 1000 / cia_freq;
+
+    printf("%u samples in %u.%03u s, %u changes",
+           samples, msec / 1000, msec % 1000, w->head);
+    if (first != 0)
+        printf(" (oldest %u overwritten)", first);
+    printf("\n");
 
-static uint
-show_ramsey_version(void)
+    for (pos = first; pos < w->head; pos++) {
+        watch_change_t *ch = &w->ring[pos % WATCH_RING];
+        uint32_t usec = (uint64_t) ch->ticks * 1000000 / cia_freq;
+        printf("%4u.%06u %-14s %0*x\n", usec / 1000000, usec % 1000000,
+               w->regs[ch->reg].reg->name,
+               w->regs[ch->reg].is_wdc ? 2 : w->regs[ch->reg].reg->width * 2,
+               ch->value);
+    }
+
+    printf("\nREGISTER         FIRST     LAST  CHANGES\n");
+    for (reg = 0; reg < w->nregs; reg++) {
+        watch_reg_t *wr = &w->regs[reg];
+        printf("%-14s %8x %8x %8u\n",
+               wr->reg->name, wr->first, wr->value, wr->changes);
+    }
+}
+
+/*
+ * watch_regs
+ * ----------
+ * Samples the listed registers at hz samples per second (0 for as fast
+ * as possible) for secs seconds or until ^C. ^C is checked by elapsed
+ * time, also while waiting for the next sample, so it is seen promptly
+ * whether sampling is slow or the registers are slow to read.
+ */
+static int
+watch_regs(const char *list, uint secs, uint hz)
 {
-    uint8_t ramsey_version = get_ramsey_version();
+    watch_t  w;
+    uint32_t period = (hz == 0) ? 0 : (cia_freq + hz / 2) / hz;
+    uint32_t limit  = secs * cia_freq;
+    uint32_t now = 0;
+    uint32_t next = 0;
+    uint32_t polled = 0;
+    uint32_t samples = 0;
+    uint16_t last;
+    uint16_t cur;
+    uint     reg;
+    uint     aborted = 0;
+
+    memset(&w, 0, sizeof (w));
+    if (watch_parse_regs(&w, list))
+        return (1);
+    w.ring = AllocMem(WATCH_RING * sizeof (*w.ring), MEMF_PUBLIC);
+    if (w.ring == NULL) {
+        printf("Failed to allocate change ring\n");
+        return (1);
+    }
+    for (reg = 0; reg < w.nregs; reg++) {
+        w.regs[reg].value = watch_read(&w.regs[reg]);
+        w.regs[reg].first = w.regs[reg].value;
+    }
 
-    switch (ramsey_version) {
-        case 0x7f:
-            ramsey_rev = 1;
-            break;
-        case 0x0d:
-            ramsey_rev = 4;
-            break;
-        case 0x0f:
-            ramsey_rev = 7;
-            break;
-        default:
-            printf("Unrecognized Ramsey version $%x -- this program only works "
-                   "on Amiga 3000\n", ramsey_version);
-            return (1);
+    printf("Watching %s", list);
+    if (hz != 0)
+        printf(" at %u Hz", hz);
+    printf(" for %u s (^C to stop)\n", secs);
+    last = cia_ticks();
+    while ((now < limit) && !aborted) {
+        for (reg = 0; reg < w.nregs; reg++)
+            watch_record(&w, reg, watch_read(&w.regs[reg]), now);
+        samples++;
+        next += period;
+        do {
+            cur = cia_ticks();
+            now += (uint16_t) (last - cur);  // CIA timer counts down
+            last = cur;
+            if (now - polled >= cia_freq / WATCH_ABORT_HZ) {
+                polled = now;
+                aborted = is_user_abort();
+            }
+        } while (((int32_t) (now - next) < 0) && !aborted);
     }
-    printf("Memory controller:   Ramsey-0%d $%x\n", ramsey_rev, ramsey_version);
+    watch_show(&w, now, samples);
+    FreeMem(w.ring, WATCH_RING * sizeof (*w.ring));
     return (0);
 }
 
-static uint8_t sdmac_version     = 0;
-static uint32_t sdmac_version_rev = 0;
+/*
+ * WDC register scripts
+ *
+ * A script file given to -r holds one operation per line:
+ *     r <reg>                          Read and show register
+ *     w <reg> <value>                  Write register
+ *     wait <reg> <mask> <value> [<ms>] Wait for (reg & mask) == value
+ *     delay <usec>                     Busy-wait
+ *     time on|off                      Timestamp following operations
+ * Registers are hex addresses (00-ff) or names from the register list,
+ * such as WDC_CONTROL. Values are hex. Text after # is ignored.
+ *
+ * The whole file is parsed before any register is touched, and results
+ * are only shown after the last operation, so the script runs at the
+ * speed of the register accesses rather than of console output.
+ */
+#define SCRIPT_MAX_OPS    512
+#define SCRIPT_READ       0
+#define SCRIPT_WRITE      1
+#define SCRIPT_WAIT       2
+#define SCRIPT_DELAY      3
+#define SCRIPT_WAIT_MSEC  100  // Default wait timeout
 
-static uint
-show_dmac_version(void)
+typedef struct {
+    uint8_t  op;       // SCRIPT_READ...SCRIPT_DELAY
+    uint8_t  reg;      // WDC register
+    uint8_t  mask;     // wait: bits to compare
+    uint8_t  value;    // write: value; wait: expected value
+    uint8_t  stamp;    // Record time of this operation
+    uint8_t  result;   // read / wait: last value read
+    uint8_t  failed;   // wait: timed out
+    uint16_t line;     // Script line number
+    uint32_t arg;      // wait: timeout msec; delay: usec
+    uint32_t ticks;    // E clock ticks after script start
+} script_op_t;
+
+static int
+script_parse_reg(const char *str, uint8_t *reg)
 {
-    sdmac_version     = get_sdmac_version();
-    sdmac_version_rev = *ADDR32(SDMAC_REVISION);  // ReSDMAC only
+    uint pos;
+    uint addr;
+    int  len = 0;
 
-    switch (sdmac_version) {
-        case 2:
-        case 4:
-            printf("SCSI DMA Controller: SDMAC-%02d", sdmac_version);
-            if ((sdmac_version == 4) && ((sdmac_version_rev >> 24) == 'v') &&
-                (((sdmac_version_rev >> 8) & 0xff) == '.')) {
-                /*
-                 * SDMAC_REVISION is in the format: 'v' <major> '.' <minor>
-                 *
-                 * XXX: Could also key off SSPBDAT as a differentiator for
-                 *      ReSDMAC. According to the A3000+ docs, it may be only
-                 *      the lower 11 bits of SSPBDAT which are r/w on SDMAC-04.
-                 *      ReSDMAC implements all 32 bits as r/w.
-                 */
-                printf("  %c%c%c%c",
-                        (char) (sdmac_version_rev >> 24),
-                        (char) (sdmac_version_rev >> 16),
-                        (char) (sdmac_version_rev >> 8),
-                        (char) sdmac_version_rev);
-            }
-            printf("\n");
+    if ((sscanf(str, "%x%n", &addr, &len) == 1) && (str[len] == '\0') &&
+        (addr <= 0xff)) {
+        *reg = addr;
+        return (0);
+    }
+    for (pos = 0; pos < ARRAY_SIZE(wd_reglist); pos++) {
+        if (strcmp(str, wd_reglist[pos].name) == 0) {
+            *reg = wd_reglist[pos].addr;
             return (0);
-        default:
-            printf("SDMAC was not detected: %s\n", sdmac_fail_reason);
-            return (1);
+        }
     }
+    return (1);
 }
 
-static uint
-show_ramsey_config(void)
+static int
+script_parse_hex(const char *str, uint max, uint32_t *value)
 {
-    int     printed = 0;
-    uint8_t ramsey_control = get_ramsey_control();
+    uint val;
+    int  len = 0;
 
-    printf("Ramsey config:       ");
-    if (ramsey_control & BIT(0)) {
-        printf("Page Mode");
-        printed++;
-    }
-    if (ramsey_control & BIT(1)) {
-        if (printed++ > 0)
-            printf(", ");
-        printf("Burst Mode");
-    }
-    if (ramsey_control & BIT(2)) {
-        if (printed++ > 0)
-            printf(", ");
-        printf("Wrap");
-    }
-    if (printed++ > 0)
-        printf(", ");
-    if (ramsey_control & BIT(3)) {
-        printf("1Mx4");
-    } else if (ramsey_rev < 7) {
-        if (ramsey_control & BIT(4))
-            printf("256Kx4");
-        else
-            printf("1Mx1");
-    } else {
-        printf("256Kx4");
-        if (ramsey_control & BIT(4))
-            printf(", Skip");
+    if ((sscanf(str, "%x%n", &val, &len) != 1) || (str[len] != '\0') ||
+        (val > max))
+        return (1);
+    *value = val;
+    return (0);
+}
+
+/*
+ * script_parse
+ * ------------
+ * Reads the script file into ops. Returns the number of operations,
+ * or -1 if the file could not be read or has an error.
+ */
+static int
+script_parse(const char *filename, script_op_t *ops, uint max_ops)
+{
+    FILE    *fp;
+    char     line[128];
+    char     words[5][32];
+    uint     lineno = 0;
+    uint     count = 0;
+    uint     stamp = 0;
+    uint32_t val;
+    int      nwords;
+    int      rc = 0;
+
+    fp = fopen(filename, "r");
+    if (fp == NULL) {
+        printf("Failed to open %s\n", filename);
+        return (-1);
     }
-    switch ((ramsey_control >> 5) & 3) {
-        case 0:
-            printf(", 154 clock refresh\n");
-            break;
-        case 1:
-            printf(", 238 clock refresh\n");
-            break;
-        case 2:
-            printf(", 380 clock refresh\n");
-            break;
-        case 3:
-            printf(", refresh disabled\n");
+    while (fgets(line, sizeof (line), fp) != NULL) {
+        script_op_t *op = &ops[count];
+        char        *ptr = strchr(line, '#');
+
+        lineno++;
+        if (ptr != NULL)
+            *ptr = '\0';
+        nwords = sscanf(line, "%31s %31s %31s %31s %31s", words[0],
+                        words[1], words[2], words[3], words[4]);
+        if (nwords <= 0)
+            continue;  // Blank line
+
+        if ((strcmp(words[0], "time") == 0) && (nwords == 2)) {
+            if (strcmp(words[1], "on") == 0)
+                stamp = 1;
+            else if (strcmp(words[1], "off") == 0)
+                stamp = 0;
+            else
+                goto bad_line;
+            continue;
+        }
+        if (count >= max_ops) {
+            printf("%s:%u: more than %u operations\n",
+                   filename, lineno, max_ops);
+            rc = -1;
             break;
+        }
+        memset(op, 0, sizeof (*op));
+        op->line  = lineno;
+        op->stamp = stamp;
+        if ((strcmp(words[0], "r") == 0) && (nwords == 2)) {
+            op->op = SCRIPT_READ;
+            if (script_parse_reg(words[1], &op->reg))
+                goto bad_line;
+        } else if ((strcmp(words[0], "w") == 0) && (nwords == 3)) {
+            op->op = SCRIPT_WRITE;
+            if (script_parse_reg(words[1], &op->reg) ||
+                script_parse_hex(words[2], 0xff, &val))
+                goto bad_line;
+            op->value = val;
+        } else if ((strcmp(words[0], "wait") == 0) &&
+                   ((nwords == 4) || (nwords == 5))) {
+            op->op  = SCRIPT_WAIT;
+            op->arg = SCRIPT_WAIT_MSEC;
+            if (script_parse_reg(words[1], &op->reg) ||
+                script_parse_hex(words[2], 0xff, &val))
+                goto bad_line;
+            op->mask = val;
+            if (script_parse_hex(words[3], 0xff, &val))
+                goto bad_line;
+            op->value = val;
+            if ((nwords == 5) &&
+                (sscanf(words[4], "%u", &op->arg) != 1))
+                goto bad_line;
+        } else if ((strcmp(words[0], "delay") == 0) && (nwords == 2)) {
+            op->op = SCRIPT_DELAY;
+            if (sscanf(words[1], "%u", &op->arg) != 1)
+                goto bad_line;
+        } else {
+            goto bad_line;
+        }
+        count++;
+        continue;
+bad_line:
+        printf("%s:%u: invalid line: %s", filename, lineno, line);
+        rc = -1;
+        break;
     }
-    if (ramsey_control & (BIT(0) | BIT(1))) {  // Page or Burst mode
-        printf("                     Static Column RAM required\n");
-    }
-    return (0);
+    fclose(fp);
+    return ((rc != 0) ? rc : (int) count);
 }
 
-
-
-#define LEVEL_UNKNOWN  0
-#define LEVEL_WD33C93  1
-#define LEVEL_WD33C93A 2
-#define LEVEL_WD33C93B 3
-static uint    wd_level = LEVEL_WD33C93;
-
-static uint8_t wdc_regs_saved = 0;
-static uint8_t wdc_regs_store[32];
-#define WDC_SAVE_MASK (BIT(WDC_OWN_ID) | BIT(WDC_CONTROL) | BIT(WDC_TPERIOD) | \
-                       BIT(WDC_CMDPHASE) | BIT(WDC_SYNC_TX))
-
 static void
-scsi_save_regs(void)
+script_delay(uint32_t usec)
 {
-    uint8_t pos;
-    for (pos = 0; pos < ARRAY_SIZE(wdc_regs_store); pos++) {
-        if (BIT(pos) & WDC_SAVE_MASK)
-            wdc_regs_store[pos] = get_wdc_reg(pos);
+    while (usec >= 1000) {
+        cia_spin(cia_usec(1000));
+        usec -= 1000;
     }
-    wdc_regs_saved++;
+    cia_spin(cia_usec(usec));
 }
 
-static void
-scsi_restore_regs(void)
+/*
+ * script_run
+ * ----------
+ * Executes the operations in order, stopping at the first wait which
+ * times out. Returns the number of operations executed.
+ */
+static uint
+script_run(script_op_t *ops, uint count, uint efreq)
 {
-    uint8_t pos;
-    if (wdc_regs_saved--) {
-        for (pos = 0; pos < ARRAY_SIZE(wdc_regs_store); pos++) {
-            if (BIT(pos) & WDC_SAVE_MASK)
-                set_wdc_reg(pos, wdc_regs_store[pos]);
+    uint32_t start = eclock_ticks();
+    uint     pos;
+
+    for (pos = 0; pos < count; pos++) {
+        script_op_t *op = &ops[pos];
+        switch (op->op) {
+            case SCRIPT_READ:
+                op->result = get_wdc_reg_extended(op->reg);
+                break;
+            case SCRIPT_WRITE:
+                set_wdc_reg_extended(op->reg, op->value);
+                break;
+            case SCRIPT_WAIT: {
+                uint32_t limit = (uint64_t) op->arg * efreq / 1000;
+                uint32_t wstart = eclock_ticks();
+                do {
+                    op->result = get_wdc_reg_extended(op->reg);
+                    if ((op->result & op->mask) == op->value)
+                        break;
+                } while (eclock_ticks() - wstart < limit);
+                op->failed = ((op->result & op->mask) != op->value);
+                break;
+            }
+            case SCRIPT_DELAY:
+                script_delay(op->arg);
+                break;
+        }
+        if (op->stamp)
+            op->ticks = eclock_ticks() - start;
+        if (op->failed) {
+            pos++;
+            break;
         }
     }
+    return (pos);
 }
 
 /*
- * calc_wdc_clock
+ * run_wdc_script
  * --------------
- * This function forces a SCSI timeout. When measured, the SCSI input
- * clock can be determined based on how long it takes for the SCSI timeout.
- * It returns the measured clock speed in KHz.
+ * Parses and runs a register script file, then shows the results.
+ * Returns non-zero if the script could not be run or a wait timed out.
  */
-static uint
-calc_wdc_clock(void)
+static int
+run_wdc_script(const char *filename)
 {
-    uint16_t ticks;
-    uint treg;
-#undef DEBUG_CALC_WDC_LOCK
-#ifdef DEBUG_CALC_WDC_LOCK
-    uint auxst;
-#endif
-    uint sstat;
-    uint efreq;
-    uint count = 200000;
-    struct EClockVal now;
+    script_op_t *ops;
+    uint         efreq = get_eclock_freq();
+    uint         done;
+    uint         pos;
+    int          count;
+    int          rc = 0;
+
+    ops = malloc(SCRIPT_MAX_OPS * sizeof (*ops));
+    if (ops == NULL) {
+        printf("Failed to allocate script memory\n");
+        return (1);
+    }
+    count = script_parse(filename, ops, SCRIPT_MAX_OPS);
+    if (count < 0) {
+        free(ops);
+        return (1);
+    }
+    done = script_run(ops, count, efreq);
 
-    INTERRUPTS_DISABLE();
-    scsi_wait_cip();
-    scsi_soft_reset(0);  // set the clock divisor to 3
+    for (pos = 0; pos < done; pos++) {
+        script_op_t *op = &ops[pos];
+        if (op->stamp) {
+            uint usec = (uint64_t) op->ticks * 1000000 / efreq;
+            printf("%4u.%06u ", usec / 1000000, usec % 1000000);
+        }
+        switch (op->op) {
+            case SCRIPT_READ:
+            case SCRIPT_WRITE:
+                show_wdc_reg(op->reg, (op->op == SCRIPT_READ) ? op->result :
+                                                                op->value);
+                break;
+            case SCRIPT_WAIT:
+                if (op->failed) {
+                    printf("%s:%u: wait %02x & %02x == %02x timed out "
+                           "(last %02x)\n", filename, op->line, op->reg,
+                           op->mask, op->value, op->result);
+                    rc = 1;
+                } else if (op->stamp) {
+                    printf("wait %02x & %02x == %02x\n",
+                           op->reg, op->mask, op->value);
+                }
+                break;
+            case SCRIPT_DELAY:
+                if (op->stamp)
+                    printf("delay %u\n", op->arg);
+                break;
+        }
+    }
+    free(ops);
+    return (rc);
+}
 
-    sstat = get_wdc_reg(WDC_SCSI_STAT);  // clear reset status
-    if (sstat == 0xff)
-        return (0);  // timeout
+/*
+ * SCSI bus logic analyzer
+ *
+ * Samples the WD33C93B live pin registers (see set_wdc_index()) as fast
+ * as GET_REGISTER commands can be issued. Each sample is timestamped in
+ * E clock ticks. The capture is exported as a Value Change Dump (VCD)
+ * file which can be viewed with GTKWave or sigrok PulseView.
+ *
+ * GET_REGISTER can only be issued while the WDC is idle, so the capture
+ * runs while scsi.device is not using the bus. Samples which would fall
+ * in a scsi.device command are skipped (see la_capture()), so its own
+ * transfers do not appear. Use it on a quiet system.
+ */
+#define LA_REG_DATA   0x50  // Live data pins D0-D7 (1 = asserted)
+#define LA_REG_CTRL   0x53  // Live control pins (0 = asserted)
+#define LA_REG_STATE  0x55  // State machine
 
-    /* Perform a select to ID 7 LUN 7 (should cause timeout) */
-    set_wdc_reg(WDC_DST_ID, 7);
-    set_wdc_reg(WDC_LUN, 7);
-    set_wdc_reg(WDC_SYNC_TX, 0);  // async
-    set_wdc_reg(WDC_CONTROL, WDC_CONTROL_IDI | WDC_CONTROL_EDI);  // No DMA
+#define LA_SIG_IO     BIT(0)
+#define LA_SIG_CD     BIT(1)
+#define LA_SIG_MSG    BIT(2)
+#define LA_SIG_REQ    BIT(3)
 
-    /*
-     * Timeout Register = Tper * Ficlk / 80
-     *                    Ficlk = input clock in MHz
-     *                    Tper  = timeout period in milliseconds
-     *
-     *     Reg = Tper * Ficlk / 80
-     *     Ficlk = Treg * 80 / Tper
-     *
-     * efreq = CIA ticks / second
-     * ticks = CIA ticks per timeout
-     * Tper = 1000 * ticks / efreq
-     *
-     * Ficlk = Treg * 80 / Tper
-     * Ficlk = Treg * 80 / 1000 / ticks * efreq
-     * Ficlk = efreq * Treg * 80 / 1000 / ticks
-     * FiclkKHz = efreq * Treg * 80 / ticks
-     *
-     * timeoutspersec = efreq / ticks
-     * SCSI clk = timeoutspersec * 80 * 100
-     */
-    treg = 10;  // any higher and there is risk of CIA timer rollover
-    set_wdc_reg(WDC_TPERIOD, treg);
-    (void) cia_ticks();
+#define LA_CHUNK      128   // Samples taken with interrupts disabled
 
-    /* Start select and wait for it to start */
-    set_wdc_reg(WDC_CMD, WDC_CMD_SELECT_WITH_ATN);
-    (void) scsi_wait_cip();
+typedef struct {
+    uint32_t ticks;  // E clock ticks since start of capture
+    uint8_t  data;   // LA_REG_DATA
+    uint8_t  ctrl;   // LA_REG_CTRL
+    uint8_t  state;  // LA_REG_STATE
+    uint8_t  pad;
+} la_sample_t;
 
-    /* Wait for select to timeout */
-    ticks = cia_ticks();
-    while ((*ADDR8(SDMAC_ISTR) & SDMAC_ISTR_INT_S) == 0)
-        if (--count == 0)
-            break;  // timeout
+/*
+ * la_decode
+ * ---------
+ * Converts the raw control and state register values of a sample to
+ * LA_SIG_* bits, where a set bit means the signal is asserted. The
+ * IO, CD, and MSG bits line up with scsi_mci_codes[].
+ */
+static uint8_t
+la_decode(const la_sample_t *sample)
+{
+    uint8_t sig = ~sample->ctrl & (LA_SIG_IO | LA_SIG_CD | LA_SIG_MSG);
+    if (sample->state & BIT(3))
+        sig |= LA_SIG_REQ;
+    return (sig);
+}
 
-    ticks -= cia_ticks();  // ticks count down, not up
+/*
+ * la_sample
+ * ---------
+ * Reads the live pin registers into sample, adding failed commands to
+ * *fails. Returns WDC_EXT_BUSY if scsi.device was using the WDC.
+ */
+static uint
+la_sample(la_sample_t *sample, uint *fails)
+{
+    static const uint8_t regs[] = { LA_REG_DATA, LA_REG_CTRL, LA_REG_STATE };
+    uint8_t *values[] = { &sample->data, &sample->ctrl, &sample->state };
+    uint     pos;
+    uint     rc;
+
+    for (pos = 0; pos < ARRAY_SIZE(regs); pos++) {
+        rc = wdc_ext_read(regs[pos], values[pos]);
+        if (rc == WDC_EXT_BUSY)
+            return (rc);
+        *fails += rc;
+    }
+    return (WDC_EXT_OK);
+}
 
-    /*
-     * Hack: Compensate for microcode execution runtime
-     *       There are minor variations in command processing time between
-     *       WD33C93A 00-04, 00-06, and 00-08, but they are small enough
-     *       to not affect the reported speed by even 1%.
-     */
-    switch (wd_level) {
-        default:
-        case LEVEL_WD33C93:
-            ticks -= 292;  // ~400 usec
-            break;
-        case LEVEL_WD33C93A:
-            ticks -= 380;  // ~530 usec
-            break;
-        case LEVEL_WD33C93B:
-            ticks -= 260;  // ~360 usec
+/*
+ * la_capture
+ * ----------
+ * Fills the sample buffer. Interrupts are only disabled for LA_CHUNK
+ * samples at a time so that ^C and the rest of the system keep working.
+ * Within a chunk, timestamps advance by cia_ticks() deltas. The 16-bit
+ * CIA count would wrap silently across a gap of more than about 91 ms,
+ * so each chunk instead restarts from the 32-bit eclock_ticks() count.
+ * If the WDC is busy or has an interrupt pending, the sample is dropped
+ * and the chunk ends, so that scsi.device can handle its interrupt.
+ * *skipped counts the samples dropped.
+ * Returns the number of samples captured.
+ */
+static uint
+la_capture(la_sample_t *buf, uint count, uint *fails, uint *skipped)
+{
+    uint8_t  reg3;
+    uint8_t  reg4;
+    uint16_t last;
+    uint16_t now;
+    uint32_t start;
+    uint32_t elapsed;
+    uint     cmds;
+    uint     pos = 0;
+    uint     chunk;
+
+    *fails = 0;
+    *skipped = 0;
+    start = eclock_ticks();
+    while (pos < count) {
+        INTERRUPTS_DISABLE();
+        cmds = wdc_ext_cmds;
+        reg3 = get_wdc_reg(WDC_CDB1);
+        reg4 = get_wdc_reg(WDC_CDB2);
+        elapsed = eclock_ticks() - start;
+        last = cia_ticks();
+        for (chunk = 0; (chunk < LA_CHUNK) && (pos < count); chunk++) {
+            la_sample_t *sample = &buf[pos];
+            now = cia_ticks();
+            elapsed += (uint16_t) (last - now);  // ticks count down
+            last = now;
+            sample->ticks = elapsed;
+            if (la_sample(sample, fails) == WDC_EXT_BUSY) {
+                (*skipped)++;
+                break;
+            }
+            pos++;
+        }
+        if (wdc_ext_cmds != cmds) {
+            set_wdc_reg(WDC_CDB1, reg3);
+            set_wdc_reg(WDC_CDB2, reg4);
+        }
+        INTERRUPTS_ENABLE();
+        if (is_user_abort()) {
+            printf("^C Abort\n");
             break;
+        }
     }
+    return (pos);
+}
 
-#ifdef DEBUG_CALC_WDC_LOCK
-    auxst = scsi_wait(WDC_AUXST_LCI | WDC_AUXST_INT, 1);
-    sstat = get_wdc_reg(WDC_SCSI_STAT);
-#endif
+static void
+la_vcd_bit(FILE *fp, uint8_t sig, uint8_t mask, char id)
+{
+    fprintf(fp, "%c%c\n", (sig & mask) ? '1' : '0', id);
+}
 
-    scsi_soft_reset(0);  // set the clock divisor to 3
-    INTERRUPTS_ENABLE();
+static void
+la_vcd_byte(FILE *fp, uint8_t value, char id)
+{
+    int bit;
+    fputc('b', fp);
+    for (bit = 7; bit >= 0; bit--)
+        fputc((value & BIT(bit)) ? '1' : '0', fp);
+    fprintf(fp, " %c\n", id);
+}
 
-    if (count == 0)
-        return (0);
+/*
+ * la_write_vcd
+ * ------------
+ * Writes the capture as a VCD file with microsecond timescale. Only
+ * signals which changed are emitted after the initial dump.
+ */
+static int
+la_write_vcd(const char *filename, const la_sample_t *buf, uint count,
+             uint efreq)
+{
+    FILE    *fp;
+    uint     pos;
+    uint8_t  sig;
+    uint8_t  osig = 0;
+    uint8_t  odata = 0;
+
+    fp = fopen(filename, "w");
+    if (fp == NULL) {
+        printf("Failed to open %s for write\n", filename);
+        return (1);
+    }
+    fprintf(fp, "$version SDMAC %s $end\n"
+                "$timescale 1 us $end\n"
+                "$scope module scsi $end\n"
+                "$var wire 8 d DB $end\n"
+                "$var wire 1 i IO $end\n"
+                "$var wire 1 c CD $end\n"
+                "$var wire 1 m MSG $end\n"
+                "$var wire 1 r REQ $end\n"
+                "$upscope $end\n"
+                "$enddefinitions $end\n", VER);
+
+    for (pos = 0; pos < count; pos++) {
+        uint32_t usec = (uint64_t) buf[pos].ticks * 1000000 / efreq;
+        sig = la_decode(&buf[pos]);
+        if ((pos != 0) && (sig == osig) && (buf[pos].data == odata))
+            continue;
+        fprintf(fp, "#%u\n", usec);
+        if (pos == 0)
+            fprintf(fp, "$dumpvars\n");
+        if ((pos == 0) || (buf[pos].data != odata))
+            la_vcd_byte(fp, buf[pos].data, 'd');
+        if ((pos == 0) || ((sig ^ osig) & LA_SIG_IO))
+            la_vcd_bit(fp, sig, LA_SIG_IO, 'i');
+        if ((pos == 0) || ((sig ^ osig) & LA_SIG_CD))
+            la_vcd_bit(fp, sig, LA_SIG_CD, 'c');
+        if ((pos == 0) || ((sig ^ osig) & LA_SIG_MSG))
+            la_vcd_bit(fp, sig, LA_SIG_MSG, 'm');
+        if ((pos == 0) || ((sig ^ osig) & LA_SIG_REQ))
+            la_vcd_bit(fp, sig, LA_SIG_REQ, 'r');
+        if (pos == 0)
+            fprintf(fp, "$end\n");
+        osig  = sig;
+        odata = buf[pos].data;
+    }
+    if (count > 0)
+        fprintf(fp, "#%u\n",
+                (uint) ((uint64_t) buf[count - 1].ticks * 1000000 / efreq));
+    fclose(fp);
+    return (0);
+}
 
-    if (TimerBase == NULL)
-        TimerBase = (struct Device *) FindName(&SysBase->DeviceList, TIMERNAME);
-    efreq = ReadEClock(&now);
+/*
+ * la_run
+ * ------
+ * Captures the requested number of samples, writes the VCD file, and
+ * reports the achieved sample rate and time spent in each bus phase.
+ */
+static int
+la_run(const char *filename, uint count)
+{
+    la_sample_t *buf;
+    uint         efreq = get_eclock_freq();
+    uint         fails;
+    uint         skipped;
+    uint         captured;
+    uint         pos;
+    uint         usec;
+    uint         phase_count[8];
+    int          rc;
+
+    buf = AllocMem(count * sizeof (*buf), MEMF_PUBLIC);
+    if (buf == NULL) {
+        printf("Failed to allocate %u samples\n", count);
+        return (1);
+    }
+    printf("Capturing %u samples\n", count);
+    captured = la_capture(buf, count, &fails, &skipped);
+    if (fails != 0) {
+        printf("%u GET_REGISTER failures (not WD33C93B?)\n", fails);
+    }
+    if (skipped != 0)
+        printf("%u samples skipped while scsi.device used the WDC\n", skipped);
+    if (captured < 2) {
+        FreeMem(buf, count * sizeof (*buf));
+        return (1);
+    }
 
-    /*
-     * efreq = CIA ticks / second
-     * ticks = CIA ticks per timeout
-     * Tper = 1000 * ticks / efreq
-     * Ficlk = Treg * 80 / Tper
-     * Ficlk = Treg * 80 / 1000 / ticks * efreq
-     * Ficlk = efreq * Treg * 80 / 1000 / ticks
-     * FiclkKHz = efreq * Treg * 80 / ticks
-     *
-     * timeoutspersec = efreq / ticks
+    usec = (uint64_t) buf[captured - 1].ticks * 1000000 / efreq;
+    printf("%u samples in %u.%03u ms", captured, usec / 1000, usec % 1000);
+    if (usec != 0) {
+        printf(" (%u samples/sec)",
+               (uint) ((uint64_t) (captured - 1) * 1000000 / usec));
+    }
+    printf("\n");
+
+    memset(phase_count, 0, sizeof (phase_count));
+    for (pos = 0; pos < captured; pos++)
+        phase_count[la_decode(&buf[pos]) & 7]++;
+    for (pos = 0; pos < ARRAY_SIZE(phase_count); pos++) {
+        if (phase_count[pos] != 0)
+            printf("  %-20s %u samples\n", scsi_mci_codes[pos],
+                   phase_count[pos]);
+    }
+
+    rc = la_write_vcd(filename, buf, captured, efreq);
+    FreeMem(buf, count * sizeof (*buf));
+    if (rc == 0)
+        printf("Wrote %s\n", filename);
+    return (rc || (fails != 0));
+}
+
+
+/*
+ * scsi_hard_reset
+ * ---------------
+ * Pulses the DMA controller's WDC reset line. Returns non-zero if the
+ * board has no reset bit in its control register.
+ */
+static int
+scsi_hard_reset(void)
+{
+    uint8_t value;
+
+    if (ctrl->reset == 0)
+        return (1);
+    INTERRUPTS_DISABLE();
+    value = CTRL_READ(ctrl->contr);
+    CTRL_WRITE(ctrl->contr, 0);  // Disable interrupts
+    cia_spin(cia_usec(10));
+    CTRL_WRITE(ctrl->contr, ctrl->reset);
+    cia_spin(cia_usec(10));
+    CTRL_WRITE(ctrl->contr, 0);
+    cia_spin(cia_usec(10));
+    CTRL_WRITE(ctrl->contr, value);
+    INTERRUPTS_ENABLE();
+    return (0);
+}
+
+static int
+scsi_soft_reset(uint enhanced_features)
+{
+#undef RESET_WDC_OWN
+#ifdef RESET_WDC_OWN
+    uint8_t wdc_own;
+#endif
+    uint8_t wdc_new_own;
+    uint auxst;
+
+    INTERRUPTS_DISABLE();
+
+    wdc_new_own =  ctrl->fsel |  // Input clock divisor (FS0 for 14 MHz clock)
+                   0x00 |        // 0x08 to enable advanced features
+                   0x07;         // SCSI bus id
+    if (enhanced_features)
+        wdc_new_own |= 0x08;  // EAF: Enable Advanced Features
+    if (enhanced_features > 1)
+        wdc_new_own |= 0x20;  // RAF: Really Advanced Features
+
+    /* Clear previous command status */
+    (void) get_wdc_reg(WDC_AUXST);
+    (void) get_wdc_reg(WDC_SCSI_STAT);
+
+#ifdef RESET_WDC_OWN
+    wdc_own = get_wdc_reg(WDC_OWN_ID);
+#endif
+    set_wdc_reg(WDC_OWN_ID, wdc_new_own);
+    set_wdc_reg(WDC_CMD, WDC_CMD_RESET);
+
+    /* Wait for Command-In-Progress to clear */
+    auxst = scsi_wait(WDC_AUXST_CIP, 0);
+
+    /* WD33C93A takes about 8ms to fully complete soft reset */
+    if (auxst != 0x100)
+        auxst = scsi_wait(WDC_AUXST_INT, 1);
+
+#ifdef RESET_WDC_OWN
+    set_wdc_reg(WDC_OWN_ID, wdc_own);
+#endif
+    set_wdc_reg(WDC_SYNC_TX, 0);
+
+    INTERRUPTS_ENABLE();
+
+    if (auxst == 0x100) {
+        if (irq_disabled)
+            Enable();
+        printf("reset timeout\n");
+        if (irq_disabled)
+            Disable();
+        return (1);
+    }
+    return (0);
+}
+
+__attribute__((noinline))
+uint8_t
+get_sdmac_version(void)
+{
+    uint32_t ovalue;
+    uint32_t rvalue;
+    uint8_t  istr = *ADDR8(SDMAC_ISTR);
+    uint     pass;
+    uint     sdmac_version = 2;
+
+    sdmac_fail_reason = "";
+    if ((istr & SDMAC_ISTR_FIFOE) && (istr & SDMAC_ISTR_FIFOF)) {
+        sdmac_fail_reason = "FIFO register test fail";
+        if (flag_debug)
+            printf(">> SDMAC_ISTR %02x has both FIFOE and FIFOF set\n", istr);
+        return (0);  // Can not be both full and empty
+    }
+
+
+    /* Probe for SDMAC version */
+    for (pass = 0; pass < 6; pass++) {
+        uint32_t wvalue;
+        switch (pass) {
+            case 0: wvalue = 0x00000000; break;
+            case 1: wvalue = 0xffffffff; break;
+            case 2: wvalue = 0xa5a5a5a5; break;
+            case 3: wvalue = 0x5a5a5a5a; break;
+            case 4: wvalue = 0xc2c2c3c3; break;
+            case 5: wvalue = 0x3c3c3c3c; break;
+        }
+
+        INTERRUPTS_DISABLE();
+        ovalue = *ADDR32(SDMAC_WTC);
+        *ADDR32(SDMAC_WTC) = wvalue;
+#define FORCE_READ(x) asm volatile ("" : : "r" (x));
+        /* Push out write and buffer something else on the bus */
+        (void) *ADDR32(RAMSEY_VER);
+        rvalue = *ADDR32(SDMAC_WTC);
+        *ADDR32(SDMAC_WTC) = ovalue;
+        INTERRUPTS_ENABLE();
+
+        if (flag_debug)
+            printf(">> SDMAC_WTC wvalue=%08x rvalue=%08x\n", wvalue, rvalue);
+
+        if (rvalue == wvalue) {
+            /* At least some bits of this register are read-only in SDMAC */
+            if ((wvalue != 0x00000000) && (wvalue != 0xffffffff)) {
+                sdmac_fail_reason = "read-only register bits not read-only";
+                return (0);
+            }
+        } else if (((rvalue ^ wvalue) & 0x00ffffff) == 0) {
+            /* SDMAC-02 */
+        } else if ((rvalue & BIT(2)) == 0) {
+            /* SDMAC-04 possibly */
+            if (wvalue & BIT(2)) {
+                /* SDMAC-04 bit 2 is always 0 */
+                sdmac_version = 4;
+            }
+        } else {
+            /* SDMAC-04 bit 2 should never be 1 */
+            sdmac_fail_reason = "bit corruption in WTC register";
+            return (0);
+        }
+    }
+    return (sdmac_version);  // SDMAC-02 WTC bits 0-23 are writable
+}
+
+static uint8_t
+get_ramsey_version(void)
+{
+    uint8_t version;
+    SUPERVISOR_STATE_ENTER();
+    INTERRUPTS_DISABLE();
+    version = *ADDR8(RAMSEY_VER);
+    INTERRUPTS_ENABLE();
+    SUPERVISOR_STATE_EXIT();
+    return (version);
+}
+
+static uint8_t
+get_ramsey_control(void)
+{
+    uint8_t control;
+    SUPERVISOR_STATE_ENTER();
+    INTERRUPTS_DISABLE();
+    control = *ADDR8(RAMSEY_CTRL);
+    INTERRUPTS_ENABLE();
+    SUPERVISOR_STATE_EXIT();
+    return (control);
+}
+
+static int ramsey_rev = 0;
+
+static uint
+show_ramsey_version(void)
+{
+    uint8_t ramsey_version;
+
+    if (ctrl->type != CTRL_A3000)
+        return (0);  // Zorro board: no Ramsey to report
+
+    ramsey_version = get_ramsey_version();
+    switch (ramsey_version) {
+        case 0x7f:
+            ramsey_rev = 1;
+            break;
+        case 0x0d:
+            ramsey_rev = 4;
+            break;
+        case 0x0f:
+            ramsey_rev = 7;
+            break;
+        default:
+            printf("Unrecognized Ramsey version $%x -- this program only works "
+                   "on Amiga 3000\n", ramsey_version);
+            return (1);
+    }
+    printf("Memory controller:   Ramsey-0%d $%x\n", ramsey_rev, ramsey_version);
+    return (0);
+}
+
+static uint8_t sdmac_version     = 0;
+static uint32_t sdmac_version_rev = 0;
+
+static uint
+show_dmac_version(void)
+{
+    if (ctrl->type != CTRL_A3000) {
+        sdmac_version = 0;
+        printf("SCSI DMA Controller: %s at $%06x\n", ctrl->name, ctrl->base);
+        return (0);
+    }
+    sdmac_version     = get_sdmac_version();
+    sdmac_version_rev = *ADDR32(SDMAC_REVISION);  // ReSDMAC only
+
+    switch (sdmac_version) {
+        case 2:
+        case 4:
+            printf("SCSI DMA Controller: SDMAC-%02d", sdmac_version);
+            if ((sdmac_version == 4) && ((sdmac_version_rev >> 24) == 'v') &&
+                (((sdmac_version_rev >> 8) & 0xff) == '.')) {
+                /*
+                 * SDMAC_REVISION is in the format: 'v' <major> '.' <minor>
+                 *
+                 * XXX: Could also key off SSPBDAT as a differentiator for
+                 *      ReSDMAC. According to the A3000+ docs, it may be only
+                 *      the lower 11 bits of SSPBDAT which are r/w on SDMAC-04.
+                 *      ReSDMAC implements all 32 bits as r/w.
+                 */
+                printf("  %c%c%c%c",
+                        (char) (sdmac_version_rev >> 24),
+                        (char) (sdmac_version_rev >> 16),
+                        (char) (sdmac_version_rev >> 8),
+                        (char) sdmac_version_rev);
+            }
+            printf("\n");
+            return (0);
+        default:
+            printf("SDMAC was not detected: %s\n", sdmac_fail_reason);
+            return (1);
+    }
+}
+
+static uint
+show_ramsey_config(void)
+{
+    int     printed = 0;
+    uint8_t ramsey_control;
+
+    if (ctrl->type != CTRL_A3000)
+        return (0);
+
+    ramsey_control = get_ramsey_control();
+    printf("Ramsey config:       ");
+    if (ramsey_control & BIT(0)) {
+        printf("Page Mode");
+        printed++;
+    }
+    if (ramsey_control & BIT(1)) {
+        if (printed++ > 0)
+            printf(", ");
+        printf("Burst Mode");
+    }
+    if (ramsey_control & BIT(2)) {
+        if (printed++ > 0)
+            printf(", ");
+        printf("Wrap");
+    }
+    if (printed++ > 0)
+        printf(", ");
+    if (ramsey_control & BIT(3)) {
+        printf("1Mx4");
+    } else if (ramsey_rev < 7) {
+        if (ramsey_control & BIT(4))
+            printf("256Kx4");
+        else
+            printf("1Mx1");
+    } else {
+        printf("256Kx4");
+        if (ramsey_control & BIT(4))
+            printf(", Skip");
+    }
+    switch ((ramsey_control >> 5) & 3) {
+        case 0:
+            printf(", 154 clock refresh\n");
+            break;
+        case 1:
+            printf(", 238 clock refresh\n");
+            break;
+        case 2:
+            printf(", 380 clock refresh\n");
+            break;
+        case 3:
+            printf(", refresh disabled\n");
+            break;
+    }
+    if (ramsey_control & (BIT(0) | BIT(1))) {  // Page or Burst mode
+        printf("                     Static Column RAM required\n");
+    }
+    return (0);
+}
+
+/*
+ * find_controllers
+ * ----------------
+ * Builds the list of WD33C93 controllers in this machine. The A3000
+ * SDMAC is recognized by its Ramsey memory controller, and Zorro II
+ * boards are located through expansion.library. If nothing is found,
+ * the A3000 SDMAC is assumed so the usual detection failures get reported.
+ *
+ * GVP uses product 11 for several boards, including some without SCSI.
+ * Those will fail WDC detection in show_wdc_version().
+ */
+static void
+find_controllers(void)
+{
+    struct ConfigDev *cd = NULL;
+    uint8_t           ramsey_version = get_ramsey_version();
+    uint              pos;
+
+    ctrl_count = 0;
+    if ((ramsey_version == 0x7f) || (ramsey_version == 0x0d) ||
+        (ramsey_version == 0x0f)) {
+        ctrl_list[ctrl_count++] = ctrl_types[CTRL_A3000];
+    }
+
+    ExpansionBase = (struct ExpansionBase *)
+                    OpenLibrary("expansion.library", 0);
+    if (ExpansionBase != NULL) {
+        while ((ctrl_count < ARRAY_SIZE(ctrl_list)) &&
+               ((cd = FindConfigDev(cd, -1, -1)) != NULL)) {
+            for (pos = 0; pos < ARRAY_SIZE(zorro_wdc_boards); pos++) {
+                if ((cd->cd_Rom.er_Manufacturer ==
+                     zorro_wdc_boards[pos].manufacturer) &&
+                    (cd->cd_Rom.er_Product == zorro_wdc_boards[pos].product)) {
+                    ctrl_list[ctrl_count] =
+                        ctrl_types[zorro_wdc_boards[pos].type];
+                    ctrl_list[ctrl_count].base = (uint32_t) cd->cd_BoardAddr;
+                    ctrl_count++;
+                    break;
+                }
+            }
+        }
+        CloseLibrary((struct Library *) ExpansionBase);
+        ExpansionBase = NULL;
+    }
+    if (ctrl_count == 0)
+        ctrl_list[ctrl_count++] = ctrl_types[CTRL_A3000];
+    ctrl = &ctrl_list[0];
+}
+
+static void
+show_controllers(void)
+{
+    uint pos;
+
+    printf("Controllers:\n");
+    for (pos = 0; pos < ctrl_count; pos++) {
+        printf("  %u %-14s at $%06x\n",
+               pos, ctrl_list[pos].name, ctrl_list[pos].base);
+    }
+}
+
+
+
+#define LEVEL_UNKNOWN  0
+#define LEVEL_WD33C93  1
+#define LEVEL_WD33C93A 2
+#define LEVEL_WD33C93B 3
+static uint    wd_level = LEVEL_WD33C93;
+static uint    wd_microcode = 0;
+
+static uint8_t wdc_regs_saved = 0;
+static uint8_t wdc_regs_store[32];
+#define WDC_SAVE_MASK (BIT(WDC_OWN_ID) | BIT(WDC_CONTROL) | BIT(WDC_TPERIOD) | \
+                       BIT(WDC_CMDPHASE) | BIT(WDC_SYNC_TX))
+
+static void
+scsi_save_regs(void)
+{
+    uint8_t pos;
+    for (pos = 0; pos < ARRAY_SIZE(wdc_regs_store); pos++) {
+        if (BIT(pos) & WDC_SAVE_MASK)
+            wdc_regs_store[pos] = get_wdc_reg(pos);
+    }
+    wdc_regs_saved++;
+}
+
+static void
+scsi_restore_regs(void)
+{
+    uint8_t pos;
+    if (wdc_regs_saved--) {
+        for (pos = 0; pos < ARRAY_SIZE(wdc_regs_store); pos++) {
+            if (BIT(pos) & WDC_SAVE_MASK)
+                set_wdc_reg(pos, wdc_regs_store[pos]);
+        }
+    }
+}
+
+/*
+ * calc_wdc_clock
+ * --------------
+ * This function forces a SCSI timeout. When measured, the SCSI input
+ * clock can be determined based on how long it takes for the SCSI timeout.
+ * It returns the measured clock speed in KHz.
+ */
+static uint
+calc_wdc_clock(void)
+{
+    uint16_t ticks;
+    uint treg;
+#undef DEBUG_CALC_WDC_LOCK
+#ifdef DEBUG_CALC_WDC_LOCK
+    uint auxst;
+#endif
+    uint sstat;
+    uint efreq;
+    uint count = 200000;
+
+    INTERRUPTS_DISABLE();
+    scsi_wait_cip();
+    scsi_soft_reset(0);  // set the clock divisor
+
+    sstat = get_wdc_reg(WDC_SCSI_STAT);  // clear reset status
+    if (sstat == 0xff)
+        return (0);  // timeout
+
+    /* Perform a select to ID 7 LUN 7 (should cause timeout) */
+    set_wdc_reg(WDC_DST_ID, 7);
+    set_wdc_reg(WDC_LUN, 7);
+    set_wdc_reg(WDC_SYNC_TX, 0);  // async
+    set_wdc_reg(WDC_CONTROL, WDC_CONTROL_IDI | WDC_CONTROL_EDI);  // No DMA
+
+    /*
+     * Timeout Register = Tper * Ficlk / 80
+     *                    Ficlk = input clock in MHz
+     *                    Tper  = timeout period in milliseconds
+     *
+     *     Reg = Tper * Ficlk / 80
+     *     Ficlk = Treg * 80 / Tper
+     *
+     * efreq = CIA ticks / second
+     * ticks = CIA ticks per timeout
+     * Tper = 1000 * ticks / efreq
+     *
+     * Ficlk = Treg * 80 / Tper
+     * Ficlk = Treg * 80 / 1000 / ticks * efreq
+     * Ficlk = efreq * Treg * 80 / 1000 / ticks
+     * FiclkKHz = efreq * Treg * 80 / ticks
+     *
+     * timeoutspersec = efreq / ticks
+     * SCSI clk = timeoutspersec * 80 * 100
+     */
+    treg = 10;  // any higher and there is risk of CIA timer rollover
+    set_wdc_reg(WDC_TPERIOD, treg);
+    (void) cia_ticks();
+
+    /* Start select and wait for it to start */
+    set_wdc_reg(WDC_CMD, WDC_CMD_SELECT_WITH_ATN);
+    (void) scsi_wait_cip();
+
+    /* Wait for select to timeout */
+    ticks = cia_ticks();
+    while (wdc_int_pending() == 0)
+        if (--count == 0)
+            break;  // timeout
+
+    ticks -= cia_ticks();  // ticks count down, not up
+
+    /*
+     * Hack: Compensate for microcode execution runtime
+     *       There are minor variations in command processing time between
+     *       WD33C93A 00-04, 00-06, and 00-08, but they are small enough
+     *       to not affect the reported speed by even 1%.
+     */
+    switch (wd_level) {
+        default:
+        case LEVEL_WD33C93:
+            ticks -= 292;  // ~400 usec
+            break;
+        case LEVEL_WD33C93A:
+            ticks -= 380;  // ~530 usec
+            break;
+        case LEVEL_WD33C93B:
+            ticks -= 260;  // ~360 usec
+            break;
+    }
+
+#ifdef DEBUG_CALC_WDC_LOCK
+    auxst = scsi_wait(WDC_AUXST_LCI | WDC_AUXST_INT, 1);
+    sstat = get_wdc_reg(WDC_SCSI_STAT);
+#endif
+
+    scsi_soft_reset(0);  // set the clock divisor
+    INTERRUPTS_ENABLE();
+
+    if (count == 0)
+        return (0);
+
+    efreq = get_eclock_freq();
+
+    /*
+     * efreq = CIA ticks / second
+     * ticks = CIA ticks per timeout
+     * Tper = 1000 * ticks / efreq
+     * Ficlk = Treg * 80 / Tper
+     * Ficlk = Treg * 80 / 1000 / ticks * efreq
+     * Ficlk = efreq * Treg * 80 / 1000 / ticks
+     * FiclkKHz = efreq * Treg * 80 / ticks
+     *
+     * timeoutspersec = efreq / ticks
      * SCSI clk = timeoutspersec * 80 * 100
      */
-#ifdef DEBUG_CALC_WDC_LOCK
-    printf("auxst=%x sstat=%x\n", auxst, sstat);
-    printf("wdc clock ticks = %u\n", ticks);
-    printf("Eclk=%u Hz\n", efreq);
-    printf("timeouts/sec=%u\n", efreq / ticks);
-    printf("SCSI clk=%u\n", efreq * treg * 80 / ticks);
+#ifdef DEBUG_CALC_WDC_LOCK
+    printf("auxst=%x sstat=%x\n", auxst, sstat);
+    printf("wdc clock ticks = %u\n", ticks);
+    printf("Eclk=%u Hz\n", efreq);
+    printf("timeouts/sec=%u\n", efreq / ticks);
+    printf("SCSI clk=%u\n", efreq * treg * 80 / ticks);
+#endif
+    return (efreq * treg * 80 / ticks);
+}
+
+#define WD_DETECT_ERR_INVALID        0x0001
+#define WD_DETECT_ERR_AUXST          0x0002
+#define WD_DETECT_ERR_AUXST_WRITABLE 0x0004
+#define WD_DETECT_ERR_SCSI_STAT      0x0008
+#define WD_DETECT_ERR_CMDPHASE       0x0010
+#define WD_DETECT_ERR_RESET_STATUS   0x0020
+
+static uint
+show_wdc_version(void)
+{
+    uint8_t     cvalue;
+    uint8_t     ovalue;
+    uint8_t     rvalue;
+    uint8_t     wvalue;
+    uint        pass;
+    uint        errs = 0;
+    uint        wd_rev_value = 0;
+    const char *wd_rev = "";
+
+    printf("SCSI Controller:     ");
+
+    /* Verify that WD33C93 or WD33C93A can be detected */
+    rvalue = get_wdc_reg(WDC_INVALID_REG);
+    if (rvalue != 0xff)
+        errs |= WD_DETECT_ERR_INVALID;
+    rvalue = get_wdc_reg(WDC_AUXST);
+    if (rvalue & (BIT(2) | BIT(3))) {
+        if (flag_debug)
+            printf("Got %02x for AUXST\n", rvalue);
+        errs |= WD_DETECT_ERR_AUXST;
+    }
+
+    INTERRUPTS_DISABLE();
+    rvalue = get_wdc_reg(WDC_AUXST);
+    ovalue = get_wdc_reg(WDC_CMDPHASE);
+    wvalue = 0xa5;
+    for (pass = 0; pass < 2; pass++) {
+        uint8_t rvalue2;
+        set_wdc_reg(WDC_CMDPHASE, wvalue);
+        rvalue2 = get_wdc_reg(WDC_AUXST);
+        cvalue = get_wdc_reg(WDC_CMDPHASE);
+        if (rvalue != rvalue2)
+            errs |= WD_DETECT_ERR_INVALID;
+        if (cvalue != wvalue)
+            errs |= WD_DETECT_ERR_CMDPHASE;
+        wvalue = 0x5a;
+    }
+    set_wdc_reg(WDC_CMDPHASE, ovalue);
+    INTERRUPTS_ENABLE();
+
+    rvalue = get_wdc_reg(WDC_SCSI_STAT);
+    switch (rvalue >> 4) {
+        case 0:
+            if ((rvalue & 0xf) > 1)
+                errs |= WD_DETECT_ERR_SCSI_STAT;
+            break;
+        case 1:
+            if ((rvalue & 0xf) == 7)  // reserved
+                errs |= WD_DETECT_ERR_SCSI_STAT;
+            break;
+        case 2:
+            if ((rvalue & 0xf) == 6)  // reserved
+                errs |= WD_DETECT_ERR_SCSI_STAT;
+            break;
+        case 4:
+            break;
+        case 8:
+            if ((rvalue & 0xf) == 6)  // reserved
+                errs |= WD_DETECT_ERR_SCSI_STAT;
+            break;
+        default:
+            /* Only one status bit may be set */
+            errs |= WD_DETECT_ERR_SCSI_STAT;
+            break;
+    }
+    if ((errs & WD_DETECT_ERR_SCSI_STAT) && flag_debug)
+        printf("Got %02x for SCSI_STAT\n", rvalue);
+
+    if (errs == 0) {
+        /* Attempt write of read-only AUXST */
+        rvalue = get_wdc_reg(WDC_AUXST);
+        set_wdc_reg(WDC_AUXST, ~rvalue);
+        if (get_wdc_reg(WDC_AUXST) != rvalue) {
+            set_wdc_reg(WDC_AUXST, rvalue);
+            errs |= WD_DETECT_ERR_AUXST_WRITABLE;
+        }
+    }
+
+    if (errs) {
+        wd_level = LEVEL_UNKNOWN;
+        goto fail;
+    }
+
+    INTERRUPTS_DISABLE();
+
+    /*
+     * Official way to detect the WD33C93A vs the WD33C93:
+     *
+     * Enable in WDC_OWN_ID:
+     *      Bit 3 - EAF Advanced Features
+     *      Bit 5 - EIH Enable Immediate Halt (WD33C93A)
+     *              RAF Really Advanced Features (WD33C93B)
+     * and from there hit the controller with a reset.
+     * If the SCSI Status Register has a value of 0x01, then
+     * the WD33C93A or WD33C93B is present.
+     */
+    scsi_soft_reset(1);
+    rvalue = get_wdc_reg(WDC_SCSI_STAT);
+    if (rvalue == 0x00) {
+        /* Does not support advanced features */
+        wd_level = LEVEL_WD33C93;
+    } else if (rvalue == 0x01) {
+        /* Supports advanced features: A or B part */
+        wd_level = LEVEL_WD33C93A;
+    } else {
+        /* Bad part? */
+        wd_level = LEVEL_UNKNOWN;
+        errs |= WD_DETECT_ERR_RESET_STATUS;
+        INTERRUPTS_ENABLE();
+        goto fail;
+    }
+
+    if (wd_level == LEVEL_WD33C93A) {
+        /*
+         * Could be WD33C93A or WD33C93B or compatible chip at this point.
+         *
+         * Try to detect WD33C93B by changing the QUETAG register. If the
+         * new value sticks, this part is a WD33C93B.
+         */
+        cvalue = get_wdc_reg(WDC_CONTROL);
+        ovalue = get_wdc_reg(WDC_QUETAG);
+        for (pass = 4; pass > 0; pass--) {
+            switch (pass) {
+                case 4: wvalue = 0x00; break;
+                case 3: wvalue = 0xff; break;
+                case 2: wvalue = 0xa5; break;
+                case 1: wvalue = 0x5a; break;
+            }
+            set_wdc_reg(WDC_QUETAG, wvalue);
+            if (get_wdc_reg(WDC_CONTROL) != cvalue) {
+                break;  // Control register should remain the same
+            }
+            rvalue = get_wdc_reg(WDC_QUETAG);
+            if (rvalue != wvalue) {
+                break;
+            }
+        }
+        set_wdc_reg(WDC_QUETAG, ovalue);
+        if (pass == 0) {
+            /* All QUETAG register tests passed */
+            wd_level = LEVEL_WD33C93B;
+        }
+    }
+    if ((wd_level == LEVEL_WD33C93A) ||
+        (wd_level == LEVEL_WD33C93B)) {
+        /*
+         * This table is mostly assumptions by me:
+         *          Marking mcode  HW Revision
+         *   WD33C93A 00-01        A  / Not released? /
+         *   WD33C93A 00-02        B  / Not released? /
+         *   WD33C93A 00-03 06     C  Seen on ebay and on A2091
+         *   WD33C93A 00-04 06     D  Common in A3000
+         *   WD33C93A 00-05 07     E  / Not released? /
+         *   WD33C93A 00-06 08     E  Seen on ebay
+         *   WD33C93A 00-07 08     F  / Not released? /
+         *   WD33C93A 00-08 09     F  Final production; same as AM33C93A?
+         *
+         * Actual samples from my part stock
+         *                  mcode datecode
+         *   WD33C93  00-02 00    8849 115315200102
+         *   WD33C93A 00-03 00    8909
+         *   WD33C93A 00-04 00    9040 040315200102  9109 041816200102
+         *   WD33C93A 00-06 08    9018 058564200302
+         *   AM33C93A       08    9022 9009 1048EXA A  8950 1608EXA A
+         *   WD33C93A 00-08 09    9209 F 25933A5-3503  9205 F 25890A2-3503
+         *   WD33C93B 00-02 0d    1025 E 2513427-3702
+         */
+
+        /*
+         * The microcode version can be obtained by enabling the
+         * RAF bit in OWN_ID and then forcing a reset. The value
+         * is stored in the CDB1 register.
+         */
+        scsi_soft_reset(2);
+        wd_rev_value = get_wdc_reg(WDC_CDB1);
+        wd_microcode = wd_rev_value;
+    }
+    scsi_soft_reset(0);
+
+    if (wd_level == LEVEL_WD33C93A) {
+        switch (wd_rev_value) {
+            case 0x00:
+                wd_rev = " 00-04 or 00-03";
+                break;
+            case 0x08:
+                wd_rev = " 00-06 or AM33C93A";
+                break;
+            case 0x09:
+                wd_rev = " 00-08";
+                break;
+        }
+    }
+    if (wd_level == LEVEL_WD33C93B) {
+        wd_rev = "";
+    }
+    INTERRUPTS_ENABLE();
+
+fail:
+    switch (wd_level) {
+        case LEVEL_UNKNOWN:
+            printf("Not detected:");
+            if (errs & WD_DETECT_ERR_INVALID)
+                printf(" INVALID");
+            if (errs & WD_DETECT_ERR_AUXST)
+                printf(" AUXST");
+            if (errs & WD_DETECT_ERR_CMDPHASE)
+                printf(" CMDPHASE");
+            if (errs & WD_DETECT_ERR_SCSI_STAT)
+                printf(" SCSI_STAT");
+            if (errs & WD_DETECT_ERR_RESET_STATUS)
+                printf(" RESET_STATUS");
+            break;
+        case LEVEL_WD33C93:
+            printf("WD33C93");
+            break;
+        case LEVEL_WD33C93A:
+            printf("WD33C93A%s microcode %02x", wd_rev, wd_rev_value);
+            break;
+        case LEVEL_WD33C93B:
+            printf("WD33C93B microcode %02x", wd_rev_value);
+            break;
+    }
+    if (wd_level != LEVEL_UNKNOWN) {
+        wdc_khz = calc_wdc_clock() + 50;
+        scsi_wait_calibrate(wdc_regs_saved ? wdc_regs_store[WDC_TPERIOD] : 0);
+        if (wdc_khz >= 1000) {
+            printf(", %u.%u MHz", wdc_khz / 1000, (wdc_khz % 1000) / 100);
+        }
+    }
+    printf("\n");
+    return (errs);
+}
+
+static uint
+show_wdc_config(void)
+{
+    const uint inclk_pal  = 28375 / 2;   // PAL frequency  28.37516 MHz
+    const uint inclk_ntsc = 28636 / 2;   // NTSC frequency 28.63636 MHz
+    uint       inclk      = inclk_ntsc;  // WD33C93A has ~14MHz clock on A3000
+    uint       control    = wdc_regs_store[WDC_CONTROL];
+    uint       tperiod    = wdc_regs_store[WDC_TPERIOD];
+    uint       syncreg    = wdc_regs_store[WDC_SYNC_TX];
+    uint       tperiodms;
+    uint       fsel_div   = 3;  // Assumption good for A3000 only (12-15 MHz)
+    uint       sync_tcycles;
+    uint       syncoff;
+
+    if ((wdc_khz > 14000) && (wdc_khz < 14250))
+        inclk = inclk_pal;
+    else if ((wdc_khz >= 14250) && (wdc_khz < 14450))
+        inclk = inclk_ntsc;
+    else
+        inclk = wdc_khz;
+    tperiodms  = tperiod * 80 * 1000 / inclk;
+#if 0
+    /*
+     * Unfortunately the FSEL bits are only valid across a reset.
+     * After that, the register may be used for SCSI CBD size.
+     *
+     * We could probably determine what FSEL was set to by first
+     * forcing a timeout of a specific period, and measuring how long
+     * that took, then calculate the SCSI clock using our own
+     * FSEL, and then from that would be able to report what FSEL
+     * was originally programmed to.
+     */
+    uint own_id   = get_wdc_reg(WDC_OWN_ID);
+    uint fsel     = own_id >> 6;
+    uint fsel_div = 1;
+
+    switch (fsel) {
+        case 0:
+            fsel_div = 2;
+            break;
+        case 1:
+            fsel_div = 3;
+            break;
+        case 2:
+            fsel_div = 4;
+            break;
+        default:
+            printf("                     Invalid WDC FSEL: %x\n", fsel);
+            fsel_div = 0;
+            break;
+    }
+#endif
+
+    printf("WDC Configuration:   ");
+
+    switch (control >> 5) {
+        case 0:  printf("Polled Mode"); break;
+        case 1:  printf("Burst Mode");  break;
+        case 2:  printf("WD Bus Mode"); break;
+        case 4:  printf("DMA Mode");    break;
+        default: printf("Unknown Bus Mode (%d)", control >> 5);
+            break;
+    }
+    printf(", %d msec timeout", tperiodms);
+
+    /* syncoff = 0 for Asynchronous mode */
+    syncoff = syncreg & 0xf;
+    if (syncoff == 0) {
+        printf(", Async");
+    } else {
+        uint sync_khz;
+        uint freq_mul;
+        printf(", Offset %d", syncoff);
+        if (syncoff > 12)
+            printf(" (BAD)");
+
+        if (wd_level == LEVEL_WD33C93) {
+            sync_tcycles = (syncreg >> 4) & 0x7;
+        } else {
+            /* WD33C93A and WD33C93B */
+            switch ((syncreg >> 4) & 0x7) {
+                default:
+                case 0:
+                case 1: sync_tcycles = 8; break;
+                case 2: sync_tcycles = 2; break;
+                case 3: sync_tcycles = 3; break;
+                case 4: sync_tcycles = 4; break;
+                case 5: sync_tcycles = 5; break;
+                case 6: sync_tcycles = 6; break;
+                case 7: sync_tcycles = 7; break;
+            }
+        }
+
+        if ((wd_level == LEVEL_WD33C93B) &&
+            (fsel_div == 4)) {
+            uint fss_mode = (syncreg & BIT(7)) ? 1 : 0;
+            freq_mul = 1 + fss_mode;
+            fsel_div = 2;
+        } else {
+            freq_mul = 2;
+        }
+        sync_khz = freq_mul * inclk / fsel_div / sync_tcycles;
+        printf(", Sync %d.%03d MHz", sync_khz / 1000, sync_khz % 1000);
+#ifdef DEBUG_SYNC_CALC
+        printf("\ninclk=%uKHz mul=%u div=%u tcycles=%u\n",
+               inclk, freq_mul, fsel_div, sync_tcycles);
+#endif
+    }
+    printf("\n");
+
+    if (ctrl->type == CTRL_A3000) {
+        uint method;
+        printf("WDC Index Access:    %s selected on %s\n",
+               wdc_index_names[wdc_index_method], cpu_name());
+        for (method = 0; method < ARRAY_SIZE(wdc_index_names); method++) {
+            printf("                     %-18s ", wdc_index_names[method]);
+            if (wdc_index_ns[method] == 0)
+                printf("FAIL\n");
+            else
+                printf("%u ns per register read\n", wdc_index_ns[method]);
+        }
+    }
+    printf("\n");
+    return (0);
+}
+
+/*
+ * Register snapshots
+ *
+ * A snapshot is a fixed-size binary record of the detection results and
+ * the SDMAC, Ramsey, and WDC register state. Records are appended to the
+ * snapshot file, so results from many machines may be concatenated into
+ * one file and decoded in a single pass with -D, or summarized with -Q.
+ * Records are big-endian. The decoder does not touch hardware, so
+ * host/sdmac-decode builds it for Linux, where each file is mapped
+ * rather than read (see snap_load()).
+ *
+ * Version 2 added the results of a -b run in the same invocation. New
+ * fields are only ever added at the end, so older and newer records
+ * can be mixed in one file.
+ */
+#define SNAP_MAGIC    0x53445370  // "SDSp"
+#define SNAP_VERSION  2
+#define SNAP_LABEL    32
+#define SNAP_DRIVE    24
+
+/* Results of the last -b run, for snapshots */
+static uint32_t bench_result_kbps[3];
+static uint32_t bench_result_p99[3];   // usec
+static char     bench_result_drive[SNAP_DRIVE];
+
+typedef struct {
+    uint32_t magic;            // SNAP_MAGIC
+    uint16_t version;          // SNAP_VERSION
+    uint16_t size;             // sizeof (snap_t)
+    uint32_t time;             // Seconds since 1978-01-01
+    char     label[SNAP_LABEL]; // User-supplied machine name
+    uint32_t ctrl_base;        // Controller base address
+    uint8_t  ctrl_type;        // CTRL_A3000, CTRL_A2091, CTRL_GVP
+    uint8_t  ramsey_ver;       // RAMSEY_VER (A3000 only)
+    uint8_t  ramsey_ctrl;      // RAMSEY_CTRL (A3000 only)
+    uint8_t  sdmac_version;    // 2, 4, or 0 if not detected
+    uint32_t sdmac_rev;        // SDMAC_REVISION (ReSDMAC)
+    uint8_t  wd_level;         // LEVEL_*
+    uint8_t  wd_microcode;     // WDC microcode revision
+    uint16_t wdc_khz;          // WDC input clock
+    uint32_t wdc_valid;        // Bitmap of wdc[] entries which were read
+    uint8_t  ext_valid;        // ext[] was read (WD33C93B only)
+    uint8_t  pad[3];
+    uint32_t sdmac_l[0x20];    // SDMAC window as long reads
+    uint8_t  sdmac_b[0x80];    // SDMAC window as byte reads
+    uint8_t  wdc[0x20];        // WDC registers 00-1f
+    uint8_t  ext[0xc0];        // WDC extended registers 40-ff
+    /* Version 2 */
+    char     drive[SNAP_DRIVE]; // -b target INQUIRY vendor and product
+    uint32_t kbps[ARRAY_SIZE(bench_result_kbps)];  // -b KB/s by path
+} snap_t;
+
+#define SNAP_MIN_SIZE offsetof(snap_t, drive)  // Version 1 record
+
+/* Converts a snapshot between host and file byte order */
+static void
+snap_order(snap_t *snap)
+{
+    uint pos;
+
+    snap->magic     = BE32(snap->magic);
+    snap->version   = BE16(snap->version);
+    snap->size      = BE16(snap->size);
+    snap->time      = BE32(snap->time);
+    snap->ctrl_base = BE32(snap->ctrl_base);
+    snap->sdmac_rev = BE32(snap->sdmac_rev);
+    snap->wdc_khz   = BE16(snap->wdc_khz);
+    snap->wdc_valid = BE32(snap->wdc_valid);
+    for (pos = 0; pos < ARRAY_SIZE(snap->sdmac_l); pos++)
+        snap->sdmac_l[pos] = BE32(snap->sdmac_l[pos]);
+    for (pos = 0; pos < ARRAY_SIZE(snap->kbps); pos++)
+        snap->kbps[pos] = BE32(snap->kbps[pos]);
+}
+
+/*
+ * snap_take
+ * ---------
+ * Fills in the register state of a snapshot from the current controller.
+ * This is done before detection, which resets the WDC.
+ */
+static void
+snap_take(snap_t *snap, const char *label)
+{
+    struct DateStamp ds;
+    uint             pos;
+
+    memset(snap, 0, sizeof (*snap));
+    snap->magic   = SNAP_MAGIC;
+    snap->version = SNAP_VERSION;
+    snap->size    = sizeof (*snap);
+    DateStamp(&ds);
+    snap->time = ds.ds_Days * 86400 + ds.ds_Minute * 60 + ds.ds_Tick / 50;
+    if (label != NULL)
+        strncpy(snap->label, label, sizeof (snap->label) - 1);
+    snap->ctrl_base = ctrl->base;
+    snap->ctrl_type = ctrl->type;
+
+    if (ctrl->type == CTRL_A3000) {
+        snap->ramsey_ver  = get_ramsey_version();
+        snap->ramsey_ctrl = get_ramsey_control();
+        get_raw_regs();
+        memcpy(snap->sdmac_b, regs_b, sizeof (snap->sdmac_b));
+#ifdef DUMP_WORDS_AND_LONGS
+        memcpy(snap->sdmac_l, regs_l, sizeof (snap->sdmac_l));
+#endif
+    }
+
+    for (pos = 0; pos < ARRAY_SIZE(wd_reglist); pos++) {
+        uint addr = wd_reglist[pos].addr;
+        INTERRUPTS_DISABLE();
+        /* Same rules as show_regs(): avoid reads with side effects */
+        if ((wd_reglist[pos].type != WO) && (addr != WDC_DATA) &&
+            ((addr != WDC_SCSI_STAT) ||
+             ((get_wdc_reg(WDC_AUXST) & WDC_AUXST_INT) == 0))) {
+            snap->wdc[addr] = get_wdc_reg(addr);
+            snap->wdc_valid |= BIT(addr);
+        }
+        INTERRUPTS_ENABLE();
+    }
+}
+
+/*
+ * snap_write
+ * ----------
+ * Adds the results of the preceding show_*() detection calls and, for
+ * a WD33C93B, the extended registers to the snapshot, and appends it to
+ * the file.
+ */
+static int
+snap_write(const char *filename, snap_t *snap)
+{
+    FILE *fp;
+
+    snap->sdmac_version = sdmac_version;
+    snap->sdmac_rev     = sdmac_version_rev;
+    snap->wd_level      = wd_level;
+    snap->wd_microcode  = wd_microcode;
+    snap->wdc_khz       = wdc_khz;
+    memcpy(snap->drive, bench_result_drive, sizeof (snap->drive));
+    memcpy(snap->kbps, bench_result_kbps, sizeof (snap->kbps));
+
+    /* Only a WD33C93B supports GET_REGISTER */
+    if ((wd_level == LEVEL_WD33C93B) &&
+        (get_wdc_regs_extended(0x40, sizeof (snap->ext), snap->ext) == 0)) {
+        snap->ext_valid = 1;
+    }
+
+    fp = fopen(filename, "ab");
+    if (fp == NULL) {
+        printf("Failed to open %s\n", filename);
+        return (1);
+    }
+    snap_order(snap);
+    if (fwrite(snap, sizeof (*snap), 1, fp) != 1) {
+        snap_order(snap);
+        printf("Failed to write %s\n", filename);
+        fclose(fp);
+        return (1);
+    }
+    snap_order(snap);
+    fclose(fp);
+    printf("Snapshot appended to %s\n", filename);
+    return (0);
+}
+
+static void
+snap_show_time(uint32_t secs)
+{
+    /* Civil date from days since 1978-01-01, which is 2922 days after 1970 */
+    uint32_t days = secs / 86400 + 2922 + 719468;
+    uint32_t era  = days / 146097;
+    uint32_t doe  = days - era * 146097;
+    uint32_t yoe  = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    uint32_t doy  = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    uint32_t mp   = (5 * doy + 2) / 153;
+    uint32_t day  = doy - (153 * mp + 2) / 5 + 1;
+    uint32_t mon  = (mp < 10) ? mp + 3 : mp - 9;
+    uint32_t year = yoe + era * 400 + (mon <= 2);
+
+    printf("%04u-%02u-%02u %02u:%02u:%02u", year, mon, day,
+           (secs / 3600) % 24, (secs / 60) % 60, secs % 60);
+}
+
+static const char *
+snap_wd_name(uint level)
+{
+    switch (level) {
+        case LEVEL_WD33C93:
+            return ("WD33C93");
+        case LEVEL_WD33C93A:
+            return ("WD33C93A");
+        case LEVEL_WD33C93B:
+            return ("WD33C93B");
+        default:
+            return ("Not detected");
+    }
+}
+
+/* One line summary of a snapshot */
+static void
+snap_show_brief(const snap_t *snap)
+{
+    snap_show_time(snap->time);
+    printf(" %-16s %-14s", snap->label,
+           (snap->ctrl_type < ARRAY_SIZE(ctrl_types)) ?
+           ctrl_types[snap->ctrl_type].name : "?");
+    if (snap->ctrl_type == CTRL_A3000)
+        printf(" Ramsey $%02x SDMAC-%02u", snap->ramsey_ver,
+               snap->sdmac_version);
+    printf(" %s", snap_wd_name(snap->wd_level));
+    if (snap->wd_level >= LEVEL_WD33C93A)
+        printf(" mc %02x", snap->wd_microcode);
+    if (snap->wdc_khz >= 1000)
+        printf(" %u.%u MHz", snap->wdc_khz / 1000, (snap->wdc_khz % 1000) / 100);
+    printf("\n");
+}
+
+/* Full register decode of a snapshot, as -r would show it */
+static void
+snap_show(const snap_t *snap)
+{
+    uint pos;
+
+    snap_show_brief(snap);
+    if (snap->ctrl_type == CTRL_A3000) {
+        printf("Ramsey control $%02x\n", snap->ramsey_ctrl);
+        printf("\nREG VALUE    NAME           DESCRIPTION\n");
+        for (pos = 0; pos < ARRAY_SIZE(sdmac_reglist); pos++) {
+            const reglist_t *reg = &sdmac_reglist[pos];
+            uint             off = reg->addr - SDMAC_BASE;
+            uint32_t         value;
+
+            if ((reg->type == WO) || (off >= sizeof (snap->sdmac_b)))
+                continue;  // Ramsey registers are outside the window
+            if (reg->width == LONG)
+                value = snap->sdmac_l[off / 4];
+            else
+                value = snap->sdmac_b[off];
+            printf(" %02x %0*x%*s %-14s %s", off, reg->width * 2, value,
+                   8 - reg->width * 2, "", reg->name, reg->desc);
+            if (reg->addr == SDMAC_ISTR)
+                decode_sdmac_istr(value);
+            printf("\n");
+        }
+    }
+    printf("REG VALUE    NAME           DESCRIPTION\n");
+    for (pos = 0; pos < ARRAY_SIZE(wd_reglist); pos++) {
+        uint addr = wd_reglist[pos].addr;
+        show_wdc_pos(pos, (snap->wdc_valid & BIT(addr)) ? snap->wdc[addr] :
+                                                         0x100);
+    }
+    if (snap->ext_valid) {
+        printf("WDC extended registers 40-ff");
+        for (pos = 0; pos < sizeof (snap->ext); pos++) {
+            if ((pos & 0xf) == 0)
+                printf("\n%02x:", pos + 0x40);
+            printf(" %02x", snap->ext[pos]);
+        }
+        printf("\n");
+    }
+    if (snap->kbps[2] != 0) {
+        printf("Read KB/s of %.*s: CMD_READ %u, HD_SCSICMD %u, direct %u\n",
+               SNAP_DRIVE, snap->drive, snap->kbps[0], snap->kbps[1],
+               snap->kbps[2]);
+    }
+}
+
+#ifdef SDMAC_HOST_TEST
+uint8_t *host_map_file(const char *filename, long *len);
+void     host_unmap_file(uint8_t *buf, long len);
+#endif
+
+/*
+ * snap_load
+ * ---------
+ * Reads a whole snapshot file into memory, or on a Linux host maps it,
+ * so a large collection streams through the page cache. Returns NULL on
+ * failure. The buffer is released with snap_unload().
+ */
+static uint8_t *
+snap_load(const char *filename, long *len)
+{
+#ifdef SDMAC_HOST_TEST
+    uint8_t *buf = host_map_file(filename, len);
+    if (buf == NULL)
+        printf("Failed to open %s\n", filename);
+    return (buf);
+#else
+    uint8_t *buf;
+    FILE    *fp = fopen(filename, "rb");
+
+    if (fp == NULL) {
+        printf("Failed to open %s\n", filename);
+        return (NULL);
+    }
+    fseek(fp, 0, SEEK_END);
+    *len = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    buf = malloc(*len + 1);
+    if ((buf == NULL) || (fread(buf, 1, *len, fp) != (size_t) *len)) {
+        printf("Failed to read %s\n", filename);
+        free(buf);
+        buf = NULL;
+    }
+    fclose(fp);
+    return (buf);
+#endif
+}
+
+static void
+snap_unload(uint8_t *buf, long len)
+{
+#ifdef SDMAC_HOST_TEST
+    host_unmap_file(buf, len);
+#else
+    (void) len;
+    free(buf);
+#endif
+}
+
+/*
+ * snap_next
+ * ---------
+ * Copies the record at *off into snap and advances *off. Records from
+ * older versions are shorter; their missing fields read as zero. Newer
+ * records are truncated to the fields known here. Returns 1 if a record
+ * was returned, 0 at end of buffer, or -1 if the data is not a snapshot.
+ * The size field is only trusted once the magic matches, and must be
+ * even so that the next record stays word aligned for the 68000.
+ */
+static int
+snap_next(const uint8_t *buf, long len, long *off, snap_t *snap)
+{
+    const snap_t *rec = (const snap_t *) (buf + *off);
+    uint          size;
+
+    if (*off == len)
+        return (0);
+    if ((*off + (long) SNAP_MIN_SIZE > len) ||
+        (BE32(rec->magic) != SNAP_MAGIC))
+        return (-1);
+    size = BE16(rec->size);
+    if ((size < SNAP_MIN_SIZE) || (size & 1) || (*off + (long) size > len))
+        return (-1);
+    memset(snap, 0, sizeof (*snap));
+    memcpy(snap, rec, (size < sizeof (*snap)) ? size : sizeof (*snap));
+    snap_order(snap);
+    *off += size;
+    return (1);
+}
+
+/*
+ * snap_decode
+ * -----------
+ * Decodes every snapshot in each file. Each file is read into memory
+ * whole and walked record by record; records from a newer version of
+ * the tool are skipped by their size field. With brief set, only one
+ * line per snapshot is shown, followed by counts of each distinct
+ * chip combination.
+ */
+static int
+snap_decode(char **files, uint nfiles, uint brief)
+{
+    static struct {
+        uint8_t  ctrl_type;
+        uint8_t  sdmac_version;
+        uint8_t  wd_level;
+        uint8_t  wd_microcode;
+        uint32_t count;
+    } combos[32];
+    uint ncombos = 0;
+    uint total = 0;
+    uint file;
+    int  rc = 0;
+
+    for (file = 0; file < nfiles; file++) {
+        snap_t        rec;
+        const snap_t *snap = &rec;
+        long          len;
+        long          off = 0;
+        int           got;
+        uint8_t      *buf = snap_load(files[file], &len);
+
+        if (buf == NULL) {
+            rc = 1;
+            continue;
+        }
+        while ((got = snap_next(buf, len, &off, &rec)) > 0) {
+            uint pos;
+
+            total++;
+            if (brief) {
+                snap_show_brief(snap);
+            } else {
+                printf("%s%s #%u: ", (total == 1) ? "" : "\n",
+                       files[file], total);
+                snap_show(snap);
+            }
+
+            for (pos = 0; pos < ncombos; pos++) {
+                if ((combos[pos].ctrl_type == snap->ctrl_type) &&
+                    (combos[pos].sdmac_version == snap->sdmac_version) &&
+                    (combos[pos].wd_level == snap->wd_level) &&
+                    (combos[pos].wd_microcode == snap->wd_microcode))
+                    break;
+            }
+            if ((pos == ncombos) && (ncombos < ARRAY_SIZE(combos))) {
+                combos[pos].ctrl_type     = snap->ctrl_type;
+                combos[pos].sdmac_version = snap->sdmac_version;
+                combos[pos].wd_level      = snap->wd_level;
+                combos[pos].wd_microcode  = snap->wd_microcode;
+                combos[pos].count         = 0;
+                ncombos++;
+            }
+            if (pos < ncombos)
+                combos[pos].count++;
+        }
+        if (got < 0) {
+            printf("%s: bad snapshot at offset %ld\n", files[file], off);
+            rc = 1;
+        }
+        snap_unload(buf, len);
+    }
+
+    if (brief && (total != 0)) {
+        uint pos;
+        printf("\n%u snapshots\n   COUNT CONTROLLER     SDMAC WDC\n", total);
+        for (pos = 0; pos < ncombos; pos++) {
+            printf("%8u %-14s %5u %s", combos[pos].count,
+                   (combos[pos].ctrl_type < ARRAY_SIZE(ctrl_types)) ?
+                   ctrl_types[combos[pos].ctrl_type].name : "?",
+                   combos[pos].sdmac_version,
+                   snap_wd_name(combos[pos].wd_level));
+            if (combos[pos].wd_level >= LEVEL_WD33C93A)
+                printf(" mc %02x", combos[pos].wd_microcode);
+            printf("\n");
+        }
+    }
+    return (rc);
+}
+
+/*
+ * Snapshot queries
+ *
+ * -Q groups the snapshots in any number of files by one key and shows,
+ * for each group, the number of snapshots and the median read speed of
+ * each -b path among the snapshots which include a benchmark. Keys are
+ * "ramsey", "sdmac", "wdc" (part and microcode), "clock", and "drive".
+ */
+#define QUERY_MAX_GROUPS 64
+
+typedef struct {
+    char      name[SNAP_DRIVE + 1];
+    uint      count;
+    uint      nkbps[ARRAY_SIZE(bench_result_kbps)];
+    uint32_t *kbps[ARRAY_SIZE(bench_result_kbps)];
+} query_group_t;
+
+static int
+query_key(const snap_t *snap, const char *key, char *name, uint len)
+{
+    if (strcmp(key, "ramsey") == 0) {
+        if (snap->ctrl_type != CTRL_A3000)
+            snprintf(name, len, "none");
+        else
+            snprintf(name, len, "$%02x", snap->ramsey_ver);
+    } else if (strcmp(key, "sdmac") == 0) {
+        if (snap->ctrl_type != CTRL_A3000)
+            snprintf(name, len, "%s",
+                     (snap->ctrl_type < ARRAY_SIZE(ctrl_types)) ?
+                     ctrl_types[snap->ctrl_type].name : "?");
+        else if ((snap->sdmac_rev >> 24) == 'v')
+            snprintf(name, len, "SDMAC-%02u %c%c%c%c", snap->sdmac_version,
+                     (char) (snap->sdmac_rev >> 24),
+                     (char) (snap->sdmac_rev >> 16),
+                     (char) (snap->sdmac_rev >> 8), (char) snap->sdmac_rev);
+        else
+            snprintf(name, len, "SDMAC-%02u", snap->sdmac_version);
+    } else if (strcmp(key, "wdc") == 0) {
+        if (snap->wd_level >= LEVEL_WD33C93A)
+            snprintf(name, len, "%s mc %02x", snap_wd_name(snap->wd_level),
+                     snap->wd_microcode);
+        else
+            snprintf(name, len, "%s", snap_wd_name(snap->wd_level));
+    } else if (strcmp(key, "clock") == 0) {
+        snprintf(name, len, "%u.%u MHz", snap->wdc_khz / 1000,
+                 (snap->wdc_khz % 1000) / 100);
+    } else if (strcmp(key, "drive") == 0) {
+        snprintf(name, len, "%.*s", SNAP_DRIVE,
+                 (snap->drive[0] != '\0') ? snap->drive : "unknown");
+    } else {
+        return (1);
+    }
+    return (0);
+}
+
+static int
+query_add(query_group_t *grp, uint path, uint32_t kbps)
+{
+    uint32_t *vals = realloc(grp->kbps[path],
+                             (grp->nkbps[path] + 1) * sizeof (*vals));
+    if (vals == NULL)
+        return (1);
+    vals[grp->nkbps[path]++] = kbps;
+    grp->kbps[path] = vals;
+    return (0);
+}
+
+/*
+ * query_group
+ * -----------
+ * Counts a snapshot in the group for its key, adding the group if it is
+ * new. Returns 1 on failure, which has been reported.
+ */
+static int
+query_group(query_group_t *grps, uint *ngrps, const snap_t *snap,
+            const char *key)
+{
+    char name[SNAP_DRIVE + 1];
+    uint pos;
+    uint path;
+
+    query_key(snap, key, name, sizeof (name));
+    for (pos = 0; pos < *ngrps; pos++)
+        if (strcmp(grps[pos].name, name) == 0)
+            break;
+    if (pos == *ngrps) {
+        if (*ngrps == QUERY_MAX_GROUPS) {
+            printf("More than %u groups\n", QUERY_MAX_GROUPS);
+            return (1);
+        }
+        strcpy(grps[(*ngrps)++].name, name);
+    }
+    grps[pos].count++;
+    for (path = 0; path < ARRAY_SIZE(snap->kbps); path++) {
+        if ((snap->kbps[path] != 0) &&
+            query_add(&grps[pos], path, snap->kbps[path])) {
+            printf("Out of memory\n");
+            return (1);
+        }
+    }
+    return (0);
+}
+
+/*
+ * query_show
+ * ----------
+ * Shows the group sizes and median -b throughput, and frees the
+ * throughput samples.
+ */
+static void
+query_show(query_group_t *grps, uint ngrps, uint total, const char *key)
+{
+    uint pos;
+    uint path;
+
+    printf("%u snapshots by %s; median read KB/s (samples)\n", total, key);
+    printf("%-24s COUNT %-14s %-14s %-14s\n",
+           "", "CMD_READ", "HD_SCSICMD", "DIRECT DMA");
+    for (pos = 0; pos < ngrps; pos++) {
+        printf("%-24s %5u", grps[pos].name, grps[pos].count);
+        for (path = 0; path < ARRAY_SIZE(grps[pos].kbps); path++) {
+            uint n = grps[pos].nkbps[path];
+            if (n == 0) {
+                printf(" %-14s", "-");
+                continue;
+            }
+            qsort(grps[pos].kbps[path], n, sizeof (uint32_t), cmp_uint32);
+            printf(" %7u (%4u)", grps[pos].kbps[path][(n - 1) / 2], n);
+            free(grps[pos].kbps[path]);
+            grps[pos].kbps[path] = NULL;
+        }
+        printf("\n");
+    }
+}
+
+/* Checks a query key, reporting it if unknown. Returns 1 if unknown. */
+static int
+query_check_key(const char *key)
+{
+    snap_t snap;
+    char   name[SNAP_DRIVE + 1];
+
+    memset(&snap, 0, sizeof (snap));
+    if (query_key(&snap, key, name, sizeof (name))) {
+        printf("Unknown query key %s: use ramsey, sdmac, wdc, clock, or "
+               "drive\n", key);
+        return (1);
+    }
+    return (0);
+}
+
+/*
+ * snap_query
+ * ----------
+ * Groups all snapshots in the files by key and shows the group sizes
+ * and median -b throughput. host/sdmac-index answers the same queries
+ * from a prebuilt index.
+ */
+static int
+snap_query(const char *key, char **files, uint nfiles)
+{
+    query_group_t *grps;
+    snap_t         snap;
+    uint           ngrps = 0;
+    uint           total = 0;
+    uint           file;
+    int            rc = 0;
+
+    if (query_check_key(key))
+        return (1);
+    grps = calloc(QUERY_MAX_GROUPS, sizeof (*grps));
+    if (grps == NULL) {
+        printf("Failed to allocate query groups\n");
+        return (1);
+    }
+    for (file = 0; (file < nfiles) && (rc == 0); file++) {
+        long     len;
+        long     off = 0;
+        int      got;
+        uint8_t *buf = snap_load(files[file], &len);
+
+        if (buf == NULL) {
+            rc = 1;
+            break;
+        }
+        while ((got = snap_next(buf, len, &off, &snap)) > 0) {
+            if (query_group(grps, &ngrps, &snap, key)) {
+                rc = 1;
+                break;
+            }
+            total++;
+        }
+        if (got < 0) {
+            printf("%s: bad snapshot at offset %ld\n", files[file], off);
+            rc = 1;
+        }
+        snap_unload(buf, len);
+    }
+
+    query_show(grps, ngrps, total, key);
+    free(grps);
+    return (rc);
+}
+
+static uint32_t test_values[] = {
+    0x00000000, 0xffffffff, 0xa5a5a5a5, 0x5a5a5a5a, 0xc3c3c3c3, 0x3c3c3c3c,
+    0xd2d2d2d2, 0x2d2d2d2d, 0x4b4b4b4b, 0xb4b4b4b4, 0xe1e1e1e1, 0x1e1e1e1e,
+    0x87878787, 0x78787878, 0xffff0000, 0x0000ffff, 0xff00ff00, 0x00ff00ff,
+    0xf0f0f0f0, 0x0f0f0f0f,
+};
+
+static int
+test_sdmac_wtc(void)
+{
+    int errs = 0;
+    int pos;
+    uint32_t ovalue;
+    uint32_t rvalue;
+    uint32_t wvalue;
+
+    INTERRUPTS_DISABLE();
+    ovalue = *ADDR32(SDMAC_WTC_ALT);
+    for (pos = 0; pos < ARRAY_SIZE(test_values); pos++) {
+        wvalue = test_values[pos] & 0x00ffffff;
+        *ADDR32(SDMAC_WTC_ALT) = wvalue;
+//      (void) *ADDR32(ROM_BASE);  // flush bus access
+        (void) *ADDR32(RAMSEY_VER);
+        rvalue = *ADDR32(SDMAC_WTC) & 0x00ffffff;
+        if (rvalue != wvalue) {
+            *ADDR32(SDMAC_WTC_ALT) = ovalue;
+            INTERRUPTS_ENABLE();
+            if (errs++ == 0)
+                printf("FAIL\n");
+            printf("  SDMAC WTC %08x != expected %08x\n", rvalue, wvalue);
+            INTERRUPTS_DISABLE();
+            ovalue = *ADDR32(SDMAC_WTC_ALT);
+        }
+    }
+    *ADDR32(SDMAC_WTC_ALT) = ovalue;
+    INTERRUPTS_ENABLE();
+    return (errs);
+}
+
+static int
+test_sdmac_sspbdat(void)
+{
+    int errs = 0;
+    int pos;
+    uint32_t ovalue;
+    uint32_t rvalue;
+    uint32_t wvalue;
+
+    INTERRUPTS_DISABLE();
+    ovalue = *ADDR32(SDMAC_SSPBDAT);
+    for (pos = 0; pos < ARRAY_SIZE(test_values); pos++) {
+        wvalue = test_values[pos] & 0x000000ff;
+        *ADDR32(SDMAC_SSPBDAT_ALT) = wvalue;
+        (void) *ADDR32(ROM_BASE);  // flush bus access
+        rvalue = *ADDR32(SDMAC_SSPBDAT) & 0x000000ff;
+        if (rvalue != wvalue) {
+            *ADDR32(SDMAC_SSPBDAT_ALT) = ovalue;
+            INTERRUPTS_ENABLE();
+            if (errs++ == 0)
+                printf("FAIL\n");
+            printf("  SDMAC SSPBDAT %02x != expected %02x\n", rvalue, wvalue);
+            INTERRUPTS_DISABLE();
+            ovalue = *ADDR32(SDMAC_SSPBDAT);
+        }
+    }
+    *ADDR32(SDMAC_SSPBDAT_ALT) = ovalue;
+    INTERRUPTS_ENABLE();
+    return (errs);
+}
+
+static int
+test_ramsey_access(void)
+{
+    int pos;
+    uint32_t ovalue;
+    uint32_t wvalue;
+    uint32_t rvalue;
+    int errs = 0;
+
+    if (ctrl->type != CTRL_A3000)
+        return (0);
+
+    printf("Ramsey test:  ");
+    fflush(stdout);
+    SUPERVISOR_STATE_ENTER();
+    INTERRUPTS_DISABLE();
+    ovalue = *ADDR32(RAMSEY_ACR);
+    for (pos = 0; pos < ARRAY_SIZE(test_values); pos++) {
+        wvalue = test_values[pos] & 0xfffffffc;
+        *ADDR32(RAMSEY_ACR_ALT) = wvalue;
+        (void) *ADDR32(ROM_BASE);  // flush bus access
+        rvalue = *ADDR32(RAMSEY_ACR);
+        if (rvalue != wvalue) {
+            *ADDR32(RAMSEY_ACR_ALT) = ovalue;
+            INTERRUPTS_ENABLE();
+            if (errs++ == 0)
+                printf("FAIL\n");
+            printf("  Ramsey ACR %08x != expected %08x\n", rvalue, wvalue);
+            INTERRUPTS_DISABLE();
+            ovalue = *ADDR32(RAMSEY_ACR);
+        }
+    }
+    *ADDR32(RAMSEY_ACR_ALT) = ovalue;
+    INTERRUPTS_ENABLE();
+    SUPERVISOR_STATE_EXIT();
+    if (errs == 0)
+        printf("PASS\n");
+    return (errs);
+}
+
+static int
+test_sdmac_access(void)
+{
+    int errs = 0;
+
+    if (ctrl->type != CTRL_A3000)
+        return (0);
+
+    printf("SDMAC test:   ");
+    fflush(stdout);
+
+    switch (sdmac_version) {
+        case 2:
+            errs = test_sdmac_wtc();
+            break;
+        case 4:
+            errs = test_sdmac_sspbdat();
+            break;
+    }
+
+    if (errs == 0)
+        printf("PASS\n");
+
+    return (errs);
+}
+
+static int
+test_wdc_access(void)
+{
+    int pos;
+    uint8_t ovalue;
+    uint8_t wvalue;
+    uint8_t rvalue = 0;
+    uint8_t covalue;
+    uint8_t crvalue;
+    int errs = 0;
+
+    printf("WDC test:     ");
+    fflush(stdout);
+
+    /* WDC_LADDR0 should be fully writable */
+    INTERRUPTS_DISABLE();
+    scsi_wait_cip();
+    covalue = get_wdc_reg(WDC_CONTROL);
+    ovalue = get_wdc_reg(WDC_LADDR0);
+    for (pos = 0; pos < ARRAY_SIZE(test_values); pos++) {
+        wvalue = test_values[pos] & 0x000000ff;
+        set_wdc_reg(WDC_LADDR0, wvalue);
+        (void) *ADDR32(ROM_BASE);  // flush bus access
+        crvalue = get_wdc_reg(WDC_CONTROL);
+        if (crvalue != covalue) {
+            INTERRUPTS_ENABLE();
+            if (errs++ == 0)
+                printf("FAIL\n");
+            printf("  WDC_CONTROL %02x != expected %02x\n", crvalue, covalue);
+            INTERRUPTS_DISABLE();
+        }
+        rvalue = get_wdc_reg(WDC_LADDR0);
+        if (rvalue != wvalue) {
+            set_wdc_reg(WDC_LADDR0, ovalue);
+            INTERRUPTS_ENABLE();
+            if (errs++ == 0)
+                printf("FAIL\n");
+            printf("  WDC_LADDR0 %02x != expected %02x\n", rvalue, wvalue);
+            INTERRUPTS_DISABLE();
+            scsi_wait_cip();
+            ovalue = get_wdc_reg(WDC_LADDR0);
+        }
+        if (errs > 6)
+            break;
+    }
+    set_wdc_reg(WDC_LADDR0, ovalue);
+    INTERRUPTS_ENABLE();
+
+    /* WDC_AUXST should be read-only */
+    INTERRUPTS_DISABLE();
+    scsi_wait_cip();
+    covalue = get_wdc_reg(WDC_CONTROL);
+    ovalue = get_wdc_reg(WDC_AUXST);
+    for (pos = 0; pos < ARRAY_SIZE(test_values); pos++) {
+        wvalue = test_values[pos] & 0x000000ff;
+        set_wdc_reg(WDC_AUXST, wvalue);
+        (void) *ADDR32(ROM_BASE);  // flush bus access
+        crvalue = get_wdc_reg(WDC_CONTROL);
+        if (crvalue != covalue) {
+            INTERRUPTS_ENABLE();
+            if (errs++ == 0)
+                printf("FAIL\n");
+            printf("  WDC_CONTROL %02x != expected %02x\n", crvalue, covalue);
+            INTERRUPTS_DISABLE();
+            scsi_wait_cip();
+        }
+        rvalue = get_wdc_reg(WDC_AUXST);
+        if (rvalue != ovalue) {
+            set_wdc_reg(WDC_AUXST, ovalue);
+            INTERRUPTS_ENABLE();
+            if (errs++ == 0)
+                printf("FAIL\n");
+            printf("  WDC_AUXST  %02x != expected %02x when %02x written\n",
+                   rvalue, ovalue, wvalue);
+            INTERRUPTS_DISABLE();
+            scsi_wait_cip();
+            ovalue = get_wdc_reg(WDC_AUXST);
+        }
+        if (errs > 6)
+            break;
+    }
+    set_wdc_reg(WDC_AUXST, ovalue);
+    INTERRUPTS_ENABLE();
+
+    /* Undefined WDC register should be read-only and always 0xff */
+    INTERRUPTS_DISABLE();
+    scsi_wait_cip();
+    covalue = get_wdc_reg(WDC_CONTROL);
+    ovalue = get_wdc_reg(WDC_INVALID_REG);
+    for (pos = 0; pos < ARRAY_SIZE(test_values); pos++) {
+        wvalue = test_values[pos] & 0x000000ff;
+        set_wdc_reg(WDC_INVALID_REG, wvalue);
+        (void) *ADDR32(ROM_BASE);  // flush bus access
+        crvalue = get_wdc_reg(WDC_CONTROL);
+        if (crvalue != covalue) {
+            INTERRUPTS_ENABLE();
+            if (errs++ == 0)
+                printf("FAIL\n");
+            printf("  WDC_CONTROL %02x != expected %02x\n", crvalue, covalue);
+            INTERRUPTS_DISABLE();
+            scsi_wait_cip();
+        }
+        rvalue = get_wdc_reg(WDC_INVALID_REG);
+        if (rvalue != ovalue) {
+            set_wdc_reg(WDC_INVALID_REG, ovalue);
+            INTERRUPTS_ENABLE();
+            if (errs++ == 0)
+                printf("FAIL\n");
+            printf("  WDC Reg 0x1e %02x != expected %02x when %02x written\n",
+                   rvalue, ovalue, wvalue);
+            INTERRUPTS_DISABLE();
+            scsi_wait_cip();
+            ovalue = get_wdc_reg(WDC_INVALID_REG);
+        }
+        if (errs > 6)
+            break;
+    }
+    set_wdc_reg(WDC_INVALID_REG, ovalue);
+    INTERRUPTS_ENABLE();
+    if (rvalue != 0xff) {
+        if (errs++ == 0)
+            printf("FAIL\n");
+        printf("  WDC Reg 0x%02x %02x != expected 0xff\n",
+               WDC_INVALID_REG, rvalue);
+    }
+
+    if (errs == 0)
+        printf("PASS\n");
+    return (errs);
+}
+
+/*
+ * wdc_index_check
+ * ---------------
+ * Checks WDC register access through the current index method against
+ * register values read with the byte method. Registers are first only
+ * read, so a method which does not set the index can not write data to
+ * the wrong register. Then WDC_LADDR0 and WDC_LADDR1 are written with
+ * different patterns and read back, and WDC_CONTROL must not change.
+ * Returns 0 if every access matched.
+ */
+static int
+wdc_index_check(const uint8_t *expect)
+{
+    static const uint8_t regs[] = {
+        WDC_OWN_ID, WDC_CONTROL, WDC_TPERIOD, WDC_LADDR0, WDC_LADDR1
+    };
+    uint pos;
+    int  errs = 0;
+
+    for (pos = 0; pos < ARRAY_SIZE(regs); pos++)
+        if (get_wdc_reg(regs[pos]) != expect[pos])
+            return (1);
+
+    for (pos = 0; pos < ARRAY_SIZE(test_values); pos++) {
+        uint8_t value = test_values[pos];
+        set_wdc_reg(WDC_LADDR0, value);
+        set_wdc_reg(WDC_LADDR1, value ^ 0x5a);
+        (void) BUS_READ32(ROM_BASE);  // flush bus access
+        if ((get_wdc_reg(WDC_LADDR0) != value) ||
+            (get_wdc_reg(WDC_LADDR1) != (uint8_t) (value ^ 0x5a)) ||
+            (get_wdc_reg(WDC_CONTROL) != expect[1])) {
+            errs++;
+            break;
+        }
+    }
+    return (errs);
+}
+
+/*
+ * wdc_index_select
+ * ----------------
+ * Times each WDC index access method which passes wdc_index_check() and
+ * selects the fastest. The byte method is kept if none pass, or if
+ * scsi.device is using the WDC, since the check writes LADDR0/1. AUXST
+ * is polled only once, rather than waiting for the WDC with interrupts
+ * disabled, as this runs before every test.
+ */
+#define WDC_INDEX_TIMED 500  // get_wdc_reg() calls timed per method
+
+static void
+wdc_index_select(void)
+{
+    uint8_t  expect[5];
+    uint     efreq = get_eclock_freq();
+    uint     method;
+    uint     best = WDC_INDEX_BYTE;
+    uint     pos;
+
+    memset(wdc_index_ns, 0, sizeof (wdc_index_ns));
+    wdc_index_method = WDC_INDEX_BYTE;
+    if (ctrl->type != CTRL_A3000)
+        return;
+
+    INTERRUPTS_DISABLE();
+    if (get_wdc_reg(WDC_AUXST) & WDC_AUXST_OWNED) {
+        /* A command is running or its status is pending */
+        INTERRUPTS_ENABLE();
+        return;
+    }
+    expect[0] = get_wdc_reg(WDC_OWN_ID);
+    expect[1] = get_wdc_reg(WDC_CONTROL);
+    expect[2] = get_wdc_reg(WDC_TPERIOD);
+    expect[3] = get_wdc_reg(WDC_LADDR0);
+    expect[4] = get_wdc_reg(WDC_LADDR1);
+
+    for (method = 0; method < ARRAY_SIZE(wdc_index_names); method++) {
+        uint16_t start;
+        uint16_t ticks;
+        int      failed;
+
+        wdc_index_method = method;
+        failed = wdc_index_check(expect);
+
+        /* Undo the pattern writes using the method known to work */
+        wdc_index_method = WDC_INDEX_BYTE;
+        set_wdc_reg(WDC_LADDR0, expect[3]);
+        set_wdc_reg(WDC_LADDR1, expect[4]);
+        if (failed)
+            continue;
+
+        wdc_index_method = method;
+        start = cia_ticks();
+        for (pos = 0; pos < WDC_INDEX_TIMED; pos++)
+            (void) get_wdc_reg(WDC_LADDR0);
+        ticks = start - cia_ticks();
+        wdc_index_ns[method] = (uint) ((uint64_t) ticks * 1000000000 /
+                                       efreq / WDC_INDEX_TIMED);
+        if (wdc_index_ns[method] == 0)
+            wdc_index_ns[method] = 1;
+        if ((wdc_index_ns[best] == 0) ||
+            (wdc_index_ns[method] < wdc_index_ns[best]))
+            best = method;
+    }
+    wdc_index_method = best;
+    INTERRUPTS_ENABLE();
+}
+
+static void
+scsi_set_transfer_len(uint len)
+{
+    set_wdc_reg24(WDC_TCOUNT2, len);
+}
+
+static uint8_t
+scsi_select(uint8_t target)
+{
+    uint8_t sstat = 0;
+    uint    auxst;
+//  uint    xfer_dir = WDC_DST_ID_DPD;  // read from device
+    uint    xfer_dir = 0;  // write to device
+
+    set_wdc_reg(WDC_DST_ID, (target & 0xf) | xfer_dir);
+    set_wdc_reg(WDC_SRC_ID, 0);
+    set_wdc_reg(WDC_LUN, target >> 8);
+    set_wdc_reg(WDC_SYNC_TX, 0);  // async
+
+    set_wdc_reg(WDC_TPERIOD, SBIC_TIMEOUT(SCSI_SEL_MSEC));
+//  scsi_set_transfer_len(6);    // WD will get count after select
+    scsi_set_transfer_len(0);    // WD will get count after select
+    set_wdc_reg(WDC_CMD, WDC_CMD_SELECT_WITH_ATN);
+
+    /* Wait for Command-In-Progress to clear */
+    auxst = scsi_wait_cip();
+    if (auxst == 0x100) {
+        printf("SS1  astat=%02x sstat=%02x",
+               get_wdc_reg(WDC_AUXST), get_wdc_reg(WDC_SCSI_STAT));
+        return (0xff);
+    }
+
+    /* Wait for Select to complete */
+    auxst = scsi_wait(WDC_AUXST_LCI | WDC_AUXST_INT, 1);
+    sstat = get_wdc_reg(WDC_SCSI_STAT);
+    INTERRUPTS_ENABLE();
+    if (auxst & 0x100)
+        printf("  timeout: no LCI or INT\n");
+    if (auxst & WDC_AUXST_PE)
+        printf("  ParityError:%02x\n", sstat);
+    if (auxst & WDC_AUXST_CIP)
+        printf("  CIP:%02x\n", sstat);
+    if (auxst & WDC_AUXST_LCI)
+        printf("  LCI:%02x\n", sstat);
+    if (auxst & WDC_AUXST_BSY)
+        printf("  BSY:%02x\n", sstat);
+    INTERRUPTS_DISABLE();
+    return (sstat);
+}
+
+#if 0
+static void
+scsi_disconnect(void)
+{
+    uint8_t auxst;
+
+    scsi_wait_cip();
+    set_wdc_reg(WDC_CMD, WDC_CMD_DISCONNECT);
+    scsi_wait_cip();
+
+    auxst = scsi_wait(WDC_AUXST_INT, 1);
+    if (auxst == 0x100)
+        printf("WDC timeout disconnect\n");
+    printf("  disconnect sstat=%02x\n", get_wdc_reg(WDC_SCSI_STAT));
+}
+
+static void
+scsi_disconnect_msg(void)
+{
+    set_wdc_reg(WDC_CMD, WDC_CMD_DISCONNECT_MSG);
+    cia_spin(10000);
+}
+#endif
+
+/*
+ * scsi_abort()
+ *
+ * XXX: According to the WD33C93A E062-B @9, the Abort command is
+ *      no longer supported in the initiator mode.
+ */
+void
+scsi_abort(void)
+{
+    uint auxst;
+    if (scsi_wait_cip() == 0x100) {
+        printf("SS1  astat=%02x sstat=%02x",
+               get_wdc_reg(WDC_AUXST), get_wdc_reg(WDC_SCSI_STAT));
+        return;
+    }
+    set_wdc_reg(WDC_CMD, WDC_CMD_ABORT);
+    auxst = scsi_wait_cip();
+    if (auxst != 0x100)
+        auxst = scsi_wait(WDC_AUXST_INT, 1);
+}
+
+#undef DEBUG_PROBE_SCSI
+
+static void
+scsi_set_cdb(void *ptr, uint len)
+{
+    uint pos;
+    uint8_t *ptr_b = (uint8_t *) ptr;
+
+    if (len >= 12) {
+        printf("Invalid CDB len %u\n", len);
+        return;
+    }
+    set_wdc_reg(WDC_OWN_ID, len);
+    for (pos = 0; pos < len; pos++)
+        set_wdc_reg(WDC_CDB1 + pos, *(ptr_b++));
+}
+
+static void
+scsi_transfer_start(uint phase)
+{
+    switch (phase) {
+        case WDC_PHASE_DATA_IN:
+        case WDC_PHASE_MESG_IN:
+#ifdef DEBUG_PROBE_SCSI
+            printf("  phase in %x\n", phase);
+#endif
+            set_wdc_reg(WDC_DST_ID,
+                        get_wdc_reg(WDC_DST_ID) | WDC_DST_ID_DPD);
+            break;
+        case WDC_PHASE_DATA_OUT:
+        case WDC_PHASE_MESG_OUT:
+        case WDC_PHASE_CMD:
+#ifdef DEBUG_PROBE_SCSI
+            printf("  phase out %x\n", phase);
+#endif
+            set_wdc_reg(WDC_DST_ID,
+                        get_wdc_reg(WDC_DST_ID) & ~WDC_DST_ID_DPD);
+            break;
+        default:
+            printf("Unknown phase %x\n", phase);
+    }
+}
+
+static int
+scsi_transfer_in(uint phase)
+{
+    uint timeout = 5000;
+    uint8_t auxst;
+    uint len = get_wdc_reg(WDC_OWN_ID);
+    uint count = 0;
+
+    printf("trans_in\n");
+    show_regs(0);
+    while (count < len) {
+        timeout = 50000;
+        auxst = get_wdc_reg(WDC_AUXST);
+        while ((auxst & WDC_AUXST_DBR) == 0) {
+            if ((auxst & WDC_AUXST_INT) || (timeout-- == 0)) {
+                printf("  WDC timeout in transfer_in, %u left: %02x\n",
+                       len - count, auxst);
+                return (-1);
+            }
+            if (auxst & WDC_AUXST_LCI) {
+                uint8_t sstat = get_wdc_reg(WDC_SCSI_STAT);
+                printf("LCI sstat=%02x\n", sstat);
+                return (-1);
+            }
+            cia_spin(10);
+            auxst = get_wdc_reg(WDC_AUXST);
+        }
+        count++;
+        printf(" %02x", get_wdc_reg(WDC_DATA));  // Pull data
+    }
+
+    printf(" [%02x %02x]\n", len, count);
+    return (len);
+}
+
+static int
+scsi_transfer_out(uint len, void *buf)
+{
+    uint8_t auxst;
+    uint8_t *bufptr = (uint8_t *) buf;
+    uint    timeout;
+
+    if (scsi_wait_cip() == 0x100) {
+        printf("STO1  astat=%02x sstat=%02x",
+               get_wdc_reg(WDC_AUXST), get_wdc_reg(WDC_SCSI_STAT));
+        return (-1);
+    }
+
+    /*
+     * The below read of AUXST and subsequent read of appears to be
+     * required. Otherwise, the WDC_CMD_TRANSFER_INFO will sometimes
+     * be ignored.
+     */
+    auxst = get_wdc_reg(WDC_AUXST);
+    if (auxst & WDC_AUXST_INT) {
+        (void) get_wdc_reg(WDC_SCSI_STAT);
+#ifdef DEBUG_PROBE_SCSI
+        printf("t_out auxst=%02x sstat=%02x\n",
+               auxst, get_wdc_reg(WDC_SCSI_STAT));
+#endif
+    }
+
+    /*
+     * The processor either should initialize the Transfer
+     * Count Register prior to issuing WDC_CMD_TRANSFER_INFO or
+     * issue the command with the SBT bit in the Command Register
+     * set. SBT = Single-byte Transfer (one byte is transferred)
+     */
+    set_wdc_reg(WDC_CONTROL, WDC_CONTROL_IDI | WDC_CONTROL_EDI);  // polled xfer
+//  scsi_set_transfer_len(len);    // WD will get count after select
+    set_wdc_reg(WDC_CMD, WDC_CMD_TRANSFER_INFO);
+    if (scsi_wait_cip() == 0x100) {
+        printf("STO2  astat=%02x sstat=%02x",
+               get_wdc_reg(WDC_AUXST), get_wdc_reg(WDC_SCSI_STAT));
+        return (-1);
+    }
+
+    while (len > 0) {
+        timeout = 5000;
+        auxst = get_wdc_reg(WDC_AUXST);
+        while ((auxst & WDC_AUXST_DBR) == 0) {
+            if ((auxst & WDC_AUXST_INT) || (timeout-- == 0)) {
+#ifdef DEBUG_PROBE_SCSI
+                printf("  WDC timeout in transfer_out, %u left: %02x\n",
+                       len, auxst);
+#endif
+                if (auxst & WDC_AUXST_LCI) {
+                    uint8_t sstat = get_wdc_reg(WDC_SCSI_STAT);
+                    printf("LCI sstat=%02x\n", sstat);
+                    return (-1);
+                }
+                return (len);
+            }
+            cia_spin(10);
+            auxst = get_wdc_reg(WDC_AUXST);
+        }
+        set_wdc_reg(WDC_DATA, *(bufptr++));  // Push data
+        len--;
+    }
+    return (len);
+}
+
+static int
+probe_scsi(void)
+{
+    int found = 0;
+    uint target;
+    uint8_t auxst;
+    uint8_t sstat;
+    uint8_t sstat2;
+    uint8_t sdmac_contr;
+
+    INTERRUPTS_DISABLE();
+    sdmac_contr = *CTRL_REG(ctrl->contr);
+    *CTRL_REG(ctrl->contr) = 0;  // Disable interrupts
+    INTERRUPTS_ENABLE();
+
+    scsi_soft_reset(0);
+    (void) get_wdc_reg(WDC_SCSI_STAT);  // clear reset status
+
+    scsi_test_unit_ready_t tur;
+    memset(&tur, 0, sizeof (tur));
+    tur.opcode = SCSI_TEST_UNIT_READY;
+
+    INTERRUPTS_DISABLE();
+    for (target = 0; target < 7; target++) {
+        uint8_t phase;
+        uint    cmdlen;
+        uint    present = 0;
+
+        if (scsi_wait_cip() == 0x100) {
+            printf("CIP%d  astat=%02x sstat=%02x", 0,
+                   get_wdc_reg(WDC_AUXST), get_wdc_reg(WDC_SCSI_STAT));
+            found = -1;
+            break;
+        }
+        sstat = get_wdc_reg(WDC_SCSI_STAT);
+        if (sstat & 0xe0) {
+            printf("odd sstat %02x\n", sstat);
+            found = -1;
+            break;
+        }
+        /* Disable WDC DMA mode */
+        set_wdc_reg(WDC_CONTROL, WDC_CONTROL_IDI | WDC_CONTROL_EDI);
+
+        cmdlen = sizeof (tur);
+        scsi_set_cdb(&tur, cmdlen);
+        scsi_set_transfer_len(0);
+        sstat = scsi_select(target);
+        sstat2 = get_wdc_reg(WDC_SCSI_STAT);
+
+        set_wdc_reg(WDC_SRC_ID, 0);  // Disable reselection
+
+        if (sstat == WDC_SSTAT_SEL_COMPLETE) {
+            uint timeout = 10;
+            while (sstat2 == sstat) {
+                cia_spin(10);
+                sstat2 = get_wdc_reg(WDC_SCSI_STAT);
+                if (--timeout == 0)
+                    break;
+            }
+            if (timeout == 0) {
+                printf("timeout: sstat=%02x sstat2=%02x\n", sstat, sstat2);
+                found = -1;
+                break;
+            }
+            phase  = sstat2 & 0x07;  // phase bits of status
+            present = 1;
+            found++;
+#ifdef DEBUG_PROBE_SCSI
+            printf("  sstat2=%02x astat=%02x\n",
+                   sstat2, get_wdc_reg(WDC_AUXST));
+#endif
+            if (scsi_wait_cip() == 0x100) {
+                printf("CIP%d  astat=%02x sstat=%02x", 1,
+                       get_wdc_reg(WDC_AUXST), get_wdc_reg(WDC_SCSI_STAT));
+                found = -1;
+                break;
+            }
+
+            /* Set up transfer */
+            set_wdc_reg(WDC_DST_ID, target & 0x7);
+            scsi_transfer_start(phase);
+
+            /* Delay and then check for interrupt */
+            if (scsi_wait_cip() == 0x100) {
+                printf("CIP%d  astat=%02x sstat=%02x", 2,
+                       get_wdc_reg(WDC_AUXST), get_wdc_reg(WDC_SCSI_STAT));
+                found = -1;
+                break;
+            }
+            (void) get_wdc_reg(WDC_AUXST);
+            (void) get_wdc_reg(WDC_AUXST);
+            (void) get_wdc_reg(WDC_AUXST);
+            auxst = get_wdc_reg(WDC_AUXST);
+            if (auxst & WDC_AUXST_INT) {
+                /* Clear pending interrupt */
+                (void) get_wdc_reg(WDC_SCSI_STAT);
+            }
+            if (auxst & WDC_AUXST_LCI) {
+                printf("LCI during SCSI transfter start: %02x\n",
+                       get_wdc_reg(WDC_SCSI_STAT));
+                found = -1;
+                break;
+            }
+            if ((phase == WDC_PHASE_DATA_IN) || (phase == WDC_PHASE_MESG_IN)) {
+                if (scsi_transfer_in(phase) <= 0) {
+                    printf("phase=%02x sstat=%02x sstat2=%02x\n",
+                           phase, sstat, sstat2);
+                    found = -1;
+                    break;
+                }
+            } else if (scsi_transfer_out(cmdlen, &tur) <= 0) {
+                found = -1;
+                break;
+            }
+            set_wdc_reg(WDC_CONTROL, WDC_CONTROL_IDI | WDC_CONTROL_EDI);
+            scsi_abort();
+        } else if (sstat == WDC_SSTAT_SEL_TIMEOUT) {
+            present = 0;
+        } else {
+            printf("  Unexpected SCSI STAT sstat=%02x %02x\n", sstat, sstat2);
+            found = -1;
+            break;
+        }
+
+        if (scsi_wait_cip() == 0x100) {
+            printf("CIP%d  astat=%02x sstat=%02x", 3,
+                   get_wdc_reg(WDC_AUXST), get_wdc_reg(WDC_SCSI_STAT));
+            found = -1;
+            break;
+        }
+        scsi_soft_reset(0);
+        if (scsi_wait_cip() == 0x100) {
+            printf("CIP%d  astat=%02x sstat=%02x", 4,
+                   get_wdc_reg(WDC_AUXST), get_wdc_reg(WDC_SCSI_STAT));
+            found = -1;
+            break;
+        }
+        (void) get_wdc_reg(WDC_SCSI_STAT);  // clear reset status
+
+        dmac_clear_int();  // Clear pending interrupts
+
+        if (is_user_abort()) {
+            printf("^C Abort\n");
+            found = -1;
+            break;
+        }
+        INTERRUPTS_ENABLE();
+#ifdef DEBUG_PROBE_SCSI
+        printf("%u %s sstat=%02x phase=%x\n",
+               target, present ? "present" : "no response", sstat, phase);
+#else
+        printf("  %u %s\n", target, present ? "present" : "no response");
+#endif
+        INTERRUPTS_DISABLE();
+    }
+#ifdef DEBUG_PROBE_SCSI
+    printf("auxst=%02x\n", get_wdc_reg(WDC_AUXST));
+    printf("sstat=%02x\n", get_wdc_reg(WDC_SCSI_STAT));
+    if (ctrl->istr != 0)
+        printf("istr=%02x\n", *CTRL_REG(ctrl->istr));
+#endif
+    dmac_clear_int();                      // Clear interrupt
+    *CTRL_REG(ctrl->contr) = sdmac_contr;  // Restore interrupts
+    INTERRUPTS_ENABLE();
+    if (found == 0) {
+        printf("No device found\n");
+        return (1);
+    }
+    if (found == -1)
+        return (1);
+    return (0);
+}
+
+/*
+ * Interrupt latency measurement
+ *
+ * A select of our own ID with a minimal timeout period is used to make
+ * the WDC raise an interrupt a few milliseconds after the command is
+ * issued. Two passes are made for every sample:
+ *
+ * Polled pass (interrupts disabled):
+ *     Both WDC AUXST and DMAC ISTR are polled to time when the WDC
+ *     raised INT and how long until the DMAC reflected it. The time from
+ *     command issue to WDC INT is also recorded.
+ * Interrupt pass:
+ *     A level 2 (PORTS) interrupt server is installed and DMAC interrupts
+ *     are enabled. The server timestamps its entry and signals the task,
+ *     which timestamps its wakeup. Since the WDC INT can't be observed
+ *     directly in this pass, its time is estimated as the command issue
+ *     time plus the median issue-to-INT time from the polled pass.
+ *
+ * The measurement is done with the system idle and again with a task
+ * at the same priority copying memory in a loop. Samples are summarized
+ * in a stat_t as they are taken, so the sample count costs no memory.
+ * -d adds a histogram of each latency.
+ */
+#define LAT_SAMPLES     256
+#define LAT_WAIT_MSEC   1000  // Interrupt pass wait for each command
+#define LAT_LOAD_BUFSIZ 16384
+#define LAT_LOAD_STACK  4096
+
+typedef struct {
+    struct Task      *task;     // Task to signal
+    ULONG             sigmask;  // Signal to send
+    volatile uint16_t ticks;    // cia_ticks() at server entry
+    volatile uint8_t  sstat;    // WDC SCSI status read by server
+    volatile uint8_t  fired;    // Server has handled the interrupt
+    volatile uint8_t  armed;    // Our command is outstanding
+    volatile uint32_t calls;    // Times the server was called
+    volatile uint32_t count;    // WDC interrupts handled
+} lat_isr_t;
+
+static lat_isr_t           lat_isr;
+static struct timerequest *lat_tr;  // Timeout for lat_wait()
+
+static volatile uint8_t lat_load_stop;
+static volatile uint8_t lat_load_done;
+static uint8_t         *lat_load_buf;
+
+/*
+ * lat_server
+ * ----------
+ * PORTS interrupt server. State is kept in lat_isr rather than passed in
+ * is_Data so no register calling convention is needed. The WDC interrupt
+ * is only claimed while one of our commands is outstanding (armed), so
+ * one raised for scsi.device is left alone. Always returns 0 so the rest
+ * of the chain (CIA-A, scsi.device) still runs.
+ */
+static ULONG
+lat_server(void)
+{
+    uint16_t ticks = cia_ticks();
+
+    lat_isr.calls++;
+    if ((lat_isr.armed == 0) || lat_isr.fired ||
+        ((CTRL_READ(ctrl->istr) & SDMAC_ISTR_INT_S) == 0))
+        return (0);
+    lat_isr.ticks = ticks;
+    lat_isr.sstat = get_wdc_reg(WDC_SCSI_STAT);  // Clears WDC interrupt
+    lat_isr.armed = 0;
+    lat_isr.fired = 1;
+    lat_isr.count++;
+    Signal(lat_isr.task, lat_isr.sigmask);
+    return (0);
+}
+
+/*
+ * lat_timer_open
+ * --------------
+ * Opens the timer.device request used by lat_wait(). Returns non-zero
+ * on failure.
+ */
+static int
+lat_timer_open(void)
+{
+    struct MsgPort *port = CreateMsgPort();
+
+    lat_tr = (port == NULL) ? NULL :
+             (struct timerequest *) CreateIORequest(port, sizeof (*lat_tr));
+    if ((lat_tr == NULL) ||
+        OpenDevice(TIMERNAME, UNIT_VBLANK, (struct IORequest *) lat_tr, 0)) {
+        printf("Failed to open %s\n", TIMERNAME);
+        if (lat_tr != NULL)
+            DeleteIORequest((struct IORequest *) lat_tr);
+        DeleteMsgPort(port);
+        lat_tr = NULL;
+        return (1);
+    }
+    return (0);
+}
+
+static void
+lat_timer_close(void)
+{
+    struct MsgPort *port = lat_tr->tr_node.io_Message.mn_ReplyPort;
+
+    CloseDevice((struct IORequest *) lat_tr);
+    DeleteIORequest((struct IORequest *) lat_tr);
+    DeleteMsgPort(port);
+    lat_tr = NULL;
+}
+
+/*
+ * lat_wait
+ * --------
+ * Waits up to msec for lat_server() to handle our command's interrupt.
+ * The command is disarmed on return, so an interrupt arriving later is
+ * left for scsi.device. Returns 0 if the server fired, LAT_WAIT_BREAK
+ * on ^C, or LAT_WAIT_TIMEOUT.
+ */
+#define LAT_WAIT_BREAK   1
+#define LAT_WAIT_TIMEOUT 2
+
+static int
+lat_wait(uint msec)
+{
+    ULONG tsig = BIT(lat_tr->tr_node.io_Message.mn_ReplyPort->mp_SigBit);
+    ULONG sigs = 0;
+    uint  fired;
+
+    lat_tr->tr_node.io_Command = TR_ADDREQUEST;
+    lat_tr->tr_time.tv_secs    = msec / 1000;
+    lat_tr->tr_time.tv_micro   = (msec % 1000) * 1000;
+    SendIO((struct IORequest *) lat_tr);
+    while ((lat_isr.fired == 0) && ((sigs & SIGBREAKF_CTRL_C) == 0) &&
+           (CheckIO((struct IORequest *) lat_tr) == NULL))
+        sigs |= Wait(lat_isr.sigmask | tsig | SIGBREAKF_CTRL_C);
+    if (CheckIO((struct IORequest *) lat_tr) == NULL)
+        AbortIO((struct IORequest *) lat_tr);
+    WaitIO((struct IORequest *) lat_tr);
+    SetSignal(0, tsig);
+
+    INTERRUPTS_DISABLE();
+    lat_isr.armed = 0;
+    fired = lat_isr.fired;
+    INTERRUPTS_ENABLE();
+    if (fired)
+        return (0);
+    return ((sigs & SIGBREAKF_CTRL_C) ? LAT_WAIT_BREAK : LAT_WAIT_TIMEOUT);
+}
+
+static void
+lat_load_task(void)
+{
+    while (lat_load_stop == 0)
+        CopyMem(lat_load_buf, lat_load_buf + LAT_LOAD_BUFSIZ, LAT_LOAD_BUFSIZ);
+    Forbid();
+    lat_load_done = 1;
+    /* Task exits with Forbid() held; RemTask() completes before Permit */
+}
+
+/*
+ * task_start
+ * ----------
+ * Starts a helper task with its own stack. The task must end with
+ * Forbid() held after setting a done flag, so task_free() can release
+ * its memory once the flag is seen.
+ */
+static struct Task *
+task_start(char *name, int pri, void (*func)(void))
+{
+    struct Task *task;
+    uint8_t     *stack;
+
+    task  = AllocMem(sizeof (*task), MEMF_PUBLIC | MEMF_CLEAR);
+    stack = AllocMem(LAT_LOAD_STACK, MEMF_PUBLIC);
+    if ((task == NULL) || (stack == NULL)) {
+        if (task != NULL)
+            FreeMem(task, sizeof (*task));
+        if (stack != NULL)
+            FreeMem(stack, LAT_LOAD_STACK);
+        return (NULL);
+    }
+    task->tc_Node.ln_Type = NT_TASK;
+    task->tc_Node.ln_Name = name;
+    task->tc_Node.ln_Pri  = pri;
+    task->tc_SPLower      = stack;
+    task->tc_SPUpper      = stack + LAT_LOAD_STACK;
+    task->tc_SPReg        = stack + LAT_LOAD_STACK;
+    AddTask(task, (APTR) func, NULL);
+    return (task);
+}
+
+static void
+task_free(struct Task *task, volatile uint8_t *done)
+{
+    while (*done == 0)
+        Delay(1);
+    FreeMem(task->tc_SPLower, LAT_LOAD_STACK);
+    FreeMem(task, sizeof (*task));
+}
+
+/*
+ * lat_load_start
+ * --------------
+ * Starts a task at the caller's priority which keeps the CPU and bus
+ * busy copying memory.
+ */
+static struct Task *
+lat_load_start(void)
+{
+    struct Task *task;
+
+    lat_load_buf = AllocMem(LAT_LOAD_BUFSIZ * 2, MEMF_PUBLIC);
+    if (lat_load_buf == NULL)
+        return (NULL);
+    lat_load_stop = 0;
+    lat_load_done = 0;
+    task = task_start("sdmac load", FindTask(NULL)->tc_Node.ln_Pri,
+                      lat_load_task);
+    if (task == NULL)
+        FreeMem(lat_load_buf, LAT_LOAD_BUFSIZ * 2);
+    return (task);
+}
+
+static void
+lat_load_stop_wait(struct Task *task)
+{
+    lat_load_stop = 1;
+    task_free(task, &lat_load_done);
+    FreeMem(lat_load_buf, LAT_LOAD_BUFSIZ * 2);
+}
+
+/* Start a select of our own ID which will time out in a few msec */
+static void
+lat_start_cmd(void)
+{
+    (void) get_wdc_reg(WDC_SCSI_STAT);  // clear previous status
+    set_wdc_reg(WDC_DST_ID, 7);
+    set_wdc_reg(WDC_LUN, 7);
+    set_wdc_reg(WDC_SYNC_TX, 0);  // async
+    set_wdc_reg(WDC_CONTROL, WDC_CONTROL_IDI | WDC_CONTROL_EDI);  // No DMA
+    set_wdc_reg(WDC_TPERIOD, 1);
+    set_wdc_reg(WDC_CMD, WDC_CMD_SELECT_WITH_ATN);
+}
+
+static void
+lat_show(const char *name, const stat_t *st, uint efreq)
+{
+    uint pos;
+
+    printf("  %-24s", name);
+    if (st->count == 0) {
+        printf(" no samples\n");
+        return;
+    }
+    printf(" %6u", stat_usec(st->min << STAT_FRAC, efreq));
+    for (pos = 0; pos < STAT_QUANTILES; pos++)
+        printf(" %6u", stat_usec(stat_quantile(st, pos), efreq));
+    printf(" %6u %6u %6u\n", stat_usec(st->max << STAT_FRAC, efreq),
+           stat_usec(stat_mean(st), efreq), stat_usec(stat_stddev(st), efreq));
+    if (flag_debug)
+        stat_show_hist(st, efreq);
+}
+
+/*
+ * lat_measure
+ * -----------
+ * Takes LAT_SAMPLES samples of each latency. Returns non-zero on failure.
+ */
+static int
+lat_measure(uint efreq)
+{
+    static stat_t    issue_to_int;
+    static stat_t    int_to_istr;
+    static stat_t    int_to_server;
+    static stat_t    server_to_wake;
+    struct Interrupt server;
+    uint16_t t_issue;
+    uint16_t t_int;
+    uint16_t t_istr;
+    uint16_t t_wake;
+    uint16_t cmd_ticks;
+    uint8_t  contr;
+    int8_t   sigbit;
+    uint     pos;
+    uint     timeout;
+
+    stat_init(&issue_to_int);
+    stat_init(&int_to_istr);
+    stat_init(&int_to_server);
+    stat_init(&server_to_wake);
+
+    /* Polled pass */
+    for (pos = 0; pos < LAT_SAMPLES; pos++) {
+        uint seen_int  = 0;
+        uint seen_istr = 0;
+        INTERRUPTS_DISABLE();
+        scsi_wait_cip();
+        t_issue = cia_ticks();
+        lat_start_cmd();
+        t_int  = 0;
+        t_istr = 0;
+        for (timeout = 100000; timeout > 0; timeout--) {
+            if ((seen_int == 0) &&
+                (get_wdc_reg(WDC_AUXST) & WDC_AUXST_INT)) {
+                t_int = cia_ticks();
+                seen_int++;
+            }
+            if ((seen_istr == 0) &&
+                (*CTRL_REG(ctrl->istr) & SDMAC_ISTR_INT_S)) {
+                t_istr = cia_ticks();
+                seen_istr++;
+            }
+            if (seen_int && seen_istr)
+                break;
+        }
+        (void) get_wdc_reg(WDC_SCSI_STAT);  // Clear interrupt
+        dmac_clear_int();
+        INTERRUPTS_ENABLE();
+        if (timeout == 0) {
+            printf("Timeout waiting for WDC interrupt\n");
+            return (1);
+        }
+        stat_add(&issue_to_int, (uint16_t) (t_issue - t_int));
+        /* Polling order may see ISTR first, which counts as no delay */
+        stat_add(&int_to_istr, ((int16_t) (t_int - t_istr) > 0) ?
+                               (uint16_t) (t_int - t_istr) : 0);
+    }
+    cmd_ticks = stat_quantile(&issue_to_int, 0) >> STAT_FRAC;  // Median
+
+    /* Interrupt pass */
+    sigbit = AllocSignal(-1);
+    if (sigbit == -1) {
+        printf("No free signal\n");
+        return (1);
+    }
+    if (lat_timer_open()) {
+        FreeSignal(sigbit);
+        return (1);
+    }
+    memset(&server, 0, sizeof (server));
+    server.is_Node.ln_Type = NT_INTERRUPT;
+    server.is_Node.ln_Pri  = 127;
+    server.is_Node.ln_Name = "sdmac latency";
+    server.is_Code         = (void (*)(void)) lat_server;
+    lat_isr.task    = FindTask(NULL);
+    lat_isr.sigmask = BIT(sigbit);
+    AddIntServer(INTB_PORTS, &server);
+
+    INTERRUPTS_DISABLE();
+    contr = *CTRL_REG(ctrl->contr);
+    *CTRL_REG(ctrl->contr) = contr | ctrl->inten;
+    INTERRUPTS_ENABLE();
+
+    for (pos = 0; pos < LAT_SAMPLES; pos++) {
+        int wrc;
+        SetSignal(0, lat_isr.sigmask);
+        lat_isr.fired = 0;
+        INTERRUPTS_DISABLE();
+        scsi_wait_cip();
+        lat_isr.armed = 1;
+        t_issue = cia_ticks();
+        lat_start_cmd();
+        INTERRUPTS_ENABLE();
+        wrc = lat_wait(LAT_WAIT_MSEC);
+        t_wake = cia_ticks();
+        if (wrc != 0) {
+            if (wrc == LAT_WAIT_BREAK) {
+                printf("^C Abort\n");
+            } else {
+                printf("Timeout waiting for WDC interrupt\n");
+                INTERRUPTS_DISABLE();
+                (void) get_wdc_reg(WDC_SCSI_STAT);  // Clear interrupt
+                dmac_clear_int();
+                INTERRUPTS_ENABLE();
+            }
+            break;
+        }
+        /* Estimated WDC INT time is cmd_ticks after issue */
+        stat_add(&int_to_server,
+                 ((int16_t) (t_issue - lat_isr.ticks - cmd_ticks) > 0) ?
+                 (uint16_t) (t_issue - lat_isr.ticks - cmd_ticks) : 0);
+        stat_add(&server_to_wake, (uint16_t) (lat_isr.ticks - t_wake));
+    }
+
+    INTERRUPTS_DISABLE();
+    *CTRL_REG(ctrl->contr) = contr;
+    dmac_clear_int();
+    INTERRUPTS_ENABLE();
+    RemIntServer(INTB_PORTS, &server);
+    lat_timer_close();
+    FreeSignal(sigbit);
+
+    lat_show("WDC INT to DMAC ISTR", &int_to_istr, efreq);
+    lat_show("WDC INT to server (est)", &int_to_server, efreq);
+    lat_show("Server to task wake", &server_to_wake, efreq);
+    return (pos != LAT_SAMPLES);
+}
+
+static int
+measure_irq_latency(void)
+{
+    struct Task *load;
+    uint         efreq = get_eclock_freq();
+    int          rc;
+
+    if (ctrl->istr == 0) {
+        printf("Interrupt latency requires a DMAC interrupt status register\n");
+        return (1);
+    }
+
+    printf("Interrupt latency (usec)      min    p50    p90    p99    max"
+           "   mean   sdev\n");
+    printf(" Idle\n");
+    rc = lat_measure(efreq);
+    if (rc != 0)
+        return (rc);
+
+    load = lat_load_start();
+    if (load == NULL) {
+        printf("Failed to start load task\n");
+        return (1);
+    }
+    printf(" Loaded\n");
+    rc = lat_measure(efreq);
+    lat_load_stop_wait(load);
+    return (rc);
+}
+
+/*
+ * Test registry
+ *
+ * Each test is a name, a function returning non-zero on failure, the
+ * prerequisites it needs from the controller, and flags. Tests flagged
+ * TEST_DEFAULT make up the test pass that runs with no options.
+ * Destructive tests disturb the SCSI bus or controller state, so "all"
+ * does not include them; they only run when named. Per-test wall time
+ * and WDC register accesses are recorded for the summary.
+ */
+#define TEST_A3000        0x01  // Requires the A3000 SDMAC and Ramsey
+#define TEST_ISTR         0x02  // Requires a DMAC interrupt status register
+#define TEST_DEFAULT      0x10  // Part of the default test pass
+#define TEST_DESTRUCTIVE  0x20  // Not run by "all"
+
+typedef struct {
+    const char *name;
+    int       (*func)(void);
+    uint8_t     flags;
+    const char *desc;
+} test_t;
+
+typedef struct {
+    uint32_t runs;         // Times run
+    uint32_t fails;        // Times failed
+    uint32_t skips;        // Times prerequisites were not met
+    uint64_t ticks;        // Total E clock ticks
+    uint32_t max_ticks;    // Longest run
+    uint32_t accesses;     // Total WDC register accesses
+} test_stat_t;
+
+static int
+test_wdc_reset(void)
+{
+    scsi_soft_reset(1);
+    return (0);
+}
+
+static const test_t tests[] = {
+    { "ramsey", test_ramsey_access,  TEST_A3000 | TEST_DEFAULT,
+      "Ramsey register access" },
+    { "sdmac",  test_sdmac_access,   TEST_A3000 | TEST_DEFAULT,
+      "SDMAC register access" },
+    { "wdc",    test_wdc_access,     TEST_DEFAULT,
+      "WDC register access" },
+    { "irq",    measure_irq_latency, TEST_ISTR,
+      "SCSI interrupt latency" },
+    { "probe",  probe_scsi,          TEST_DESTRUCTIVE,
+      "Probe SCSI bus" },
+    { "reset",  test_wdc_reset,      TEST_DESTRUCTIVE,
+      "WDC soft reset" },
+};
+
+static test_stat_t test_stats[ARRAY_SIZE(tests)];
+
+static int
+test_find(const char *name, uint len)
+{
+    uint pos;
+
+    for (pos = 0; pos < ARRAY_SIZE(tests); pos++) {
+        if ((strncmp(tests[pos].name, name, len) == 0) &&
+            (tests[pos].name[len] == '\0'))
+            return (pos);
+    }
+    return (-1);
+}
+
+/* Returns the mask of tests which have any of the specified flags */
+static uint32_t
+test_mask(uint flags)
+{
+    uint32_t mask = 0;
+    uint     pos;
+
+    for (pos = 0; pos < ARRAY_SIZE(tests); pos++)
+        if (tests[pos].flags & flags)
+            mask |= BIT(pos);
+    return (mask);
+}
+
+static void
+test_list(void)
+{
+    uint pos;
+
+    printf("Tests:\n");
+    for (pos = 0; pos < ARRAY_SIZE(tests); pos++) {
+        printf("    %-8s %s%s%s%s\n", tests[pos].name, tests[pos].desc,
+               (tests[pos].flags & TEST_A3000) ? " (A3000)" : "",
+               (tests[pos].flags & TEST_DEFAULT) ? " (default)" : "",
+               (tests[pos].flags & TEST_DESTRUCTIVE) ? " (destructive)" : "");
+    }
+}
+
+/*
+ * test_parse
+ * ----------
+ * Converts a comma-separated list of test names, "all", or "default" to
+ * a mask of tests. Returns 0 if a name is not known.
+ */
+static uint32_t
+test_parse(const char *list)
+{
+    uint32_t mask = 0;
+
+    while (*list != '\0') {
+        uint len = strcspn(list, ",");
+        int  pos = test_find(list, len);
+
+        if (pos >= 0) {
+            mask |= BIT(pos);
+        } else if ((len == 3) && (strncmp(list, "all", 3) == 0)) {
+            mask |= BIT(ARRAY_SIZE(tests)) - 1;
+            mask &= ~test_mask(TEST_DESTRUCTIVE);
+        } else if ((len == 7) && (strncmp(list, "default", 7) == 0)) {
+            mask |= test_mask(TEST_DEFAULT);
+        } else {
+            printf("Unknown test %.*s\n", len, list);
+            return (0);
+        }
+        list += len;
+        if (*list == ',')
+            list++;
+    }
+    return (mask);
+}
+
+/* Returns what the current controller lacks to run the test, or NULL */
+static const char *
+test_missing(const test_t *test)
+{
+    if ((test->flags & TEST_A3000) && (ctrl->type != CTRL_A3000))
+        return ("A3000 only");
+    if ((test->flags & TEST_ISTR) && (ctrl->istr == 0))
+        return ("no DMAC interrupt status register");
+    return (NULL);
+}
+
+/*
+ * test_run
+ * --------
+ * Runs the tests in mask in registry order. Tests whose prerequisites
+ * are not met are skipped, with a message if verbose is set. Returns
+ * the number of tests which failed.
+ */
+static int
+test_run(uint32_t mask, uint verbose)
+{
+    uint pos;
+    int  fails = 0;
+
+    for (pos = 0; pos < ARRAY_SIZE(tests); pos++) {
+        const test_t *test = &tests[pos];
+        test_stat_t  *st = &test_stats[pos];
+        const char   *missing;
+        uint32_t      accesses;
+        uint32_t      start;
+        uint32_t      ticks;
+        int           rc;
+
+        if ((mask & BIT(pos)) == 0)
+            continue;
+        missing = test_missing(test);
+        if (missing != NULL) {
+            if (verbose)
+                printf("%s test: skipped (%s)\n", test->name, missing);
+            st->skips++;
+            continue;
+        }
+        accesses = wdc_accesses;
+        start = eclock_ticks();
+        rc = test->func();
+        ticks = eclock_ticks() - start;
+
+        st->runs++;
+        st->ticks += ticks;
+        st->accesses += wdc_accesses - accesses;
+        if (st->max_ticks < ticks)
+            st->max_ticks = ticks;
+        if (rc != 0) {
+            st->fails++;
+            fails++;
+        }
+        if (is_user_abort())
+            break;
+    }
+    return (fails);
+}
+
+static void
+test_summary(uint32_t mask)
+{
+    uint efreq = get_eclock_freq();
+    uint pos;
+
+    printf("Test       runs fails skips  avg msec  max msec  WDC accesses\n");
+    for (pos = 0; pos < ARRAY_SIZE(tests); pos++) {
+        const test_stat_t *st = &test_stats[pos];
+
+        if ((mask & BIT(pos)) == 0)
+            continue;
+        printf("%-8s %6u %5u %5u %9u %9u %13u\n", tests[pos].name,
+               st->runs, st->fails, st->skips,
+               (st->runs == 0) ? 0 :
+               (uint) (st->ticks * 1000 / efreq / st->runs),
+               (uint) ((uint64_t) st->max_ticks * 1000 / efreq),
+               (st->runs == 0) ? 0 : st->accesses / st->runs);
+    }
+}
+
+/*
+ * scsi.device I/O tracer
+ *
+ * BeginIO() of scsi.device is patched to record each IORequest in a
+ * preallocated ring. Completion is recorded either immediately, if the
+ * request completed quickly (IOF_QUICK still set on return), or when the
+ * device replies to it, which is caught by patching exec ReplyMsg().
+ * The patch code runs in the context of other tasks and possibly in
+ * interrupts, so it uses no stdio and no INTERRUPTS_DISABLE() nesting.
+ *
+ * Each entry is built on the stack and copied into its ring slot inside
+ * the same Disable() which advances trace_head, so readers such as
+ * met_collect() never see a claimed slot still holding an old request.
+ * Timestamps are the low 32 bits of ReadEClock(), which may be called
+ * from interrupts.
+ *
+ * The patch code counts the callers inside it in trace_users, including
+ * those waiting in the original BeginIO(), so that trace_stop() can wait
+ * for them to leave before the ring and the code are freed.
+ *
+ * The dump file is a trace_hdr_t followed by trace_entry_t records in
+ * big-endian byte order. host/sdmac-trace analyzes it on Linux.
+ */
+#define TRACE_MAGIC        0x53447472  // 'SDtr'
+#define TRACE_VERSION      2           // 2: 64-bit offset
+#define TRACE_ENTRIES      8192
+#define TRACE_INFLIGHT     32
+#define TRACE_DEVICE       "scsi.device"
+#define LVO_BEGINIO        -30         // DEV_BEGINIO
+#define LVO_REPLYMSG       -378        // exec.library ReplyMsg()
+
+/* 64-bit commands: io_Actual holds the high 32 bits of the offset */
+#ifndef TD_READ64
+#define TD_READ64          24          // TD64
+#define TD_WRITE64         25
+#define TD_SEEK64          26
+#define TD_FORMAT64        27
 #endif
-    return (efreq * treg * 80 / ticks);
+#ifndef NSCMD_TD_READ64
+#define NSCMD_TD_READ64    0xc000      // New Style Device
+#define NSCMD_TD_WRITE64   0xc001
+#define NSCMD_TD_SEEK64    0xc002
+#define NSCMD_TD_FORMAT64  0xc003
+#endif
+
+typedef struct {
+    uint32_t magic;       // TRACE_MAGIC
+    uint16_t version;     // TRACE_VERSION
+    uint16_t entry_size;  // sizeof (trace_entry_t)
+    uint32_t efreq;       // E clock ticks per second
+    uint32_t count;       // Number of entries which follow
+} trace_hdr_t;
+
+typedef struct {
+    uint64_t offset;      // Byte offset (from CDB LBA for HD_SCSICMD)
+    uint32_t length;      // Bytes requested
+    uint32_t submit;      // E clock at BeginIO
+    uint32_t complete;    // E clock at completion, 0 if not seen
+    uint16_t command;     // io_Command
+    uint8_t  scsi_op;     // CDB opcode for HD_SCSICMD, else 0
+    int8_t   error;       // io_Error at completion
+} trace_entry_t;
+
+typedef struct {
+    struct IORequest *ior;  // Request in flight, NULL if slot free
+    uint32_t          seq;  // Ring sequence number of its entry
+} trace_inflight_t;
+
+void                    *trace_old_beginio;
+void                    *trace_old_replymsg;
+static trace_entry_t    *trace_ring;
+static volatile uint32_t trace_head;
+static trace_inflight_t  trace_inflight[TRACE_INFLIGHT];
+volatile uint32_t        trace_users;  // Callers inside the patch code
+
+void trace_beginio(void);
+void trace_replymsg(void);
+
+/*
+ * Patch entry points. BeginIO() receives the IORequest in a1 and the
+ * device in a6. The original is called as a subroutine so quick
+ * completions can be caught when it returns. trace_users is dropped
+ * just before the final rts (ReplyMsg() leaves through the original's
+ * address pushed on the stack). addq/subq to memory are single
+ * instructions, so need no Disable(). Host test builds (see tests/)
+ * provide C stubs instead.
+ */
+#ifndef SDMAC_HOST_TEST
+__asm__("                                               \n\
+        .text                                           \n\
+        .even                                           \n\
+_trace_beginio:                                         \n\
+        addq.l  #1,_trace_users                         \n\
+        movem.l a1/a6,-(sp)                             \n\
+        move.l  a1,-(sp)                                \n\
+        jsr     _trace_submit                           \n\
+        addq.l  #4,sp                                   \n\
+        movem.l (sp),a1/a6                              \n\
+        move.l  _trace_old_beginio,a0                   \n\
+        jsr     (a0)                                    \n\
+        movem.l (sp)+,a1/a6                             \n\
+        move.l  a1,-(sp)                                \n\
+        jsr     _trace_quick                            \n\
+        addq.l  #4,sp                                   \n\
+        subq.l  #1,_trace_users                         \n\
+        rts                                             \n\
+                                                        \n\
+_trace_replymsg:                                        \n\
+        addq.l  #1,_trace_users                         \n\
+        movem.l a1/a6,-(sp)                             \n\
+        move.l  a1,-(sp)                                \n\
+        jsr     _trace_reply                            \n\
+        addq.l  #4,sp                                   \n\
+        movem.l (sp)+,a1/a6                             \n\
+        move.l  _trace_old_replymsg,-(sp)               \n\
+        subq.l  #1,_trace_users                         \n\
+        rts                                             \n\
+");
+#endif
+
+static void
+trace_complete(struct IORequest *ior)
+{
+    uint32_t now = eclock_ticks();
+    uint     pos;
+
+    Disable();
+    for (pos = 0; pos < ARRAY_SIZE(trace_inflight); pos++) {
+        if (trace_inflight[pos].ior == ior) {
+            uint32_t seq = trace_inflight[pos].seq;
+            trace_inflight[pos].ior = NULL;
+            if (trace_head - seq <= TRACE_ENTRIES) {
+                trace_entry_t *ent = &trace_ring[seq % TRACE_ENTRIES];
+                ent->complete = now ? now : 1;
+                ent->error    = ior->io_Error;
+            }
+            break;
+        }
+    }
+    Enable();
+}
+
+static uint
+trace_is_64(uint command)
+{
+    switch (command) {
+        case TD_READ64:
+        case TD_WRITE64:
+        case TD_SEEK64:
+        case TD_FORMAT64:
+        case NSCMD_TD_READ64:
+        case NSCMD_TD_WRITE64:
+        case NSCMD_TD_SEEK64:
+        case NSCMD_TD_FORMAT64:
+            return (1);
+    }
+    return (0);
+}
+
+/* Returns the LBA of a READ/WRITE CDB, or 0 for other commands */
+static uint64_t
+trace_cdb_lba(const uint8_t *cdb)
+{
+    uint     pos;
+    uint64_t lba = 0;
+
+    switch (cdb[0]) {
+        case 0x08:  // READ(6)
+        case 0x0a:  // WRITE(6)
+            return (((cdb[1] & 0x1f) << 16) | (cdb[2] << 8) | cdb[3]);
+        case 0x28:  // READ(10)
+        case 0x2a:  // WRITE(10)
+        case 0xa8:  // READ(12)
+        case 0xaa:  // WRITE(12)
+            for (pos = 2; pos < 6; pos++)
+                lba = (lba << 8) | cdb[pos];
+            return (lba);
+        case 0x88:  // READ(16)
+        case 0x8a:  // WRITE(16)
+            for (pos = 2; pos < 10; pos++)
+                lba = (lba << 8) | cdb[pos];
+            return (lba);
+    }
+    return (0);
+}
+
+void
+trace_submit(struct IORequest *ior)
+{
+    struct IOStdReq *io = (struct IOStdReq *) ior;
+    trace_entry_t    ent;
+    uint32_t         seq;
+    uint             pos;
+
+    ent.command  = io->io_Command;
+    ent.offset   = io->io_Offset;
+    ent.length   = io->io_Length;
+    if (trace_is_64(io->io_Command))
+        ent.offset |= (uint64_t) io->io_Actual << 32;
+    ent.scsi_op  = 0;
+    ent.error    = 0;
+    ent.complete = 0;
+    if ((io->io_Command == HD_SCSICMD) && (io->io_Data != NULL)) {
+        struct SCSICmd *cmd = (struct SCSICmd *) io->io_Data;
+        uint8_t        *cdb = cmd->scsi_Command;
+        ent.length = cmd->scsi_Length;
+        ent.offset = 0;
+        if (cdb != NULL) {
+            ent.scsi_op = cdb[0];
+            ent.offset  = trace_cdb_lba(cdb) * 512;
+        }
+    }
+    ent.submit = eclock_ticks();
+
+    Disable();
+    seq = trace_head;
+    trace_ring[seq % TRACE_ENTRIES] = ent;
+    for (pos = 0; pos < ARRAY_SIZE(trace_inflight); pos++) {
+        if (trace_inflight[pos].ior == NULL) {
+            trace_inflight[pos].ior = ior;
+            trace_inflight[pos].seq = seq;
+            break;
+        }
+    }
+    trace_head = seq + 1;  // Publish the filled slot
+    Enable();
+}
+
+void
+trace_quick(struct IORequest *ior)
+{
+    if (ior->io_Flags & IOF_QUICK)
+        trace_complete(ior);
+}
+
+void
+trace_reply(struct Message *msg)
+{
+    trace_complete((struct IORequest *) msg);
+}
+
+/* Returns 0 for other, 1 for read, 2 for write */
+static uint
+trace_rw(const trace_entry_t *ent)
+{
+    switch (ent->command) {
+        case CMD_READ:
+        case TD_READ64:
+        case NSCMD_TD_READ64:
+            return (1);
+        case CMD_WRITE:
+        case TD_FORMAT:
+        case TD_WRITE64:
+        case TD_FORMAT64:
+        case NSCMD_TD_WRITE64:
+        case NSCMD_TD_FORMAT64:
+            return (2);
+        case HD_SCSICMD:
+            switch (ent->scsi_op) {
+                case 0x08:  // READ(6)
+                case 0x28:  // READ(10)
+                case 0xa8:  // READ(12)
+                case 0x88:  // READ(16)
+                    return (1);
+                case 0x0a:  // WRITE(6)
+                case 0x2a:  // WRITE(10)
+                case 0xaa:  // WRITE(12)
+                case 0x8a:  // WRITE(16)
+                    return (2);
+            }
+            break;
+    }
+    return (0);
+}
+
+/* Converts an entry between host and file byte order */
+static void
+trace_entry_order(trace_entry_t *ent)
+{
+    ent->offset   = BE64(ent->offset);
+    ent->length   = BE32(ent->length);
+    ent->submit   = BE32(ent->submit);
+    ent->complete = BE32(ent->complete);
+    ent->command  = BE16(ent->command);
+}
+
+/*
+ * trace_analyze
+ * -------------
+ * Reports request size histogram, seek distance distribution, and
+ * completion latency percentiles from a trace dump file. This does not
+ * touch any hardware, so it also works on a dump copied to another
+ * machine, including by host/sdmac-trace on Linux.
+ */
+static int
+trace_analyze(const char *filename)
+{
+    static const char * const size_names[] = {
+        "<= 512", "1K", "2K", "4K", "8K", "16K", "32K", "64K",
+        "128K", "256K", "512K", "> 512K"
+    };
+    static const char * const seek_names[] = {
+        "sequential", "< 64K", "< 1M", "< 16M", "< 256M", ">= 256M"
+    };
+    static const uint32_t seek_limits[] = {
+        1, 64 << 10, 1 << 20, 16 << 20, 256 << 20, 0xffffffff
+    };
+    trace_hdr_t    hdr;
+    trace_entry_t *ents;
+    stat_t         lat;
+    uint64_t       prev_end = 0;
+    uint           size_count[ARRAY_SIZE(size_names)];
+    uint           seek_count[ARRAY_SIZE(seek_names)];
+    uint           rw_count[3] = { 0, 0, 0 };
+    uint           backward = 0;
+    uint           nlat = 0;
+    uint           have_prev = 0;
+    uint           pos;
+    long           len;
+    FILE          *fp;
+
+    fp = fopen(filename, "rb");
+    if (fp == NULL) {
+        printf("Failed to open %s\n", filename);
+        return (1);
+    }
+    fseek(fp, 0, SEEK_END);
+    len = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    if ((fread(&hdr, sizeof (hdr), 1, fp) != 1) ||
+        (BE32(hdr.magic) != TRACE_MAGIC) ||
+        (BE16(hdr.version) != TRACE_VERSION) ||
+        (BE16(hdr.entry_size) != sizeof (trace_entry_t)) ||
+        (hdr.efreq == 0)) {
+        printf("%s is not a trace file\n", filename);
+        fclose(fp);
+        return (1);
+    }
+    hdr.efreq = BE32(hdr.efreq);
+    hdr.count = BE32(hdr.count);
+
+    /* Bounding count by the file size also keeps the multiply in range */
+    if (hdr.count > (len - sizeof (hdr)) / sizeof (*ents)) {
+        printf("%s is truncated: %u entries in %ld bytes\n",
+               filename, hdr.count, len);
+        fclose(fp);
+        return (1);
+    }
+    if (hdr.count == 0) {
+        printf("%s: no requests were traced\n", filename);
+        fclose(fp);
+        return (0);
+    }
+    ents = malloc(hdr.count * sizeof (*ents));
+    if (ents == NULL) {
+        printf("Failed to allocate %u entries\n", hdr.count);
+        fclose(fp);
+        return (1);
+    }
+    if (fread(ents, sizeof (*ents), hdr.count, fp) != hdr.count) {
+        printf("Failed to read %s\n", filename);
+        free(ents);
+        fclose(fp);
+        return (1);
+    }
+    fclose(fp);
+    for (pos = 0; pos < hdr.count; pos++)
+        trace_entry_order(&ents[pos]);
+
+    memset(size_count, 0, sizeof (size_count));
+    memset(seek_count, 0, sizeof (seek_count));
+    stat_init(&lat);
+    for (pos = 0; pos < hdr.count; pos++) {
+        trace_entry_t *ent = &ents[pos];
+        uint           rw  = trace_rw(ent);
+        uint           bucket;
+        uint32_t       len;
+
+        rw_count[rw]++;
+        if (ent->complete != 0) {
+            stat_add(&lat, ent->complete - ent->submit);
+            nlat++;
+        }
+        if (rw == 0)
+            continue;
+
+        for (bucket = 0, len = 512; (bucket < ARRAY_SIZE(size_names) - 1) &&
+                                    (ent->length > len); bucket++)
+            len <<= 1;
+        size_count[bucket]++;
+
+        if (have_prev) {
+            uint64_t dist;
+            if (ent->offset >= prev_end) {
+                dist = ent->offset - prev_end;
+            } else {
+                dist = prev_end - ent->offset;
+                backward++;
+            }
+            for (bucket = 0; (bucket < ARRAY_SIZE(seek_limits) - 1) &&
+                             (dist >= seek_limits[bucket]); bucket++)
+                ;
+            seek_count[bucket]++;
+        }
+        prev_end  = ent->offset + ent->length;
+        have_prev = 1;
+    }
+
+    printf("Requests: %u (read %u, write %u, other %u)\n",
+           hdr.count, rw_count[1], rw_count[2], rw_count[0]);
+    printf("Request size      count\n");
+    for (pos = 0; pos < ARRAY_SIZE(size_names); pos++)
+        if (size_count[pos] != 0)
+            printf("  %-12s %8u\n", size_names[pos], size_count[pos]);
+    printf("Seek distance     count  (%u backward)\n", backward);
+    for (pos = 0; pos < ARRAY_SIZE(seek_names); pos++)
+        if (seek_count[pos] != 0)
+            printf("  %-12s %8u\n", seek_names[pos], seek_count[pos]);
+    if (nlat != 0) {
+        printf("Latency (usec)    min %u  p50 %u  p90 %u  p99 %u  max %u\n",
+               stat_usec(lat.min << STAT_FRAC, hdr.efreq),
+               stat_usec(stat_quantile(&lat, 0), hdr.efreq),
+               stat_usec(stat_quantile(&lat, 1), hdr.efreq),
+               stat_usec(stat_quantile(&lat, 2), hdr.efreq),
+               stat_usec(lat.max << STAT_FRAC, hdr.efreq));
+    }
+    if (nlat != hdr.count)
+        printf("%u requests did not complete during trace\n",
+               hdr.count - nlat);
+    free(ents);
+    return (0);
+}
+
+static int
+trace_write(const char *filename, uint efreq)
+{
+    trace_hdr_t hdr;
+    FILE       *fp;
+    uint32_t    first = 0;
+    uint32_t    seq;
+
+    if (trace_head > TRACE_ENTRIES)
+        first = trace_head - TRACE_ENTRIES;
+
+    fp = fopen(filename, "w");
+    if (fp == NULL) {
+        printf("Failed to open %s for write\n", filename);
+        return (1);
+    }
+    hdr.magic      = BE32(TRACE_MAGIC);
+    hdr.version    = BE16(TRACE_VERSION);
+    hdr.entry_size = BE16(sizeof (trace_entry_t));
+    hdr.efreq      = BE32(efreq);
+    hdr.count      = BE32(trace_head - first);
+    fwrite(&hdr, sizeof (hdr), 1, fp);
+    for (seq = first; seq != trace_head; seq++) {
+        trace_entry_t ent = trace_ring[seq % TRACE_ENTRIES];
+        trace_entry_order(&ent);
+        fwrite(&ent, sizeof (ent), 1, fp);
+    }
+    fclose(fp);
+    return (0);
+}
+
+/*
+ * trace_start
+ * -----------
+ * Allocates the trace ring and patches scsi.device. Returns the device,
+ * or NULL on failure.
+ */
+static struct Library *
+trace_start(void)
+{
+    struct Library *dev;
+
+    Forbid();
+    dev = (struct Library *) FindName(&SysBase->DeviceList, TRACE_DEVICE);
+    Permit();
+    if (dev == NULL) {
+        printf("%s not found\n", TRACE_DEVICE);
+        return (NULL);
+    }
+    trace_ring = AllocMem(TRACE_ENTRIES * sizeof (trace_entry_t),
+                          MEMF_PUBLIC | MEMF_CLEAR);
+    if (trace_ring == NULL) {
+        printf("Failed to allocate trace buffer\n");
+        return (NULL);
+    }
+    trace_head  = 0;
+    trace_users = 0;
+    memset(trace_inflight, 0, sizeof (trace_inflight));
+
+    Forbid();
+    trace_old_replymsg = SetFunction((struct Library *) SysBase, LVO_REPLYMSG,
+                                     (APTR) trace_replymsg);
+    trace_old_beginio  = SetFunction(dev, LVO_BEGINIO, (APTR) trace_beginio);
+    Permit();
+    return (dev);
+}
+
+/*
+ * trace_stop
+ * ----------
+ * Removes the scsi.device patches and waits for every caller to leave
+ * the patch code. The trace ring is left for the caller to process and
+ * free.
+ */
+static void
+trace_stop(struct Library *dev)
+{
+    void *cur;
+
+    /* Only unpatch if nobody has patched on top of us */
+    for (;;) {
+        Forbid();
+        cur = SetFunction(dev, LVO_BEGINIO, trace_old_beginio);
+        if (cur == (void *) trace_beginio) {
+            cur = SetFunction((struct Library *) SysBase, LVO_REPLYMSG,
+                              trace_old_replymsg);
+            if (cur == (void *) trace_replymsg) {
+                Permit();
+                break;
+            }
+            SetFunction((struct Library *) SysBase, LVO_REPLYMSG, cur);
+            SetFunction(dev, LVO_BEGINIO, (APTR) trace_beginio);
+        } else {
+            SetFunction(dev, LVO_BEGINIO, cur);
+        }
+        Permit();
+        printf("Patched by another program; waiting to remove patch\n");
+        Delay(250);
+    }
+
+    /* A task may be waiting in the original BeginIO() for some time */
+    while (trace_users != 0)
+        Delay(1);
+}
+
+/*
+ * trace_run
+ * ---------
+ * Patches scsi.device, traces for the specified number of seconds (or
+ * until ^C), then removes the patches and writes the dump file.
+ */
+static int
+trace_run(const char *filename, uint seconds)
+{
+    struct Library *dev;
+    uint            efreq = get_eclock_freq();
+    uint            ticks;
+    int             rc;
+
+    dev = trace_start();
+    if (dev == NULL)
+        return (1);
+
+    printf("Tracing %s for %u seconds (^C to stop)\n", TRACE_DEVICE, seconds);
+    for (ticks = 0; ticks < seconds * 50; ticks += 10) {
+        Delay(10);
+        if (is_user_abort())
+            break;
+    }
+    trace_stop(dev);
+
+    printf("%u requests traced\n", trace_head);
+    rc = trace_write(filename, efreq);
+    FreeMem(trace_ring, TRACE_ENTRIES * sizeof (trace_entry_t));
+    if (rc == 0)
+        rc = trace_analyze(filename);
+    return (rc);
+}
+
+/*
+ * Direct SCSI command execution
+ *
+ * Commands are run with a WD33C93 Select-with-ATN-and-Transfer, which
+ * handles selection, command, data, status, and message phases without
+ * CPU involvement. Data is moved by the CPU or by the SDMAC. This is only
+ * implemented for the A3000, as the Zorro DMAC register layouts differ.
+ *
+ * In the polled modes, interrupts are disabled for the duration of the
+ * command, which keeps scsi.device from starting a command of its own
+ * on the WDC meanwhile. The interrupt modes let other tasks run while
+ * waiting for completion, so they should be used with the bus idle.
+ */
+#define SCSI_READ_10        0x28
+#define SCSI_BLOCK_SIZE     512
+
+static void
+scsi_build_read10(uint8_t *cdb, uint32_t lba, uint blocks)
+{
+    memset(cdb, 0, 10);
+    cdb[0] = SCSI_READ_10;
+    cdb[2] = lba >> 24;
+    cdb[3] = lba >> 16;
+    cdb[4] = lba >> 8;
+    cdb[5] = lba;
+    cdb[7] = blocks >> 8;
+    cdb[8] = blocks;
+}
+
+/*
+ * DMA cache maintenance
+ *
+ * scsi_xfer_cmd() brackets DMA with CachePreDMA() and CachePostDMA().
+ * For measurement, dma_cache_mode may instead select CacheClearE() of
+ * the buffer before and after the transfer, as drivers written before
+ * the DMA calls existed do, or no maintenance at all. Time spent in the
+ * calls is added to dma_cache_ticks.
+ */
+#define DMA_CACHE_PREPOST 0
+#define DMA_CACHE_CLEARE  1
+#define DMA_CACHE_NONE    2
+
+static uint     dma_cache_mode = DMA_CACHE_PREPOST;
+static uint32_t dma_cache_ticks;  // E clock ticks in cache maintenance
+
+static APTR
+dma_cache_pre(void *buf, ULONG *len)
+{
+    uint16_t start = cia_ticks();
+    APTR     paddr = buf;
+
+    switch (dma_cache_mode) {
+        case DMA_CACHE_PREPOST:
+            paddr = CachePreDMA(buf, len, 0);
+            break;
+        case DMA_CACHE_CLEARE:
+            CacheClearE(buf, *len, CACRF_ClearD);
+            break;
+    }
+    dma_cache_ticks += (uint16_t) (start - cia_ticks());
+    return (paddr);
+}
+
+static void
+dma_cache_post(void *buf, ULONG *len)
+{
+    uint16_t start = cia_ticks();
+
+    switch (dma_cache_mode) {
+        case DMA_CACHE_PREPOST:
+            CachePostDMA(buf, len, 0);
+            break;
+        case DMA_CACHE_CLEARE:
+            CacheClearE(buf, *len, CACRF_ClearD);
+            break;
+    }
+    dma_cache_ticks += (uint16_t) (start - cia_ticks());
 }
 
-#define WD_DETECT_ERR_INVALID        0x0001
-#define WD_DETECT_ERR_AUXST          0x0002
-#define WD_DETECT_ERR_AUXST_WRITABLE 0x0004
-#define WD_DETECT_ERR_SCSI_STAT      0x0008
-#define WD_DETECT_ERR_CMDPHASE       0x0010
-#define WD_DETECT_ERR_RESET_STATUS   0x0020
+/*
+ * scsi_xfer_cmd
+ * -------------
+ * Runs a data-in SCSI command, transferring len bytes to buf. The mode
+ * selects how data is moved (CPU reading the WDC data register, or SDMAC
+ * DMA) and how the WDC completion interrupt is taken (polled with
+ * interrupts disabled, or by lat_server() while the task sleeps). The
+ * interrupt modes require the caller to have installed lat_server(),
+ * opened lat_timer_open(), and enabled DMAC interrupts. All modes but
+ * XFER_PIO give up if the command has not completed within
+ * XFER_WAIT_MSEC(len). Returns the SCSI status byte from the target
+ * (0 = GOOD), SCSI_SEL_TIMEOUT if the target did not respond to
+ * selection, or -1 if the command did not complete.
+ */
+#define XFER_PIO        0  // CPU moves data, WDC INT polled
+#define XFER_PIO_INTR   1  // CPU moves data, WDC INT by interrupt
+#define XFER_DMA        2  // SDMAC moves data, WDC INT polled
+#define XFER_DMA_INTR   3  // SDMAC moves data, WDC INT by interrupt
+#define XFER_IS_DMA(x)  ((x) >= XFER_DMA)
+#define XFER_IS_INTR(x) ((x) & 1)
 
-static uint
-show_wdc_version(void)
-{
-    uint8_t     cvalue;
-    uint8_t     ovalue;
-    uint8_t     rvalue;
-    uint8_t     wvalue;
-    uint        pass;
-    uint        errs = 0;
-    uint        wd_rev_value = 0;
-    const char *wd_rev = "";
+/* Completion deadline: 1 second plus the transfer at 250 KB/s */
+#define XFER_WAIT_MSEC(len) (1000 + (len) / 256)
 
-    printf("SCSI Controller:     ");
+#define SCSI_SEL_TIMEOUT (-2)
 
-    /* Verify that WD33C93 or WD33C93A can be detected */
-    rvalue = get_wdc_reg(WDC_INVALID_REG);
-    if (rvalue != 0xff)
-        errs |= WD_DETECT_ERR_INVALID;
-    rvalue = get_wdc_reg(WDC_AUXST);
-    if (rvalue & (BIT(2) | BIT(3))) {
-        if (flag_debug)
-            printf("Got %02x for AUXST\n", rvalue);
-        errs |= WD_DETECT_ERR_AUXST;
+static uint scsi_sel_msec = SCSI_SEL_MSEC;  // Programmed in TPERIOD
+
+static int
+scsi_xfer_cmd(uint target, uint lun, uint8_t *cdb, uint cdblen,
+              void *buf, uint len, uint mode)
+{
+    ULONG    dlen = len;
+    APTR     paddr = NULL;
+    uint8_t *dst = buf;
+    uint8_t  contr;
+    uint8_t  sstat;
+    uint8_t  status;
+    uint     auxst = 0;
+    uint     pos = 0;
+    uint     timeout;
+
+    if (ctrl->type != CTRL_A3000)
+        return (-1);
+
+    if (XFER_IS_DMA(mode)) {
+        paddr = dma_cache_pre(buf, &dlen);
+        if (dlen != len) {
+            /* Buffer is not physically contiguous */
+            dma_cache_post(buf, &dlen);
+            return (-1);
+        }
+    }
+    if (XFER_IS_INTR(mode)) {
+        SetSignal(0, lat_isr.sigmask);
+        lat_isr.fired = 0;
+        Forbid();  // Keep scsi.device off the WDC until we sleep
     }
 
     INTERRUPTS_DISABLE();
-    rvalue = get_wdc_reg(WDC_AUXST);
-    ovalue = get_wdc_reg(WDC_CMDPHASE);
-    wvalue = 0xa5;
-    for (pass = 0; pass < 2; pass++) {
-        uint8_t rvalue2;
-        set_wdc_reg(WDC_CMDPHASE, wvalue);
-        rvalue2 = get_wdc_reg(WDC_AUXST);
-        cvalue = get_wdc_reg(WDC_CMDPHASE);
-        if (rvalue != rvalue2)
-            errs |= WD_DETECT_ERR_INVALID;
-        if (cvalue != wvalue)
-            errs |= WD_DETECT_ERR_CMDPHASE;
-        wvalue = 0x5a;
+    if (scsi_wait_cip() == 0x100) {
+        INTERRUPTS_ENABLE();
+        if (XFER_IS_INTR(mode))
+            Permit();
+        if (XFER_IS_DMA(mode))
+            dma_cache_post(buf, &dlen);
+        return (-1);
     }
-    set_wdc_reg(WDC_CMDPHASE, ovalue);
-    INTERRUPTS_ENABLE();
+    (void) get_wdc_reg(WDC_SCSI_STAT);  // clear previous status
+    contr = BUS_READ8(SDMAC_CONTR);
 
-    rvalue = get_wdc_reg(WDC_SCSI_STAT);
-    switch (rvalue >> 4) {
-        case 0:
-            if ((rvalue & 0xf) > 1)
-                errs |= WD_DETECT_ERR_SCSI_STAT;
-            break;
-        case 1:
-            if ((rvalue & 0xf) == 7)  // reserved
-                errs |= WD_DETECT_ERR_SCSI_STAT;
-            break;
-        case 2:
-            if ((rvalue & 0xf) == 6)  // reserved
-                errs |= WD_DETECT_ERR_SCSI_STAT;
+    scsi_set_cdb(cdb, cdblen);
+    set_wdc_reg(WDC_LUN, lun);
+    set_wdc_reg(WDC_DST_ID, target | WDC_DST_ID_DPD);
+    set_wdc_reg(WDC_SRC_ID, 0);  // Disable reselection
+    set_wdc_reg(WDC_SYNC_TX, 0);  // async
+    set_wdc_reg(WDC_TPERIOD, SBIC_TIMEOUT(scsi_sel_msec));
+    set_wdc_reg(WDC_CMDPHASE, 0);
+    set_wdc_reg(WDC_CONTROL, (XFER_IS_DMA(mode) ? WDC_CONTROL_DMA : 0) |
+                             WDC_CONTROL_IDI | WDC_CONTROL_EDI);
+    scsi_set_transfer_len(len);
+
+    if (XFER_IS_DMA(mode)) {
+        BUS_WRITE32(RAMSEY_ACR, (uint32_t) paddr);
+        /* SCSI to memory */
+        BUS_WRITE8(SDMAC_CONTR,
+                   SDMAC_CONTR_PMODE | (contr & SDMAC_CONTR_INTEN));
+        BUS_WRITE8(SDMAC_ST_DMA, 0);
+    }
+    if (XFER_IS_INTR(mode))
+        lat_isr.armed = 1;
+    set_wdc_reg(WDC_CMD, WDC_CMD_SEL_ATN_XFER);
+
+    switch (mode) {
+        case XFER_PIO:
+            for (timeout = 500000; timeout > 0; timeout--) {
+                auxst = get_wdc_reg(WDC_AUXST);
+                if (auxst & WDC_AUXST_DBR) {
+                    uint8_t value = get_wdc_reg(WDC_DATA);
+                    if (pos < len)
+                        dst[pos++] = value;
+                    timeout = 500000;
+                } else if (auxst & WDC_AUXST_INT) {
+                    break;
+                }
+            }
+            if (timeout == 0)
+                auxst = 0x100;
             break;
-        case 4:
+        case XFER_DMA:
+            auxst = scsi_wait_limit(WDC_AUXST_INT, 1,
+                                    XFER_WAIT_MSEC(len) * 1000);
             break;
-        case 8:
-            if ((rvalue & 0xf) == 6)  // reserved
-                errs |= WD_DETECT_ERR_SCSI_STAT;
+        case XFER_PIO_INTR:
+            INTERRUPTS_ENABLE();
+            for (timeout = 500000; (timeout > 0) && (lat_isr.fired == 0);
+                 timeout--) {
+                if (get_wdc_reg(WDC_AUXST) & WDC_AUXST_DBR) {
+                    uint8_t value = get_wdc_reg(WDC_DATA);
+                    if (pos < len)
+                        dst[pos++] = value;
+                    timeout = 500000;
+                }
+            }
+            Permit();
+            if ((timeout == 0) || lat_wait(XFER_WAIT_MSEC(len)))
+                auxst = 0x100;
+            INTERRUPTS_DISABLE();
             break;
-        default:
-            /* Only one status bit may be set */
-            errs |= WD_DETECT_ERR_SCSI_STAT;
+        case XFER_DMA_INTR:
+            INTERRUPTS_ENABLE();
+            Permit();
+            if (lat_wait(XFER_WAIT_MSEC(len)))
+                auxst = 0x100;
+            INTERRUPTS_DISABLE();
             break;
     }
-    if ((errs & WD_DETECT_ERR_SCSI_STAT) && flag_debug)
-        printf("Got %02x for SCSI_STAT\n", rvalue);
+    lat_isr.armed = 0;
+    if (XFER_IS_INTR(mode) && (auxst != 0x100))
+        sstat = lat_isr.sstat;  // Server already cleared the interrupt
+    else
+        sstat = get_wdc_reg(WDC_SCSI_STAT);
+    status = get_wdc_reg(WDC_LUN);  // Target status byte
 
-    if (errs == 0) {
-        /* Attempt write of read-only AUXST */
-        rvalue = get_wdc_reg(WDC_AUXST);
-        set_wdc_reg(WDC_AUXST, ~rvalue);
-        if (get_wdc_reg(WDC_AUXST) != rvalue) {
-            set_wdc_reg(WDC_AUXST, rvalue);
-            errs |= WD_DETECT_ERR_AUXST_WRITABLE;
-        }
+    if (XFER_IS_DMA(mode)) {
+        /* Drain the FIFO to memory, then stop DMA */
+        BUS_WRITE8(SDMAC_FLUSH, 0);
+        for (timeout = 10000; timeout > 0; timeout--)
+            if (BUS_READ8(SDMAC_ISTR) & SDMAC_ISTR_FIFOE)
+                break;
+        BUS_WRITE8(SDMAC_CLR_INT, 0);
+        BUS_WRITE8(SDMAC_SP_DMA, 0);
+        BUS_WRITE8(SDMAC_CONTR, contr);
     }
+    set_wdc_reg(WDC_CONTROL, WDC_CONTROL_IDI | WDC_CONTROL_EDI);
 
-    if (errs) {
-        wd_level = LEVEL_UNKNOWN;
-        goto fail;
+    if (auxst == 0x100) {
+        /* Target is hung: get the WDC back to a known state */
+        scsi_soft_reset(0);
+        (void) get_wdc_reg(WDC_SCSI_STAT);
     }
+    INTERRUPTS_ENABLE();
+    if (XFER_IS_DMA(mode))
+        dma_cache_post(buf, &dlen);
 
-    INTERRUPTS_DISABLE();
+    if ((auxst != 0x100) && (sstat == WDC_SSTAT_SEL_TIMEOUT))
+        return (SCSI_SEL_TIMEOUT);
+    if ((auxst == 0x100) || (sstat != WDC_SSTAT_SAT_COMPLETE)) {
+        if (flag_debug)
+            printf(">> SAT failed auxst=%x sstat=%02x\n", auxst, sstat);
+        return (-1);
+    }
+    return (status);
+}
 
-    /*
-     * Official way to detect the WD33C93A vs the WD33C93:
-     *
-     * Enable in WDC_OWN_ID:
-     *      Bit 3 - EAF Advanced Features
-     *      Bit 5 - EIH Enable Immediate Halt (WD33C93A)
-     *              RAF Really Advanced Features (WD33C93B)
-     * and from there hit the controller with a reset.
-     * If the SCSI Status Register has a value of 0x01, then
-     * the WD33C93A or WD33C93B is present.
-     */
-    scsi_soft_reset(1);
-    rvalue = get_wdc_reg(WDC_SCSI_STAT);
-    if (rvalue == 0x00) {
-        /* Does not support advanced features */
-        wd_level = LEVEL_WD33C93;
-    } else if (rvalue == 0x01) {
-        /* Supports advanced features: A or B part */
-        wd_level = LEVEL_WD33C93A;
-    } else {
-        /* Bad part? */
-        wd_level = LEVEL_UNKNOWN;
-        errs |= WD_DETECT_ERR_RESET_STATUS;
-        INTERRUPTS_ENABLE();
+/*
+ * Read benchmark
+ *
+ * The same workload is run through scsi.device (CMD_READ and HD_SCSICMD,
+ * with several requests outstanding) and through scsi_xfer_cmd(). The
+ * workload definition and request generator are shared, so both paths
+ * read exactly the same blocks in the same order.
+ */
+#define BENCH_DEVICE     "scsi.device"
+#define BENCH_MAX_DEPTH  8
+
+typedef struct {
+    uint     unit;         // scsi.device unit (target + lun * 10)
+    uint32_t start_lba;    // First block read
+    uint32_t blocks;       // Total blocks to read
+    uint32_t xfer_blocks;  // Blocks per request
+    uint     depth;        // Outstanding requests (scsi.device path)
+} bench_workload_t;
+
+typedef struct {
+    uint32_t bytes;        // Bytes transferred
+    uint32_t ticks;        // Elapsed E clock ticks
+    uint32_t lat_avg;      // Average request latency (usec)
+    uint32_t lat_p50;      // Median request latency (usec)
+    uint32_t lat_p99;      // 99th percentile request latency (usec)
+    uint     errors;       // Failed requests
+    uint32_t cache_ticks;  // E clock ticks in DMA cache maintenance
+} bench_result_t;
+
+static uint
+bench_requests(const bench_workload_t *wl)
+{
+    return ((wl->blocks + wl->xfer_blocks - 1) / wl->xfer_blocks);
+}
+
+/* Returns the first block and block count of request number req */
+static uint32_t
+bench_req_lba(const bench_workload_t *wl, uint req, uint *blocks)
+{
+    uint32_t offset = req * wl->xfer_blocks;
+    *blocks = wl->blocks - offset;
+    if (*blocks > wl->xfer_blocks)
+        *blocks = wl->xfer_blocks;
+    return (wl->start_lba + offset);
+}
+
+static void
+bench_finish(bench_result_t *res, const stat_t *lat, uint efreq)
+{
+    if (lat->count == 0)
+        return;
+    res->lat_avg = stat_usec(stat_mean(lat), efreq);
+    res->lat_p50 = stat_usec(stat_quantile(lat, 0), efreq);
+    res->lat_p99 = stat_usec(stat_quantile(lat, 2), efreq);
+}
+
+/*
+ * bench_os
+ * --------
+ * Runs the workload through scsi.device with wl->depth requests kept
+ * outstanding. Request latencies are added to lat in E clock ticks.
+ */
+static int
+bench_os(const bench_workload_t *wl, uint use_scsicmd, bench_result_t *res,
+         stat_t *lat)
+{
+    struct MsgPort  *port;
+    struct IOStdReq *io[BENCH_MAX_DEPTH];
+    struct SCSICmd   scmd[BENCH_MAX_DEPTH];
+    uint8_t          cdb[BENCH_MAX_DEPTH][10];
+    uint8_t          sense[BENCH_MAX_DEPTH][18];
+    void            *buf[BENCH_MAX_DEPTH];
+    uint32_t         submit[BENCH_MAX_DEPTH];
+    uint8_t          busy[BENCH_MAX_DEPTH];
+    struct Message  *msg;
+    uint             xfer = wl->xfer_blocks * SCSI_BLOCK_SIZE;
+    uint             nreq = bench_requests(wl);
+    uint             next = 0;
+    uint             done = 0;
+    uint             active = 0;
+    uint             pos;
+    uint32_t         start;
+    int              rc = 0;
+
+    memset(io, 0, sizeof (io));
+    memset(buf, 0, sizeof (buf));
+    memset(busy, 0, sizeof (busy));
+    port = CreateMsgPort();
+    if (port == NULL)
+        return (1);
+    for (pos = 0; pos < wl->depth; pos++) {
+        io[pos]  = (struct IOStdReq *) CreateIORequest(port, sizeof (**io));
+        buf[pos] = AllocMem(xfer, MEMF_PUBLIC);
+        if ((io[pos] == NULL) || (buf[pos] == NULL)) {
+            printf("Failed to allocate I/O request\n");
+            rc = 1;
+            goto fail;
+        }
+    }
+    if (OpenDevice(BENCH_DEVICE, wl->unit, (struct IORequest *) io[0], 0)) {
+        printf("Failed to open %s unit %u\n", BENCH_DEVICE, wl->unit);
+        rc = 1;
         goto fail;
     }
+    for (pos = 1; pos < wl->depth; pos++) {
+        io[pos]->io_Device = io[0]->io_Device;
+        io[pos]->io_Unit   = io[0]->io_Unit;
+    }
 
-    if (wd_level == LEVEL_WD33C93A) {
-        /*
-         * Could be WD33C93A or WD33C93B or compatible chip at this point.
-         *
-         * Try to detect WD33C93B by changing the QUETAG register. If the
-         * new value sticks, this part is a WD33C93B.
-         */
-        cvalue = get_wdc_reg(WDC_CONTROL);
-        ovalue = get_wdc_reg(WDC_QUETAG);
-        for (pass = 4; pass > 0; pass--) {
-            switch (pass) {
-                case 4: wvalue = 0x00; break;
-                case 3: wvalue = 0xff; break;
-                case 2: wvalue = 0xa5; break;
-                case 1: wvalue = 0x5a; break;
-            }
-            set_wdc_reg(WDC_QUETAG, wvalue);
-            if (get_wdc_reg(WDC_CONTROL) != cvalue) {
-                break;  // Control register should remain the same
-            }
-            rvalue = get_wdc_reg(WDC_QUETAG);
-            if (rvalue != wvalue) {
-                break;
+    start = eclock_ticks();
+    while (done < nreq) {
+        /* Keep the queue full */
+        while ((active < wl->depth) && (next < nreq)) {
+            uint             blocks;
+            uint32_t         lba = bench_req_lba(wl, next, &blocks);
+            struct IOStdReq *req;
+
+            for (pos = 0; busy[pos]; pos++)
+                ;  // Find an idle request
+            req = io[pos];
+            if (use_scsicmd) {
+                scsi_build_read10(cdb[pos], lba, blocks);
+                memset(&scmd[pos], 0, sizeof (scmd[pos]));
+                scmd[pos].scsi_Data        = buf[pos];
+                scmd[pos].scsi_Length      = blocks * SCSI_BLOCK_SIZE;
+                scmd[pos].scsi_Command     = cdb[pos];
+                scmd[pos].scsi_CmdLength   = 10;
+                scmd[pos].scsi_Flags       = SCSIF_READ | SCSIF_AUTOSENSE;
+                scmd[pos].scsi_SenseData   = sense[pos];
+                scmd[pos].scsi_SenseLength = sizeof (sense[pos]);
+                req->io_Command = HD_SCSICMD;
+                req->io_Data    = &scmd[pos];
+                req->io_Length  = sizeof (scmd[pos]);
+            } else {
+                req->io_Command = CMD_READ;
+                req->io_Data    = buf[pos];
+                req->io_Length  = blocks * SCSI_BLOCK_SIZE;
+                req->io_Offset  = lba * SCSI_BLOCK_SIZE;
             }
+            busy[pos] = 1;
+            submit[pos] = eclock_ticks();
+            SendIO((struct IORequest *) req);
+            active++;
+            next++;
         }
-        set_wdc_reg(WDC_QUETAG, ovalue);
-        if (pass == 0) {
-            /* All QUETAG register tests passed */
-            wd_level = LEVEL_WD33C93B;
+
+        /* Collect completions */
+        WaitPort(port);
+        while ((msg = GetMsg(port)) != NULL) {
+            uint32_t now = eclock_ticks();
+            for (pos = 0; &io[pos]->io_Message != msg; pos++)
+                ;
+            stat_add(lat, now - submit[pos]);
+            done++;
+            busy[pos] = 0;
+            if (io[pos]->io_Error != 0)
+                res->errors++;
+            else if (use_scsicmd)
+                res->bytes += scmd[pos].scsi_Actual;
+            else
+                res->bytes += io[pos]->io_Actual;
+            active--;
         }
     }
-    if ((wd_level == LEVEL_WD33C93A) ||
-        (wd_level == LEVEL_WD33C93B)) {
-        /*
-         * This table is mostly assumptions by me:
-         *          Marking mcode  HW Revision
-         *   WD33C93A 00-01        A  / Not released? /
-         *   WD33C93A 00-02        B  / Not released? /
-         *   WD33C93A 00-03 06     C  Seen on ebay and on A2091
-         *   WD33C93A 00-04 06     D  Common in A3000
-         *   WD33C93A 00-05 07     E  / Not released? /
-         *   WD33C93A 00-06 08     E  Seen on ebay
-         *   WD33C93A 00-07 08     F  / Not released? /
-         *   WD33C93A 00-08 09     F  Final production; same as AM33C93A?
-         *
-         * Actual samples from my part stock
-         *                  mcode datecode
-         *   WD33C93  00-02 00    8849 115315200102
-         *   WD33C93A 00-03 00    8909
-         *   WD33C93A 00-04 00    9040 040315200102  9109 041816200102
-         *   WD33C93A 00-06 08    9018 058564200302
-         *   AM33C93A       08    9022 9009 1048EXA A  8950 1608EXA A
-         *   WD33C93A 00-08 09    9209 F 25933A5-3503  9205 F 25890A2-3503
-         *   WD33C93B 00-02 0d    1025 E 2513427-3702
-         */
+    res->ticks = eclock_ticks() - start;
+    CloseDevice((struct IORequest *) io[0]);
+
+fail:
+    for (pos = 0; pos < wl->depth; pos++) {
+        if (io[pos] != NULL)
+            DeleteIORequest((struct IORequest *) io[pos]);
+        if (buf[pos] != NULL)
+            FreeMem(buf[pos], xfer);
+    }
+    DeleteMsgPort(port);
+    return (rc);
+}
+
+/*
+ * bench_direct
+ * ------------
+ * Runs the workload through scsi_xfer_cmd(), one request at a time.
+ * Request latencies are added to lat in E clock ticks.
+ */
+static int
+bench_direct(const bench_workload_t *wl, bench_result_t *res, stat_t *lat)
+{
+    uint8_t  cdb[10];
+    uint     xfer = wl->xfer_blocks * SCSI_BLOCK_SIZE;
+    uint     nreq = bench_requests(wl);
+    uint     req;
+    uint32_t start;
+    uint32_t submit;
+    void    *buf;
+
+    buf = AllocMem(xfer, MEMF_PUBLIC);
+    if (buf == NULL) {
+        printf("Failed to allocate %u byte buffer\n", xfer);
+        return (1);
+    }
+    dma_cache_ticks = 0;
+    start = eclock_ticks();
+    for (req = 0; req < nreq; req++) {
+        uint     blocks;
+        uint32_t lba = bench_req_lba(wl, req, &blocks);
+        scsi_build_read10(cdb, lba, blocks);
+        submit = eclock_ticks();
+        if (scsi_xfer_cmd(wl->unit % 10, wl->unit / 10, cdb, sizeof (cdb),
+                          buf, blocks * SCSI_BLOCK_SIZE, XFER_DMA) != 0) {
+            res->errors++;
+        } else {
+            res->bytes += blocks * SCSI_BLOCK_SIZE;
+        }
+        stat_add(lat, eclock_ticks() - submit);
+        if (is_user_abort())
+            break;
+    }
+    res->ticks = eclock_ticks() - start;
+    res->cache_ticks = dma_cache_ticks;
+    FreeMem(buf, xfer);
+    return (0);
+}
+
+static uint
+bench_kbps(const bench_result_t *res, uint efreq)
+{
+    if (res->ticks == 0)
+        return (0);
+    return ((uint64_t) res->bytes * efreq / 1024 / res->ticks);
+}
+
+static void
+bench_show(const char *name, const bench_result_t *res, uint efreq)
+{
+    printf("  %-22s %7u %9u %9u %9u", name, bench_kbps(res, efreq),
+           res->lat_avg, res->lat_p50, res->lat_p99);
+    if (res->errors)
+        printf("  %u errors", res->errors);
+    printf("\n");
+}
+
+/*
+ * Performance baseline
+ *
+ * With -B, each -b run is compared against the stored baseline for the
+ * same drive and workload, and then added to it. Each metric is kept as
+ * a count, sum, and sum of squares, from which the mean and standard
+ * deviation are derived. A metric is reported as regressed when it is
+ * worse than the mean by more than the tolerance percentage, or by more
+ * than three standard deviations if that is larger, so that normally
+ * noisy metrics do not raise false alarms. Regressed runs are not added
+ * to the baseline. After BL_MAX_RUNS runs, older runs are given
+ * progressively less weight so the baseline can follow slow changes.
+ *
+ * The file lives in ENVARC: so it stays with the machine. It is a
+ * bl_hdr_t followed by bl_entry_t records in native byte order.
+ */
+#define BL_FILE         "ENVARC:sdmac.baseline"
+#define BL_MAGIC        0x5344626c  // "SDbl"
+#define BL_VERSION      1
+#define BL_MAX_ENTRIES  32
+#define BL_MAX_RUNS     32
+#define BL_DEF_TOL      10          // Percent
+#define BL_METRICS      5
+
+typedef struct {
+    uint32_t magic;       // BL_MAGIC
+    uint16_t version;     // BL_VERSION
+    uint16_t entry_size;  // sizeof (bl_entry_t)
+    uint32_t count;       // Number of entries which follow
+} bl_hdr_t;
+
+typedef struct {
+    uint64_t sum;         // Sum of samples
+    uint64_t sumsq;       // Sum of squares of samples
+} bl_stat_t;
+
+typedef struct {
+    char      drive[SNAP_DRIVE];  // INQUIRY vendor and product
+    uint8_t   unit;               // scsi.device unit
+    uint8_t   depth;              // Outstanding requests
+    uint16_t  xfer_kb;            // KB per request
+    uint16_t  wdc_khz;            // WDC clock of the last run added
+    uint16_t  runs;               // Weighted number of runs
+    bl_stat_t stat[3][BL_METRICS];  // By path, then bl_metrics[]
+} bl_entry_t;
+
+static const struct {
+    const char *name;
+    uint8_t     higher_is_better;
+} bl_metrics[BL_METRICS] = {
+    { "KB/s",     1 },
+    { "req/s",    1 },
+    { "avg usec", 0 },
+    { "p50 usec", 0 },
+    { "p99 usec", 0 },
+};
 
-        /*
-         * The microcode version can be obtained by enabling the
-         * RAF bit in OWN_ID and then forcing a reset. The value
-         * is stored in the CDB1 register.
-         */
-        scsi_soft_reset(2);
-        wd_rev_value = get_wdc_reg(WDC_CDB1);
-    }
-    scsi_soft_reset(0);
+static uint bl_tolerance;     // -B tolerance percent, 0 if not enabled
+static uint bl_reset;         // -BB: discard stored baseline first
 
-    if (wd_level == LEVEL_WD33C93A) {
-        switch (wd_rev_value) {
-            case 0x00:
-                wd_rev = " 00-04 or 00-03";
-                break;
-            case 0x08:
-                wd_rev = " 00-06 or AM33C93A";
-                break;
-            case 0x09:
-                wd_rev = " 00-08";
-                break;
-        }
-    }
-    if (wd_level == LEVEL_WD33C93B) {
-        wd_rev = "";
-    }
-    INTERRUPTS_ENABLE();
+static void
+bl_sample(const bench_result_t *res, uint nreq, uint efreq,
+          uint32_t *sample)
+{
+    sample[0] = bench_kbps(res, efreq);
+    sample[1] = (res->ticks == 0) ? 0 :
+                (uint64_t) nreq * efreq / res->ticks;
+    sample[2] = res->lat_avg;
+    sample[3] = res->lat_p50;
+    sample[4] = res->lat_p99;
+}
 
-fail:
-    switch (wd_level) {
-        case LEVEL_UNKNOWN:
-            printf("Not detected:");
-            if (errs & WD_DETECT_ERR_INVALID)
-                printf(" INVALID");
-            if (errs & WD_DETECT_ERR_AUXST)
-                printf(" AUXST");
-            if (errs & WD_DETECT_ERR_CMDPHASE)
-                printf(" CMDPHASE");
-            if (errs & WD_DETECT_ERR_SCSI_STAT)
-                printf(" SCSI_STAT");
-            if (errs & WD_DETECT_ERR_RESET_STATUS)
-                printf(" RESET_STATUS");
-            break;
-        case LEVEL_WD33C93:
-            printf("WD33C93");
-            break;
-        case LEVEL_WD33C93A:
-            printf("WD33C93A%s microcode %02x", wd_rev, wd_rev_value);
-            break;
-        case LEVEL_WD33C93B:
-            printf("WD33C93B microcode %02x", wd_rev_value);
-            break;
+/*
+ * bl_check_metric
+ * ---------------
+ * Returns non-zero if the sample is worse than the baseline by more
+ * than the allowed amount. The mean and allowed deviation are returned.
+ */
+static int
+bl_check_metric(const bl_stat_t *st, uint runs, uint metric,
+                uint32_t sample, uint32_t *mean, uint32_t *allowed)
+{
+    uint64_t var = 0;
+    uint32_t sdev3;
+
+    *mean = st->sum / runs;
+    if (runs > 1) {
+        uint64_t sq = (uint64_t) *mean * *mean * runs;
+        if (st->sumsq > sq)
+            var = (st->sumsq - sq) / (runs - 1);
     }
-    if (wd_level != LEVEL_UNKNOWN) {
-        wdc_khz = calc_wdc_clock() + 50;
-        if (wdc_khz >= 1000) {
-            printf(", %u.%u MHz", wdc_khz / 1000, (wdc_khz % 1000) / 100);
+    *allowed = (uint64_t) *mean * bl_tolerance / 100;
+    sdev3 = isqrt64(var) * 3;
+    if ((runs >= 3) && (*allowed < sdev3))
+        *allowed = sdev3;
+    if (bl_metrics[metric].higher_is_better)
+        return (sample + *allowed < *mean);
+    return (sample > *mean + *allowed);
+}
+
+static void
+bl_add(bl_entry_t *ent, const uint32_t sample[3][BL_METRICS])
+{
+    uint path;
+    uint metric;
+
+    for (path = 0; path < 3; path++) {
+        for (metric = 0; metric < BL_METRICS; metric++) {
+            bl_stat_t *st = &ent->stat[path][metric];
+            if (ent->runs >= BL_MAX_RUNS) {
+                /* Drop the weight of one average run */
+                st->sum   -= st->sum / ent->runs;
+                st->sumsq -= st->sumsq / ent->runs;
+            }
+            st->sum   += sample[path][metric];
+            st->sumsq += (uint64_t) sample[path][metric] *
+                         sample[path][metric];
         }
     }
-    printf("\n");
-    return (errs);
+    if (ent->runs < BL_MAX_RUNS)
+        ent->runs++;
+    ent->wdc_khz = wdc_khz;
 }
 
+/* Loads the baseline file, returning the number of entries */
 static uint
-show_wdc_config(void)
+bl_load(bl_entry_t *ents)
 {
-    const uint inclk_pal  = 28375 / 2;   // PAL frequency  28.37516 MHz
-    const uint inclk_ntsc = 28636 / 2;   // NTSC frequency 28.63636 MHz
-    uint       inclk      = inclk_ntsc;  // WD33C93A has ~14MHz clock on A3000
-    uint       control    = wdc_regs_store[WDC_CONTROL];
-    uint       tperiod    = wdc_regs_store[WDC_TPERIOD];
-    uint       syncreg    = wdc_regs_store[WDC_SYNC_TX];
-    uint       tperiodms;
-    uint       fsel_div   = 3;  // Assumption good for A3000 only (12-15 MHz)
-    uint       sync_tcycles;
-    uint       syncoff;
-
-    if ((wdc_khz > 14000) && (wdc_khz < 14250))
-        inclk = inclk_pal;
-    else if ((wdc_khz >= 14250) && (wdc_khz < 14450))
-        inclk = inclk_ntsc;
-    else
-        inclk = wdc_khz;
-    tperiodms  = tperiod * 80 * 1000 / inclk;
-#if 0
-    /*
-     * Unfortunately the FSEL bits are only valid across a reset.
-     * After that, the register may be used for SCSI CBD size.
-     *
-     * We could probably determine what FSEL was set to by first
-     * forcing a timeout of a specific period, and measuring how long
-     * that took, then calculate the SCSI clock using our own
-     * FSEL, and then from that would be able to report what FSEL
-     * was originally programmed to.
-     */
-    uint own_id   = get_wdc_reg(WDC_OWN_ID);
-    uint fsel     = own_id >> 6;
-    uint fsel_div = 1;
+    bl_hdr_t hdr;
+    FILE    *fp = fopen(BL_FILE, "rb");
+    uint     count = 0;
 
-    switch (fsel) {
-        case 0:
-            fsel_div = 2;
-            break;
-        case 1:
-            fsel_div = 3;
-            break;
-        case 2:
-            fsel_div = 4;
-            break;
-        default:
-            printf("                     Invalid WDC FSEL: %x\n", fsel);
-            fsel_div = 0;
-            break;
+    if (fp == NULL)
+        return (0);
+    if ((fread(&hdr, sizeof (hdr), 1, fp) == 1) &&
+        (hdr.magic == BL_MAGIC) && (hdr.version == BL_VERSION) &&
+        (hdr.entry_size == sizeof (bl_entry_t))) {
+        count = (hdr.count > BL_MAX_ENTRIES) ? BL_MAX_ENTRIES : hdr.count;
+        count = fread(ents, sizeof (*ents), count, fp);
+    } else {
+        printf("Ignoring %s: unknown format\n", BL_FILE);
     }
-#endif
+    fclose(fp);
+    return (count);
+}
 
-    printf("WDC Configuration:   ");
+static int
+bl_save(const bl_entry_t *ents, uint count)
+{
+    bl_hdr_t hdr;
+    FILE    *fp = fopen(BL_FILE, "wb");
 
-    switch (control >> 5) {
-        case 0:  printf("Polled Mode"); break;
-        case 1:  printf("Burst Mode");  break;
-        case 2:  printf("WD Bus Mode"); break;
-        case 4:  printf("DMA Mode");    break;
-        default: printf("Unknown Bus Mode (%d)", control >> 5);
+    if (fp == NULL) {
+        printf("Failed to open %s\n", BL_FILE);
+        return (1);
+    }
+    hdr.magic      = BL_MAGIC;
+    hdr.version    = BL_VERSION;
+    hdr.entry_size = sizeof (bl_entry_t);
+    hdr.count      = count;
+    if ((fwrite(&hdr, sizeof (hdr), 1, fp) != 1) ||
+        (fwrite(ents, sizeof (*ents), count, fp) != count)) {
+        printf("Failed to write %s\n", BL_FILE);
+        fclose(fp);
+        return (1);
+    }
+    fclose(fp);
+    return (0);
+}
+
+/*
+ * baseline_check
+ * --------------
+ * Compares the results of a -b run against the stored baseline for the
+ * drive and workload, then adds them to it unless something regressed.
+ * Returns non-zero if any metric regressed.
+ */
+static int
+baseline_check(const bench_workload_t *wl, const char * const *names,
+               const bench_result_t *res, uint nreq, uint efreq)
+{
+    static bl_entry_t ents[BL_MAX_ENTRIES];
+    uint32_t          sample[3][BL_METRICS];
+    bl_entry_t       *ent = NULL;
+    uint              count = bl_load(ents);
+    uint              xfer_kb = wl->xfer_blocks * SCSI_BLOCK_SIZE / 1024;
+    uint              path;
+    uint              metric;
+    uint              regressed = 0;
+
+    for (path = 0; path < 3; path++)
+        bl_sample(&res[path], nreq, efreq, sample[path]);
+
+    for (path = 0; path < count; path++) {
+        if ((memcmp(ents[path].drive, bench_result_drive,
+                    sizeof (ents[path].drive)) == 0) &&
+            (ents[path].unit == wl->unit) &&
+            (ents[path].depth == wl->depth) &&
+            (ents[path].xfer_kb == xfer_kb)) {
+            ent = &ents[path];
             break;
+        }
+    }
+    if (ent == NULL) {
+        if (count == BL_MAX_ENTRIES) {
+            /* Replace the oldest entry */
+            memmove(&ents[0], &ents[1], sizeof (ents[0]) * --count);
+        }
+        ent = &ents[count++];
+        bl_reset = 1;
+    }
+    if (bl_reset) {
+        bl_reset = 0;  // Only for the first pass with -L
+        memset(ent, 0, sizeof (*ent));
+        memcpy(ent->drive, bench_result_drive, sizeof (ent->drive));
+        ent->unit    = wl->unit;
+        ent->depth   = wl->depth;
+        ent->xfer_kb = xfer_kb;
     }
-    printf(", %d msec timeout", tperiodms);
 
-    /* syncoff = 0 for Asynchronous mode */
-    syncoff = syncreg & 0xf;
-    if (syncoff == 0) {
-        printf(", Async");
+    if (ent->runs == 0) {
+        printf("Starting new baseline in %s\n", BL_FILE);
     } else {
-        uint sync_khz;
-        uint freq_mul;
-        printf(", Offset %d", syncoff);
-        if (syncoff > 12)
-            printf(" (BAD)");
-
-        if (wd_level == LEVEL_WD33C93) {
-            sync_tcycles = (syncreg >> 4) & 0x7;
-        } else {
-            /* WD33C93A and WD33C93B */
-            switch ((syncreg >> 4) & 0x7) {
-                default:
-                case 0:
-                case 1: sync_tcycles = 8; break;
-                case 2: sync_tcycles = 2; break;
-                case 3: sync_tcycles = 3; break;
-                case 4: sync_tcycles = 4; break;
-                case 5: sync_tcycles = 5; break;
-                case 6: sync_tcycles = 6; break;
-                case 7: sync_tcycles = 7; break;
+        printf("Baseline of %u runs, tolerance %u%%\n", ent->runs,
+               bl_tolerance);
+        if ((ent->wdc_khz != 0) && (ent->wdc_khz != wdc_khz)) {
+            printf("  WDC clock changed: %u.%03u MHz, was %u.%03u MHz\n",
+                   wdc_khz / 1000, wdc_khz % 1000,
+                   ent->wdc_khz / 1000, ent->wdc_khz % 1000);
+        }
+        for (path = 0; path < 3; path++) {
+            for (metric = 0; metric < BL_METRICS; metric++) {
+                uint32_t mean;
+                uint32_t allowed;
+                if (bl_check_metric(&ent->stat[path][metric], ent->runs,
+                                    metric, sample[path][metric],
+                                    &mean, &allowed)) {
+                    printf("  REGRESSED %s %s: %u, baseline %u +/- %u\n",
+                           names[path], bl_metrics[metric].name,
+                           sample[path][metric], mean, allowed);
+                    regressed++;
+                }
             }
         }
+        if (regressed == 0)
+            printf("  All metrics within baseline\n");
+    }
+    if (regressed != 0) {
+        printf("Run not added to baseline (-BB to start a new one)\n");
+        return (1);
+    }
+    bl_add(ent, (const uint32_t (*)[BL_METRICS]) sample);
+    return (bl_save(ents, count));
+}
 
-        if ((wd_level == LEVEL_WD33C93B) &&
-            (fsel_div == 4)) {
-            uint fss_mode = (syncreg & BIT(7)) ? 1 : 0;
-            freq_mul = 1 + fss_mode;
-            fsel_div = 2;
-        } else {
-            freq_mul = 2;
+/*
+ * bench_compare
+ * -------------
+ * Runs the read workload through each path and reports throughput and
+ * latency, and the overhead of the scsi.device paths relative to the
+ * direct path.
+ */
+static int
+bench_compare(const bench_workload_t *wl)
+{
+    static const char * const names[] = {
+        "scsi.device CMD_READ", "scsi.device HD_SCSICMD", "direct SDMAC DMA"
+    };
+    bench_result_t res[ARRAY_SIZE(names)];
+    uint8_t        cdb[6];
+    uint8_t        inq[36];
+    stat_t         lat;
+    uint           nreq = bench_requests(wl);
+    uint           efreq = get_eclock_freq();
+    uint           direct_kbps;
+    uint           path;
+    int            rc = 0;
+
+    if (ctrl->type != CTRL_A3000) {
+        printf("Direct path is only implemented for the A3000 SDMAC\n");
+        return (1);
+    }
+    memset(res, 0, sizeof (res));
+    memset(bench_result_kbps, 0, sizeof (bench_result_kbps));
+    memset(bench_result_p99, 0, sizeof (bench_result_p99));
+    memset(bench_result_drive, 0, sizeof (bench_result_drive));
+
+    memset(cdb, 0, sizeof (cdb));
+    cdb[0] = SCSI_INQUIRY;
+    cdb[4] = sizeof (inq);
+    if (scsi_xfer_cmd(wl->unit % 10, wl->unit / 10, cdb, sizeof (cdb), inq,
+                      sizeof (inq), XFER_PIO) == 0) {
+        memcpy(bench_result_drive, inq + 8, sizeof (bench_result_drive));
+        printf("%.*s\n", SNAP_DRIVE, bench_result_drive);
+    }
+    printf("Read unit %u: %u KB from block %u in %u KB requests, "
+           "%u outstanding via %s\n", wl->unit,
+           wl->blocks * SCSI_BLOCK_SIZE / 1024, wl->start_lba,
+           wl->xfer_blocks * SCSI_BLOCK_SIZE / 1024, wl->depth, BENCH_DEVICE);
+    printf("  Path                      KB/s  avg usec  p50 usec  p99 usec\n");
+    for (path = 0; path < ARRAY_SIZE(names); path++) {
+        stat_init(&lat);
+        if (path < 2)
+            rc = bench_os(wl, path, &res[path], &lat);
+        else
+            rc = bench_direct(wl, &res[path], &lat);
+        if (rc != 0)
+            break;
+        bench_finish(&res[path], &lat, efreq);
+        bench_show(names[path], &res[path], efreq);
+        bench_result_kbps[path] = bench_kbps(&res[path], efreq);
+        bench_result_p99[path]  = res[path].lat_p99;
+        if (is_user_abort()) {
+            printf("^C Abort\n");
+            rc = 1;
+            break;
         }
-        sync_khz = freq_mul * inclk / fsel_div / sync_tcycles;
-        printf(", Sync %d.%03d MHz", sync_khz / 1000, sync_khz % 1000);
-#ifdef DEBUG_SYNC_CALC
-        printf("\ninclk=%uKHz mul=%u div=%u tcycles=%u\n",
-               inclk, freq_mul, fsel_div, sync_tcycles);
-#endif
     }
-    printf("\n\n");
+    if (rc != 0)
+        return (rc);
+
+    direct_kbps = bench_kbps(&res[2], efreq);
+    if (direct_kbps != 0) {
+        printf("  scsi.device overhead:   CMD_READ %d%%, HD_SCSICMD %d%% "
+               "throughput; %d / %d usec per request\n",
+               (int) (bench_kbps(&res[0], efreq) * 100 / direct_kbps) - 100,
+               (int) (bench_kbps(&res[1], efreq) * 100 / direct_kbps) - 100,
+               (int) (res[0].lat_avg - res[2].lat_avg),
+               (int) (res[1].lat_avg - res[2].lat_avg));
+    }
+    if ((res[2].ticks != 0) && (nreq != 0)) {
+        printf("  Direct DMA cache maintenance: %u usec per request, "
+               "%u%% of time\n",
+               (uint) ((uint64_t) res[2].cache_ticks * 1000000 / efreq / nreq),
+               (uint) ((uint64_t) res[2].cache_ticks * 100 / res[2].ticks));
+    }
+    if ((res[0].errors + res[1].errors + res[2].errors) != 0)
+        return (1);
+    if (bl_tolerance != 0)
+        return (baseline_check(wl, names, res, nreq, efreq));
     return (0);
 }
 
-static uint32_t test_values[] = {
-    0x00000000, 0xffffffff, 0xa5a5a5a5, 0x5a5a5a5a, 0xc3c3c3c3, 0x3c3c3c3c,
-    0xd2d2d2d2, 0x2d2d2d2d, 0x4b4b4b4b, 0xb4b4b4b4, 0xe1e1e1e1, 0x1e1e1e1e,
-    0x87878787, 0x78787878, 0xffff0000, 0x0000ffff, 0xff00ff00, 0x00ff00ff,
-    0xf0f0f0f0, 0x0f0f0f0f,
-};
+/*
+ * Transfer mode comparison
+ *
+ * The same reads are done with the CPU moving data and polling for
+ * completion, with the CPU moving data and completion by interrupt, and
+ * with SDMAC DMA and completion by interrupt. CPU use is measured by a
+ * lowest priority task which counts loop iterations; its rate with the
+ * system otherwise idle is taken first as the 0% reference.
+ */
+#define IDLE_CALIBRATE_TICKS 25  // Delay() ticks (1/50 sec)
+
+static volatile uint32_t idle_count;
+static volatile uint8_t  idle_stop;
+static volatile uint8_t  idle_done;
+
+static void
+idle_task(void)
+{
+    while (idle_stop == 0)
+        idle_count++;
+    Forbid();
+    idle_done = 1;
+}
+
+/*
+ * idle_start
+ * ----------
+ * Starts the idle counting task and measures its rate with nothing else
+ * running. The rate is returned in *rate as idle_count increments per
+ * E clock tick, scaled by 2^16.
+ */
+static struct Task *
+idle_start(uint64_t *rate)
+{
+    struct Task *idle;
+    uint32_t     start;
+    uint32_t     count;
+
+    idle_stop = 0;
+    idle_done = 0;
+    idle = task_start("sdmac idle", -128, idle_task);
+    if (idle == NULL)
+        return (NULL);
+
+    start = eclock_ticks();
+    count = idle_count;
+    Delay(IDLE_CALIBRATE_TICKS);
+    *rate = ((uint64_t) (idle_count - count) << 16) /
+            (eclock_ticks() - start);
+    if (*rate == 0)
+        *rate = 1;
+    return (idle);
+}
+
+static void
+idle_stop_wait(struct Task *idle)
+{
+    idle_stop = 1;
+    task_free(idle, &idle_done);
+}
 
 static int
-test_sdmac_wtc(void)
+xfer_mode_compare(const bench_workload_t *wl)
 {
-    int errs = 0;
-    int pos;
-    uint32_t ovalue;
-    uint32_t rvalue;
-    uint32_t wvalue;
+    static const struct {
+        const char *name;
+        uint        mode;
+    } modes[] = {
+        { "Polled PIO",    XFER_PIO },
+        { "Interrupt PIO", XFER_PIO_INTR },
+        { "Interrupt DMA", XFER_DMA_INTR },
+    };
+    struct Interrupt server;
+    struct Task     *idle;
+    uint8_t          cdb[10];
+    uint8_t          contr;
+    int8_t           sigbit;
+    uint             xfer = wl->xfer_blocks * SCSI_BLOCK_SIZE;
+    uint             nreq = bench_requests(wl);
+    uint             efreq = get_eclock_freq();
+    uint             mode;
+    uint             req;
+    uint64_t         idle_rate;  // idle_count per E clock tick << 16
+    uint32_t         start;
+    uint32_t         count;
+    void            *buf;
+    int              rc = 0;
+
+    if (ctrl->type != CTRL_A3000) {
+        printf("Transfer modes are only implemented for the A3000 SDMAC\n");
+        return (1);
+    }
+    buf = AllocMem(xfer, MEMF_PUBLIC);
+    sigbit = AllocSignal(-1);
+    if ((buf == NULL) || (sigbit == -1)) {
+        printf("Failed to allocate buffer or signal\n");
+        if (buf != NULL)
+            FreeMem(buf, xfer);
+        return (1);
+    }
+    if (lat_timer_open()) {
+        FreeSignal(sigbit);
+        FreeMem(buf, xfer);
+        return (1);
+    }
+    idle = idle_start(&idle_rate);
+    if (idle == NULL) {
+        printf("Failed to start idle task\n");
+        lat_timer_close();
+        FreeSignal(sigbit);
+        FreeMem(buf, xfer);
+        return (1);
+    }
 
+    memset(&server, 0, sizeof (server));
+    server.is_Node.ln_Type = NT_INTERRUPT;
+    server.is_Node.ln_Pri  = 127;
+    server.is_Node.ln_Name = "sdmac xfer";
+    server.is_Code         = (void (*)(void)) lat_server;
+    lat_isr.task    = FindTask(NULL);
+    lat_isr.sigmask = BIT(sigbit);
+    AddIntServer(INTB_PORTS, &server);
     INTERRUPTS_DISABLE();
-    ovalue = *ADDR32(SDMAC_WTC_ALT);
-    for (pos = 0; pos < ARRAY_SIZE(test_values); pos++) {
-        wvalue = test_values[pos] & 0x00ffffff;
-        *ADDR32(SDMAC_WTC_ALT) = wvalue;
-//      (void) *ADDR32(ROM_BASE);  // flush bus access
-        (void) *ADDR32(RAMSEY_VER);
-        rvalue = *ADDR32(SDMAC_WTC) & 0x00ffffff;
-        if (rvalue != wvalue) {
-            *ADDR32(SDMAC_WTC_ALT) = ovalue;
-            INTERRUPTS_ENABLE();
-            if (errs++ == 0)
-                printf("FAIL\n");
-            printf("  SDMAC WTC %08x != expected %08x\n", rvalue, wvalue);
-            INTERRUPTS_DISABLE();
-            ovalue = *ADDR32(SDMAC_WTC_ALT);
+    contr = CTRL_READ(ctrl->contr);
+    CTRL_WRITE(ctrl->contr, contr | ctrl->inten);
+    INTERRUPTS_ENABLE();
+
+    printf("Read unit %u: %u KB from block %u in %u KB commands\n",
+           wl->unit, wl->blocks * SCSI_BLOCK_SIZE / 1024, wl->start_lba,
+           xfer / 1024);
+    printf("  Mode              KB/s   CPU%%  WDC int/MB  L2 int/MB\n");
+    for (mode = 0; mode < ARRAY_SIZE(modes); mode++) {
+        bench_result_t res;
+        uint32_t       calls;
+        uint32_t       wdc_ints;
+        uint32_t       idle_ticks;
+        uint           cpu;
+        uint           mb_x16;
+
+        memset(&res, 0, sizeof (res));
+        lat_isr.calls = 0;
+        lat_isr.count = 0;
+        count = idle_count;
+        start = eclock_ticks();
+        for (req = 0; req < nreq; req++) {
+            uint     blocks;
+            uint32_t lba = bench_req_lba(wl, req, &blocks);
+            scsi_build_read10(cdb, lba, blocks);
+            if (scsi_xfer_cmd(wl->unit % 10, wl->unit / 10, cdb,
+                              sizeof (cdb), buf, blocks * SCSI_BLOCK_SIZE,
+                              modes[mode].mode) != 0) {
+                res.errors++;
+            } else {
+                res.bytes += blocks * SCSI_BLOCK_SIZE;
+            }
+            if (is_user_abort())
+                break;
+        }
+        res.ticks  = eclock_ticks() - start;
+        calls      = lat_isr.calls;
+        wdc_ints   = lat_isr.count;
+        idle_ticks = ((uint64_t) (idle_count - count) << 16) / idle_rate;
+        cpu = (idle_ticks >= res.ticks) ? 0 :
+              (uint) ((uint64_t) (res.ticks - idle_ticks) * 100 / res.ticks);
+        mb_x16 = res.bytes / 65536;
+        if (mb_x16 == 0)
+            mb_x16 = 1;
+
+        printf("  %-15s %6u %5u%% %11u %10u", modes[mode].name,
+               bench_kbps(&res, efreq), cpu, wdc_ints * 16 / mb_x16,
+               calls * 16 / mb_x16);
+        if (res.errors)
+            printf("  %u errors", res.errors);
+        printf("\n");
+        if (res.errors)
+            rc = 1;
+        if (req < nreq) {
+            printf("^C Abort\n");
+            rc = 1;
+            break;
         }
     }
-    *ADDR32(SDMAC_WTC_ALT) = ovalue;
+
+    INTERRUPTS_DISABLE();
+    CTRL_WRITE(ctrl->contr, contr);
+    dmac_clear_int();
     INTERRUPTS_ENABLE();
-    return (errs);
+    RemIntServer(INTB_PORTS, &server);
+    idle_stop_wait(idle);
+    lat_timer_close();
+    FreeSignal(sigbit);
+    FreeMem(buf, xfer);
+    return (rc);
 }
 
-static int
-test_sdmac_sspbdat(void)
+/*
+ * DMA alignment check
+ *
+ * The SDMAC is given destination addresses at each byte offset from 0 to
+ * 15, and transfer lengths exact and up to ALIGN_DELTA bytes shorter or
+ * longer. Each result is compared against the same data read by PIO into
+ * an aligned buffer, and guard bytes on either side of the destination
+ * are checked for stray writes. Odd lengths need a command whose data
+ * length is chosen by the initiator, so READ BUFFER is used when the
+ * drive supports it; otherwise only whole blocks are read with READ(10).
+ * The usual driver workaround for a misaligned buffer, DMA to an aligned
+ * bounce buffer and a CPU copy, is timed next to the direct transfer.
+ */
+#define SCSI_READ_BUFFER      0x3c
+#define READ_BUFFER_DATA      0x02
+#define READ_BUFFER_DESC      0x03
+#define ALIGN_OFFSETS         16
+#define ALIGN_DELTA           3     // Length varied by +/- this many bytes
+#define ALIGN_GUARD           16    // Guard bytes each side of destination
+#define ALIGN_GUARD_BYTE      0xa5
+#define ALIGN_REPS            8     // Timed reads per offset
+#define ALIGN_LEN_MAX         65536
+
+static void
+scsi_build_read_buffer(uint8_t *cdb, uint mode, uint len)
 {
-    int errs = 0;
-    int pos;
-    uint32_t ovalue;
-    uint32_t rvalue;
-    uint32_t wvalue;
+    memset(cdb, 0, 10);
+    cdb[0] = SCSI_READ_BUFFER;
+    cdb[1] = mode;
+    cdb[6] = len >> 16;
+    cdb[7] = len >> 8;
+    cdb[8] = len;
+}
 
-    INTERRUPTS_DISABLE();
-    ovalue = *ADDR32(SDMAC_SSPBDAT);
-    for (pos = 0; pos < ARRAY_SIZE(test_values); pos++) {
-        wvalue = test_values[pos] & 0x000000ff;
-        *ADDR32(SDMAC_SSPBDAT_ALT) = wvalue;
-        (void) *ADDR32(ROM_BASE);  // flush bus access
-        rvalue = *ADDR32(SDMAC_SSPBDAT) & 0x000000ff;
-        if (rvalue != wvalue) {
-            *ADDR32(SDMAC_SSPBDAT_ALT) = ovalue;
-            INTERRUPTS_ENABLE();
-            if (errs++ == 0)
-                printf("FAIL\n");
-            printf("  SDMAC SSPBDAT %02x != expected %02x\n", rvalue, wvalue);
-            INTERRUPTS_DISABLE();
-            ovalue = *ADDR32(SDMAC_SSPBDAT);
-        }
+static void
+align_build_cdb(uint8_t *cdb, uint rbuf, uint len)
+{
+    if (rbuf)
+        scsi_build_read_buffer(cdb, READ_BUFFER_DATA, len);
+    else
+        scsi_build_read10(cdb, 0, len / SCSI_BLOCK_SIZE);
+}
+
+/*
+ * align_classify
+ * --------------
+ * Compares len bytes at dst against the reference data and checks the
+ * guard bytes around them. Returns the result table character:
+ *     .  Correct
+ *     B  Bytes written before the destination
+ *     X  Data wrong
+ *     T  Data correct, but bytes missing at the tail
+ *     O  Bytes written past the end of the destination
+ */
+static char
+align_classify(const uint8_t *dst, const uint8_t *ref, uint len)
+{
+    uint pos;
+    uint bad;
+
+    for (pos = 1; pos <= ALIGN_GUARD; pos++)
+        if (dst[-(int) pos] != ALIGN_GUARD_BYTE)
+            return ('B');
+    for (bad = 0; bad < len; bad++)
+        if (dst[bad] != ref[bad])
+            break;
+    if (bad < len) {
+        if (len - bad > ALIGN_DELTA)
+            return ('X');
+        for (pos = bad; pos < len; pos++)
+            if (dst[pos] != ALIGN_GUARD_BYTE)
+                return ('X');
+        return ('T');
     }
-    *ADDR32(SDMAC_SSPBDAT_ALT) = ovalue;
-    INTERRUPTS_ENABLE();
-    return (errs);
+    for (pos = len; pos < len + ALIGN_GUARD; pos++)
+        if (dst[pos] != ALIGN_GUARD_BYTE)
+            return ('O');
+    return ('.');
 }
 
-static int
-test_ramsey_access(void)
+/*
+ * align_time
+ * ----------
+ * Times ALIGN_REPS DMA reads of len bytes to dst. If bounce is not NULL,
+ * each read is done to the bounce buffer and then copied to dst by the
+ * CPU. Returns the elapsed E clock ticks, or 0 if a read failed.
+ */
+static uint32_t
+align_time(uint target, uint lun, uint8_t *cdb, uint8_t *dst,
+           uint8_t *bounce, uint len)
 {
-    int pos;
-    uint32_t ovalue;
-    uint32_t wvalue;
-    uint32_t rvalue;
-    int errs = 0;
+    uint32_t start = eclock_ticks();
+    uint     rep;
 
-    printf("Ramsey test:  ");
-    fflush(stdout);
-    SUPERVISOR_STATE_ENTER();
-    INTERRUPTS_DISABLE();
-    ovalue = *ADDR32(RAMSEY_ACR);
-    for (pos = 0; pos < ARRAY_SIZE(test_values); pos++) {
-        wvalue = test_values[pos] & 0xfffffffc;
-        *ADDR32(RAMSEY_ACR_ALT) = wvalue;
-        (void) *ADDR32(ROM_BASE);  // flush bus access
-        rvalue = *ADDR32(RAMSEY_ACR);
-        if (rvalue != wvalue) {
-            *ADDR32(RAMSEY_ACR_ALT) = ovalue;
-            INTERRUPTS_ENABLE();
-            if (errs++ == 0)
-                printf("FAIL\n");
-            printf("  Ramsey ACR %08x != expected %08x\n", rvalue, wvalue);
-            INTERRUPTS_DISABLE();
-            ovalue = *ADDR32(RAMSEY_ACR);
+    for (rep = 0; rep < ALIGN_REPS; rep++) {
+        if (scsi_xfer_cmd(target, lun, cdb, 10,
+                          (bounce != NULL) ? bounce : dst, len,
+                          XFER_DMA) != 0) {
+            return (0);
         }
+        if (bounce != NULL)
+            CopyMem(bounce, dst, len);
     }
-    *ADDR32(RAMSEY_ACR_ALT) = ovalue;
-    INTERRUPTS_ENABLE();
-    SUPERVISOR_STATE_EXIT();
-    if (errs == 0)
-        printf("PASS\n");
-    return (errs);
+    return (eclock_ticks() - start);
 }
 
 static int
-test_sdmac_access(void)
+dma_align_check(uint unit, uint len)
 {
-    int errs = 0;
+    bench_result_t direct;
+    bench_result_t bounced;
+    uint8_t        cdb[10];
+    uint8_t        desc[4];
+    uint8_t       *area;
+    uint8_t       *base;
+    uint8_t       *ref;
+    uint8_t       *bounce;
+    uint           area_len = len + ALIGN_DELTA + 2 * ALIGN_GUARD +
+                              ALIGN_OFFSETS + 16;
+    uint           ref_len = len + ALIGN_DELTA;
+    uint           target = unit % 10;
+    uint           lun = unit / 10;
+    uint           efreq = get_eclock_freq();
+    uint           rbuf = 0;
+    uint           fails = 0;
+    uint           runs = 0;
+    uint           offset;
+    int            delta_max = 0;
+    int            delta;
+    int            status;
+    int            rc = 1;
+
+    if (ctrl->type != CTRL_A3000) {
+        printf("DMA alignment check is only implemented for the A3000 "
+               "SDMAC\n");
+        return (1);
+    }
+    area   = AllocMem(area_len, MEMF_PUBLIC);
+    ref    = AllocMem(ref_len, MEMF_PUBLIC);
+    bounce = AllocMem(ref_len, MEMF_PUBLIC);
+    if ((area == NULL) || (ref == NULL) || (bounce == NULL)) {
+        printf("Failed to allocate %u byte buffers\n", area_len);
+        goto done;
+    }
+    /* Offset 0 is 16-byte aligned, with room for the leading guard */
+    base = (uint8_t *) (((uintptr_t) area + ALIGN_GUARD + 15) & ~15);
+
+    scsi_build_read_buffer(cdb, READ_BUFFER_DESC, sizeof (desc));
+    status = scsi_xfer_cmd(target, lun, cdb, sizeof (cdb), desc,
+                           sizeof (desc), XFER_PIO);
+    if (status == SCSI_SEL_TIMEOUT) {
+        printf("Unit %u did not respond to selection\n", unit);
+        goto done;
+    }
+    if ((status == 0) &&
+        (((desc[1] << 16) | (desc[2] << 8) | desc[3]) >= ref_len)) {
+        rbuf = 1;
+        delta_max = ALIGN_DELTA;
+    } else if (len % SCSI_BLOCK_SIZE != 0) {
+        printf("Unit %u has no %u byte READ BUFFER: length must be a "
+               "multiple of %u\n", unit, ref_len, SCSI_BLOCK_SIZE);
+        goto done;
+    } else {
+        printf("Unit %u has no %u byte READ BUFFER: odd lengths skipped\n",
+               unit, ref_len);
+        ref_len = len;
+    }
 
-    printf("SDMAC test:   ");
-    fflush(stdout);
+    align_build_cdb(cdb, rbuf, ref_len);
+    if (scsi_xfer_cmd(target, lun, cdb, sizeof (cdb), ref, ref_len,
+                      XFER_PIO) != 0) {
+        printf("Reference PIO read failed\n");
+        goto done;
+    }
 
-    switch (sdmac_version) {
-        case 2:
-            errs = test_sdmac_wtc();
-            break;
-        case 4:
-            errs = test_sdmac_sspbdat();
-            break;
+    printf("DMA unit %u: %u bytes by %s, offsets 0-%u, lengths %+d to %+d\n",
+           unit, len, rbuf ? "READ BUFFER" : "READ(10)", ALIGN_OFFSETS - 1,
+           -delta_max, delta_max);
+    printf("  Offset  Lengths  Direct KB/s  Bounce KB/s\n");
+    for (offset = 0; offset < ALIGN_OFFSETS; offset++) {
+        char     results[2 * ALIGN_DELTA + 2];
+        uint8_t *dst = base + offset;
+        uint     pos = 0;
+
+        for (delta = -delta_max; delta <= delta_max; delta++) {
+            uint n = len + delta;
+            char result;
+
+            memset(dst - ALIGN_GUARD, ALIGN_GUARD_BYTE, n + 2 * ALIGN_GUARD);
+            align_build_cdb(cdb, rbuf, n);
+            if (scsi_xfer_cmd(target, lun, cdb, sizeof (cdb), dst, n,
+                              XFER_DMA) != 0) {
+                result = 'E';
+            } else {
+                result = align_classify(dst, ref, n);
+            }
+            if (result != '.')
+                fails++;
+            runs++;
+            results[pos++] = result;
+        }
+        results[pos] = '\0';
+
+        memset(&direct, 0, sizeof (direct));
+        memset(&bounced, 0, sizeof (bounced));
+        align_build_cdb(cdb, rbuf, len);
+        direct.ticks = align_time(target, lun, cdb, dst, NULL, len);
+        direct.bytes = len * ALIGN_REPS;
+        printf("  %6u  %-7s  %11u", offset, results,
+               bench_kbps(&direct, efreq));
+        if (offset & 3) {
+            bounced.ticks = align_time(target, lun, cdb, dst, bounce, len);
+            bounced.bytes = len * ALIGN_REPS;
+            printf("  %11u\n", bench_kbps(&bounced, efreq));
+        } else {
+            printf("  %11s\n", "-");
+        }
+        if (is_user_abort()) {
+            printf("^C Abort\n");
+            goto done;
+        }
     }
 
-    if (errs == 0)
-        printf("PASS\n");
+    /* A scsi.device command may have replaced the drive buffer data */
+    align_build_cdb(cdb, rbuf, ref_len);
+    if ((scsi_xfer_cmd(target, lun, cdb, sizeof (cdb), bounce, ref_len,
+                       XFER_PIO) != 0) ||
+        (memcmp(bounce, ref, ref_len) != 0)) {
+        printf("Reference data changed during the check; "
+               "run it with the bus idle\n");
+        goto done;
+    }
+    if (fails != 0) {
+        printf("%u of %u DMA reads wrong (E command failed, B wrote before "
+               "buffer,\n  X data wrong, T tail bytes missing, O wrote past "
+               "end)\n", fails, runs);
+        goto done;
+    }
+    rc = 0;
+
+done:
+    if (bounce != NULL)
+        FreeMem(bounce, len + ALIGN_DELTA);
+    if (ref != NULL)
+        FreeMem(ref, len + ALIGN_DELTA);
+    if (area != NULL)
+        FreeMem(area, area_len);
+    return (rc);
+}
 
-    return (errs);
+/*
+ * DMA cache maintenance cost
+ *
+ * Direct DMA reads of several sizes are timed with each cache maintenance
+ * method, accounting the time spent in the cache calls separately. Each
+ * size is then checked for coherency: the CPU fills the buffer with a
+ * poison pattern and reads it back, which leaves the poison in the data
+ * cache, before a DMA read whose result must match data read by PIO.
+ * Without maintenance the poison is expected to survive while the data
+ * cache is on, so that method is not counted as a failure.
+ */
+#define CACHE_XFER_MAX 65536
+#define CACHE_REPS     32
+#define CACHE_POISON   0xdb
+
+/* Returns the number of bytes of a DMA read over a poisoned cache wrong */
+static uint
+cache_poison_check(uint unit, uint8_t *cdb, uint8_t *buf,
+                   const uint8_t *ref, uint len)
+{
+    volatile uint32_t *lp = (volatile uint32_t *) buf;
+    uint32_t           sum = 0;
+    uint               pos;
+    uint               bad = 0;
+
+    memset(buf, CACHE_POISON, len);
+    for (pos = 0; pos < len / 4; pos++)
+        sum += lp[pos];
+    (void) sum;
+    if (scsi_xfer_cmd(unit % 10, unit / 10, cdb, 10, buf, len,
+                      XFER_DMA) != 0) {
+        return (len);
+    }
+    for (pos = 0; pos < len; pos++)
+        if (buf[pos] != ref[pos])
+            bad++;
+    return (bad);
 }
 
 static int
-test_wdc_access(void)
+dma_cache_cost(uint unit)
 {
-    int pos;
-    uint8_t ovalue;
-    uint8_t wvalue;
-    uint8_t rvalue = 0;
-    uint8_t covalue;
-    uint8_t crvalue;
-    int errs = 0;
+    static const uint sizes[] = { 512, 2048, 8192, 32768, 65536 };
+    static const char * const methods[] = {
+        "CachePre/PostDMA", "CacheClearE", "None"
+    };
+    uint8_t  cdb[10];
+    uint8_t *buf;
+    uint8_t *ref;
+    uint     efreq = get_eclock_freq();
+    uint     cacr;
+    uint     size;
+    uint     method;
+    uint     stale = 0;
+    int      rc = 0;
+
+    if (ctrl->type != CTRL_A3000) {
+        printf("Cache cost is only measured for the A3000 SDMAC\n");
+        return (1);
+    }
+    if (SysBase->LibNode.lib_Version < 37) {
+        printf("exec V%u has no CachePreDMA() or CacheClearE()\n",
+               SysBase->LibNode.lib_Version);
+        return (1);
+    }
+    buf = AllocMem(CACHE_XFER_MAX, MEMF_PUBLIC);
+    ref = AllocMem(CACHE_XFER_MAX, MEMF_PUBLIC);
+    if ((buf == NULL) || (ref == NULL)) {
+        printf("Failed to allocate %u byte buffers\n", CACHE_XFER_MAX);
+        rc = 1;
+        goto done;
+    }
+    scsi_build_read10(cdb, 0, CACHE_XFER_MAX / SCSI_BLOCK_SIZE);
+    if (scsi_xfer_cmd(unit % 10, unit / 10, cdb, sizeof (cdb), ref,
+                      CACHE_XFER_MAX, XFER_PIO) != 0) {
+        printf("Reference PIO read of unit %u failed\n", unit);
+        rc = 1;
+        goto done;
+    }
 
-    printf("WDC test:     ");
-    fflush(stdout);
+    cacr = CacheControl(0, 0);
+    printf("CPU %s, data cache %s%s, exec V%u\n", cpu_name(),
+           (cacr & CACRF_EnableD) ? "on" : "off",
+           (cacr & CACRF_CopyBack) ? " (copyback)" : "",
+           SysBase->LibNode.lib_Version);
+    printf("DMA unit %u: %u reads of each size from block 0\n", unit,
+           CACHE_REPS);
+    printf("  Method             Bytes  Cache usec  Total usec  Cache%%  "
+           "Coherent\n");
+    for (size = 0; size < ARRAY_SIZE(sizes); size++) {
+        uint len = sizes[size];
+
+        scsi_build_read10(cdb, 0, len / SCSI_BLOCK_SIZE);
+        for (method = 0; method < ARRAY_SIZE(methods); method++) {
+            uint32_t start;
+            uint32_t ticks;
+            uint     errors = 0;
+            uint     bad;
+            uint     rep;
+
+            dma_cache_mode  = method;
+            dma_cache_ticks = 0;
+            start = eclock_ticks();
+            for (rep = 0; rep < CACHE_REPS; rep++)
+                if (scsi_xfer_cmd(unit % 10, unit / 10, cdb, sizeof (cdb),
+                                  buf, len, XFER_DMA) != 0)
+                    errors++;
+            ticks = eclock_ticks() - start;
+            if (ticks == 0)
+                ticks = 1;
+            bad = cache_poison_check(unit, cdb, buf, ref, len);
+
+            /* Per transfer times in tenths of a usec */
+            printf("  %-16s %7u %9u.%u %9u.%u %6u%%  ", methods[method], len,
+                   (uint) ((uint64_t) dma_cache_ticks * 10000000 / efreq /
+                           CACHE_REPS / 10),
+                   (uint) ((uint64_t) dma_cache_ticks * 10000000 / efreq /
+                           CACHE_REPS % 10),
+                   (uint) ((uint64_t) ticks * 10000000 / efreq /
+                           CACHE_REPS / 10),
+                   (uint) ((uint64_t) ticks * 10000000 / efreq /
+                           CACHE_REPS % 10),
+                   (uint) ((uint64_t) dma_cache_ticks * 100 / ticks));
+            if (bad == 0)
+                printf("yes");
+            else
+                printf("no (%u bytes)", bad);
+            if (errors != 0)
+                printf("  %u errors", errors);
+            printf("\n");
 
-    /* WDC_LADDR0 should be fully writable */
-    INTERRUPTS_DISABLE();
-    scsi_wait_cip();
-    covalue = get_wdc_reg(WDC_CONTROL);
-    ovalue = get_wdc_reg(WDC_LADDR0);
-    for (pos = 0; pos < ARRAY_SIZE(test_values); pos++) {
-        wvalue = test_values[pos] & 0x000000ff;
-        set_wdc_reg(WDC_LADDR0, wvalue);
-        (void) *ADDR32(ROM_BASE);  // flush bus access
-        crvalue = get_wdc_reg(WDC_CONTROL);
-        if (crvalue != covalue) {
-            INTERRUPTS_ENABLE();
-            if (errs++ == 0)
-                printf("FAIL\n");
-            printf("  WDC_CONTROL %02x != expected %02x\n", crvalue, covalue);
-            INTERRUPTS_DISABLE();
-        }
-        rvalue = get_wdc_reg(WDC_LADDR0);
-        if (rvalue != wvalue) {
-            set_wdc_reg(WDC_LADDR0, ovalue);
-            INTERRUPTS_ENABLE();
-            if (errs++ == 0)
-                printf("FAIL\n");
-            printf("  WDC_LADDR0 %02x != expected %02x\n", rvalue, wvalue);
-            INTERRUPTS_DISABLE();
-            scsi_wait_cip();
-            ovalue = get_wdc_reg(WDC_LADDR0);
+            if (errors != 0)
+                rc = 1;
+            if (bad != 0) {
+                if (method == DMA_CACHE_NONE)
+                    stale++;
+                else
+                    rc = 1;
+            }
+            if (is_user_abort()) {
+                printf("^C Abort\n");
+                rc = 1;
+                goto done;
+            }
         }
-        if (errs > 6)
-            break;
     }
-    set_wdc_reg(WDC_LADDR0, ovalue);
-    INTERRUPTS_ENABLE();
-
-    /* WDC_AUXST should be read-only */
-    INTERRUPTS_DISABLE();
-    scsi_wait_cip();
-    covalue = get_wdc_reg(WDC_CONTROL);
-    ovalue = get_wdc_reg(WDC_AUXST);
-    for (pos = 0; pos < ARRAY_SIZE(test_values); pos++) {
-        wvalue = test_values[pos] & 0x000000ff;
-        set_wdc_reg(WDC_AUXST, wvalue);
-        (void) *ADDR32(ROM_BASE);  // flush bus access
-        crvalue = get_wdc_reg(WDC_CONTROL);
-        if (crvalue != covalue) {
-            INTERRUPTS_ENABLE();
-            if (errs++ == 0)
-                printf("FAIL\n");
-            printf("  WDC_CONTROL %02x != expected %02x\n", crvalue, covalue);
-            INTERRUPTS_DISABLE();
-            scsi_wait_cip();
-        }
-        rvalue = get_wdc_reg(WDC_AUXST);
-        if (rvalue != ovalue) {
-            set_wdc_reg(WDC_AUXST, ovalue);
-            INTERRUPTS_ENABLE();
-            if (errs++ == 0)
-                printf("FAIL\n");
-            printf("  WDC_AUXST  %02x != expected %02x when %02x written\n",
-                   rvalue, ovalue, wvalue);
-            INTERRUPTS_DISABLE();
-            scsi_wait_cip();
-            ovalue = get_wdc_reg(WDC_AUXST);
-        }
-        if (errs > 6)
-            break;
+    if (stale != 0)
+        printf("Stale data without maintenance is expected with the data "
+               "cache on\n");
+
+done:
+    dma_cache_mode = DMA_CACHE_PREPOST;
+    if (ref != NULL)
+        FreeMem(ref, CACHE_XFER_MAX);
+    if (buf != NULL) {
+        /* Don't leave poison from the unmaintained pass in the cache */
+        CacheClearE(buf, CACHE_XFER_MAX, CACRF_ClearD);
+        FreeMem(buf, CACHE_XFER_MAX);
     }
-    set_wdc_reg(WDC_AUXST, ovalue);
-    INTERRUPTS_ENABLE();
+    return (rc);
+}
 
-    /* Undefined WDC register should be read-only and always 0xff */
-    INTERRUPTS_DISABLE();
-    scsi_wait_cip();
-    covalue = get_wdc_reg(WDC_CONTROL);
-    ovalue = get_wdc_reg(WDC_INVALID_REG);
-    for (pos = 0; pos < ARRAY_SIZE(test_values); pos++) {
-        wvalue = test_values[pos] & 0x000000ff;
-        set_wdc_reg(WDC_INVALID_REG, wvalue);
-        (void) *ADDR32(ROM_BASE);  // flush bus access
-        crvalue = get_wdc_reg(WDC_CONTROL);
-        if (crvalue != covalue) {
-            INTERRUPTS_ENABLE();
-            if (errs++ == 0)
-                printf("FAIL\n");
-            printf("  WDC_CONTROL %02x != expected %02x\n", crvalue, covalue);
-            INTERRUPTS_DISABLE();
-            scsi_wait_cip();
-        }
-        rvalue = get_wdc_reg(WDC_INVALID_REG);
-        if (rvalue != ovalue) {
-            set_wdc_reg(WDC_INVALID_REG, ovalue);
-            INTERRUPTS_ENABLE();
-            if (errs++ == 0)
-                printf("FAIL\n");
-            printf("  WDC Reg 0x1e %02x != expected %02x when %02x written\n",
-                   rvalue, ovalue, wvalue);
-            INTERRUPTS_DISABLE();
-            scsi_wait_cip();
-            ovalue = get_wdc_reg(WDC_INVALID_REG);
-        }
-        if (errs > 6)
-            break;
+/*
+ * Time to ready
+ *
+ * After a SCSI bus reset, each target ID is polled in turn with TEST UNIT
+ * READY until it reports GOOD status or the time limit expires. Every
+ * change in a target's response (no response to selection, CHECK
+ * CONDITION sense key and additional sense code, GOOD) is recorded with
+ * the time since the reset. With the start option, START STOP UNIT is
+ * sent to each target when it first responds, as a host adapter which
+ * does not rely on drive auto-start jumpers would.
+ *
+ * A target which still has not answered selection TTR_ABSENT_MSEC after
+ * the reset is taken to be absent and is no longer polled, so empty IDs
+ * neither hold the loop to the time limit nor slow the polling of
+ * targets which are present. Polls use a short selection timeout for
+ * the same reason; a present target answers within microseconds.
+ */
+#define TTR_MAX_EVENTS  16
+#define TTR_POLL_TICKS  2    // Delay() ticks between polling rounds
+#define TTR_NO_RESPONSE 0xff // Event status: selection timeout
+#define TTR_ABSENT_MSEC 2000 // Grace period to answer selection
+#define TTR_SEL_MSEC    10   // Selection timeout while polling
+
+typedef struct {
+    uint32_t ticks;   // E clock ticks since reset
+    uint8_t  status;  // SCSI status or TTR_NO_RESPONSE
+    uint8_t  key;     // Sense key (CHECK CONDITION only)
+    uint8_t  asc;     // Additional sense code
+    uint8_t  ascq;    // Additional sense code qualifier
+} ttr_event_t;
+
+typedef struct {
+    uint        ready;     // Target returned GOOD
+    uint        absent;    // No response to selection in grace period
+    uint        responded; // Target has answered selection
+    uint        started;   // START STOP UNIT was sent
+    uint        polls;     // TEST UNIT READY commands sent
+    uint        nevents;
+    ttr_event_t events[TTR_MAX_EVENTS];
+} ttr_target_t;
+
+static const char * const sense_keys[] = {
+    "NO SENSE", "RECOVERED ERROR", "NOT READY", "MEDIUM ERROR",
+    "HARDWARE ERROR", "ILLEGAL REQUEST", "UNIT ATTENTION", "DATA PROTECT",
+    "BLANK CHECK", "VENDOR SPECIFIC", "COPY ABORTED", "ABORTED COMMAND",
+    "EQUAL", "VOLUME OVERFLOW", "MISCOMPARE", "RESERVED"
+};
+
+static void
+ttr_record(ttr_target_t *tgt, uint32_t ticks, uint8_t status,
+           const uint8_t *sense)
+{
+    ttr_event_t *last;
+    ttr_event_t  cur;
+
+    memset(&cur, 0, sizeof (cur));
+    cur.ticks  = ticks;
+    cur.status = status;
+    if (sense != NULL) {
+        cur.key  = sense[2] & 0x0f;
+        cur.asc  = sense[12];
+        cur.ascq = sense[13];
     }
-    set_wdc_reg(WDC_INVALID_REG, ovalue);
-    INTERRUPTS_ENABLE();
-    if (rvalue != 0xff) {
-        if (errs++ == 0)
-            printf("FAIL\n");
-        printf("  WDC Reg 0x%02x %02x != expected 0xff\n",
-               WDC_INVALID_REG, rvalue);
+    if (tgt->nevents == 0) {
+        tgt->events[tgt->nevents++] = cur;
+        return;
     }
-
-    if (errs == 0)
-        printf("PASS\n");
-    return (errs);
+    last = &tgt->events[tgt->nevents - 1];
+    if ((last->status == cur.status) &&
+        (last->key == cur.key) && (last->asc == cur.asc) &&
+        (last->ascq == cur.ascq)) {
+        return;  // No change
+    }
+    if (tgt->nevents < TTR_MAX_EVENTS)
+        tgt->events[tgt->nevents++] = cur;
+    else
+        *last = cur;  // Keep the final state
 }
 
+/*
+ * ttr_poll
+ * --------
+ * Sends one TEST UNIT READY to the target, fetching sense data if the
+ * target reports CHECK CONDITION, and records any change in response.
+ */
 static void
-scsi_set_transfer_len(uint len)
+ttr_poll(ttr_target_t *tgt, uint target, uint32_t t_reset, uint do_start)
 {
-    set_wdc_reg24(WDC_TCOUNT2, len);
+    uint8_t cdb[6];
+    uint8_t sense[18];
+    int     status;
+
+    memset(cdb, 0, sizeof (cdb));
+    cdb[0] = SCSI_TEST_UNIT_READY;
+    status = scsi_xfer_cmd(target, 0, cdb, sizeof (cdb), NULL, 0, XFER_PIO);
+    tgt->polls++;
+    if (status == SCSI_SEL_TIMEOUT) {
+        uint32_t ticks = eclock_ticks() - t_reset;
+        ttr_record(tgt, ticks, TTR_NO_RESPONSE, NULL);
+        if ((tgt->responded == 0) &&
+            ((uint64_t) ticks * 1000 >=
+             (uint64_t) TTR_ABSENT_MSEC * get_eclock_freq()))
+            tgt->absent = 1;
+        return;
+    }
+    if (status < 0)
+        return;  // Transient failure; poll again next round
+    tgt->responded = 1;
+
+    if (status == SCSI_STATUS_CHECK_CONDITION) {
+        memset(cdb, 0, sizeof (cdb));
+        memset(sense, 0, sizeof (sense));
+        cdb[0] = SCSI_REQUEST_SENSE;
+        cdb[4] = sizeof (sense);
+        if (scsi_xfer_cmd(target, 0, cdb, sizeof (cdb), sense,
+                          sizeof (sense), XFER_PIO) != 0)
+            memset(sense, 0, sizeof (sense));
+        ttr_record(tgt, eclock_ticks() - t_reset, status, sense);
+    } else {
+        ttr_record(tgt, eclock_ticks() - t_reset, status, NULL);
+        if (status == SCSI_STATUS_GOOD)
+            tgt->ready = 1;
+    }
+
+    if (do_start && (tgt->started == 0)) {
+        memset(cdb, 0, sizeof (cdb));
+        cdb[0] = SCSI_START_STOP_UNIT;
+        cdb[1] = 0x01;  // IMMED: return before spin-up completes
+        cdb[4] = 0x01;  // START
+        (void) scsi_xfer_cmd(target, 0, cdb, sizeof (cdb), NULL, 0,
+                             XFER_PIO);
+        tgt->started = 1;
+    }
 }
 
-static uint8_t
-scsi_select(uint8_t target)
+static void
+ttr_show_event(const ttr_event_t *ev, uint efreq)
 {
-    uint8_t sstat = 0;
-    uint    auxst;
-//  uint    xfer_dir = WDC_DST_ID_DPD;  // read from device
-    uint    xfer_dir = 0;  // write to device
-
-    set_wdc_reg(WDC_DST_ID, (target & 0xf) | xfer_dir);
-    set_wdc_reg(WDC_SRC_ID, 0);
-    set_wdc_reg(WDC_LUN, target >> 8);
-    set_wdc_reg(WDC_SYNC_TX, 0);  // async
+    uint msec = (uint64_t) ev->ticks * 1000 / efreq;
 
-    set_wdc_reg(WDC_TPERIOD, SBIC_TIMEOUT(250));  // ~250ms
-//  scsi_set_transfer_len(6);    // WD will get count after select
-    scsi_set_transfer_len(0);    // WD will get count after select
-    set_wdc_reg(WDC_CMD, WDC_CMD_SELECT_WITH_ATN);
+    printf("    %5u.%03u s  ", msec / 1000, msec % 1000);
+    switch (ev->status) {
+        case TTR_NO_RESPONSE:
+            printf("No response\n");
+            break;
+        case SCSI_STATUS_GOOD:
+            printf("Ready\n");
+            break;
+        case SCSI_STATUS_CHECK_CONDITION:
+            printf("%s ASC %02x ASCQ %02x\n",
+                   sense_keys[ev->key], ev->asc, ev->ascq);
+            break;
+        default:
+            printf("Status %02x\n", ev->status);
+            break;
+    }
+}
 
-    /* Wait for Command-In-Progress to clear */
-    auxst = scsi_wait_cip();
-    if (auxst == 0x100) {
-        printf("SS1  astat=%02x sstat=%02x",
-               get_wdc_reg(WDC_AUXST), get_wdc_reg(WDC_SCSI_STAT));
-        return (0xff);
+/*
+ * measure_time_to_ready
+ * ---------------------
+ * Resets the SCSI bus and polls all targets until each is ready or
+ * max_secs elapse. Targets which never respond to selection are not
+ * reported.
+ */
+static int
+measure_time_to_ready(uint max_secs, uint do_start)
+{
+    ttr_target_t *tgts;
+    uint          efreq = get_eclock_freq();
+    uint          own_id;
+    uint          target;
+    uint          pending;
+    uint          aborted = 0;
+    uint32_t      t_reset;
+
+    if (ctrl->type != CTRL_A3000) {
+        printf("Time to ready is only implemented for the A3000 SDMAC\n");
+        return (1);
+    }
+    tgts = AllocMem(sizeof (*tgts) * 8, MEMF_PUBLIC | MEMF_CLEAR);
+    if (tgts == NULL) {
+        printf("Failed to allocate target state\n");
+        return (1);
     }
+    own_id = get_wdc_reg(WDC_OWN_ID) & 0x07;
 
-    /* Wait for Select to complete */
-    auxst = scsi_wait(WDC_AUXST_LCI | WDC_AUXST_INT, 1);
-    sstat = get_wdc_reg(WDC_SCSI_STAT);
-    INTERRUPTS_ENABLE();
-    if (auxst & 0x100)
-        printf("  timeout: no LCI or INT\n");
-    if (auxst & WDC_AUXST_PE)
-        printf("  ParityError:%02x\n", sstat);
-    if (auxst & WDC_AUXST_CIP)
-        printf("  CIP:%02x\n", sstat);
-    if (auxst & WDC_AUXST_LCI)
-        printf("  LCI:%02x\n", sstat);
-    if (auxst & WDC_AUXST_BSY)
-        printf("  BSY:%02x\n", sstat);
-    INTERRUPTS_DISABLE();
-    return (sstat);
+    printf("Resetting SCSI bus%s\n", do_start ? " (START UNIT on response)" :
+           "");
+    (void) scsi_hard_reset();  // A3000 only, so always has a reset bit
+    t_reset = eclock_ticks();
+    scsi_soft_reset(0);
+    (void) get_wdc_reg(WDC_SCSI_STAT);  // clear reset status
+
+    scsi_sel_msec = TTR_SEL_MSEC;
+    do {
+        pending = 0;
+        for (target = 0; target < 8; target++) {
+            if ((target == own_id) || tgts[target].ready ||
+                tgts[target].absent)
+                continue;
+            ttr_poll(&tgts[target], target, t_reset, do_start);
+            if (tgts[target].ready == 0)
+                pending++;
+        }
+        if (is_user_abort()) {
+            printf("^C Abort\n");
+            aborted = 1;
+            break;
+        }
+        if (pending != 0)
+            Delay(TTR_POLL_TICKS);
+    } while ((pending != 0) &&
+             ((uint64_t) (eclock_ticks() - t_reset) < (uint64_t) max_secs *
+                                                      efreq));
+    scsi_sel_msec = SCSI_SEL_MSEC;
+
+    for (target = 0; target < 8; target++) {
+        ttr_target_t *tgt = &tgts[target];
+        uint          pos;
+        if ((target == own_id) || (tgt->nevents == 0) ||
+            ((tgt->nevents == 1) &&
+             (tgt->events[0].status == TTR_NO_RESPONSE))) {
+            continue;  // Never responded
+        }
+        if (tgt->ready) {
+            uint msec = (uint64_t) tgt->events[tgt->nevents - 1].ticks *
+                        1000 / efreq;
+            printf("Target %u: ready in %u.%03u s (%u polls)\n",
+                   target, msec / 1000, msec % 1000, tgt->polls);
+        } else {
+            printf("Target %u: not ready after %u s (%u polls)\n",
+                   target, max_secs, tgt->polls);
+        }
+        for (pos = 0; pos < tgt->nevents; pos++)
+            ttr_show_event(&tgt->events[pos], efreq);
+    }
+    FreeMem(tgts, sizeof (*tgts) * 8);
+    return (aborted);
 }
 
-#if 0
+/*
+ * Quick health check
+ *
+ * -q is meant for Startup-Sequence. Full detection takes most of a
+ * default run (show_wdc_version() soft resets the WDC several times and
+ * calc_wdc_clock() times a selection timeout), so its results are kept
+ * in ENV: along with a signature of the board and chip identity. The
+ * signature only uses reads which do not disturb scsi.device: the
+ * controller base and type, and the Ramsey and SDMAC revisions. The
+ * WDC microcode revision can only be read after a soft reset, and
+ * OWN_ID depends on the last command scsi.device issued, so the WDC is
+ * not part of it. Changing the WDC needs a power cycle, which clears
+ * ENV:, so the first check after boot always does full detection. If
+ * the register tests fail with cached results, full detection is run
+ * and the tests repeated, in case the cache is stale.
+ */
+#define QC_FILE       "ENV:sdmac.cache"
+#define QC_MAGIC      0x53447163  // "SDqc"
+#define QC_VERSION    3
+
+static uint32_t qc_start;  // E clock at program start
+
+typedef struct {
+    uint32_t ctrl_base;    // Controller base address
+    uint8_t  ctrl_type;    // CTRL_*
+    uint8_t  ramsey_ver;   // RAMSEY_VER (A3000 only)
+    uint8_t  ramsey_ctrl;  // RAMSEY_CTRL (A3000 only)
+    uint8_t  pad;
+    uint32_t sdmac_rev;    // SDMAC_REVISION (A3000 only)
+} qc_sig_t;
+
+typedef struct {
+    uint32_t magic;        // QC_MAGIC
+    uint16_t version;      // QC_VERSION
+    uint16_t size;         // sizeof (qc_cache_t)
+    qc_sig_t sig;          // Signature at detection time
+    uint8_t  ramsey_rev;   // Detection results
+    uint8_t  sdmac_version;
+    uint8_t  wd_level;
+    uint8_t  wd_microcode;
+    uint32_t sdmac_rev;
+    uint16_t wdc_khz;
+    uint16_t pad;
+} qc_cache_t;
+
 static void
-scsi_disconnect(void)
+qc_signature(qc_sig_t *sig)
 {
-    uint8_t auxst;
+    memset(sig, 0, sizeof (*sig));
+    sig->ctrl_base = ctrl->base;
+    sig->ctrl_type = ctrl->type;
+    if (ctrl->type == CTRL_A3000) {
+        sig->ramsey_ver  = get_ramsey_version();
+        sig->ramsey_ctrl = get_ramsey_control();
+        sig->sdmac_rev   = *ADDR32(SDMAC_REVISION);
+    }
+}
 
-    scsi_wait_cip();
-    set_wdc_reg(WDC_CMD, WDC_CMD_DISCONNECT);
-    scsi_wait_cip();
+/* Returns non-zero if the cache is intact and matches the signature */
+static int
+qc_valid(const qc_cache_t *qc, const qc_sig_t *sig)
+{
+    return ((qc->magic == QC_MAGIC) && (qc->version == QC_VERSION) &&
+            (qc->size == sizeof (*qc)) &&
+            (memcmp(&qc->sig, sig, sizeof (*sig)) == 0) &&
+            (qc->wd_level != LEVEL_UNKNOWN));
+}
 
-    auxst = scsi_wait(WDC_AUXST_INT, 1);
-    if (auxst == 0x100)
-        printf("WDC timeout disconnect\n");
-    printf("  disconnect sstat=%02x\n", get_wdc_reg(WDC_SCSI_STAT));
+static int
+qc_load(qc_cache_t *qc)
+{
+    FILE *fp = fopen(QC_FILE, "rb");
+    int   rc;
+
+    if (fp == NULL)
+        return (1);
+    rc = (fread(qc, sizeof (*qc), 1, fp) != 1);
+    fclose(fp);
+    return (rc);
 }
 
 static void
-scsi_disconnect_msg(void)
+qc_save(const qc_cache_t *qc)
 {
-    set_wdc_reg(WDC_CMD, WDC_CMD_DISCONNECT_MSG);
-    cia_spin(10000);
+    FILE *fp = fopen(QC_FILE, "wb");
+
+    if (fp == NULL)
+        return;  // No ENV: is not an error for a health check
+    (void) fwrite(qc, sizeof (*qc), 1, fp);
+    fclose(fp);
 }
-#endif
 
 /*
- * scsi_abort()
- *
- * XXX: According to the WD33C93A E062-B @9, the Abort command is
- *      no longer supported in the initiator mode.
+ * quick_check
+ * -----------
+ * Runs detection (or takes it from the cache) and the register tests,
+ * then reports the time since sdmac started. Returns non-zero on failure.
  */
-void
-scsi_abort(void)
+static int
+quick_check(void)
 {
-    uint auxst;
-    if (scsi_wait_cip() == 0x100) {
-        printf("SS1  astat=%02x sstat=%02x",
-               get_wdc_reg(WDC_AUXST), get_wdc_reg(WDC_SCSI_STAT));
-        return;
+    qc_cache_t qc;
+    qc_sig_t   sig;
+    uint       efreq = get_eclock_freq();
+    int        cached;
+    int        rc = 0;
+
+    qc_signature(&sig);
+    cached = (qc_load(&qc) == 0) && qc_valid(&qc, &sig);
+    if (cached) {
+        ramsey_rev        = qc.ramsey_rev;
+        sdmac_version     = qc.sdmac_version;
+        sdmac_version_rev = qc.sdmac_rev;
+        wd_level          = qc.wd_level;
+        wd_microcode      = qc.wd_microcode;
+        wdc_khz           = qc.wdc_khz;
+        scsi_wait_calibrate(wdc_regs_saved ? wdc_regs_store[WDC_TPERIOD] : 0);
+        if (ctrl->type == CTRL_A3000) {
+            printf("Memory controller:   Ramsey-0%d $%x\n",
+                   ramsey_rev, sig.ramsey_ver);
+            printf("SCSI DMA Controller: SDMAC-%02d\n", sdmac_version);
+        } else {
+            printf("SCSI DMA Controller: %s at $%06x\n",
+                   ctrl->name, ctrl->base);
+        }
+        printf("SCSI Controller:     %s microcode %02x, %u.%u MHz "
+               "(cached)\n", snap_wd_name(wd_level), wd_microcode,
+               wdc_khz / 1000, (wdc_khz % 1000) / 100);
+        if (test_run(test_mask(TEST_DEFAULT), 0)) {
+            printf("Tests failed with cached detection, detecting again\n");
+            cached = 0;
+        }
     }
-    set_wdc_reg(WDC_CMD, WDC_CMD_ABORT);
-    auxst = scsi_wait_cip();
-    if (auxst != 0x100)
-        auxst = scsi_wait(WDC_AUXST_INT, 1);
+    if (!cached) {
+        if (show_ramsey_version() ||
+            show_dmac_version() ||
+            show_wdc_version()) {
+            rc = 1;
+        } else {
+            memset(&qc, 0, sizeof (qc));
+            qc.magic         = QC_MAGIC;
+            qc.version       = QC_VERSION;
+            qc.size          = sizeof (qc);
+            qc.ramsey_rev    = ramsey_rev;
+            qc.sdmac_version = sdmac_version;
+            qc.sdmac_rev     = sdmac_version_rev;
+            qc.wd_level      = wd_level;
+            qc.wd_microcode  = wd_microcode;
+            qc.wdc_khz       = wdc_khz;
+            qc.sig           = sig;
+            qc_save(&qc);
+            if (test_run(test_mask(TEST_DEFAULT), 0))
+                rc = 1;
+        }
+    }
+    printf("Quick check %s in %u ms\n", (rc == 0) ? "passed" : "FAILED",
+           (uint) ((uint64_t) (eclock_ticks() - qc_start) * 1000 / efreq));
+    return (rc);
 }
 
-#undef DEBUG_PROBE_SCSI
+/*
+ * Acceptance profile
+ *
+ * -P reads a profile of pass/fail thresholds, runs the tests and
+ * benchmarks the profile needs, and reports each check. sdmac exits
+ * non-zero if any threshold is missed. Profile lines are:
+ *
+ *     unit <unit> [<KB> [<depth>]]   Benchmark target and workload
+ *     min_dma_kbps <KB/s>            Direct SDMAC DMA read throughput
+ *     max_p99_usec <usec>            Direct DMA read p99 latency
+ *     clock_khz <min> <max>          WDC input clock range
+ *     reg_passes <count>             Register test passes (default 10)
+ *     max_reg_fail_pct <percent>     Failed register test runs allowed
+ *
+ * '#' starts a comment. Checks whose keys are absent are not run.
+ */
+#define PROF_UNSET 0xffffffff
 
-static void
-scsi_set_cdb(void *ptr, uint len)
+typedef struct {
+    bench_workload_t wl;
+    uint32_t min_dma_kbps;
+    uint32_t max_p99_usec;
+    uint32_t clock_min_khz;
+    uint32_t clock_max_khz;
+    uint32_t reg_passes;
+    uint32_t max_reg_fail_pct;
+} profile_t;
+
+static int
+profile_parse(const char *filename, profile_t *prof)
 {
-    uint pos;
-    uint8_t *ptr_b = (uint8_t *) ptr;
+    FILE     *fp;
+    char      line[128];
+    char      words[4][32];
+    uint      lineno = 0;
+    uint32_t  val[3];
+    int       nwords;
+    int       rc = 0;
+
+    memset(prof, 0, sizeof (*prof));
+    prof->wl.blocks       = 4096 * 1024 / SCSI_BLOCK_SIZE;
+    prof->wl.xfer_blocks  = 64 * 1024 / SCSI_BLOCK_SIZE;
+    prof->wl.depth        = 4;
+    prof->wl.unit         = PROF_UNSET;
+    prof->min_dma_kbps    = PROF_UNSET;
+    prof->max_p99_usec    = PROF_UNSET;
+    prof->clock_min_khz   = PROF_UNSET;
+    prof->reg_passes      = 10;
+    prof->max_reg_fail_pct = PROF_UNSET;
+
+    fp = fopen(filename, "r");
+    if (fp == NULL) {
+        printf("Failed to open %s\n", filename);
+        return (1);
+    }
+    while (fgets(line, sizeof (line), fp) != NULL) {
+        char *ptr = strchr(line, '#');
+        int   nvals;
+
+        lineno++;
+        if (ptr != NULL)
+            *ptr = '\0';
+        nwords = sscanf(line, "%31s %31s %31s %31s", words[0], words[1],
+                        words[2], words[3]);
+        if (nwords <= 0)
+            continue;  // Blank line
+        for (nvals = 0; nvals < nwords - 1; nvals++) {
+            int pos = 0;
+            if ((sscanf(words[nvals + 1], "%u%n", &val[nvals], &pos) != 1) ||
+                (words[nvals + 1][pos] != '\0'))
+                goto bad_line;
+        }
 
-    if (len >= 12) {
-        printf("Invalid CDB len %u\n", len);
-        return;
+        if ((strcmp(words[0], "unit") == 0) && (nvals >= 1)) {
+            prof->wl.unit = val[0];
+            if (val[0] % 10 > 7)
+                goto bad_line;
+            if (nvals >= 2) {
+                if ((val[1] == 0) || (val[1] > 8192))
+                    goto bad_line;
+                prof->wl.xfer_blocks = val[1] * 1024 / SCSI_BLOCK_SIZE;
+            }
+            if (nvals >= 3) {
+                if ((val[2] == 0) || (val[2] > BENCH_MAX_DEPTH))
+                    goto bad_line;
+                prof->wl.depth = val[2];
+            }
+        } else if ((strcmp(words[0], "min_dma_kbps") == 0) && (nvals == 1)) {
+            prof->min_dma_kbps = val[0];
+        } else if ((strcmp(words[0], "max_p99_usec") == 0) && (nvals == 1)) {
+            prof->max_p99_usec = val[0];
+        } else if ((strcmp(words[0], "clock_khz") == 0) && (nvals == 2) &&
+                   (val[0] <= val[1])) {
+            prof->clock_min_khz = val[0];
+            prof->clock_max_khz = val[1];
+        } else if ((strcmp(words[0], "reg_passes") == 0) && (nvals == 1) &&
+                   (val[0] != 0)) {
+            prof->reg_passes = val[0];
+        } else if ((strcmp(words[0], "max_reg_fail_pct") == 0) &&
+                   (nvals == 1) && (val[0] <= 100)) {
+            prof->max_reg_fail_pct = val[0];
+        } else {
+            goto bad_line;
+        }
+        continue;
+bad_line:
+        printf("%s:%u: invalid line: %s", filename, lineno, line);
+        rc = 1;
+        break;
     }
-    set_wdc_reg(WDC_OWN_ID, len);
-    for (pos = 0; pos < len; pos++)
-        set_wdc_reg(WDC_CDB1 + pos, *(ptr_b++));
+    fclose(fp);
+    if ((rc == 0) && (prof->wl.unit == PROF_UNSET) &&
+        ((prof->min_dma_kbps != PROF_UNSET) ||
+         (prof->max_p99_usec != PROF_UNSET))) {
+        printf("%s: benchmark thresholds need a unit line\n", filename);
+        rc = 1;
+    }
+    return (rc);
 }
 
-static void
-scsi_transfer_start(uint phase)
+static uint
+profile_check(const char *name, uint32_t value, uint32_t min, uint32_t max,
+              const char *units)
 {
-    switch (phase) {
-        case WDC_PHASE_DATA_IN:
-        case WDC_PHASE_MESG_IN:
-#ifdef DEBUG_PROBE_SCSI
-            printf("  phase in %x\n", phase);
-#endif
-            set_wdc_reg(WDC_DST_ID,
-                        get_wdc_reg(WDC_DST_ID) | WDC_DST_ID_DPD);
-            break;
-        case WDC_PHASE_DATA_OUT:
-        case WDC_PHASE_MESG_OUT:
-        case WDC_PHASE_CMD:
-#ifdef DEBUG_PROBE_SCSI
-            printf("  phase out %x\n", phase);
-#endif
-            set_wdc_reg(WDC_DST_ID,
-                        get_wdc_reg(WDC_DST_ID) & ~WDC_DST_ID_DPD);
-            break;
-        default:
-            printf("Unknown phase %x\n", phase);
-    }
+    uint fail = (value < min) || (value > max);
+
+    printf("  %-4s %-22s %8u %s", fail ? "FAIL" : "ok", name, value, units);
+    if (max == PROF_UNSET)
+        printf(" (min %u)\n", min);
+    else if (min == 0)
+        printf(" (max %u)\n", max);
+    else
+        printf(" (%u-%u)\n", min, max);
+    return (fail);
 }
 
+/*
+ * profile_run
+ * -----------
+ * Runs what the profile requires and reports each threshold. Returns
+ * the number of thresholds missed, or 1 if a benchmark could not run.
+ */
 static int
-scsi_transfer_in(uint phase)
+profile_run(const profile_t *prof)
 {
-    uint timeout = 5000;
-    uint8_t auxst;
-    uint len = get_wdc_reg(WDC_OWN_ID);
-    uint count = 0;
+    uint32_t reg_fails = 0;
+    uint32_t pass;
+    int      bench_rc = 0;
+    uint     missed = 0;
+
+    if (prof->max_reg_fail_pct != PROF_UNSET) {
+        for (pass = 0; pass < prof->reg_passes; pass++) {
+            if (test_run(test_mask(TEST_DEFAULT), 0))
+                reg_fails++;
+            if (is_user_abort())
+                return (1);
+        }
+    }
+    if (prof->wl.unit != PROF_UNSET)
+        bench_rc = bench_compare(&prof->wl);
 
-    printf("trans_in\n");
-    show_regs(0);
-    while (count < len) {
-        timeout = 50000;
-        auxst = get_wdc_reg(WDC_AUXST);
-        while ((auxst & WDC_AUXST_DBR) == 0) {
-            if ((auxst & WDC_AUXST_INT) || (timeout-- == 0)) {
-                printf("  WDC timeout in transfer_in, %u left: %02x\n",
-                       len - count, auxst);
-                return (-1);
-            }
-            if (auxst & WDC_AUXST_LCI) {
-                uint8_t sstat = get_wdc_reg(WDC_SCSI_STAT);
-                printf("LCI sstat=%02x\n", sstat);
-                return (-1);
-            }
-            cia_spin(10);
-            auxst = get_wdc_reg(WDC_AUXST);
+    printf("Acceptance profile\n");
+    if (prof->clock_min_khz != PROF_UNSET) {
+        missed += profile_check("WDC clock", wdc_khz, prof->clock_min_khz,
+                                prof->clock_max_khz, "kHz");
+    }
+    if (prof->max_reg_fail_pct != PROF_UNSET) {
+        missed += profile_check("Register test failures",
+                                reg_fails * 100 / prof->reg_passes, 0,
+                                prof->max_reg_fail_pct, "%");
+    }
+    if (bench_rc != 0) {
+        printf("  FAIL Benchmark did not complete\n");
+        missed++;
+    } else if (prof->wl.unit != PROF_UNSET) {
+        if (prof->min_dma_kbps != PROF_UNSET) {
+            missed += profile_check("DMA read", bench_result_kbps[2],
+                                    prof->min_dma_kbps, PROF_UNSET, "KB/s");
         }
-        count++;
-        printf(" %02x", get_wdc_reg(WDC_DATA));  // Pull data
+        if (prof->max_p99_usec != PROF_UNSET) {
+            missed += profile_check("DMA read p99 latency",
+                                    bench_result_p99[2], 0,
+                                    prof->max_p99_usec, "usec");
+        }
+    }
+    printf("Acceptance: %s\n", (missed == 0) ? "PASS" : "FAIL");
+    return (missed);
+}
+
+/*
+ * Serial metrics
+ *
+ * -e sends a metrics frame over serial.device at a fixed interval, for
+ * machines without a display or network. Each frame covers one
+ * interval: scsi.device request counts, bytes, errors, and latency (from
+ * the -T tracer patches), CPU use (from the idle counting task), and
+ * free memory. Frames are built in a static buffer and written with
+ * DoIO(), so the sampling loop does no stdio and spends its time in
+ * Delay().
+ *
+ * Frame layout, all fields big-endian:
+ *     A5 5A  <len>  <type>  <payload: len bytes>  <CRC-16 hi> <CRC-16 lo>
+ * The CRC is CRC-16/CCITT-FALSE over len, type, and payload. A receiver
+ * which sees a bad CRC skips one byte and searches for the next A5 5A.
+ *
+ * The live receiver is host/sdmac-collect, which runs on Linux; the
+ * frame definitions in host/sdmac_host.h must be kept in step with
+ * these. -E decodes a captured byte stream on the Amiga and shows each
+ * frame with rolling averages. It does not touch hardware.
+ */
+#define MET_SYNC0        0xa5
+#define MET_SYNC1        0x5a
+#define MET_TYPE_STATS   1
+#define MET_PAYLOAD      40
+#define MET_FRAME_MAX    (4 + MET_PAYLOAD + 2)
+#define MET_SERIAL_UNIT  0
+#define MET_ROLLING      60      // Frames in rolling average
+#define MET_STALE_SECS   5       // Incomplete requests older are dropped
+
+typedef struct {
+    uint32_t seq;          // Frame sequence number
+    uint32_t uptime;       // Seconds since metrics started
+    uint32_t interval_ms;  // Length of this interval
+    uint32_t requests;     // scsi.device requests completed
+    uint32_t read_kb;      // KB read
+    uint32_t write_kb;     // KB written
+    uint32_t lat_avg;      // Average request latency (usec)
+    uint32_t lat_max;      // Maximum request latency (usec)
+    uint16_t errors;       // Requests completed with io_Error set
+    uint8_t  cpu_pct;      // CPU use
+    uint8_t  dropped;      // Requests not seen to complete
+    uint16_t chip_free;    // Free chip memory (KB)
+    uint16_t fast_free;    // Free fast memory (MB)
+} met_stats_t;
+
+static uint16_t
+met_crc16(const uint8_t *data, uint len)
+{
+    uint16_t crc = 0xffff;
+    uint     bit;
+
+    while (len-- > 0) {
+        crc ^= *(data++) << 8;
+        for (bit = 0; bit < 8; bit++)
+            crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : (crc << 1);
     }
+    return (crc);
+}
+
+static uint8_t *
+met_put32(uint8_t *ptr, uint32_t value)
+{
+    *(ptr++) = value >> 24;
+    *(ptr++) = value >> 16;
+    *(ptr++) = value >> 8;
+    *(ptr++) = value;
+    return (ptr);
+}
+
+static uint8_t *
+met_put16(uint8_t *ptr, uint16_t value)
+{
+    *(ptr++) = value >> 8;
+    *(ptr++) = value;
+    return (ptr);
+}
+
+static uint32_t
+met_get32(const uint8_t *ptr)
+{
+    return ((ptr[0] << 24) | (ptr[1] << 16) | (ptr[2] << 8) | ptr[3]);
+}
 
-    printf(" [%02x %02x]\n", len, count);
-    return (len);
+static uint16_t
+met_get16(const uint8_t *ptr)
+{
+    return ((ptr[0] << 8) | ptr[1]);
 }
 
-static int
-scsi_transfer_out(uint len, void *buf)
+/*
+ * met_frame_wrap
+ * --------------
+ * Adds the sync bytes, header, and CRC around plen bytes of payload
+ * already stored at buf + 4. Returns the frame length.
+ */
+static uint
+met_frame_wrap(uint8_t *buf, uint type, uint plen)
 {
-    uint8_t auxst;
-    uint8_t *bufptr = (uint8_t *) buf;
-    uint    timeout;
+    buf[0] = MET_SYNC0;
+    buf[1] = MET_SYNC1;
+    buf[2] = plen;
+    buf[3] = type;
+    met_put16(buf + 4 + plen, met_crc16(buf + 2, plen + 2));
+    return (4 + plen + 2);
+}
 
-    if (scsi_wait_cip() == 0x100) {
-        printf("STO1  astat=%02x sstat=%02x",
-               get_wdc_reg(WDC_AUXST), get_wdc_reg(WDC_SCSI_STAT));
-        return (-1);
-    }
+/* Builds a stats frame in buf, returning its length */
+static uint
+met_frame(uint8_t *buf, const met_stats_t *st)
+{
+    uint8_t *ptr = buf + 4;
+
+    ptr = met_put32(ptr, st->seq);
+    ptr = met_put32(ptr, st->uptime);
+    ptr = met_put32(ptr, st->interval_ms);
+    ptr = met_put32(ptr, st->requests);
+    ptr = met_put32(ptr, st->read_kb);
+    ptr = met_put32(ptr, st->write_kb);
+    ptr = met_put32(ptr, st->lat_avg);
+    ptr = met_put32(ptr, st->lat_max);
+    ptr = met_put16(ptr, st->errors);
+    *(ptr++) = st->cpu_pct;
+    *(ptr++) = st->dropped;
+    ptr = met_put16(ptr, st->chip_free);
+    ptr = met_put16(ptr, st->fast_free);
+    return (met_frame_wrap(buf, MET_TYPE_STATS, ptr - buf - 4));
+}
 
-    /*
-     * The below read of AUXST and subsequent read of appears to be
-     * required. Otherwise, the WDC_CMD_TRANSFER_INFO will sometimes
-     * be ignored.
-     */
-    auxst = get_wdc_reg(WDC_AUXST);
-    if (auxst & WDC_AUXST_INT) {
-        (void) get_wdc_reg(WDC_SCSI_STAT);
-#ifdef DEBUG_PROBE_SCSI
-        printf("t_out auxst=%02x sstat=%02x\n",
-               auxst, get_wdc_reg(WDC_SCSI_STAT));
-#endif
-    }
+static void
+met_unframe(const uint8_t *payload, met_stats_t *st)
+{
+    st->seq         = met_get32(payload + 0);
+    st->uptime      = met_get32(payload + 4);
+    st->interval_ms = met_get32(payload + 8);
+    st->requests    = met_get32(payload + 12);
+    st->read_kb     = met_get32(payload + 16);
+    st->write_kb    = met_get32(payload + 20);
+    st->lat_avg     = met_get32(payload + 24);
+    st->lat_max     = met_get32(payload + 28);
+    st->errors      = met_get16(payload + 32);
+    st->cpu_pct     = payload[34];
+    st->dropped     = payload[35];
+    st->chip_free   = met_get16(payload + 36);
+    st->fast_free   = met_get16(payload + 38);
+}
 
-    /*
-     * The processor either should initialize the Transfer
-     * Count Register prior to issuing WDC_CMD_TRANSFER_INFO or
-     * issue the command with the SBT bit in the Command Register
-     * set. SBT = Single-byte Transfer (one byte is transferred)
-     */
-    set_wdc_reg(WDC_CONTROL, WDC_CONTROL_IDI | WDC_CONTROL_EDI);  // polled xfer
-//  scsi_set_transfer_len(len);    // WD will get count after select
-    set_wdc_reg(WDC_CMD, WDC_CMD_TRANSFER_INFO);
-    if (scsi_wait_cip() == 0x100) {
-        printf("STO2  astat=%02x sstat=%02x",
-               get_wdc_reg(WDC_AUXST), get_wdc_reg(WDC_SCSI_STAT));
-        return (-1);
+/*
+ * met_collect
+ * -----------
+ * Folds trace ring entries completed since the last call into st. An
+ * entry which has not completed stops the scan until it does, unless it
+ * is older than MET_STALE_SECS, in which case it is counted as dropped.
+ */
+static void
+met_collect(met_stats_t *st, uint32_t *tail, uint efreq)
+{
+    uint32_t head = trace_head;
+    uint32_t now = eclock_ticks();
+    uint64_t lat_sum = 0;
+    uint64_t bytes[3] = { 0, 0, 0 };
+
+    if (head - *tail > TRACE_ENTRIES) {
+        uint32_t lost = head - *tail - TRACE_ENTRIES;
+        st->dropped = (lost > 0xff) ? 0xff : lost;
+        *tail = head - TRACE_ENTRIES;
     }
+    for (; *tail != head; (*tail)++) {
+        trace_entry_t *ent = &trace_ring[*tail % TRACE_ENTRIES];
+        uint32_t       lat;
 
-    while (len > 0) {
-        timeout = 5000;
-        auxst = get_wdc_reg(WDC_AUXST);
-        while ((auxst & WDC_AUXST_DBR) == 0) {
-            if ((auxst & WDC_AUXST_INT) || (timeout-- == 0)) {
-#ifdef DEBUG_PROBE_SCSI
-                printf("  WDC timeout in transfer_out, %u left: %02x\n",
-                       len, auxst);
-#endif
-                if (auxst & WDC_AUXST_LCI) {
-                    uint8_t sstat = get_wdc_reg(WDC_SCSI_STAT);
-                    printf("LCI sstat=%02x\n", sstat);
-                    return (-1);
-                }
-                return (len);
-            }
-            cia_spin(10);
-            auxst = get_wdc_reg(WDC_AUXST);
+        if (ent->complete == 0) {
+            if (now - ent->submit < MET_STALE_SECS * efreq)
+                break;
+            if (st->dropped < 0xff)
+                st->dropped++;
+            continue;
         }
-        set_wdc_reg(WDC_DATA, *(bufptr++));  // Push data
-        len--;
+        lat = (uint64_t) (ent->complete - ent->submit) * 1000000 / efreq;
+        lat_sum += lat;
+        if (st->lat_max < lat)
+            st->lat_max = lat;
+        if (ent->error != 0)
+            st->errors++;
+        bytes[trace_rw(ent)] += ent->length;
+        st->requests++;
     }
-    return (len);
+    st->read_kb  = bytes[1] / 1024;
+    st->write_kb = bytes[2] / 1024;
+    if (st->requests != 0)
+        st->lat_avg = lat_sum / st->requests;
 }
 
-static int
-probe_scsi(void)
+/*
+ * ser_open
+ * --------
+ * Opens serial.device for exclusive use at the specified baud rate,
+ * 8N1 without XON/XOFF, so binary frames pass through unaltered.
+ */
+static struct IOExtSer *
+ser_open(uint baud)
 {
-    int found = 0;
-    uint target;
-    uint8_t auxst;
-    uint8_t sstat;
-    uint8_t sstat2;
-    uint8_t sdmac_contr;
+    struct MsgPort  *port;
+    struct IOExtSer *ser;
+
+    port = CreateMsgPort();
+    ser = (port == NULL) ? NULL :
+          (struct IOExtSer *) CreateIORequest(port, sizeof (*ser));
+    if (ser == NULL) {
+        printf("Failed to allocate serial request\n");
+        DeleteMsgPort(port);
+        return (NULL);
+    }
+    if (OpenDevice(SERIALNAME, MET_SERIAL_UNIT, (struct IORequest *) ser, 0)) {
+        printf("Failed to open %s unit %u\n", SERIALNAME, MET_SERIAL_UNIT);
+        DeleteIORequest((struct IORequest *) ser);
+        DeleteMsgPort(port);
+        return (NULL);
+    }
+    ser->io_Baud      = baud;
+    ser->io_ReadLen   = 8;
+    ser->io_WriteLen  = 8;
+    ser->io_StopBits  = 1;
+    ser->io_SerFlags |= SERF_XDISABLED;
+    ser->IOSer.io_Command = SDCMD_SETPARAMS;
+    if (DoIO((struct IORequest *) ser) != 0) {
+        printf("Failed to set %u baud\n", baud);
+        CloseDevice((struct IORequest *) ser);
+        DeleteIORequest((struct IORequest *) ser);
+        DeleteMsgPort(port);
+        return (NULL);
+    }
+    return (ser);
+}
 
-    INTERRUPTS_DISABLE();
-    sdmac_contr = *ADDR8(SDMAC_CONTR);
-    *ADDR8(SDMAC_CONTR) = 0;  // Disable interrupts
-    INTERRUPTS_ENABLE();
+static void
+ser_close(struct IOExtSer *ser)
+{
+    struct MsgPort *port = ser->IOSer.io_Message.mn_ReplyPort;
 
-    scsi_soft_reset(0);
-    (void) get_wdc_reg(WDC_SCSI_STAT);  // clear reset status
+    CloseDevice((struct IORequest *) ser);
+    DeleteIORequest((struct IORequest *) ser);
+    DeleteMsgPort(port);
+}
 
-    scsi_test_unit_ready_t tur;
-    memset(&tur, 0, sizeof (tur));
-    tur.opcode = SCSI_TEST_UNIT_READY;
+/* Writes len bytes to the serial port, returning non-zero on failure */
+static int
+ser_write(struct IOExtSer *ser, const void *buf, uint len)
+{
+    ser->IOSer.io_Command = CMD_WRITE;
+    ser->IOSer.io_Data    = (APTR) buf;
+    ser->IOSer.io_Length  = len;
+    return (DoIO((struct IORequest *) ser) != 0);
+}
 
-    INTERRUPTS_DISABLE();
-    for (target = 0; target < 7; target++) {
-        uint8_t phase;
-        uint    cmdlen;
-        uint    present = 0;
+/*
+ * metrics_run
+ * -----------
+ * Sends a metrics frame every interval seconds until ^C.
+ */
+static int
+metrics_run(uint interval, uint baud)
+{
+    static uint8_t   frame[MET_FRAME_MAX];
+    struct IOExtSer *ser;
+    struct Library  *dev;
+    struct Task     *idle;
+    met_stats_t      st;
+    uint64_t         idle_rate;
+    uint32_t         idle_last;
+    uint64_t         uptime = 0;  // E clock ticks; eclock_ticks() wraps
+    uint32_t         last;
+    uint32_t         tail = 0;
+    uint32_t         seq = 0;
+    uint             efreq = get_eclock_freq();
+    int              rc = 0;
+
+    ser = ser_open(baud);
+    if (ser == NULL)
+        return (1);
 
-        if (scsi_wait_cip() == 0x100) {
-            printf("CIP%d  astat=%02x sstat=%02x", 0,
-                   get_wdc_reg(WDC_AUXST), get_wdc_reg(WDC_SCSI_STAT));
-            found = -1;
+    idle = idle_start(&idle_rate);
+    if (idle == NULL) {
+        printf("Failed to start idle task\n");
+        rc = 1;
+        goto fail_close;
+    }
+    dev = trace_start();
+    if (dev == NULL) {
+        rc = 1;
+        goto fail_idle;
+    }
+
+    printf("Sending metrics every %u s at %u baud on %s unit %u "
+           "(^C to stop)\n", interval, baud, SERIALNAME, MET_SERIAL_UNIT);
+    last = eclock_ticks();
+    idle_last = idle_count;
+    for (;;) {
+        uint32_t now;
+        uint32_t elapsed;
+        uint32_t idle_ticks;
+
+        Delay(interval * 50);
+        if (is_user_abort())
             break;
-        }
-        sstat = get_wdc_reg(WDC_SCSI_STAT);
-        if (sstat & 0xe0) {
-            printf("odd sstat %02x\n", sstat);
-            found = -1;
+
+        /* Hot path: no stdio from here to DoIO() */
+        now = eclock_ticks();
+        elapsed = now - last;
+        uptime += elapsed;
+        memset(&st, 0, sizeof (st));
+        st.seq         = seq++;
+        st.uptime      = uptime / efreq;
+        st.interval_ms = (uint64_t) elapsed * 1000 / efreq;
+        met_collect(&st, &tail, efreq);
+        idle_ticks = ((uint64_t) (idle_count - idle_last) << 16) / idle_rate;
+        st.cpu_pct = (idle_ticks >= elapsed) ? 0 :
+                     (uint64_t) (elapsed - idle_ticks) * 100 / elapsed;
+        st.chip_free = AvailMem(MEMF_CHIP) / 1024;
+        st.fast_free = AvailMem(MEMF_FAST) / (1024 * 1024);
+        idle_last = idle_count;
+        last = now;
+
+        if (ser_write(ser, frame, met_frame(frame, &st))) {
+            rc = 1;
             break;
         }
-        /* Disable WDC DMA mode */
-        set_wdc_reg(WDC_CONTROL, WDC_CONTROL_IDI | WDC_CONTROL_EDI);
+    }
+    trace_stop(dev);
+    FreeMem(trace_ring, TRACE_ENTRIES * sizeof (trace_entry_t));
+    printf("%u frames sent\n", seq);
+fail_idle:
+    idle_stop_wait(idle);
+fail_close:
+    ser_close(ser);
+    return (rc);
+}
 
-        cmdlen = sizeof (tur);
-        scsi_set_cdb(&tur, cmdlen);
-        scsi_set_transfer_len(0);
-        sstat = scsi_select(target);
-        sstat2 = get_wdc_reg(WDC_SCSI_STAT);
+/*
+ * metrics_decode
+ * --------------
+ * Decodes a captured metrics stream, resynchronizing after corrupt or
+ * partial frames, and shows each frame with the average throughput and
+ * CPU use and the maximum latency of the last MET_ROLLING frames.
+ */
+static int
+metrics_decode(const char *filename)
+{
+    static met_stats_t hist[MET_ROLLING];
+    uint8_t *buf;
+    long     len;
+    long     pos = 0;
+    uint     nhist = 0;
+    uint     frames = 0;
+    uint     skipped = 0;
+    uint32_t next_seq = 0;
+    uint     lost = 0;
+
+    buf = snap_load(filename, &len);
+    if (buf == NULL)
+        return (1);
 
-        set_wdc_reg(WDC_SRC_ID, 0);  // Disable reselection
+    printf("   SEQ  UPTIME  REQS RD_KB WR_KB AVG_US MAX_US ERR CPU "
+           "| ROLLING KB/s CPU MAX_US\n");
+    while (pos + 4 + 2 <= len) {
+        met_stats_t *st;
+        uint         plen;
+        uint         hpos;
+        uint64_t     kb = 0;
+        uint64_t     ms = 0;
+        uint         cpu = 0;
+        uint32_t     lat_max = 0;
+
+        if ((buf[pos] != MET_SYNC0) || (buf[pos + 1] != MET_SYNC1)) {
+            pos++;
+            skipped++;
+            continue;
+        }
+        plen = buf[pos + 2];
+        if ((pos + 4 + plen + 2 > len) ||
+            (met_crc16(buf + pos + 2, plen + 2) !=
+             met_get16(buf + pos + 4 + plen))) {
+            pos++;  // Bad or truncated frame: resync
+            skipped++;
+            continue;
+        }
+        if ((buf[pos + 3] != MET_TYPE_STATS) || (plen < MET_PAYLOAD)) {
+            pos += 4 + plen + 2;  // Unknown frame type
+            continue;
+        }
 
-        if (sstat == WDC_SSTAT_SEL_COMPLETE) {
-            uint timeout = 10;
-            while (sstat2 == sstat) {
-                cia_spin(10);
-                sstat2 = get_wdc_reg(WDC_SCSI_STAT);
-                if (--timeout == 0)
-                    break;
-            }
-            if (timeout == 0) {
-                printf("timeout: sstat=%02x sstat2=%02x\n", sstat, sstat2);
-                found = -1;
-                break;
-            }
-            phase  = sstat2 & 0x07;  // phase bits of status
-            present = 1;
-            found++;
-#ifdef DEBUG_PROBE_SCSI
-            printf("  sstat2=%02x astat=%02x\n",
-                   sstat2, get_wdc_reg(WDC_AUXST));
-#endif
-            if (scsi_wait_cip() == 0x100) {
-                printf("CIP%d  astat=%02x sstat=%02x", 1,
-                       get_wdc_reg(WDC_AUXST), get_wdc_reg(WDC_SCSI_STAT));
-                found = -1;
-                break;
-            }
+        st = &hist[frames % MET_ROLLING];
+        met_unframe(buf + pos + 4, st);
+        pos += 4 + plen + 2;
+        if ((frames != 0) && (st->seq != next_seq))
+            lost += st->seq - next_seq;
+        next_seq = st->seq + 1;
+        frames++;
+        if (nhist < MET_ROLLING)
+            nhist++;
+
+        for (hpos = 0; hpos < nhist; hpos++) {
+            kb  += hist[hpos].read_kb + hist[hpos].write_kb;
+            ms  += hist[hpos].interval_ms;
+            cpu += hist[hpos].cpu_pct;
+            if (lat_max < hist[hpos].lat_max)
+                lat_max = hist[hpos].lat_max;
+        }
+        printf("%6u %7u %5u %5u %5u %6u %6u %3u %3u | %12u %3u %6u\n",
+               st->seq, st->uptime, st->requests, st->read_kb, st->write_kb,
+               st->lat_avg, st->lat_max, st->errors, st->cpu_pct,
+               (ms == 0) ? 0 : (uint) (kb * 1000 / ms), cpu / nhist, lat_max);
+    }
+    printf("%u frames, %u lost, %u bytes skipped\n", frames, lost,
+           skipped + (uint) (len - pos));
+    free(buf);
+    return (0);
+}
 
-            /* Set up transfer */
-            set_wdc_reg(WDC_DST_ID, target & 0x7);
-            scsi_transfer_start(phase);
+/*
+ * Remote test agent
+ *
+ * -g listens on serial.device for command frames from a host and sends
+ * one reply frame for each. Frames use the -e layout (A5 5A, length,
+ * type, payload, CRC-16). A reply has the request type with bit 7 set,
+ * or AG_ERROR with a payload of the request type and an AG_ERR code.
+ * Multi-byte fields are big-endian. A frame with a bad CRC gets no
+ * reply, so the host should retry after a timeout. The Linux client is
+ * in host/sdmac_host.c, which mirrors the definitions below.
+ *
+ *   Request         Payload                    Reply payload
+ *   AG_PING         -                          version string
+ *   AG_REG_READ     reg                        value
+ *   AG_REG_WRITE    reg value                  -
+ *   AG_BURST_READ   first count                count register values
+ *   AG_TEST         test name                  failed (16-bit)
+ *   AG_BENCH        unit KB(16-bit) depth      status
+ *   AG_RESULTS      -                          KB/s x3 (32-bit), drive
+ *   AG_QUIT         -                          -
+ *
+ * Registers are WDC registers as for -r; 0x40 and above are WD33C93B
+ * extended registers. Test names are those in the test registry (see
+ * -x). AG_BENCH runs the -b comparison, after which AG_RESULTS
+ * returns the KB/s of each path and the drive INQUIRY identification.
+ * Test and benchmark output also goes to the local console.
+ */
+#define AG_PING          0x01
+#define AG_REG_READ      0x02
+#define AG_REG_WRITE     0x03
+#define AG_BURST_READ    0x04
+#define AG_TEST          0x05
+#define AG_BENCH         0x06
+#define AG_RESULTS       0x07
+#define AG_QUIT          0x08
+#define AG_REPLY         0x80
+#define AG_ERROR         0xff
+
+#define AG_ERR_LENGTH    1  // Payload length wrong for request
+#define AG_ERR_UNKNOWN   2  // Unknown request type or test name
+#define AG_ERR_RANGE     3  // Parameter out of range
+#define AG_ERR_HARDWARE  4  // Not supported by this controller
+
+#define AG_FRAME_MAX     (4 + 255 + 2)
 
-            /* Delay and then check for interrupt */
-            if (scsi_wait_cip() == 0x100) {
-                printf("CIP%d  astat=%02x sstat=%02x", 2,
-                       get_wdc_reg(WDC_AUXST), get_wdc_reg(WDC_SCSI_STAT));
-                found = -1;
-                break;
-            }
-            (void) get_wdc_reg(WDC_AUXST);
-            (void) get_wdc_reg(WDC_AUXST);
-            (void) get_wdc_reg(WDC_AUXST);
-            auxst = get_wdc_reg(WDC_AUXST);
-            if (auxst & WDC_AUXST_INT) {
-                /* Clear pending interrupt */
-                (void) get_wdc_reg(WDC_SCSI_STAT);
-            }
-            if (auxst & WDC_AUXST_LCI) {
-                printf("LCI during SCSI transfter start: %02x\n",
-                       get_wdc_reg(WDC_SCSI_STAT));
-                found = -1;
-                break;
-            }
-            if ((phase == WDC_PHASE_DATA_IN) || (phase == WDC_PHASE_MESG_IN)) {
-                if (scsi_transfer_in(phase) <= 0) {
-                    printf("phase=%02x sstat=%02x sstat2=%02x\n",
-                           phase, sstat, sstat2);
-                    found = -1;
-                    break;
-                }
-            } else if (scsi_transfer_out(cmdlen, &tur) <= 0) {
-                found = -1;
-                break;
-            }
-            set_wdc_reg(WDC_CONTROL, WDC_CONTROL_IDI | WDC_CONTROL_EDI);
-            scsi_abort();
-        } else if (sstat == WDC_SSTAT_SEL_TIMEOUT) {
-            present = 0;
-        } else {
-            printf("  Unexpected SCSI STAT sstat=%02x %02x\n", sstat, sstat2);
-            found = -1;
-            break;
+/*
+ * ser_read
+ * --------
+ * Reads len bytes from the serial port, waiting as long as required.
+ * Returns non-zero on ^C or a device error.
+ */
+static int
+ser_read(struct IOExtSer *ser, uint8_t *buf, uint len)
+{
+    ULONG portsig = 1UL << ser->IOSer.io_Message.mn_ReplyPort->mp_SigBit;
+
+    ser->IOSer.io_Command = CMD_READ;
+    ser->IOSer.io_Data    = buf;
+    ser->IOSer.io_Length  = len;
+    SendIO((struct IORequest *) ser);
+    while (CheckIO((struct IORequest *) ser) == NULL) {
+        if (Wait(portsig | SIGBREAKF_CTRL_C) & SIGBREAKF_CTRL_C) {
+            AbortIO((struct IORequest *) ser);
+            WaitIO((struct IORequest *) ser);
+            return (1);
         }
+    }
+    return (WaitIO((struct IORequest *) ser) != 0);
+}
 
-        if (scsi_wait_cip() == 0x100) {
-            printf("CIP%d  astat=%02x sstat=%02x", 3,
-                   get_wdc_reg(WDC_AUXST), get_wdc_reg(WDC_SCSI_STAT));
-            found = -1;
-            break;
+/*
+ * agent_recv
+ * ----------
+ * Reads the next frame with a valid CRC into buf, discarding anything
+ * before it. Returns non-zero on ^C or a device error.
+ */
+static int
+agent_recv(struct IOExtSer *ser, uint8_t *buf)
+{
+    buf[0] = 0;
+    for (;;) {
+        if (ser_read(ser, buf + 1, 1))
+            return (1);
+        if ((buf[0] != MET_SYNC0) || (buf[1] != MET_SYNC1)) {
+            buf[0] = buf[1];  // A5 A5 5A must still sync
+            continue;
         }
-        scsi_soft_reset(0);
-        if (scsi_wait_cip() == 0x100) {
-            printf("CIP%d  astat=%02x sstat=%02x", 4,
-                   get_wdc_reg(WDC_AUXST), get_wdc_reg(WDC_SCSI_STAT));
-            found = -1;
-            break;
+        if (ser_read(ser, buf + 2, 2) ||
+            ser_read(ser, buf + 4, buf[2] + 2))
+            return (1);
+        if (met_crc16(buf + 2, buf[2] + 2) == met_get16(buf + 4 + buf[2]))
+            return (0);
+        if (flag_debug)
+            printf("agent: CRC error, frame type %02x dropped\n", buf[3]);
+        buf[0] = 0;
+    }
+}
+
+/*
+ * agent_request
+ * -------------
+ * Performs the request in req and builds the reply payload at rep + 4.
+ * Returns the reply payload length, or -(AG_ERR code) on error.
+ */
+static int
+agent_request(const uint8_t *req, uint8_t *rep)
+{
+    const uint8_t   *arg = req + 4;
+    uint8_t         *out = rep + 4;
+    uint             plen = req[2];
+    uint             pos;
+    bench_workload_t wl;
+
+    switch (req[3]) {
+        case AG_PING:
+            pos = strlen(version + 7);
+            memcpy(out, version + 7, pos);
+            return (pos);
+        case AG_REG_READ:
+            if (plen != 1)
+                return (-AG_ERR_LENGTH);
+            if ((arg[0] >= 0x40) && (wd_level != LEVEL_WD33C93B))
+                return (-AG_ERR_HARDWARE);
+            out[0] = get_wdc_reg_extended(arg[0]);
+            return (1);
+        case AG_REG_WRITE:
+            if (plen != 2)
+                return (-AG_ERR_LENGTH);
+            if ((arg[0] >= 0x40) && (wd_level != LEVEL_WD33C93B))
+                return (-AG_ERR_HARDWARE);
+            set_wdc_reg_extended(arg[0], arg[1]);
+            return (0);
+        case AG_BURST_READ:
+            if (plen != 2)
+                return (-AG_ERR_LENGTH);
+            if ((arg[1] == 0) || (arg[0] + arg[1] > 0x100))
+                return (-AG_ERR_RANGE);
+            if ((arg[0] + arg[1] > 0x40) && (wd_level != LEVEL_WD33C93B))
+                return (-AG_ERR_HARDWARE);
+            if (get_wdc_regs_extended(arg[0], arg[1], out) != 0)
+                return (-AG_ERR_HARDWARE);
+            return (arg[1]);
+        case AG_TEST: {
+            int test = test_find((const char *) arg, plen);
+            if (plen == 0)
+                return (-AG_ERR_LENGTH);
+            if (test < 0)
+                return (-AG_ERR_UNKNOWN);
+            if (test_missing(&tests[test]) != NULL)
+                return (-AG_ERR_HARDWARE);
+            met_put16(out, test_run(BIT(test), 0));
+            return (2);
         }
-        (void) get_wdc_reg(WDC_SCSI_STAT);  // clear reset status
+        case AG_BENCH:
+            if (plen != 4)
+                return (-AG_ERR_LENGTH);
+            memset(&wl, 0, sizeof (wl));
+            wl.unit        = arg[0];
+            wl.blocks      = 4096 * 1024 / SCSI_BLOCK_SIZE;
+            wl.xfer_blocks = met_get16(arg + 1) * 1024 / SCSI_BLOCK_SIZE;
+            wl.depth       = arg[3];
+            if ((wl.unit % 10 > 7) || (wl.xfer_blocks == 0) ||
+                (wl.xfer_blocks > 8192 * 1024 / SCSI_BLOCK_SIZE) ||
+                (wl.depth == 0) || (wl.depth > BENCH_MAX_DEPTH))
+                return (-AG_ERR_RANGE);
+            out[0] = bench_compare(&wl);
+            return (1);
+        case AG_RESULTS:
+            for (pos = 0; pos < ARRAY_SIZE(bench_result_kbps); pos++)
+                out = met_put32(out, bench_result_kbps[pos]);
+            memcpy(out, bench_result_drive, sizeof (bench_result_drive));
+            return (out + sizeof (bench_result_drive) - (rep + 4));
+        case AG_QUIT:
+            return (0);
+        default:
+            return (-AG_ERR_UNKNOWN);
+    }
+}
+
+/*
+ * agent_run
+ * ---------
+ * Serves host requests on the serial port until AG_QUIT or ^C.
+ */
+static int
+agent_run(uint baud)
+{
+    static uint8_t   req[AG_FRAME_MAX];
+    static uint8_t   rep[AG_FRAME_MAX];
+    struct IOExtSer *ser;
+    uint             requests = 0;
+    int              rc = 0;
+
+    ser = ser_open(baud);
+    if (ser == NULL)
+        return (1);
 
-        *ADDR8(SDMAC_CLR_INT) = 0;  // Clear pending interrupts
+    printf("Agent listening at %u baud on %s unit %u (^C to stop)\n",
+           baud, SERIALNAME, MET_SERIAL_UNIT);
+    while (agent_recv(ser, req) == 0) {
+        int len = agent_request(req, rep);
+        uint type = req[3];
 
-        if (is_user_abort()) {
-            printf("^C Abort\n");
-            found = -1;
+        requests++;
+        if (flag_debug)
+            printf("agent: request %02x len %u -> %d\n", type, req[2], len);
+        if (len < 0) {
+            rep[4] = type;
+            rep[5] = -len;
+            len = met_frame_wrap(rep, AG_ERROR, 2);
+        } else {
+            len = met_frame_wrap(rep, type | AG_REPLY, len);
+        }
+        if (ser_write(ser, rep, len)) {
+            printf("Serial write failed\n");
+            rc = 1;
             break;
         }
-        INTERRUPTS_ENABLE();
-#ifdef DEBUG_PROBE_SCSI
-        printf("%u %s sstat=%02x phase=%x\n",
-               target, present ? "present" : "no response", sstat, phase);
-#else
-        printf("  %u %s\n", target, present ? "present" : "no response");
-#endif
-        INTERRUPTS_DISABLE();
-    }
-#ifdef DEBUG_PROBE_SCSI
-    printf("auxst=%02x\n", get_wdc_reg(WDC_AUXST));
-    printf("sstat=%02x\n", get_wdc_reg(WDC_SCSI_STAT));
-    printf("istr=%02x\n", *ADDR8(SDMAC_ISTR));
-#endif
-    *ADDR8(SDMAC_CLR_INT) = 0;          // Clear interrupt
-    *ADDR8(SDMAC_CONTR) = sdmac_contr;  // Restore interrupts
-    INTERRUPTS_ENABLE();
-    if (found == 0) {
-        printf("No device found\n");
-        return (1);
+        if (type == AG_QUIT)
+            break;
     }
-    if (found == -1)
-        return (1);
-    return (0);
+    printf("Agent stopped after %u requests\n", requests);
+    ser_close(ser);
+    return (rc);
 }
 
 int
@@ -2510,34 +9090,341 @@ main(int argc, char **argv)
 {
     int do_wdc_reset = 0;
     int raw_sdmac_regs = 0;
+    int map_sdmac = 0;
+    const char *watch_list = NULL;
+    uint watch_secs = 10;
+    uint watch_hz = WATCH_DEF_HZ;
     int all_regs = 0;
     int loop_until_failure = 0;
     int readwrite_wdc_reg = 0;
     int probe_scsi_bus = 0;
+    int irq_latency = 0;
     int flag_show = 0;
     int flag_force_test = 0;
+    int all_controllers = 0;
+    const char *la_file = NULL;
+    uint la_samples = 4096;
+    const char *trace_file = NULL;
+    uint trace_secs = 10;
+    int trace_analyze_only = 0;
+    int metrics = 0;
+    uint metrics_secs = 1;
+    uint metrics_baud = 9600;
+    const char *metrics_file = NULL;
+    int agent = 0;
+    uint32_t test_sel = 0;
+    profile_t profile;
+    int profile_set = 0;
+    int quick = 0;
+    uint test_repeat = 1;
+    uint agent_baud = 9600;
+    int snap_decode_files = 0;
+    int snap_decode_brief = 0;
+    char *snap_query_key = NULL;
+    char **snap_files = NULL;
+    char *snap_file = NULL;
+    char *snap_label = NULL;
+    snap_t snap;
+    bench_workload_t bench_wl;
+    int bench = 0;
+    int xfer_modes = 0;
+    int align = 0;
+    int cache_cost = 0;
+    uint cache_unit = 0;
+    uint align_unit = 0;
+    uint align_len = 4096;
+    int ttr = 0;
+    uint ttr_secs = 30;
     int arg;
     uint pass = 0;
     uint exit_status = 0;
+    uint cur;
+    uint ctrl_first;
+    uint ctrl_last;
+    uint display_only;
+
+    cia_timer_alloc();
+    atexit(cia_timer_free);
+    qc_start = eclock_ticks();
 
     for (arg = 1; arg < argc; arg++) {
         char *ptr = argv[arg];
         if (*ptr == '-') {
             while (*(++ptr) != '\0') {
                 switch (*ptr) {
+                    case 'a': {
+                        int pos = 0;
+                        char *arg2 = argv[arg + 2];
+                        if ((argc <= arg + 1) || (*argv[arg + 1] == '-')) {
+                            printf("Missing VCD file for -%s\n", ptr);
+                            exit(1);
+                        }
+                        la_file = argv[++arg];
+                        if ((argc <= arg + 1) || (*arg2 == '-'))
+                            break;
+                        if ((sscanf(arg2, "%u%n", &la_samples, &pos) != 1) ||
+                            (arg2[pos] != '\0') || (la_samples < 2)) {
+                            printf("Invalid sample count %s for -%s\n",
+                                   arg2, ptr);
+                            exit(1);
+                        }
+                        arg++;
+                        break;
+                    }
+                    case 'q':
+                        quick++;
+                        break;
+                    case 'Q':
+                        if ((argc <= arg + 1) || (*argv[arg + 1] == '-')) {
+                            printf("Missing query key for -%s\n", ptr);
+                            exit(1);
+                        }
+                        snap_query_key = argv[++arg];
+                        /* FALLTHROUGH */
+                    case 'D':
+                        if (snap_decode_brief++ > 0)
+                            break;  // -DD: files already collected
+                        snap_files = &argv[arg + 1];
+                        while ((arg + 1 < argc) && (*argv[arg + 1] != '-')) {
+                            snap_decode_files++;
+                            arg++;
+                        }
+                        if (snap_decode_files == 0) {
+                            printf("Missing snapshot file for -%s\n", ptr);
+                            exit(1);
+                        }
+                        break;
+                    case 'S':
+                        if ((argc <= arg + 1) || (*argv[arg + 1] == '-')) {
+                            printf("Missing snapshot file for -%s\n", ptr);
+                            exit(1);
+                        }
+                        snap_file = argv[++arg];
+                        if ((argc > arg + 1) && (*argv[arg + 1] != '-'))
+                            snap_label = argv[++arg];
+                        break;
+                    case 'A':
+                    case 'T': {
+                        int pos = 0;
+                        char *arg2 = argv[arg + 2];
+                        if ((argc <= arg + 1) || (*argv[arg + 1] == '-')) {
+                            printf("Missing trace file for -%s\n", ptr);
+                            exit(1);
+                        }
+                        trace_file = argv[++arg];
+                        if (*ptr == 'A') {
+                            trace_analyze_only++;
+                            break;
+                        }
+                        if ((argc <= arg + 1) || (*arg2 == '-'))
+                            break;
+                        if ((sscanf(arg2, "%u%n", &trace_secs, &pos) != 1) ||
+                            (arg2[pos] != '\0')) {
+                            printf("Invalid seconds %s for -%s\n", arg2, ptr);
+                            exit(1);
+                        }
+                        arg++;
+                        break;
+                    }
+                    case 'b':
+                    case 'm': {
+                        int pos = 0;
+                        uint kb = 64;
+                        char *arg1 = argv[arg + 1];
+                        char *arg2 = argv[arg + 2];
+                        char *arg3 = argv[arg + 3];
+                        memset(&bench_wl, 0, sizeof (bench_wl));
+                        bench_wl.blocks = 4096 * 1024 / SCSI_BLOCK_SIZE;
+                        bench_wl.depth  = 4;
+                        if ((argc <= arg + 1) ||
+                            (sscanf(arg1, "%u%n", &bench_wl.unit, &pos) != 1) ||
+                            (arg1[pos] != '\0') || (bench_wl.unit % 10 > 7)) {
+                            printf("Invalid unit for -%s\n", ptr);
+                            exit(1);
+                        }
+                        arg++;
+                        if (*ptr == 'm') {
+                            /* PIO is slow: use a smaller workload */
+                            bench_wl.blocks = 1024 * 1024 / SCSI_BLOCK_SIZE;
+                            xfer_modes++;
+                        } else {
+                            bench++;
+                        }
+                        if ((argc > arg + 1) && (*arg2 != '-')) {
+                            if ((sscanf(arg2, "%u%n", &kb, &pos) != 1) ||
+                                (arg2[pos] != '\0') || (kb == 0) ||
+                                (kb > 8192)) {
+                                printf("Invalid KB %s for -%s\n", arg2, ptr);
+                                exit(1);
+                            }
+                            arg++;
+                            if ((argc > arg + 1) && (*arg3 != '-')) {
+                                if ((sscanf(arg3, "%u%n", &bench_wl.depth,
+                                            &pos) != 1) ||
+                                    (arg3[pos] != '\0') ||
+                                    (bench_wl.depth == 0) ||
+                                    (bench_wl.depth > BENCH_MAX_DEPTH)) {
+                                    printf("Invalid depth %s for -%s\n",
+                                           arg3, ptr);
+                                    exit(1);
+                                }
+                                arg++;
+                            }
+                        }
+                        bench_wl.xfer_blocks = kb * 1024 / SCSI_BLOCK_SIZE;
+                        break;
+                    }
+                    case 'B': {
+                        int pos = 0;
+                        char *arg1 = argv[arg + 1];
+                        if (bl_tolerance != 0) {
+                            bl_reset++;  // -BB
+                            break;
+                        }
+                        bl_tolerance = BL_DEF_TOL;
+                        if ((argc <= arg + 1) || (*arg1 == '-'))
+                            break;
+                        if ((sscanf(arg1, "%u%n", &bl_tolerance, &pos) != 1) ||
+                            (arg1[pos] != '\0') || (bl_tolerance == 0)) {
+                            printf("Invalid tolerance %s for -%s\n", arg1, ptr);
+                            exit(1);
+                        }
+                        arg++;
+                        break;
+                    }
+                    case 'c': {
+                        int pos = 0;
+                        uint sel;
+                        char *arg1 = argv[arg + 1];
+                        if (ctrl_count == 0)
+                            find_controllers();
+                        if ((argc <= arg + 1) || (*arg1 == '-')) {
+                            /* Display detected controllers */
+                            show_controllers();
+                            exit(0);
+                        }
+                        arg++;
+                        if (strcmp(arg1, "all") == 0) {
+                            all_controllers++;
+                            break;
+                        }
+                        if ((sscanf(arg1, "%u%n", &sel, &pos) != 1) ||
+                            (arg1[pos] != '\0') || (sel >= ctrl_count)) {
+                            printf("Invalid controller %s for -%s\n", arg1, ptr);
+                            exit(1);
+                        }
+                        ctrl = &ctrl_list[sel];
+                        break;
+                    }
+                    case 'C': {
+                        int pos = 0;
+                        char *arg1 = argv[arg + 1];
+                        if ((argc <= arg + 1) ||
+                            (sscanf(arg1, "%u%n", &cache_unit, &pos) != 1) ||
+                            (arg1[pos] != '\0') || (cache_unit % 10 > 7)) {
+                            printf("Invalid unit for -%s\n", ptr);
+                            exit(1);
+                        }
+                        arg++;
+                        cache_cost++;
+                        break;
+                    }
                     case 'd':
                         flag_debug++;
                         break;
+                    case 'e': {
+                        int pos = 0;
+                        char *arg1 = argv[arg + 1];
+                        char *arg2 = argv[arg + 2];
+                        metrics++;
+                        if ((argc <= arg + 1) || (*arg1 == '-'))
+                            break;
+                        if ((sscanf(arg1, "%u%n", &metrics_secs, &pos) != 1) ||
+                            (arg1[pos] != '\0') || (metrics_secs == 0)) {
+                            printf("Invalid seconds %s for -%s\n", arg1, ptr);
+                            exit(1);
+                        }
+                        arg++;
+                        if ((argc <= arg + 1) || (*arg2 == '-'))
+                            break;
+                        if ((sscanf(arg2, "%u%n", &metrics_baud, &pos) != 1) ||
+                            (arg2[pos] != '\0') || (metrics_baud < 110)) {
+                            printf("Invalid baud %s for -%s\n", arg2, ptr);
+                            exit(1);
+                        }
+                        arg++;
+                        break;
+                    }
+                    case 'E':
+                        if ((argc <= arg + 1) || (*argv[arg + 1] == '-')) {
+                            printf("Missing metrics file for -%s\n", ptr);
+                            exit(1);
+                        }
+                        metrics_file = argv[++arg];
+                        break;
+                    case 'g': {
+                        int pos = 0;
+                        char *arg1 = argv[arg + 1];
+                        agent++;
+                        if ((argc <= arg + 1) || (*arg1 == '-'))
+                            break;
+                        if ((sscanf(arg1, "%u%n", &agent_baud, &pos) != 1) ||
+                            (arg1[pos] != '\0') || (agent_baud < 110)) {
+                            printf("Invalid baud %s for -%s\n", arg1, ptr);
+                            exit(1);
+                        }
+                        arg++;
+                        break;
+                    }
+                    case 'i':
+                        irq_latency++;
+                        break;
+                    case 'k':
+                        cia_timer_show();
+                        exit(0);
                     case 'L':
                         loop_until_failure++;
                         break;
+                    case 'o': {
+                        int pos = 0;
+                        char *arg1 = argv[arg + 1];
+                        char *arg2 = argv[arg + 2];
+                        if ((argc <= arg + 1) ||
+                            (sscanf(arg1, "%u%n", &align_unit, &pos) != 1) ||
+                            (arg1[pos] != '\0') || (align_unit % 10 > 7)) {
+                            printf("Invalid unit for -%s\n", ptr);
+                            exit(1);
+                        }
+                        arg++;
+                        align++;
+                        if ((argc <= arg + 1) || (*arg2 == '-'))
+                            break;
+                        if ((sscanf(arg2, "%u%n", &align_len, &pos) != 1) ||
+                            (arg2[pos] != '\0') || (align_len < 16) ||
+                            (align_len & 3) || (align_len > ALIGN_LEN_MAX)) {
+                            printf("Invalid bytes %s for -%s\n", arg2, ptr);
+                            exit(1);
+                        }
+                        arg++;
+                        break;
+                    }
                     case 'p':
                         probe_scsi_bus++;
                         break;
+                    case 'P':
+                        if ((argc <= arg + 1) || (*argv[arg + 1] == '-')) {
+                            printf("Missing profile file for -%s\n", ptr);
+                            exit(1);
+                        }
+                        if (profile_parse(argv[++arg], &profile))
+                            exit(1);
+                        profile_set++;
+                        break;
                     case 'r': {
                         int pos = 0;
                         uint addr;
                         uint val;
+                        FILE *fp;
                         char *arg1 = argv[arg + 1];
                         char *arg2 = argv[arg + 2];
                         if ((argc <= arg + 1) || (*arg1 == '-')) {
@@ -2545,10 +9432,25 @@ main(int argc, char **argv)
                             all_regs++;
                             break;
                         }
-                        if ((sscanf(arg1, "%x%n", &addr, &pos) != 1) ||
+                        if (ctrl_count == 0)
+                            find_controllers();
+                        /*
+                         * A script named like a hex register (such as
+                         * "ab") would otherwise be read as one, so an
+                         * existing file takes precedence.
+                         */
+                        fp = fopen(arg1, "r");
+                        if (fp != NULL)
+                            fclose(fp);
+                        if ((fp != NULL) ||
+                            (sscanf(arg1, "%x%n", &addr, &pos) != 1) ||
                             (arg1[pos] != '\0') || (addr > 0xff)) {
-                            printf("Invalid address %s for -%s\n", arg1, ptr);
-                            exit(1);
+                            /* Not a register: run as a script file */
+                            arg++;
+                            readwrite_wdc_reg++;
+                            if (run_wdc_script(arg1))
+                                exit(1);
+                            break;
                         }
                         if ((argc <= arg + 2) || (*arg2 == '-')) {
                             /* read */
@@ -2571,6 +9473,9 @@ main(int argc, char **argv)
                         show_wdc_reg(addr, val);
                         break;
                     }
+                    case 'M':
+                        map_sdmac++;
+                        break;
                     case 'R':
                         do_wdc_reset++;
                         break;
@@ -2580,6 +9485,71 @@ main(int argc, char **argv)
                     case 't':
                         flag_force_test++;
                         break;
+                    case 'u': {
+                        int pos = 0;
+                        char *arg1 = argv[arg + 1];
+                        ttr++;
+                        if ((ttr > 1) || (argc <= arg + 1) || (*arg1 == '-'))
+                            break;
+                        if ((sscanf(arg1, "%u%n", &ttr_secs, &pos) != 1) ||
+                            (arg1[pos] != '\0') || (ttr_secs == 0)) {
+                            printf("Invalid seconds %s for -%s\n", arg1, ptr);
+                            exit(1);
+                        }
+                        arg++;
+                        break;
+                    }
+                    case 'w': {
+                        int pos = 0;
+                        char *arg1 = argv[arg + 1];
+                        char *arg2 = argv[arg + 2];
+                        char *arg3 = argv[arg + 3];
+                        watch_list = WATCH_DEF_REGS;
+                        if ((argc <= arg + 1) || (*arg1 == '-'))
+                            break;
+                        watch_list = arg1;
+                        arg++;
+                        if ((argc <= arg + 1) || (*arg2 == '-'))
+                            break;
+                        if ((sscanf(arg2, "%u%n", &watch_secs, &pos) != 1) ||
+                            (arg2[pos] != '\0') || (watch_secs == 0) ||
+                            (watch_secs > 3600)) {
+                            printf("Invalid seconds %s for -%s\n", arg2, ptr);
+                            exit(1);
+                        }
+                        arg++;
+                        if ((argc <= arg + 1) || (*arg3 == '-'))
+                            break;
+                        if ((sscanf(arg3, "%u%n", &watch_hz, &pos) != 1) ||
+                            (arg3[pos] != '\0')) {
+                            printf("Invalid rate %s for -%s\n", arg3, ptr);
+                            exit(1);
+                        }
+                        arg++;
+                        break;
+                    }
+                    case 'x': {
+                        int pos = 0;
+                        char *arg1 = argv[arg + 1];
+                        char *arg2 = argv[arg + 2];
+                        if ((argc <= arg + 1) || (*arg1 == '-')) {
+                            test_list();
+                            exit(0);
+                        }
+                        test_sel = test_parse(arg1);
+                        if (test_sel == 0)
+                            exit(1);
+                        arg++;
+                        if ((argc <= arg + 1) || (*arg2 == '-'))
+                            break;
+                        if ((sscanf(arg2, "%u%n", &test_repeat, &pos) != 1) ||
+                            (arg2[pos] != '\0') || (test_repeat == 0)) {
+                            printf("Invalid count %s for -%s\n", arg2, ptr);
+                            exit(1);
+                        }
+                        arg++;
+                        break;
+                    }
                     case 'v':
                         printf("%s\n", version + 7);
                         exit(0);
@@ -2590,88 +9560,291 @@ main(int argc, char **argv)
         } else {
 usage:
             printf("%s\nOptions:\n"
+                   "    -a <file> [<samples>] Capture SCSI bus to VCD file "
+                   "(WD33C93B)\n"
+                   "    -A <file> Analyze scsi.device trace file\n"
+                   "    -b <unit> [<KB> [<depth>]] Compare scsi.device and "
+                   "direct read speed\n"
+                   "    -B [<percent>] Check -b against baseline in ENVARC: "
+                   "(-BB new baseline)\n"
+                   "    -c [<num>|all] Select WD33C93 controller (list)\n"
+                   "    -C <unit> Measure DMA cache maintenance cost and "
+                   "coherency\n"
                    "    -d Debug output\n"
+                   "    -D <file>... Decode register snapshots (-DD brief)\n"
+                   "    -e [<secs> [<baud>]] Send metrics frames over serial\n"
+                   "    -E <file> Decode captured serial metrics\n"
+                   "    -g [<baud>] Serve remote test agent requests over "
+                   "serial\n"
+                   "    -i Measure SCSI interrupt latency\n"
+                   "    -k Show measurement timer and read overhead\n"
                    "    -L Loop tests until failure\n"
+                   "    -M Map SDMAC address space aliases\n"
+                   "    -m <unit> [<KB>] Compare PIO, interrupt, and DMA "
+                   "transfer modes\n"
+                   "    -o <unit> [<bytes>] Check DMA at odd buffer offsets "
+                   "and lengths\n"
                    "    -p probe SCSI bus (not well-tested)\n"
+                   "    -P <file> Check acceptance thresholds in profile\n"
+                   "    -q Quick health check using cached detection\n"
+                   "    -Q <key> <file>... Median -b speed from snapshots by "
+                   "key\n"
+                   "       (ramsey, sdmac, wdc, clock, or drive)\n"
                    "    -R reset WD SCSI Controller\n"
                    "    -r [<reg> [<value>]] Display/change WDC registers\n"
+                   "    -r <script> Run WDC register script file\n"
+                   "       (-rr adds hidden, -rrr adds WD33C93B extended)\n"
                    "    -s Display raw SDMAC registers\n"
+                   "    -S <file> [<label>] Append register snapshot to file\n"
                    "    -t Force tests to run\n"
-                   "    -v Display program version\n", version + 7);
+                   "    -T <file> [<secs>] Trace scsi.device requests to file\n"
+                   "    -u [<secs>] Reset SCSI bus and time targets to ready "
+                   "(-uu sends START)\n"
+                   "    -v Display program version\n"
+                   "    -w [<regs> [<secs> [<Hz>]]] Watch registers for "
+                   "changes\n"
+                   "    -x [<tests> [<count>]] Run tests by name, "
+                   "all, or default (list)\n", version + 7);
             exit(1);
         }
     }
+    if (snap_decode_files != 0) {
+        /* Offline decode does not touch the controller hardware */
+        if (snap_query_key != NULL)
+            exit(snap_query(snap_query_key, snap_files, snap_decode_files));
+        exit(snap_decode(snap_files, snap_decode_files,
+                         snap_decode_brief > 1));
+    }
+    if (trace_file != NULL) {
+        /* OS level tracing does not touch the controller hardware */
+        if (trace_analyze_only)
+            exit(trace_analyze(trace_file));
+        exit(trace_run(trace_file, trace_secs));
+    }
+    if (metrics_file != NULL)
+        exit(metrics_decode(metrics_file));
+    if (metrics) {
+        /* OS level metrics do not touch the controller hardware */
+        exit(metrics_run(metrics_secs, metrics_baud));
+    }
+
     BERR_DSACK_SAVE();
-    scsi_save_regs();
-    if (all_regs)
-        goto finish;  // Do not probe or perform tests
-    if (readwrite_wdc_reg)
-        goto finish;
+    if (ctrl_count == 0)
+        find_controllers();
+
+    /*
+     * Register displays do not need the fastest WDC index method, and
+     * should not write WDC registers while scsi.device may be using it.
+     */
+    display_only = (all_regs || readwrite_wdc_reg ||
+                    ((raw_sdmac_regs || map_sdmac || (watch_list != NULL)) &&
+                     (probe_scsi_bus == 0) && (irq_latency == 0) &&
+                     (bench == 0) && (xfer_modes == 0) && (align == 0) &&
+                     (cache_cost == 0) && (ttr == 0) &&
+                     (do_wdc_reset == 0) && (snap_file == NULL) &&
+                     (la_file == NULL) && (agent == 0) &&
+                     (test_sel == 0) && (profile_set == 0) &&
+                     (quick == 0) && (flag_force_test == 0)));
 
     if ((probe_scsi_bus == 0) &&
+        (irq_latency == 0) &&
+        (bench == 0) &&
+        (xfer_modes == 0) &&
+        (align == 0) &&
+        (cache_cost == 0) &&
+        (ttr == 0) &&
         (do_wdc_reset == 0) &&
         (raw_sdmac_regs == 0) &&
+        (map_sdmac == 0) &&
+        (watch_list == NULL) &&
+        (snap_file == NULL) &&
+        (agent == 0) &&
+        (test_sel == 0) &&
+        (profile_set == 0) &&
+        (quick == 0) &&
         (flag_force_test == 0)) {
         flag_force_test++;
         flag_show++;
     }
 
-    if (flag_show &&
-        (show_ramsey_version() ||
-         show_ramsey_config() ||
-         show_dmac_version() ||
-         show_wdc_version() ||
-         show_wdc_config())) {
-        if (flag_force_test == 0)
-            goto finish;
+    if (all_controllers) {
+        ctrl_first = 0;
+        ctrl_last  = ctrl_count - 1;
+    } else {
+        ctrl_first = ctrl - ctrl_list;
+        ctrl_last  = ctrl_first;
     }
 
-    do {
-        pass++;
-        if (flag_force_test &&
-            (test_ramsey_access() +
-             test_sdmac_access() +
-             test_wdc_access() > 0)) {
-            exit_status = 1;
-            break;
+    for (cur = ctrl_first; cur <= ctrl_last; cur++) {
+        ctrl     = &ctrl_list[cur];
+        wd_level = LEVEL_WD33C93;
+        wd_microcode = 0;
+        wdc_khz  = 0;
+        scsi_wait_usec = SCSI_WAIT_MAX_USEC;
+        memset(test_stats, 0, sizeof (test_stats));
+        pass     = 0;
+        if (all_controllers) {
+            printf("%s%s at $%06x\n",
+                   (cur == ctrl_first) ? "" : "\n", ctrl->name, ctrl->base);
+        }
+
+        if (display_only == 0)
+            wdc_index_select();
+        scsi_save_regs();
+        if (all_regs)
+            goto finish;  // Do not probe or perform tests
+        if (readwrite_wdc_reg)
+            goto finish;
+        if (la_file != NULL) {
+            if (la_run(la_file, la_samples))
+                exit_status = 1;
+            goto finish;
+        }
+        if (quick) {
+            if (quick_check())
+                exit_status = 1;
+            goto finish;
         }
-        if (probe_scsi_bus &&
-            probe_scsi()) {
+
+        if (snap_file != NULL)
+            snap_take(&snap, snap_label);
+        if ((flag_show || (snap_file != NULL) || agent || test_sel ||
+             profile_set) &&
+            (show_ramsey_version() ||
+             show_ramsey_config() ||
+             show_dmac_version() ||
+             show_wdc_version() ||
+             show_wdc_config())) {
+            if ((flag_force_test == 0) && (snap_file == NULL) &&
+                (test_sel == 0) && (profile_set == 0))
+                goto finish;
+        }
+        do {
+            pass++;
+            if (flag_force_test &&
+                test_run(test_mask(TEST_DEFAULT), 0)) {
+                exit_status = 1;
+                break;
+            }
+            if (test_sel) {
+                uint rep;
+                for (rep = 0; rep < test_repeat; rep++)
+                    if (test_run(test_sel, rep == 0) || is_user_abort())
+                        break;
+                if (rep < test_repeat) {
+                    exit_status = 1;
+                    break;
+                }
+            }
+            if (probe_scsi_bus &&
+                probe_scsi()) {
+                exit_status = 1;
+                break;
+            }
+            if (irq_latency &&
+                measure_irq_latency()) {
+                exit_status = 1;
+                break;
+            }
+            if (bench &&
+                bench_compare(&bench_wl)) {
+                exit_status = 1;
+                break;
+            }
+            if (xfer_modes &&
+                xfer_mode_compare(&bench_wl)) {
+                exit_status = 1;
+                break;
+            }
+            if (align &&
+                dma_align_check(align_unit, align_len)) {
+                exit_status = 1;
+                break;
+            }
+            if (cache_cost &&
+                dma_cache_cost(cache_unit)) {
+                exit_status = 1;
+                break;
+            }
+            if (profile_set &&
+                profile_run(&profile)) {
+                exit_status = 1;
+                break;
+            }
+            if (ttr &&
+                measure_time_to_ready(ttr_secs, ttr > 1)) {
+                exit_status = 1;
+                break;
+            }
+            if (do_wdc_reset) {
+                const char *mode;
+                if (do_wdc_reset > 3) {
+                    if (scsi_hard_reset()) {
+                        printf("%s has no WDC reset control\n", ctrl->name);
+                        exit_status = 1;
+                        break;
+                    }
+                    mode = "hard";
+                } else {
+                    scsi_soft_reset(do_wdc_reset);
+                    mode = "soft";
+                }
+                printf("WDC %s reset complete\n", mode);
+            }
+            if (is_user_abort()) {
+                printf("^C Abort\n");
+                exit_status = 1;
+                break;
+            }
+        } while (loop_until_failure);
+
+        if (test_sel)
+            test_summary(test_sel);
+
+        /* Written after the tests so it includes -b results */
+        if ((snap_file != NULL) &&
+            snap_write(snap_file, &snap)) {
             exit_status = 1;
-            break;
         }
-        if (do_wdc_reset) {
-            const char *mode;
-            if (do_wdc_reset > 3) {
-                scsi_hard_reset();
-                mode = "hard";
+
+finish:
+        if (all_regs) {
+            show_regs(all_regs > 1);
+            if (all_regs > 2)
+                show_wdc_extended();
+        }
+        if (raw_sdmac_regs) {
+            if (ctrl->type == CTRL_A3000) {
+                get_raw_regs();
+                dump_raw_sdmac_regs();
             } else {
-                scsi_soft_reset(do_wdc_reset);
-                mode = "soft";
+                printf("Raw register dump is only available for A3000 SDMAC\n");
             }
-            printf("WDC %s reset complete\n", mode);
         }
-        if (is_user_abort()) {
-            printf("^C Abort\n");
+        if ((watch_list != NULL) &&
+            watch_regs(watch_list, watch_secs, watch_hz)) {
             exit_status = 1;
-            break;
         }
-    } while (loop_until_failure);
-
-finish:
-    if (all_regs) {
-        show_regs(all_regs > 1);
-    }
-    if (raw_sdmac_regs) {
-        get_raw_regs();
-        dump_raw_sdmac_regs();
+        if (map_sdmac) {
+            if (ctrl->type == CTRL_A3000)
+                map_sdmac_space();
+            else
+                printf("Address map is only available for A3000 SDMAC\n");
+        }
+        if (agent &&
+            agent_run(agent_baud)) {
+            exit_status = 1;
+        }
+        INTERRUPTS_DISABLE();
+        scsi_restore_regs();
+        INTERRUPTS_ENABLE();
+        if (loop_until_failure)
+            printf("%s at pass %u\n",
+                   is_user_abort() ? "Stopped" : "Failed", pass);
+        if (is_user_abort())
+            break;
     }
-    INTERRUPTS_DISABLE();
-    scsi_restore_regs();
-    INTERRUPTS_ENABLE();
     BERR_DSACK_RESTORE();
-    if (loop_until_failure)
-        printf("%s at pass %u\n", is_user_abort() ? "Stopped" : "Failed", pass);
 
     exit(exit_status);
 }
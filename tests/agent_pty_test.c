@@ -0,0 +1,168 @@
+/*
+ * agent_pty_test.c
+ * ----------------
+ * End-to-end test of the -g remote test agent over a pty pair. sdmac.c's
+ * agent_run() serves the pty master through the serial.device emulation,
+ * with WDC registers in the simulated register file. The host/ client
+ * library drives it from the pty slave.
+ */
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#define main sdmac_main
+#include "../sdmac.c"
+#undef main
+
+#include "../host/sdmac_host.h"
+#include "amiga_host.h"
+#include "check.h"
+
+#define TEST_BAUD        19200
+#define TEST_REPLY_MSEC  300
+#define TEST_START_MSEC  400  // Agent starts after the first ping is sent
+
+static int agent_rc = -1;
+
+static void *
+amiga_agent(void *arg)
+{
+    (void) arg;
+    usleep(TEST_START_MSEC * 1000);
+    agent_rc = agent_run(TEST_BAUD);
+    return (NULL);
+}
+
+int
+main(void)
+{
+    static const uint8_t noise[] = { 0x00, MET_SYNC0, 0x13, MET_SYNC0 };
+    sdm_agent_t   ag;
+    sdm_results_t res;
+    pthread_t     thread;
+    uint8_t       frame[SDM_FRAME_MAX];
+    uint8_t       values[255];
+    uint8_t       req[2];
+    char          version[64];
+    uint          failed;
+    uint          status;
+    uint          len;
+    uint          pos;
+    int           master;
+    int           slave;
+
+    master = posix_openpt(O_RDWR | O_NOCTTY);
+    if ((master < 0) || (grantpt(master) != 0) || (unlockpt(master) != 0)) {
+        perror("pty");
+        return (1);
+    }
+    slave = sdm_serial_open(ptsname(master), TEST_BAUD);
+    if (slave < 0)
+        return (1);
+
+    wd_level = LEVEL_WD33C93B;
+    for (pos = 0; pos < sizeof (sim_wdc_regs); pos++)
+        sim_wdc_regs[pos] = pos ^ 0xc0;
+    for (pos = 0; pos < sizeof (sim_wdc_ext); pos++)
+        sim_wdc_ext[pos] = ~pos;
+    host_serial_attach(master);
+    pthread_create(&thread, NULL, amiga_agent, NULL);
+
+    /* The first attempt is sent before the agent runs, so is retried */
+    sdm_agent_init(&ag, slave);
+    ag.timeout_ms = TEST_REPLY_MSEC;
+    ag.retries    = 3;
+    CHECK(sdm_agent_ping(&ag, version, sizeof (version)) == 0);
+    CHECK(strncmp(version, "SDMAC " VER " ", 7) == 0);
+    CHECK(ag.timeouts >= 1);
+    CHECK(host_serial_baud() == TEST_BAUD);
+    usleep(100000);  // Let the late reply to the first attempt arrive
+
+    /* Registers */
+    CHECK(sdm_agent_reg_write(&ag, WDC_OWN_ID, 0x5a) == 0);
+    CHECK(sim_wdc_regs[WDC_OWN_ID] == 0x5a);
+    CHECK((sdm_agent_reg_read(&ag, WDC_OWN_ID, values) == 0) &&
+          (values[0] == 0x5a));
+    CHECK((sdm_agent_reg_read(&ag, WDC_SCSI_STAT, values) == 0) &&
+          (values[0] == (WDC_SCSI_STAT ^ 0xc0)));
+    CHECK(sdm_agent_burst_read(&ag, 0x00, 0x20, values) == 0);
+    for (pos = 0; pos < 0x1f; pos++)
+        CHECK(values[pos] == sim_wdc_regs[pos]);
+    CHECK(values[WDC_AUXST] == 0);
+
+    /* WD33C93B extended registers, and the CDB registers kept intact */
+    CHECK(sdm_agent_reg_write(&ag, 0x80, 0x33) == 0);
+    CHECK(sim_wdc_ext[0x80] == 0x33);
+    CHECK((sdm_agent_reg_read(&ag, 0x80, values) == 0) &&
+          (values[0] == 0x33));
+    CHECK(sdm_agent_burst_read(&ag, 0x3e, 4, values) == 0);
+    CHECK((values[0] == sim_wdc_regs[0x3e]) &&
+          (values[1] == sim_wdc_regs[0x3f]) &&
+          (values[2] == sim_wdc_ext[0x40]) &&
+          (values[3] == sim_wdc_ext[0x41]));
+    CHECK(sim_wdc_regs[WDC_CDB1] == (WDC_CDB1 ^ 0xc0));
+    CHECK(sim_wdc_regs[WDC_CDB2] == (WDC_CDB2 ^ 0xc0));
+
+    /* Other WDC parts have no extended registers */
+    wd_level = LEVEL_WD33C93A;
+    CHECK(sdm_agent_reg_read(&ag, 0x80, values) == -SDM_ERR_HARDWARE);
+    CHECK(sdm_agent_reg_write(&ag, 0x40, 1) == -SDM_ERR_HARDWARE);
+    CHECK(sdm_agent_burst_read(&ag, 0x30, 0x20, values) ==
+          -SDM_ERR_HARDWARE);
+    wd_level = LEVEL_WD33C93B;
+
+    /* Requests the agent rejects */
+    req[0] = 0xf0;
+    req[1] = 0x20;
+    CHECK(sdm_agent_call(&ag, SDM_AG_BURST_READ, req, 2, values,
+                         TEST_REPLY_MSEC) == -SDM_ERR_RANGE);
+    req[1] = 0;
+    CHECK(sdm_agent_call(&ag, SDM_AG_BURST_READ, req, 2, values,
+                         TEST_REPLY_MSEC) == -SDM_ERR_RANGE);
+    CHECK(sdm_agent_call(&ag, SDM_AG_REG_READ, req, 2, values,
+                         TEST_REPLY_MSEC) == -SDM_ERR_LENGTH);
+    CHECK(sdm_agent_call(&ag, 0x42, NULL, 0, values,
+                         TEST_REPLY_MSEC) == -SDM_ERR_UNKNOWN);
+    CHECK(sdm_agent_test(&ag, "bogus", &failed) == -SDM_ERR_UNKNOWN);
+    CHECK(sdm_agent_bench(&ag, 6, 64, 0, &status) == -SDM_ERR_RANGE);
+    CHECK(sdm_agent_bench(&ag, 8, 64, 4, &status) == -SDM_ERR_RANGE);
+    CHECK(sdm_agent_bench(&ag, 6, 0, 4, &status) == -SDM_ERR_RANGE);
+
+    /* Tests and benchmarks which this controller can not run */
+    ctrl = &ctrl_types[CTRL_A2091];
+    CHECK(sdm_agent_test(&ag, "ramsey", &failed) == -SDM_ERR_HARDWARE);
+    CHECK((sdm_agent_bench(&ag, 6, 64, 4, &status) == 0) && (status != 0));
+    ctrl = &ctrl_types[CTRL_A3000];
+    CHECK(sdm_agent_results(&ag, &res) == 0);
+    CHECK((res.kbps[0] == 0) && (res.kbps[2] == 0) &&
+          (res.drive[0] == '\0'));
+
+    /*
+     * A damaged request gets no reply. The next one is answered at once,
+     * although it follows a stray sync byte.
+     */
+    len = sdm_frame(frame, SDM_AG_REG_WRITE, req, 2);
+    frame[len - 1] ^= 1;
+    CHECK(write(slave, noise, sizeof (noise)) == sizeof (noise));
+    CHECK(write(slave, frame, len) == len);
+    CHECK(write(slave, noise, sizeof (noise)) == sizeof (noise));
+    failed = ag.timeouts;
+    CHECK((sdm_agent_reg_read(&ag, WDC_OWN_ID, values) == 0) &&
+          (values[0] == 0x5a));
+    CHECK(ag.timeouts == failed);
+    CHECK(sim_wdc_ext[0xf0] == (uint8_t) ~0xf0);  // Not written
+
+    CHECK(sdm_agent_quit(&ag) == 0);
+    pthread_join(thread, NULL);
+    CHECK(agent_rc == 0);
+    ag.retries = 0;
+    CHECK(sdm_agent_ping(&ag, version, sizeof (version)) ==
+          -SDM_ERR_TIMEOUT);
+
+    host_serial_detach();
+    close(slave);
+    close(master);
+    printf("agent_pty_test: %u checks, %u failed\n", checks, failures);
+    return (failures != 0);
+}
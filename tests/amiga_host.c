@@ -0,0 +1,782 @@
+/*
+ * amiga_host.c
+ * ------------
+ * Host emulation of the AmigaOS calls made by sdmac.c. See amiga_host.h.
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <inline/exec.h>
+#include <inline/expansion.h>
+#include <inline/timer.h>
+#include <inline/cia.h>
+#include <proto/dos.h>
+#include <exec/memory.h>
+#include <exec/interrupts.h>
+#include <hardware/intbits.h>
+#include <devices/serial.h>
+#include <devices/scsidisk.h>
+#include "amiga_host.h"
+
+#define HOST_SIGBIT 16  // Signal bit given to every message port
+
+/*
+ * AllocMem() blocks are kept on a list, so that host_dma_ptr() can find
+ * the host address of the 32-bit address the simulated SDMAC is given.
+ */
+typedef struct host_mem {
+    struct host_mem *next;
+    uint64_t         size;
+} host_mem_t;
+
+static struct Task      host_task;
+static struct ExecBase  host_execbase;
+static struct Library   host_lib;
+static struct Device    host_serial_dev;
+static struct Device    host_timer_dev;
+static struct Device    host_scsi_dev;
+static host_mem_t      *host_mem_list;
+static pthread_mutex_t  host_mem_lock = PTHREAD_MUTEX_INITIALIZER;
+static int              host_serial_fd = -1;
+static uint32_t         host_baud;
+static volatile ULONG   host_signals;
+static uint64_t         host_eclock_skew;     // See host_eclock_advance()
+static uint64_t         host_disable_start;
+static uint8_t          host_disabled;
+static uint8_t          host_int_pending;    // PORTS raised while disabled
+static struct Interrupt *host_servers[4];    // PORTS interrupt servers
+static struct IORequest *host_timer_req;     // Outstanding timer request
+static uint64_t         host_timer_due;      // E clock when it completes
+
+void     (*host_enable_hook)(void);
+uint32_t host_disable_max;
+int      (*host_scsi_target)(uint32_t id, uint32_t lun, const uint8_t *cdb,
+                             uint32_t cdblen, uint8_t *data, uint32_t *len);
+uint32_t host_cache_calls[3];
+uint32_t host_cache_bytes[3];
+uint32_t host_cache_kb_ticks;
+
+struct ExecBase *SysBase = &host_execbase;
+struct Library  *DOSBase = &host_lib;
+
+/* The tracer's m68k patch entry points; never installed on the host */
+void trace_beginio(void) { }
+void trace_replymsg(void) { }
+
+void
+host_serial_attach(int fd)
+{
+    host_serial_fd = fd;
+    host_baud = 0;
+}
+
+void
+host_serial_detach(void)
+{
+    host_serial_fd = -1;
+}
+
+/* Returns the rate last set by SDCMD_SETPARAMS */
+uint32_t
+host_serial_baud(void)
+{
+    return (host_baud);
+}
+
+/* Raises ^C for the sdmac code under test */
+void
+host_break(void)
+{
+    __atomic_or_fetch(&host_signals, SIGBREAKF_CTRL_C, __ATOMIC_SEQ_CST);
+}
+
+/* Moves the E clock forward, as if a simulated access took that long */
+void
+host_eclock_advance(uint32_t ticks)
+{
+    __atomic_add_fetch(&host_eclock_skew, ticks, __ATOMIC_SEQ_CST);
+}
+
+static uint64_t
+host_eclock(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t) ts.tv_sec * HOST_ECLOCK +
+            (uint64_t) ts.tv_nsec * HOST_ECLOCK / 1000000000 +
+            __atomic_load_n(&host_eclock_skew, __ATOMIC_SEQ_CST));
+}
+
+static void
+host_run_servers(void)
+{
+    int pos;
+
+    for (pos = 0; pos < 4; pos++)
+        if (host_servers[pos] != NULL)
+            ((ULONG (*)(void)) host_servers[pos]->is_Code)();
+}
+
+/*
+ * host_interrupt
+ * --------------
+ * Raises the PORTS interrupt. The servers run at once, or at Enable() if
+ * interrupts are disabled; sdmac.c disables them around each simulated
+ * register access, so a server never runs in the middle of one.
+ */
+void
+host_interrupt(void)
+{
+    if (host_disabled)
+        host_int_pending = 1;
+    else
+        host_run_servers();
+}
+
+/*
+ * sdmac.c nests Disable() itself (see INTERRUPTS_DISABLE()), so these
+ * are only called at the outermost level.
+ */
+void
+Disable(void)
+{
+    host_disable_start = host_eclock();
+    host_disabled = 1;
+}
+
+void
+Enable(void)
+{
+    uint64_t ticks = host_eclock() - host_disable_start;
+
+    host_disabled = 0;
+    if (host_disable_max < ticks)
+        host_disable_max = ticks;
+    if (host_enable_hook != NULL)
+        host_enable_hook();
+    if (host_int_pending) {
+        host_int_pending = 0;
+        host_run_servers();
+    }
+}
+
+void Forbid(void) { }
+void Permit(void) { }
+APTR SuperState(void) { return (NULL); }
+void UserState(APTR stack) { (void) stack; }
+
+ULONG
+SetSignal(ULONG new_signals, ULONG mask)
+{
+    ULONG old = host_signals;
+
+    host_signals = (old & ~mask) | (new_signals & mask);
+    return (old);
+}
+
+void
+Signal(struct Task *task, ULONG sigs)
+{
+    (void) task;
+    __atomic_or_fetch(&host_signals, sigs, __ATOMIC_SEQ_CST);
+}
+
+/* Completes the outstanding timer request when it is due, or aborted */
+static void
+host_timer_check(int abort)
+{
+    struct MsgPort *port;
+
+    if ((host_timer_req == NULL) ||
+        ((abort == 0) && (host_eclock() < host_timer_due)))
+        return;
+    if (abort)
+        host_timer_req->io_Error = -2;  // IOERR_ABORTED
+    host_timer_req->io_Message.mn_Node.ln_Type = NT_REPLYMSG;
+    port = host_timer_req->io_Message.mn_ReplyPort;
+    host_timer_req = NULL;
+    Signal(port->mp_SigTask, 1UL << port->mp_SigBit);
+}
+
+ULONG
+Wait(ULONG mask)
+{
+    ULONG got;
+
+    while ((got = host_signals & mask) == 0) {
+        usleep(1000);
+        host_timer_check(0);
+    }
+    host_signals &= ~got;
+    return (got);
+}
+
+BYTE AllocSignal(LONG num) { return ((num >= 0) ? num : HOST_SIGBIT + 1); }
+void FreeSignal(LONG num) { (void) num; }
+
+struct Node *
+FindName(struct List *list, const char *name)
+{
+    struct Node *node;
+
+    if (list->lh_Head == NULL)
+        return (NULL);
+    for (node = list->lh_Head; node->ln_Succ != NULL; node = node->ln_Succ)
+        if ((node->ln_Name != NULL) && (strcmp(node->ln_Name, name) == 0))
+            return (node);
+    return (NULL);
+}
+
+struct Task *
+FindTask(const char *name)
+{
+    return ((name == NULL) ? &host_task : NULL);
+}
+
+struct Library *
+OpenLibrary(const char *name, ULONG version)
+{
+    (void) name;
+    (void) version;
+    return (&host_lib);
+}
+
+void CloseLibrary(struct Library *lib) { (void) lib; }
+
+/* No resources: the CIA timers and hardware are not emulated */
+APTR OpenResource(const char *name) { (void) name; return (NULL); }
+
+APTR
+AllocMem(ULONG size, ULONG flags)
+{
+    host_mem_t *mem = calloc(1, sizeof (*mem) + size);
+
+    (void) flags;
+    if (mem == NULL)
+        return (NULL);
+    mem->size = size;
+    pthread_mutex_lock(&host_mem_lock);
+    mem->next = host_mem_list;
+    host_mem_list = mem;
+    pthread_mutex_unlock(&host_mem_lock);
+    return (mem + 1);
+}
+
+void
+FreeMem(APTR ptr, ULONG size)
+{
+    host_mem_t **prev;
+    host_mem_t  *mem = NULL;
+
+    (void) size;
+    pthread_mutex_lock(&host_mem_lock);
+    for (prev = &host_mem_list; *prev != NULL; prev = &(*prev)->next) {
+        if (*prev + 1 == ptr) {
+            mem = *prev;
+            *prev = mem->next;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&host_mem_lock);
+    free(mem);
+}
+
+/*
+ * host_dma_ptr
+ * ------------
+ * Returns the host address of len bytes at the 32-bit address addr, or
+ * NULL if they are not all within one AllocMem() block.
+ */
+uint8_t *
+host_dma_ptr(uint32_t addr, uint32_t len)
+{
+    host_mem_t *mem;
+    uint8_t    *ptr = NULL;
+
+    pthread_mutex_lock(&host_mem_lock);
+    for (mem = host_mem_list; mem != NULL; mem = mem->next) {
+        uint32_t off = addr - (uint32_t) (uintptr_t) (mem + 1);
+        if ((off <= mem->size) && (len <= mem->size - off)) {
+            ptr = (uint8_t *) (mem + 1) + off;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&host_mem_lock);
+    return (ptr);
+}
+
+ULONG
+AvailMem(ULONG flags)
+{
+    return ((flags & MEMF_CHIP) ? 2 << 20 : 16 << 20);
+}
+
+void
+CopyMem(const void *src, void *dst, ULONG len)
+{
+    memmove(dst, src, len);
+}
+
+struct MsgPort *
+CreateMsgPort(void)
+{
+    struct MsgPort *port = calloc(1, sizeof (*port));
+
+    if (port != NULL) {
+        struct List *list = &port->mp_MsgList;
+        port->mp_SigBit  = HOST_SIGBIT;
+        port->mp_SigTask = &host_task;
+        list->lh_Head     = (struct Node *) &list->lh_Tail;
+        list->lh_TailPred = (struct Node *) &list->lh_Head;
+    }
+    return (port);
+}
+
+void DeleteMsgPort(struct MsgPort *port) { free(port); }
+
+struct IORequest *
+CreateIORequest(struct MsgPort *port, ULONG size)
+{
+    struct IORequest *ior;
+
+    if (port == NULL)
+        return (NULL);
+    ior = calloc(1, size);
+    if (ior != NULL) {
+        ior->io_Message.mn_ReplyPort = port;
+        ior->io_Message.mn_Length    = size;
+    }
+    return (ior);
+}
+
+void DeleteIORequest(struct IORequest *ior) { free(ior); }
+
+BYTE
+OpenDevice(const char *name, ULONG unit, struct IORequest *ior, ULONG flags)
+{
+    (void) unit;
+    (void) flags;
+    if ((strcmp(name, SERIALNAME) == 0) && (host_serial_fd >= 0)) {
+        ior->io_Device = &host_serial_dev;
+        return (0);
+    }
+    if (strcmp(name, TIMERNAME) == 0) {
+        ior->io_Device = &host_timer_dev;
+        return (0);
+    }
+    if ((strcmp(name, "scsi.device") == 0) && (host_scsi_target != NULL)) {
+        ior->io_Device = &host_scsi_dev;
+        ior->io_Unit   = (struct Unit *) (uintptr_t) unit;
+        return (0);
+    }
+    ior->io_Error = -1;  // IOERR_OPENFAIL
+    return (-1);
+}
+
+void CloseDevice(struct IORequest *ior) { ior->io_Device = NULL; }
+
+/*
+ * host_serial_io
+ * --------------
+ * Performs a serial.device read or write on the attached descriptor.
+ * Reads wait up to HOST_IO_MSEC for data, so a test which goes wrong
+ * fails instead of hanging.
+ */
+static BYTE
+host_serial_io(struct IOStdReq *io)
+{
+    uint8_t *buf = io->io_Data;
+    ULONG    done = 0;
+
+    while (done < io->io_Length) {
+        ssize_t len;
+
+        if (io->io_Command == CMD_READ) {
+            struct pollfd pfd = { host_serial_fd, POLLIN, 0 };
+            if (poll(&pfd, 1, HOST_IO_MSEC) <= 0)
+                break;
+            len = read(host_serial_fd, buf + done, io->io_Length - done);
+        } else {
+            len = write(host_serial_fd, buf + done, io->io_Length - done);
+        }
+        if ((len < 0) && (errno == EINTR))
+            continue;
+        if (len <= 0)
+            break;
+        done += len;
+    }
+    io->io_Actual = done;
+    return ((done == io->io_Length) ? 0 : 1);
+}
+
+/*
+ * host_scsi_io
+ * ------------
+ * Runs a scsi.device CMD_READ, as READ(10), or an HD_SCSICMD command on
+ * the simulated target for the unit. Returns the io_Error value.
+ */
+static BYTE
+host_scsi_io(struct IOStdReq *io)
+{
+    struct SCSICmd *scmd = io->io_Data;
+    uint32_t        unit = (uintptr_t) io->io_Unit;
+    uint32_t        lba = io->io_Offset / 512;
+    uint32_t        blocks = io->io_Length / 512;
+    uint8_t         cdb[10];
+    uint32_t        len;
+    int             status;
+
+    if (io->io_Command == HD_SCSICMD) {
+        len = (scmd->scsi_Flags & SCSIF_READ) ? scmd->scsi_Length : 0;
+        status = host_scsi_target(unit % 10, unit / 10, scmd->scsi_Command,
+                                  scmd->scsi_CmdLength,
+                                  (uint8_t *) scmd->scsi_Data, &len);
+        scmd->scsi_Actual    = (status == SIM_SCSI_NO_TARGET) ? 0 : len;
+        scmd->scsi_CmdActual = scmd->scsi_CmdLength;
+        scmd->scsi_Status    = (status == SIM_SCSI_NO_TARGET) ? 0 : status;
+    } else if (io->io_Command == CMD_READ) {
+        memset(cdb, 0, sizeof (cdb));
+        cdb[0] = 0x28;  // READ(10)
+        cdb[2] = lba >> 24;
+        cdb[3] = lba >> 16;
+        cdb[4] = lba >> 8;
+        cdb[5] = lba;
+        cdb[7] = blocks >> 8;
+        cdb[8] = blocks;
+        len = io->io_Length;
+        status = host_scsi_target(unit % 10, unit / 10, cdb, sizeof (cdb),
+                                  io->io_Data, &len);
+        io->io_Actual = (status == 0) ? len : 0;
+    } else {
+        return (-3);  // IOERR_NOCMD
+    }
+    if (status == SIM_SCSI_NO_TARGET)
+        return (44);  // HFERR_SelTimeout
+    return ((status == 0) ? 0 : 45);  // HFERR_BadStatus
+}
+
+/* Queues a completed request on its reply port */
+static void
+host_reply(struct IORequest *ior)
+{
+    struct MsgPort *port = ior->io_Message.mn_ReplyPort;
+    struct Node    *node = &ior->io_Message.mn_Node;
+    struct List    *list = &port->mp_MsgList;
+
+    node->ln_Succ = (struct Node *) &list->lh_Tail;
+    node->ln_Pred = list->lh_TailPred;
+    list->lh_TailPred->ln_Succ = node;
+    list->lh_TailPred = node;
+    Signal(port->mp_SigTask, 1UL << port->mp_SigBit);
+}
+
+void
+SendIO(struct IORequest *ior)
+{
+    struct IOStdReq *io = (struct IOStdReq *) ior;
+
+    ior->io_Error = 0;
+    if (ior->io_Device == &host_serial_dev) {
+        switch (ior->io_Command) {
+            case CMD_READ:
+            case CMD_WRITE:
+                ior->io_Error = host_serial_io(io);
+                break;
+            case SDCMD_SETPARAMS:
+                host_baud = ((struct IOExtSer *) ior)->io_Baud;
+                break;
+            default:
+                ior->io_Error = -3;  // IOERR_NOCMD
+                break;
+        }
+    } else if (ior->io_Device == &host_timer_dev) {
+        struct timerequest *tr = (struct timerequest *) ior;
+
+        host_timer_req = ior;
+        host_timer_due = host_eclock() +
+                         (uint64_t) tr->tr_time.tv_secs * HOST_ECLOCK +
+                         (uint64_t) tr->tr_time.tv_micro * HOST_ECLOCK /
+                         1000000;
+        ior->io_Message.mn_Node.ln_Type = NT_MESSAGE;
+        return;
+    } else if (ior->io_Device == &host_scsi_dev) {
+        ior->io_Error = host_scsi_io(io);
+        ior->io_Message.mn_Node.ln_Type = NT_REPLYMSG;
+        host_reply(ior);
+        return;
+    } else {
+        ior->io_Error = -3;
+    }
+    ior->io_Message.mn_Node.ln_Type = NT_REPLYMSG;
+}
+
+BYTE
+DoIO(struct IORequest *ior)
+{
+    SendIO(ior);
+    return (ior->io_Error);
+}
+
+/*
+ * Other than one timer.device request at a time, every request completes
+ * within SendIO(). Only scsi.device requests are queued on their reply
+ * port; sdmac.c collects them with GetMsg().
+ */
+struct IORequest *
+CheckIO(struct IORequest *ior)
+{
+    host_timer_check(0);
+    return ((ior == host_timer_req) ? NULL : ior);
+}
+
+BYTE
+WaitIO(struct IORequest *ior)
+{
+    while (CheckIO(ior) == NULL)
+        usleep(1000);
+    return (ior->io_Error);
+}
+
+void
+AbortIO(struct IORequest *ior)
+{
+    if (ior == host_timer_req)
+        host_timer_check(1);
+}
+
+struct Message *
+GetMsg(struct MsgPort *port)
+{
+    struct List *list = &port->mp_MsgList;
+    struct Node *node = list->lh_Head;
+
+    if ((node == NULL) || (node->ln_Succ == NULL))
+        return (NULL);
+    list->lh_Head = node->ln_Succ;
+    node->ln_Succ->ln_Pred = (struct Node *) &list->lh_Head;
+    return ((struct Message *) node);
+}
+
+struct Message *
+WaitPort(struct MsgPort *port)
+{
+    struct Node *node;
+
+    while (((node = port->mp_MsgList.lh_Head) == NULL) ||
+           (node->ln_Succ == NULL))
+        Wait(1UL << port->mp_SigBit);
+    return ((struct Message *) node);
+}
+
+ULONG
+ReadEClock(struct EClockVal *ev)
+{
+    uint64_t ticks = host_eclock();
+
+    ev->ev_hi = ticks >> 32;
+    ev->ev_lo = ticks;
+    return (HOST_ECLOCK);
+}
+
+void
+Delay(LONG ticks)
+{
+    usleep(ticks * (1000000 / TICKS_PER_SECOND));
+}
+
+struct DateStamp *
+DateStamp(struct DateStamp *ds)
+{
+    time_t now = time(NULL) - 252460800;  // Amiga epoch is 1978-01-01
+
+    ds->ds_Days   = now / 86400;
+    ds->ds_Minute = now % 86400 / 60;
+    ds->ds_Tick   = now % 60 * TICKS_PER_SECOND;
+    return (ds);
+}
+
+/*
+ * host_map_file
+ * -------------
+ * Maps a whole file read-only for sequential access, for the snapshot
+ * decoders. An empty file gives a valid buffer of length 0.
+ */
+uint8_t *
+host_map_file(const char *filename, long *len)
+{
+    static uint8_t empty;
+    struct stat    st;
+    void          *buf;
+    int            fd = open(filename, O_RDONLY);
+
+    if (fd < 0)
+        return (NULL);
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return (NULL);
+    }
+    *len = st.st_size;
+    if (*len == 0) {
+        close(fd);
+        return (&empty);
+    }
+    buf = mmap(NULL, *len, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (buf == MAP_FAILED)
+        return (NULL);
+    madvise(buf, *len, MADV_SEQUENTIAL);
+    return (buf);
+}
+
+void
+host_unmap_file(uint8_t *buf, long len)
+{
+    if (len != 0)
+        munmap(buf, len);
+}
+
+/* Library vectors are only recorded; nothing calls through them */
+APTR
+SetFunction(struct Library *lib, LONG off, APTR func)
+{
+    static struct {
+        struct Library *lib;
+        LONG            off;
+        APTR            func;
+    } vecs[8];
+    APTR old;
+    int  pos;
+
+    for (pos = 0; pos < 8; pos++)
+        if ((vecs[pos].lib == NULL) ||
+            ((vecs[pos].lib == lib) && (vecs[pos].off == off)))
+            break;
+    if (pos == 8)
+        abort();
+    old = vecs[pos].func;
+    vecs[pos].lib  = lib;
+    vecs[pos].off  = off;
+    vecs[pos].func = func;
+    return (old);
+}
+
+static void *
+host_task_run(void *pc)
+{
+    ((void (*)(void)) pc)();
+    return (NULL);
+}
+
+/* Tasks run as threads, which end when the task function returns */
+APTR
+AddTask(struct Task *task, APTR pc, APTR fin)
+{
+    pthread_t thread;
+
+    (void) fin;
+    if (pthread_create(&thread, NULL, host_task_run, pc) != 0)
+        return (NULL);
+    pthread_detach(thread);
+    return (task);
+}
+
+/*
+ * The cache calls only count themselves in host_cache_calls[] and
+ * host_cache_bytes[], and take host_cache_kb_ticks of E clock time per
+ * KB, so tests can check how their cost is accounted.
+ */
+static void
+host_cache_call(int call, ULONG len)
+{
+    host_cache_calls[call]++;
+    host_cache_bytes[call] += len;
+    host_eclock_advance((uint64_t) len * host_cache_kb_ticks / 1024);
+}
+
+APTR
+CachePreDMA(APTR addr, ULONG *len, ULONG flags)
+{
+    (void) flags;
+    host_cache_call(HOST_CACHE_PRE, *len);
+    return (addr);
+}
+
+void
+CachePostDMA(APTR addr, ULONG *len, ULONG flags)
+{
+    (void) addr;
+    (void) flags;
+    host_cache_call(HOST_CACHE_POST, *len);
+}
+
+void
+CacheClearE(APTR addr, ULONG len, ULONG flags)
+{
+    (void) addr;
+    (void) flags;
+    host_cache_call(HOST_CACHE_CLEAR, len);
+}
+
+/* Only the PORTS chain is kept; see host_interrupt() */
+void
+AddIntServer(LONG num, struct Interrupt *is)
+{
+    int pos;
+
+    for (pos = 0; (num == INTB_PORTS) && (pos < 4); pos++) {
+        if (host_servers[pos] == NULL) {
+            host_servers[pos] = is;
+            return;
+        }
+    }
+    abort();
+}
+
+void
+RemIntServer(LONG num, struct Interrupt *is)
+{
+    int pos;
+
+    (void) num;
+    for (pos = 0; pos < 4; pos++)
+        if (host_servers[pos] == is)
+            host_servers[pos] = NULL;
+}
+
+/* Not emulated: nothing is found or installed */
+ULONG CacheControl(ULONG bits, ULONG mask)
+{
+    (void) bits;
+    (void) mask;
+    return (0);
+}
+struct ConfigDev *FindConfigDev(struct ConfigDev *cd, LONG mfg, LONG prod)
+{
+    (void) cd;
+    (void) mfg;
+    (void) prod;
+    return (NULL);
+}
+struct Interrupt *AddICRVector(APTR res, LONG bit, struct Interrupt *is)
+{
+    (void) res;
+    (void) bit;
+    return (is);  // Always in use
+}
+void RemICRVector(APTR res, LONG bit, struct Interrupt *is)
+{
+    (void) res;
+    (void) bit;
+    (void) is;
+}
+WORD AbleICR(APTR res, LONG mask) { (void) res; (void) mask; return (0); }
+WORD SetICR(APTR res, LONG mask) { (void) res; (void) mask; return (0); }
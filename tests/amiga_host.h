@@ -0,0 +1,80 @@
+/*
+ * Host emulation of the AmigaOS calls made by sdmac.c, for the tests in
+ * this directory and the file decoders in ../host. Memory, message
+ * ports, timer.device, and the E clock are backed by the host, and
+ * snapshot files are mapped with host_map_file(). serial.device is
+ * backed by a file descriptor (normally one side of a pty pair) given
+ * to host_serial_attach(). scsi.device passes commands to the simulated
+ * targets in host_scsi_target, which the simulated WDC also reaches.
+ * The BUS_* accessors in sdmac.c go to the simulated SDMAC address space
+ * in sim_bus.c, with the WD33C93B simulated in sim_wdc.c.
+ * Other hardware is not emulated; tests must not reach code which
+ * touches it.
+ */
+#ifndef AMIGA_HOST_H
+#define AMIGA_HOST_H
+
+#include <stdint.h>
+
+#define HOST_ECLOCK      709379  // E clock rate reported (PAL)
+#define HOST_IO_MSEC     5000    // serial.device read timeout
+
+void host_serial_attach(int fd);
+void host_serial_detach(void);
+uint32_t host_serial_baud(void);
+void host_break(void);
+void host_eclock_advance(uint32_t ticks);
+void host_interrupt(void);
+uint8_t *host_map_file(const char *filename, long *len);
+void host_unmap_file(uint8_t *buf, long len);
+uint8_t *host_dma_ptr(uint32_t addr, uint32_t len);
+
+/*
+ * Simulated SCSI targets. The function runs the command in cdb for the
+ * target and LUN, and returns its status byte, or SIM_SCSI_NO_TARGET if
+ * nothing answers selection. Data-in commands fill data with at most
+ * *len bytes and set *len to the number filled; *len is 0 on entry for
+ * commands without data. NULL means no targets.
+ */
+#define SIM_SCSI_NO_TARGET (-1)
+extern int (*host_scsi_target)(uint32_t id, uint32_t lun, const uint8_t *cdb,
+                               uint32_t cdblen, uint8_t *data, uint32_t *len);
+
+/* CachePreDMA(), CachePostDMA(), and CacheClearE() calls and cost */
+#define HOST_CACHE_PRE   0
+#define HOST_CACHE_POST  1
+#define HOST_CACHE_CLEAR 2
+extern uint32_t host_cache_calls[3];
+extern uint32_t host_cache_bytes[3];
+extern uint32_t host_cache_kb_ticks;  // E clock ticks per KB in each call
+
+/* Called by Enable(), so tests can check state left while Disable()d */
+extern void (*host_enable_hook)(void);
+extern uint32_t host_disable_max;  // Longest Disable() in E clock ticks
+
+/* sim_bus.c: SDMAC and Ramsey registers at $dd0000 */
+#define SIM_BUS_NONE 0xffffffff  // sim_bus_decode(): nothing responds
+extern uint8_t sim_bus_regs[0x100];
+extern uint32_t (*sim_bus_decode)(uint32_t addr);
+
+#define SIM_SASRW_OK    0  // Long index writes work
+#define SIM_SASRW_LOST  1  // Long index writes are lost
+#define SIM_SASRW_LANE  2  // Long index writes land in the wrong byte lane
+extern uint32_t sim_bus_sasrw;
+extern uint32_t sim_bus_dma_align;  // DMA unit in bytes, a power of 2
+uint32_t sim_bus_dma(const uint8_t *data, uint32_t len);
+void sim_bus_wdc_int(void);
+
+/* sim_wdc.c: direct WDC registers and WD33C93B extended registers */
+extern uint8_t sim_wdc_regs[0x40];
+extern uint8_t sim_wdc_ext[0x100];
+extern uint8_t sim_wdc_auxst;
+extern uint32_t sim_wdc_stat_steals;  // SCSI_STAT reads taking an interrupt
+uint8_t sim_wdc_get(uint8_t reg);
+void sim_wdc_set(uint8_t reg, uint8_t value);
+void sim_wdc_select(uint8_t reg);
+uint8_t sim_wdc_index(void);
+uint8_t sim_wdc_read(void);
+void sim_wdc_write(uint8_t value);
+
+#endif /* AMIGA_HOST_H */
@@ -0,0 +1,56 @@
+/*
+ * check.h
+ * -------
+ * Check macros shared by the host tests. Each test program includes this
+ * once and reports the check and failure counts from main().
+ */
+#ifndef CHECK_H
+#define CHECK_H
+
+#include <math.h>
+#include <stdio.h>
+#include <stdint.h>
+
+static uint checks;
+static uint failures;
+
+#define CHECK(cond) check((cond), #cond, __FILE__, __LINE__)
+#define CHECK_NEAR(got, want, pct) \
+        check_near((got), (want), (pct), #got, __FILE__, __LINE__)
+
+static inline void
+check(int ok, const char *what, const char *file, uint line)
+{
+    checks++;
+    if (!ok) {
+        printf("%s:%u: check failed: %s\n", file, line, what);
+        failures++;
+    }
+}
+
+/* Checks that got is within pct percent of want */
+static inline void
+check_near(double got, double want, double pct, const char *what,
+           const char *file, uint line)
+{
+    checks++;
+    if (fabs(got - want) > fabs(want) * pct / 100) {
+        printf("%s:%u: %s is %.3f, want %.3f +/- %.2f%%\n",
+               file, line, what, got, want, pct);
+        failures++;
+    }
+}
+
+static uint32_t rand_state = 1;
+
+/* xorshift32, so every run sees the same samples */
+static inline uint32_t
+rand32(void)
+{
+    rand_state ^= rand_state << 13;
+    rand_state ^= rand_state >> 17;
+    rand_state ^= rand_state << 5;
+    return (rand_state);
+}
+
+#endif /* CHECK_H */
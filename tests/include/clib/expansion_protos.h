@@ -0,0 +1,9 @@
+/*
+ * Minimal AmigaOS definitions for building sdmac.c on the host. Only
+ * what sdmac.c uses is declared; see tests/amiga_host.c.
+ */
+#ifndef CLIB_EXPANSION_PROTOS_H
+#define CLIB_EXPANSION_PROTOS_H
+
+#include <libraries/configvars.h>
+#endif
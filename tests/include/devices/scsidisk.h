@@ -0,0 +1,30 @@
+/*
+ * Minimal AmigaOS definitions for building sdmac.c on the host. Only
+ * what sdmac.c uses is declared; see tests/amiga_host.c.
+ */
+#ifndef DEVICES_SCSIDISK_H
+#define DEVICES_SCSIDISK_H
+
+#include <exec/io.h>
+
+#define HD_SCSICMD 28
+
+struct SCSICmd {
+    UWORD *scsi_Data;
+    ULONG  scsi_Length;
+    ULONG  scsi_Actual;
+    UBYTE *scsi_Command;
+    UWORD  scsi_CmdLength;
+    UWORD  scsi_CmdActual;
+    UBYTE  scsi_Flags;
+    UBYTE  scsi_Status;
+    UBYTE *scsi_SenseData;
+    UWORD  scsi_SenseLength;
+    UWORD  scsi_SenseActual;
+};
+
+#define SCSIF_WRITE        0
+#define SCSIF_READ         1
+#define SCSIF_AUTOSENSE    2
+#define SCSIF_OLDAUTOSENSE 6
+#endif
@@ -0,0 +1,31 @@
+/*
+ * Minimal AmigaOS definitions for building sdmac.c on the host. Only
+ * what sdmac.c uses is declared; see tests/amiga_host.c.
+ */
+#ifndef DEVICES_SERIAL_H
+#define DEVICES_SERIAL_H
+
+#include <exec/io.h>
+
+struct IOExtSer {
+    struct IOStdReq IOSer;
+    ULONG           io_CtlChar;
+    ULONG           io_RBufLen;
+    ULONG           io_ExtFlags;
+    ULONG           io_Baud;
+    ULONG           io_BrkTime;
+    UBYTE           io_TermArray[8];
+    UBYTE           io_ReadLen;
+    UBYTE           io_WriteLen;
+    UBYTE           io_StopBits;
+    UBYTE           io_SerFlags;
+    UWORD           io_Status;
+};
+
+#define SERIALNAME      "serial.device"
+#define SDCMD_QUERY     9
+#define SDCMD_SETPARAMS 11
+#define SERF_RAD_BOOGIE (1 << 2)
+#define SERF_SHARED     (1 << 5)
+#define SERF_XDISABLED  (1 << 7)
+#endif
@@ -0,0 +1,30 @@
+/*
+ * Minimal AmigaOS definitions for building sdmac.c on the host. Only
+ * what sdmac.c uses is declared; see tests/amiga_host.c.
+ */
+#ifndef DEVICES_TIMER_H
+#define DEVICES_TIMER_H
+
+#include <exec/io.h>
+#include <sys/time.h>
+
+/* The host struct timeval stands in for the Amiga one */
+#define tv_secs  tv_sec
+#define tv_micro tv_usec
+
+struct EClockVal {
+    ULONG ev_hi;
+    ULONG ev_lo;
+};
+
+struct timerequest {
+    struct IORequest tr_node;
+    struct timeval   tr_time;
+};
+
+#define UNIT_MICROHZ  0
+#define UNIT_VBLANK   1
+#define UNIT_ECLOCK   2
+#define TR_ADDREQUEST 9
+#define TIMERNAME     "timer.device"
+#endif
@@ -0,0 +1,14 @@
+/*
+ * Minimal AmigaOS definitions for building sdmac.c on the host. Only
+ * what sdmac.c uses is declared; see tests/amiga_host.c.
+ */
+#ifndef DEVICES_TRACKDISK_H
+#define DEVICES_TRACKDISK_H
+
+#include <exec/io.h>
+
+#define TD_MOTOR  9
+#define TD_SEEK   10
+#define TD_FORMAT 11
+#define ETD_READ  (0x8000 | CMD_READ)
+#endif
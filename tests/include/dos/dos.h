@@ -0,0 +1,19 @@
+/*
+ * Minimal AmigaOS definitions for building sdmac.c on the host. Only
+ * what sdmac.c uses is declared; see tests/amiga_host.c.
+ */
+#ifndef DOS_DOS_H
+#define DOS_DOS_H
+
+#include <exec/types.h>
+
+#define SIGBREAKF_CTRL_C (1 << 12)
+#define SIGBREAKF_CTRL_D (1 << 13)
+#define TICKS_PER_SECOND 50
+
+struct DateStamp {
+    LONG ds_Days;
+    LONG ds_Minute;
+    LONG ds_Tick;
+};
+#endif
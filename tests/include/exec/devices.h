@@ -0,0 +1,18 @@
+/*
+ * Minimal AmigaOS definitions for building sdmac.c on the host. Only
+ * what sdmac.c uses is declared; see tests/amiga_host.c.
+ */
+#ifndef EXEC_DEVICES_H
+#define EXEC_DEVICES_H
+
+#include <exec/libraries.h>
+#include <exec/ports.h>
+
+struct Device {
+    struct Library dd_Library;
+};
+
+struct Unit {
+    struct MsgPort unit_MsgPort;
+};
+#endif
@@ -0,0 +1,43 @@
+/*
+ * Minimal AmigaOS definitions for building sdmac.c on the host. Only
+ * what sdmac.c uses is declared; see tests/amiga_host.c.
+ */
+#ifndef EXEC_EXECBASE_H
+#define EXEC_EXECBASE_H
+
+#include <exec/lists.h>
+#include <exec/interrupts.h>
+#include <exec/libraries.h>
+#include <exec/tasks.h>
+
+struct ExecBase {
+    struct Library  LibNode;
+    UWORD           SoftVer;
+    UWORD           AttnFlags;
+    struct List     DeviceList;
+    struct List     ResourceList;
+    struct List     LibList;
+    struct Task    *ThisTask;
+    ULONG           VBlankFrequency;
+    ULONG           ex_EClockFrequency;
+};
+
+#define AFF_68010      (1 << 0)
+#define AFF_68020      (1 << 1)
+#define AFF_68030      (1 << 2)
+#define AFF_68040      (1 << 3)
+#define AFF_68881      (1 << 4)
+#define AFF_68882      (1 << 5)
+#define AFF_FPU40      (1 << 6)
+#define AFF_68060      (1 << 7)
+
+#define CACRF_EnableI  (1 << 0)
+#define CACRF_ClearI   (1 << 3)
+#define CACRF_EnableD  (1 << 8)
+#define CACRF_ClearD   (1 << 11)
+#define CACRF_CopyBack (1U << 31)
+
+#define DMA_Continue    (1 << 1)
+#define DMA_NoModify    (1 << 2)
+#define DMA_ReadFromRAM (1 << 3)
+#endif
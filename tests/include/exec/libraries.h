@@ -0,0 +1,22 @@
+/*
+ * Minimal AmigaOS definitions for building sdmac.c on the host. Only
+ * what sdmac.c uses is declared; see tests/amiga_host.c.
+ */
+#ifndef EXEC_LIBRARIES_H
+#define EXEC_LIBRARIES_H
+
+#include <exec/lists.h>
+
+struct Library {
+    struct Node lib_Node;
+    UBYTE       lib_Flags;
+    UBYTE       lib_pad;
+    UWORD       lib_NegSize;
+    UWORD       lib_PosSize;
+    UWORD       lib_Version;
+    UWORD       lib_Revision;
+    APTR        lib_IdString;
+    ULONG       lib_Sum;
+    UWORD       lib_OpenCnt;
+};
+#endif
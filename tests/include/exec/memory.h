@@ -0,0 +1,17 @@
+/*
+ * Minimal AmigaOS definitions for building sdmac.c on the host. Only
+ * what sdmac.c uses is declared; see tests/amiga_host.c.
+ */
+#ifndef EXEC_MEMORY_H
+#define EXEC_MEMORY_H
+
+#include <exec/nodes.h>
+
+#define MEMF_ANY      0
+#define MEMF_PUBLIC   (1 << 0)
+#define MEMF_CHIP     (1 << 1)
+#define MEMF_FAST     (1 << 2)
+#define MEMF_24BITDMA (1 << 9)
+#define MEMF_CLEAR    (1 << 16)
+#define MEMF_LARGEST  (1 << 17)
+#endif
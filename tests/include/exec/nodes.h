@@ -0,0 +1,27 @@
+/*
+ * Minimal AmigaOS definitions for building sdmac.c on the host. Only
+ * what sdmac.c uses is declared; see tests/amiga_host.c.
+ */
+#ifndef EXEC_NODES_H
+#define EXEC_NODES_H
+
+#include <exec/types.h>
+
+struct Node {
+    struct Node *ln_Succ;
+    struct Node *ln_Pred;
+    UBYTE        ln_Type;
+    BYTE         ln_Pri;
+    char        *ln_Name;
+};
+
+struct MinNode {
+    struct MinNode *mln_Succ;
+    struct MinNode *mln_Pred;
+};
+
+#define NT_TASK      1
+#define NT_INTERRUPT 2
+#define NT_MESSAGE   5
+#define NT_REPLYMSG  7
+#endif
@@ -0,0 +1,23 @@
+/*
+ * Minimal AmigaOS definitions for building sdmac.c on the host. Only
+ * what sdmac.c uses is declared; see tests/amiga_host.c.
+ */
+#ifndef EXEC_PORTS_H
+#define EXEC_PORTS_H
+
+#include <exec/tasks.h>
+
+struct MsgPort {
+    struct Node  mp_Node;
+    UBYTE        mp_Flags;
+    UBYTE        mp_SigBit;
+    void        *mp_SigTask;
+    struct List  mp_MsgList;
+};
+
+struct Message {
+    struct Node     mn_Node;
+    struct MsgPort *mn_ReplyPort;
+    UWORD           mn_Length;
+};
+#endif
@@ -0,0 +1,18 @@
+/*
+ * Minimal AmigaOS definitions for building sdmac.c on the host. Only
+ * what sdmac.c uses is declared; see tests/amiga_host.c.
+ */
+#ifndef EXEC_TASKS_H
+#define EXEC_TASKS_H
+
+#include <exec/lists.h>
+
+struct Task {
+    struct Node tc_Node;
+    ULONG       tc_SigAlloc;
+    ULONG       tc_SigRecvd;
+    APTR        tc_SPReg;
+    APTR        tc_SPLower;
+    APTR        tc_SPUpper;
+};
+#endif
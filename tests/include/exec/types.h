@@ -0,0 +1,24 @@
+/*
+ * Minimal AmigaOS definitions for building sdmac.c on the host. Only
+ * what sdmac.c uses is declared; see tests/amiga_host.c.
+ */
+#ifndef EXEC_TYPES_H
+#define EXEC_TYPES_H
+
+#include <stdint.h>
+
+typedef void           *APTR;
+typedef int32_t         LONG;
+typedef uint32_t        ULONG;
+typedef int16_t         WORD;
+typedef uint16_t        UWORD;
+typedef int8_t          BYTE;
+typedef uint8_t         UBYTE;
+typedef int16_t         BOOL;
+typedef char           *STRPTR;
+typedef const char     *CONST_STRPTR;
+typedef LONG            BPTR;
+
+#define TRUE  1
+#define FALSE 0
+#endif
@@ -0,0 +1,23 @@
+/*
+ * Minimal AmigaOS definitions for building sdmac.c on the host. Only
+ * what sdmac.c uses is declared; see tests/amiga_host.c.
+ */
+#ifndef HARDWARE_CIA_H
+#define HARDWARE_CIA_H
+
+#include <exec/types.h>
+
+#define CIAICRB_TA      0
+#define CIAICRB_TB      1
+#define CIAICRF_TA      (1 << 0)
+#define CIAICRF_TB      (1 << 1)
+#define CIAICRF_SETCLR  (1 << 7)
+#define CIACRAF_START   (1 << 0)
+#define CIACRAF_RUNMODE (1 << 3)
+#define CIACRAF_LOAD    (1 << 4)
+#define CIACRBF_START   (1 << 0)
+#define CIACRBF_RUNMODE (1 << 3)
+#define CIACRBF_LOAD    (1 << 4)
+#define CIACRBF_INMODE0 (1 << 5)
+#define CIACRBF_INMODE1 (1 << 6)
+#endif
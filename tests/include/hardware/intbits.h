@@ -0,0 +1,12 @@
+/*
+ * Minimal AmigaOS definitions for building sdmac.c on the host. Only
+ * what sdmac.c uses is declared; see tests/amiga_host.c.
+ */
+#ifndef HARDWARE_INTBITS_H
+#define HARDWARE_INTBITS_H
+
+#define INTB_PORTS 3
+#define INTB_VERTB 5
+#define INTB_EXTER 13
+#define INTF_PORTS (1 << 3)
+#endif
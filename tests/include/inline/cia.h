@@ -0,0 +1,14 @@
+/*
+ * Minimal AmigaOS definitions for building sdmac.c on the host. Only
+ * what sdmac.c uses is declared; see tests/amiga_host.c.
+ */
+#ifndef INLINE_CIA_H
+#define INLINE_CIA_H
+
+#include <resources/cia.h>
+
+struct Interrupt *AddICRVector(APTR, LONG, struct Interrupt *);
+void RemICRVector(APTR, LONG, struct Interrupt *);
+WORD AbleICR(APTR, LONG);
+WORD SetICR(APTR, LONG);
+#endif
@@ -0,0 +1,56 @@
+/*
+ * Minimal AmigaOS definitions for building sdmac.c on the host. Only
+ * what sdmac.c uses is declared; see tests/amiga_host.c.
+ */
+#ifndef INLINE_EXEC_H
+#define INLINE_EXEC_H
+
+#include <exec/types.h>
+#include <exec/execbase.h>
+#include <exec/ports.h>
+#include <exec/io.h>
+
+extern struct ExecBase *SysBase;
+
+void Disable(void);
+void Enable(void);
+void Forbid(void);
+void Permit(void);
+APTR SuperState(void);
+void UserState(APTR);
+ULONG SetSignal(ULONG, ULONG);
+struct Node *FindName(struct List *, const char *);
+struct Task *FindTask(const char *);
+struct Library *OpenLibrary(const char *, ULONG);
+void CloseLibrary(struct Library *);
+APTR OpenResource(const char *);
+APTR AllocMem(ULONG, ULONG);
+void FreeMem(APTR, ULONG);
+ULONG AvailMem(ULONG);
+void CopyMem(const void *, void *, ULONG);
+struct MsgPort *CreateMsgPort(void);
+void DeleteMsgPort(struct MsgPort *);
+struct IORequest *CreateIORequest(struct MsgPort *, ULONG);
+void DeleteIORequest(struct IORequest *);
+BYTE OpenDevice(const char *, ULONG, struct IORequest *, ULONG);
+void CloseDevice(struct IORequest *);
+BYTE DoIO(struct IORequest *);
+void SendIO(struct IORequest *);
+struct IORequest *CheckIO(struct IORequest *);
+BYTE WaitIO(struct IORequest *);
+void AbortIO(struct IORequest *);
+struct Message *GetMsg(struct MsgPort *);
+struct Message *WaitPort(struct MsgPort *);
+ULONG Wait(ULONG);
+void Signal(struct Task *, ULONG);
+BYTE AllocSignal(LONG);
+void FreeSignal(LONG);
+APTR AddTask(struct Task *, APTR, APTR);
+void AddIntServer(LONG, struct Interrupt *);
+void RemIntServer(LONG, struct Interrupt *);
+APTR SetFunction(struct Library *, LONG, APTR);
+APTR CachePreDMA(APTR, ULONG *, ULONG);
+void CachePostDMA(APTR, ULONG *, ULONG);
+void CacheClearE(APTR, ULONG, ULONG);
+ULONG CacheControl(ULONG, ULONG);
+#endif
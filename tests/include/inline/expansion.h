@@ -0,0 +1,11 @@
+/*
+ * Minimal AmigaOS definitions for building sdmac.c on the host. Only
+ * what sdmac.c uses is declared; see tests/amiga_host.c.
+ */
+#ifndef INLINE_EXPANSION_H
+#define INLINE_EXPANSION_H
+
+#include <libraries/configvars.h>
+
+struct ConfigDev *FindConfigDev(struct ConfigDev *, LONG, LONG);
+#endif
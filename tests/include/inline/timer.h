@@ -0,0 +1,11 @@
+/*
+ * Minimal AmigaOS definitions for building sdmac.c on the host. Only
+ * what sdmac.c uses is declared; see tests/amiga_host.c.
+ */
+#ifndef INLINE_TIMER_H
+#define INLINE_TIMER_H
+
+#include <devices/timer.h>
+
+ULONG ReadEClock(struct EClockVal *);
+#endif
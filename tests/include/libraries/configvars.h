@@ -0,0 +1,28 @@
+/*
+ * Minimal AmigaOS definitions for building sdmac.c on the host. Only
+ * what sdmac.c uses is declared; see tests/amiga_host.c.
+ */
+#ifndef LIBRARIES_CONFIGVARS_H
+#define LIBRARIES_CONFIGVARS_H
+
+#include <exec/nodes.h>
+
+struct ExpansionRom {
+    UBYTE er_Type;
+    UBYTE er_Product;
+    UBYTE er_Flags;
+    UBYTE er_Reserved03;
+    UWORD er_Manufacturer;
+    ULONG er_SerialNumber;
+    UWORD er_InitDiagVec;
+};
+
+struct ConfigDev {
+    struct Node         cd_Node;
+    UBYTE               cd_Flags;
+    UBYTE               cd_Pad;
+    struct ExpansionRom cd_Rom;
+    APTR                cd_BoardAddr;
+    ULONG               cd_BoardSize;
+};
+#endif
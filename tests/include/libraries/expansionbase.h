@@ -0,0 +1,14 @@
+/*
+ * Minimal AmigaOS definitions for building sdmac.c on the host. Only
+ * what sdmac.c uses is declared; see tests/amiga_host.c.
+ */
+#ifndef LIBRARIES_EXPANSIONBASE_H
+#define LIBRARIES_EXPANSIONBASE_H
+
+#include <exec/libraries.h>
+#include <libraries/configvars.h>
+
+struct ExpansionBase {
+    struct Library LibNode;
+};
+#endif
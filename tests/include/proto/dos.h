@@ -0,0 +1,14 @@
+/*
+ * Minimal AmigaOS definitions for building sdmac.c on the host. Only
+ * what sdmac.c uses is declared; see tests/amiga_host.c.
+ */
+#ifndef PROTO_DOS_H
+#define PROTO_DOS_H
+
+#include <dos/dos.h>
+
+extern struct Library *DOSBase;
+
+void Delay(LONG);
+struct DateStamp *DateStamp(struct DateStamp *);
+#endif
@@ -0,0 +1,13 @@
+/*
+ * Minimal AmigaOS definitions for building sdmac.c on the host. Only
+ * what sdmac.c uses is declared; see tests/amiga_host.c.
+ */
+#ifndef RESOURCES_CIA_H
+#define RESOURCES_CIA_H
+
+#include <exec/libraries.h>
+#include <exec/interrupts.h>
+
+#define CIAANAME "ciaa.resource"
+#define CIABNAME "ciab.resource"
+#endif
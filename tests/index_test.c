@@ -0,0 +1,168 @@
+/*
+ * index_test.c
+ * ------------
+ * Test of host/sdmac-index. Snapshot files are written with sdmac.c's
+ * snap_write(), indexed in steps by the tool, and each query answer is
+ * compared with what "sdmac -Q" (snap_query()) shows for the same files.
+ */
+#define _GNU_SOURCE
+#include <limits.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#define main sdmac_main
+#include "../sdmac.c"
+#undef main
+
+#include "amiga_host.h"
+#include "check.h"
+
+static char tool[PATH_MAX];
+
+/* Appends a snapshot of a machine with the given WDC and -b result */
+static void
+add_snap(const char *file, uint level, uint microcode, uint32_t kbps)
+{
+    snap_t snap;
+
+    memset(&snap, 0, sizeof (snap));
+    snap.magic     = SNAP_MAGIC;
+    snap.version   = SNAP_VERSION;
+    snap.size      = sizeof (snap);
+    snap.ctrl_type = CTRL_A3000;
+    wd_level     = level;
+    wd_microcode = microcode;
+    wdc_khz      = 14318;
+    bench_result_kbps[2] = kbps;
+    strcpy(bench_result_drive, "QUANTUM LPS240S");
+    snap_write(file, &snap);
+}
+
+/* Runs the tool, returning its exit code and output */
+static int
+run(char *out, size_t len, const char *args)
+{
+    char   cmd[PATH_MAX + 256];
+    size_t got;
+    FILE  *fp;
+
+    snprintf(cmd, sizeof (cmd), "%s %s 2>&1", tool, args);
+    fp = popen(cmd, "r");
+    got = fread(out, 1, len - 1, fp);
+    out[got] = '\0';
+    return (WEXITSTATUS(pclose(fp)));
+}
+
+/* Returns the output of snap_query(), as sdmac -Q would show it */
+static void
+query(char *out, size_t len, const char *key, char **files, uint nfiles)
+{
+    size_t got;
+    FILE  *fp = tmpfile();
+    int    saved;
+
+    fflush(stdout);
+    saved = dup(1);
+    dup2(fileno(fp), 1);
+    snap_query(key, files, nfiles);
+    fflush(stdout);
+    dup2(saved, 1);
+    close(saved);
+    rewind(fp);
+    got = fread(out, 1, len - 1, fp);
+    out[got] = '\0';
+    fclose(fp);
+}
+
+static long
+file_size(const char *name)
+{
+    struct stat st;
+    return ((stat(name, &st) == 0) ? st.st_size : -1);
+}
+
+int
+main(void)
+{
+    static const char * const keys[] = { "wdc", "drive", "sdmac" };
+    char  *files[] = { "a.snap", "b.snap", "c.snap" };
+    char   dir[] = "/tmp/index_test.XXXXXX";
+    char   got[4096];
+    char   want[4096];
+    char   args[256];
+    uint   pos;
+    FILE  *fp;
+
+    if ((getcwd(tool, sizeof (tool) - 32) == NULL) ||
+        (mkdtemp(dir) == NULL) || (chdir(dir) != 0)) {
+        perror(dir);
+        return (1);
+    }
+    strcat(tool, "/../host/sdmac-index");
+
+    add_snap("a.snap", LEVEL_WD33C93A, 0x09, 3000);
+    add_snap("a.snap", LEVEL_WD33C93A, 0x09, 3200);
+    add_snap("a.snap", LEVEL_WD33C93A, 0x08, 0);
+    add_snap("b.snap", LEVEL_WD33C93B, 0x0d, 4100);
+    add_snap("b.snap", LEVEL_WD33C93A, 0x09, 2900);
+
+    /* The first add indexes everything; a repeat adds nothing */
+    CHECK(run(got, sizeof (got), "-j 4 idx add a.snap b.snap a.snap") == 0);
+    CHECK(strcmp(got, "5 snapshots added from 2 files; 5 indexed\n") == 0);
+    CHECK(file_size("idx/time") == 5 * 4);
+    CHECK(file_size("idx/kbps") == 5 * 12);
+    CHECK(run(got, sizeof (got), "idx add b.snap") == 0);
+    CHECK(strcmp(got, "0 snapshots added from 1 files; 5 indexed\n") == 0);
+    for (pos = 0; pos < ARRAY_SIZE(keys); pos++) {
+        snprintf(args, sizeof (args), "idx query %s", keys[pos]);
+        CHECK(run(got, sizeof (got), args) == 0);
+        query(want, sizeof (want), keys[pos], files, 2);
+        CHECK(strcmp(got, want) == 0);
+    }
+
+    /* Only records appended since are parsed */
+    add_snap("a.snap", LEVEL_WD33C93B, 0x0d, 4300);
+    add_snap("c.snap", LEVEL_WD33C93, 0, 1500);
+    CHECK(run(got, sizeof (got), "-j 2 idx add a.snap b.snap c.snap") == 0);
+    CHECK(strcmp(got, "2 snapshots added from 3 files; 7 indexed\n") == 0);
+    CHECK(run(got, sizeof (got), "idx query wdc") == 0);
+    query(want, sizeof (want), "wdc", files, 3);
+    CHECK(strcmp(got, want) == 0);
+    CHECK(strstr(got, "7 snapshots by wdc") != NULL);
+
+    /*
+     * Column data from an interrupted add is dropped, and a record still
+     * being written is left for the next add.
+     */
+    fp = fopen("idx/time", "ab");
+    fputs("junk", fp);
+    fclose(fp);
+    fp = fopen("c.snap", "ab");
+    fwrite(got, 1, SNAP_MIN_SIZE / 2, fp);
+    fclose(fp);
+    CHECK(run(got, sizeof (got), "idx add c.snap") == 1);
+    CHECK(strstr(got, "bad snapshot at offset 584\n") != NULL);
+    CHECK(strstr(got, "0 snapshots added from 1 files; 7 indexed\n") != NULL);
+    CHECK(file_size("idx/time") == 7 * 4);
+    CHECK(truncate("c.snap", sizeof (snap_t)) == 0);
+    add_snap("c.snap", LEVEL_WD33C93, 0, 1600);
+    CHECK(run(got, sizeof (got), "idx add c.snap") == 0);
+    CHECK(strcmp(got, "1 snapshots added from 1 files; 8 indexed\n") == 0);
+
+    /* One thread gives the same index */
+    CHECK(run(got, sizeof (got), "-j 1 one add a.snap b.snap c.snap") == 0);
+    CHECK(run(got, sizeof (got), "one query wdc") == 0);
+    CHECK(run(want, sizeof (want), "idx query wdc") == 0);
+    CHECK(strcmp(got, want) == 0);
+    query(want, sizeof (want), "wdc", files, 3);
+    CHECK(strcmp(got, want) == 0);
+
+    CHECK(run(got, sizeof (got), "idx query bogus") == 1);
+    CHECK(run(got, sizeof (got), "idx add missing.snap") == 1);
+
+    if (system("rm -rf -- \"$PWD\"") != 0)
+        printf("Failed to remove %s\n", dir);
+    printf("index_test: %u checks, %u failed\n", checks, failures);
+    return (failures != 0);
+}
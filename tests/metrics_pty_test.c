@@ -0,0 +1,204 @@
+/*
+ * metrics_pty_test.c
+ * ------------------
+ * End-to-end test of the -e metrics stream over a pty pair. The Amiga
+ * side is sdmac.c's own met_frame() and ser_write() on serial.device,
+ * emulated on the pty master. The Linux side is the host/ decoder and
+ * rolling aggregates reading the pty slave, as sdmac-collect does.
+ * Garbage, false sync patterns, corrupt frames, and a sequence gap are
+ * injected into the stream.
+ */
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#define main sdmac_main
+#include "../sdmac.c"
+#undef main
+
+#include "../host/sdmac_host.h"
+#include "amiga_host.h"
+#include "check.h"
+
+#define TEST_FRAMES    200
+#define TEST_BAUD      19200
+#define TEST_GAP_SEQ   50    // Sequence number never sent
+
+static struct IOExtSer *ser;
+static uint8_t          corrupt[TEST_FRAMES];
+static uint             corrupt_count;
+
+/* Returns the statistics which the Amiga side sends in frame seq */
+static void
+frame_stats(uint32_t seq, met_stats_t *st)
+{
+    memset(st, 0, sizeof (*st));
+    st->seq         = seq;
+    st->uptime      = seq;
+    st->interval_ms = 1000 + seq % 3;
+    st->requests    = 50 + seq % 7;
+    st->read_kb     = 1000 + (seq * 37) % 500;
+    st->write_kb    = seq % 11;
+    st->lat_avg     = 800 + seq;
+    st->lat_max     = 2000 + (seq * 7919) % 10000;
+    st->errors      = (seq % 40 == 0);
+    st->cpu_pct     = seq % 100;
+    st->dropped     = seq % 3;
+    st->chip_free   = 1500;
+    st->fast_free   = 14;
+}
+
+/*
+ * amiga_send
+ * ----------
+ * Sends TEST_FRAMES frames as metrics_run() does, with damage between
+ * and within frames, followed by a partial frame.
+ */
+static void *
+amiga_send(void *arg)
+{
+    static const uint8_t false_sync[] = { MET_SYNC0, MET_SYNC1, 0xff, 0x01 };
+    uint8_t     frame[MET_FRAME_MAX];
+    uint8_t     noise[16];
+    met_stats_t st;
+    uint32_t    seq;
+    uint        len;
+    uint        pos;
+
+    (void) arg;
+    for (seq = 0; seq < TEST_FRAMES; seq++) {
+        if (seq == TEST_GAP_SEQ)
+            continue;
+        frame_stats(seq, &st);
+        len = met_frame(frame, &st);
+        if (seq % 10 == 3) {
+            for (pos = 0; pos < sizeof (noise); pos++)
+                noise[pos] = rand32();
+            ser_write(ser, noise, sizeof (noise));
+        }
+        if (seq % 25 == 7)
+            ser_write(ser, false_sync, sizeof (false_sync));
+        if (seq % 13 == 5) {
+            frame[4 + seq % MET_PAYLOAD] ^= 0x40;
+            corrupt[seq] = 1;
+            corrupt_count++;
+        }
+        ser_write(ser, frame, len);
+    }
+    ser_write(ser, frame, 10);  // Cut off mid-frame
+    return (NULL);
+}
+
+int
+main(void)
+{
+    uint8_t       frame[SDM_FRAME_MAX];
+    sdm_decoder_t dec;
+    sdm_rolling_t roll;
+    sdm_rollup_t  sum;
+    sdm_stats_t   got;
+    met_stats_t   want;
+    pthread_t     thread;
+    uint32_t      seq = 0;
+    uint          expect_frames = 0;
+    int           master;
+    int           slave;
+    int           len;
+
+    master = posix_openpt(O_RDWR | O_NOCTTY);
+    if ((master < 0) || (grantpt(master) != 0) || (unlockpt(master) != 0)) {
+        perror("pty");
+        return (1);
+    }
+    slave = sdm_serial_open(ptsname(master), TEST_BAUD);
+    if (slave < 0)
+        return (1);
+
+    /* The host and Amiga CRC and frame layout agree */
+    CHECK(sdm_crc16((const uint8_t *) "123456789", 9) ==
+          met_crc16((const uint8_t *) "123456789", 9));
+    frame_stats(1234, &want);
+    CHECK(met_frame(frame, &want) == 4 + SDM_STATS_PAYLOAD + 2);
+    CHECK(sdm_stats_parse(frame, &got) == 0);
+    CHECK(memcmp(&got, &want, sizeof (got)) == 0);
+    frame[3] = SDM_TYPE_STATS + 1;
+    CHECK(sdm_stats_parse(frame, &got) != 0);
+
+    host_serial_attach(master);
+    ser = ser_open(TEST_BAUD);
+    CHECK(ser != NULL);
+    if (ser == NULL)
+        return (1);
+    CHECK(host_serial_baud() == TEST_BAUD);
+    CHECK((ser->io_SerFlags & SERF_XDISABLED) != 0);
+
+    pthread_create(&thread, NULL, amiga_send, NULL);
+    sdm_decode_init(&dec);
+    sdm_rolling_init(&roll);
+    while ((len = sdm_decode_read(&dec, slave, frame, 1000)) > 0) {
+        uint32_t kb = 0;
+        uint32_t ms = 0;
+        uint32_t lat_max = 0;
+        uint     cpu = 0;
+        uint     count = 0;
+        uint32_t prev;
+
+        /* Frames arrive in order; damaged ones and the gap are missing */
+        while ((seq == TEST_GAP_SEQ) || corrupt[seq])
+            seq++;
+        CHECK(len == 4 + MET_PAYLOAD + 2);
+        CHECK(sdm_stats_parse(frame, &got) == 0);
+        frame_stats(seq, &want);
+        if (memcmp(&got, &want, sizeof (got)) != 0) {
+            printf("frame %u: got seq %u\n", seq, got.seq);
+            CHECK(memcmp(&got, &want, sizeof (got)) == 0);
+        }
+        sdm_rolling_add(&roll, &got);
+        expect_frames++;
+        seq++;
+
+        /* Rolling aggregates over the last SDM_ROLLING frames received */
+        for (prev = seq; (prev-- > 0) && (count < SDM_ROLLING); ) {
+            if ((prev == TEST_GAP_SEQ) || corrupt[prev])
+                continue;
+            frame_stats(prev, &want);
+            kb += want.read_kb + want.write_kb;
+            ms += want.interval_ms;
+            cpu += want.cpu_pct;
+            if (lat_max < want.lat_max)
+                lat_max = want.lat_max;
+            count++;
+        }
+        sdm_rolling_get(&roll, &sum);
+        CHECK(roll.count == count);
+        CHECK(sum.kbps == (uint64_t) kb * 1000 / ms);
+        CHECK(sum.cpu_pct == cpu / count);
+        CHECK(sum.lat_max == lat_max);
+    }
+    pthread_join(thread, NULL);
+
+    CHECK(len == 0);  // Timed out on the partial frame
+    CHECK(seq == TEST_FRAMES);
+    CHECK(roll.frames == expect_frames);
+    CHECK(dec.frames == expect_frames);
+    CHECK(roll.lost == 1 + corrupt_count);
+    CHECK(dec.crc_errors >= corrupt_count);
+    CHECK(dec.skipped > 0);
+    CHECK(expect_frames == TEST_FRAMES - 1 - corrupt_count);
+
+    /* The rest of the cut off frame completes it */
+    frame_stats(TEST_FRAMES - 1, &want);
+    met_frame(frame, &want);
+    ser_write(ser, frame + 10, 4 + MET_PAYLOAD + 2 - 10);
+    CHECK(sdm_decode_read(&dec, slave, frame, 1000) > 0);
+    CHECK((sdm_stats_parse(frame, &got) == 0) &&
+          (got.seq == TEST_FRAMES - 1));
+
+    ser_close(ser);
+    host_serial_detach();
+    close(slave);
+    close(master);
+    printf("metrics_pty_test: %u checks, %u failed\n", checks, failures);
+    return (failures != 0);
+}
@@ -0,0 +1,1528 @@
+/*
+ * sdmac_test.c
+ * ------------
+ * Host unit tests for sdmac.c. sdmac.c is included so that its static
+ * functions can be called. Code which accesses the SDMAC or WDC runs
+ * against the simulation in sim_bus.c and sim_wdc.c.
+ */
+#define _GNU_SOURCE
+#include <math.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#define main sdmac_main
+#include "../sdmac.c"
+#undef main
+
+#include "amiga_host.h"
+#include "check.h"
+
+static void
+write_file(const char *name, const char *text)
+{
+    FILE *fp = fopen(name, "w");
+    fputs(text, fp);
+    fclose(fp);
+}
+
+static FILE *capture_fp;
+static int   capture_saved;
+
+/* Sends stdout to a temporary file until capture_end() */
+static void
+capture_start(void)
+{
+    fflush(stdout);
+    capture_fp = tmpfile();
+    capture_saved = dup(1);
+    dup2(fileno(capture_fp), 1);
+}
+
+/* Restores stdout, returning what was written to it in buf */
+static void
+capture_end(char *buf, size_t len)
+{
+    size_t got;
+
+    fflush(stdout);
+    dup2(capture_saved, 1);
+    close(capture_saved);
+    rewind(capture_fp);
+    got = fread(buf, 1, len - 1, capture_fp);
+    buf[got] = '\0';
+    fclose(capture_fp);
+}
+
+static int
+cmp_double(const void *a, const void *b)
+{
+    double va = *(const double *) a;
+    double vb = *(const double *) b;
+    return ((va > vb) - (va < vb));
+}
+
+/*
+ * test_stat_exact
+ * ---------------
+ * Feeds count samples from gen() to a stat_t and compares the results
+ * with exact computation over the stored samples.
+ */
+static void
+test_stat_exact(uint32_t (*gen)(void), uint count)
+{
+    stat_t   st;
+    double  *vals = malloc(count * sizeof (*vals));
+    double   sum = 0;
+    double   sumsq = 0;
+    double   mean;
+    uint32_t hist = 0;
+    uint32_t min = STAT_VALUE_MAX;
+    uint32_t max = 0;
+    uint     pos;
+
+    stat_init(&st);
+    for (pos = 0; pos < count; pos++) {
+        uint32_t value = gen();
+        stat_add(&st, value);
+        vals[pos] = value;
+        sum += value;
+        if (min > value)
+            min = value;
+        if (max < value)
+            max = value;
+    }
+    mean = sum / count;
+    for (pos = 0; pos < count; pos++)
+        sumsq += (vals[pos] - mean) * (vals[pos] - mean);
+    qsort(vals, count, sizeof (*vals), cmp_double);
+
+    CHECK(st.count == count);
+    CHECK(st.min == min);
+    CHECK(st.max == max);
+    CHECK_NEAR((double) stat_mean(&st) / STAT_ONE, mean, 0.1);
+    CHECK_NEAR((double) stat_stddev(&st) / STAT_ONE,
+               sqrt(sumsq / (count - 1)), 0.5);
+    for (pos = 0; pos < STAT_QUANTILES; pos++) {
+        double exact = vals[(uint) ((count - 1) * (stat_pct[pos] / 10000.0))];
+        CHECK_NEAR((double) stat_quantile(&st, pos) / STAT_ONE, exact, 1.0);
+    }
+    for (pos = 0; pos < STAT_HIST_BUCKETS; pos++)
+        hist += st.hist[pos];
+    CHECK(hist == count);
+    free(vals);
+}
+
+/* Approximately normal: mean 4094, standard deviation 1182 */
+static uint32_t
+gen_normal(void)
+{
+    return ((rand32() & 2047) + (rand32() & 2047) +
+            (rand32() & 2047) + (rand32() & 2047));
+}
+
+/* Exponential with a mean of 1000, like request latencies */
+static uint32_t
+gen_exponential(void)
+{
+    return (-log((rand32() + 1.0) / 4294967297.0) * 1000);
+}
+
+static void
+test_stat(void)
+{
+    stat_t st;
+
+    test_stat_exact(gen_normal, 100000);
+    test_stat_exact(gen_exponential, 100000);
+
+    /* Fewer than five samples are kept exactly */
+    stat_init(&st);
+    stat_add(&st, 30);
+    stat_add(&st, 10);
+    stat_add(&st, 20);
+    CHECK(stat_quantile(&st, 0) == 20 * STAT_ONE);
+    CHECK(stat_mean(&st) == 20 * STAT_ONE);
+    CHECK(stat_stddev(&st) == 10 * STAT_ONE);
+    CHECK(st.hist[4] == 1);  // 10
+    CHECK(st.hist[5] == 2);  // 20 and 30
+
+    /* Out of range samples are clamped */
+    stat_init(&st);
+    CHECK(stat_quantile(&st, 2) == 0);
+    stat_add(&st, STAT_VALUE_MAX + 100);
+    CHECK(st.max == STAT_VALUE_MAX);
+    CHECK(st.hist[STAT_HIST_BUCKETS - 1] == 1);
+
+    CHECK(stat_usec(1000 * STAT_ONE, 1000000) == 1000);
+    CHECK(stat_usec(709379 * STAT_ONE, 709379) == 1000000);
+    CHECK(isqrt64(0) == 0);
+    CHECK(isqrt64(99) == 9);
+    CHECK(isqrt64(1ULL << 62) == 1U << 31);
+}
+
+static void
+test_met(void)
+{
+    static const uint8_t check_str[] = "123456789";
+    uint8_t     frame[MET_FRAME_MAX];
+    met_stats_t in;
+    met_stats_t out;
+    uint        len;
+
+    CHECK(met_crc16(check_str, 9) == 0x29b1);  // CRC-16/CCITT-FALSE check
+    CHECK(met_crc16(check_str, 0) == 0xffff);
+
+    memset(&in, 0, sizeof (in));
+    in.seq         = 0x01020304;
+    in.uptime      = 3600;
+    in.interval_ms = 1000;
+    in.requests    = 1234;
+    in.read_kb     = 0x89abcdef;
+    in.write_kb    = 77;
+    in.lat_avg     = 850;
+    in.lat_max     = 120000;
+    in.errors      = 0xfedc;
+    in.cpu_pct     = 42;
+    in.dropped     = 3;
+    in.chip_free   = 1500;
+    in.fast_free   = 14;
+    len = met_frame(frame, &in);
+    CHECK(len == MET_FRAME_MAX);
+    CHECK((frame[0] == MET_SYNC0) && (frame[1] == MET_SYNC1));
+    CHECK(frame[2] == MET_PAYLOAD);
+    CHECK(frame[3] == MET_TYPE_STATS);
+    CHECK((frame[4] == 0x01) && (frame[7] == 0x04));  // Big-endian
+    CHECK(met_crc16(frame + 2, MET_PAYLOAD + 2) ==
+          met_get16(frame + 4 + MET_PAYLOAD));
+
+    memset(&out, 0, sizeof (out));
+    met_unframe(frame + 4, &out);
+    CHECK(memcmp(&in, &out, sizeof (in)) == 0);
+
+    /* Any corrupt byte is caught by the CRC */
+    frame[20] ^= 0x10;
+    CHECK(met_crc16(frame + 2, MET_PAYLOAD + 2) !=
+          met_get16(frame + 4 + MET_PAYLOAD));
+
+    frame[4] = 0x55;
+    CHECK(met_frame_wrap(frame, 0x81, 1) == 7);
+    CHECK((frame[2] == 1) && (frame[3] == 0x81));
+    CHECK(met_get16(frame + 5) == met_crc16(frame + 2, 3));
+}
+
+static void
+test_script(void)
+{
+    script_op_t ops[8];
+
+    write_file("script", "# comment\n"
+                         "time on\n"
+                         "r WDC_CONTROL\n"
+                         "w 01 ff   # own id\n"
+                         "wait 17 80 80 250\n"
+                         "time off\n"
+                         "\n"
+                         "wait WDC_AUXST 01 00\n"
+                         "delay 1000\n");
+    CHECK(script_parse("script", ops, ARRAY_SIZE(ops)) == 5);
+    CHECK((ops[0].op == SCRIPT_READ) && (ops[0].reg == WDC_CONTROL) &&
+          ops[0].stamp && (ops[0].line == 3));
+    CHECK((ops[1].op == SCRIPT_WRITE) && (ops[1].reg == 0x01) &&
+          (ops[1].value == 0xff) && ops[1].stamp);
+    CHECK((ops[2].op == SCRIPT_WAIT) && (ops[2].reg == 0x17) &&
+          (ops[2].mask == 0x80) && (ops[2].value == 0x80) &&
+          (ops[2].arg == 250));
+    CHECK((ops[3].op == SCRIPT_WAIT) && (ops[3].reg == WDC_AUXST) &&
+          (ops[3].arg == SCRIPT_WAIT_MSEC) && !ops[3].stamp);
+    CHECK((ops[4].op == SCRIPT_DELAY) && (ops[4].arg == 1000) &&
+          (ops[4].line == 9));
+
+    write_file("script", "w 01 100\n");
+    CHECK(script_parse("script", ops, ARRAY_SIZE(ops)) == -1);
+    write_file("script", "r\n");
+    CHECK(script_parse("script", ops, ARRAY_SIZE(ops)) == -1);
+    write_file("script", "r WDC_NONE\n");
+    CHECK(script_parse("script", ops, ARRAY_SIZE(ops)) == -1);
+    write_file("script", "time maybe\n");
+    CHECK(script_parse("script", ops, ARRAY_SIZE(ops)) == -1);
+    write_file("script", "delay soon\n");
+    CHECK(script_parse("script", ops, ARRAY_SIZE(ops)) == -1);
+    write_file("script", "r 00\nr 01\nr 02\n");
+    CHECK(script_parse("script", ops, 2) == -1);
+    CHECK(script_parse("no-such-script", ops, ARRAY_SIZE(ops)) == -1);
+}
+
+static void
+test_profile(void)
+{
+    profile_t prof;
+
+    write_file("profile", "unit 3 32 2   # comment\n"
+                          "min_dma_kbps 2500\n"
+                          "max_p99_usec 40000\n"
+                          "clock_khz 14000 14400\n"
+                          "reg_passes 5\n"
+                          "max_reg_fail_pct 10\n");
+    CHECK(profile_parse("profile", &prof) == 0);
+    CHECK((prof.wl.unit == 3) && (prof.wl.depth == 2));
+    CHECK(prof.wl.xfer_blocks == 32 * 1024 / SCSI_BLOCK_SIZE);
+    CHECK((prof.min_dma_kbps == 2500) && (prof.max_p99_usec == 40000));
+    CHECK((prof.clock_min_khz == 14000) && (prof.clock_max_khz == 14400));
+    CHECK((prof.reg_passes == 5) && (prof.max_reg_fail_pct == 10));
+
+    write_file("profile", "reg_passes 3\n");
+    CHECK(profile_parse("profile", &prof) == 0);
+    CHECK((prof.wl.unit == PROF_UNSET) && (prof.wl.depth == 4));
+    CHECK(prof.wl.xfer_blocks == 64 * 1024 / SCSI_BLOCK_SIZE);
+    CHECK((prof.min_dma_kbps == PROF_UNSET) &&
+          (prof.clock_min_khz == PROF_UNSET) &&
+          (prof.max_reg_fail_pct == PROF_UNSET));
+
+    write_file("profile", "unit 8\n");
+    CHECK(profile_parse("profile", &prof) != 0);
+    write_file("profile", "unit 3 0\n");
+    CHECK(profile_parse("profile", &prof) != 0);
+    write_file("profile", "unit 3 32 9\n");
+    CHECK(profile_parse("profile", &prof) != 0);
+    write_file("profile", "clock_khz 14400 14000\n");
+    CHECK(profile_parse("profile", &prof) != 0);
+    write_file("profile", "max_reg_fail_pct 101\n");
+    CHECK(profile_parse("profile", &prof) != 0);
+    write_file("profile", "reg_passes 5x\n");
+    CHECK(profile_parse("profile", &prof) != 0);
+    write_file("profile", "min_dma_kbps 2500\n");  // Needs a unit
+    CHECK(profile_parse("profile", &prof) != 0);
+}
+
+static void
+test_qc(void)
+{
+    qc_cache_t qc;
+    qc_cache_t loaded;
+    qc_sig_t   sig;
+
+    memset(&sig, 0, sizeof (sig));
+    sig.ctrl_base = 0xdd0000;
+    sig.ctrl_type = CTRL_A3000;
+    sig.sdmac_rev = 0x76343031;
+    memset(&qc, 0, sizeof (qc));
+    qc.magic    = QC_MAGIC;
+    qc.version  = QC_VERSION;
+    qc.size     = sizeof (qc);
+    qc.sig      = sig;
+    qc.wd_level = LEVEL_WD33C93A;
+    qc.wdc_khz  = 14200;
+    CHECK(qc_valid(&qc, &sig));
+
+    /* The cache round trips through ENV: */
+    qc_save(&qc);
+    CHECK((qc_load(&loaded) == 0) && (memcmp(&qc, &loaded, sizeof (qc)) == 0));
+
+    sig.sdmac_rev = 0x76343032;  // Different SDMAC part
+    CHECK(!qc_valid(&qc, &sig));
+    sig.sdmac_rev = 0x76343031;
+    qc.version = QC_VERSION - 1;
+    CHECK(!qc_valid(&qc, &sig));
+    qc.version = QC_VERSION;
+    qc.size--;
+    CHECK(!qc_valid(&qc, &sig));
+    qc.size++;
+    qc.magic = 0;
+    CHECK(!qc_valid(&qc, &sig));
+    qc.magic = QC_MAGIC;
+    qc.wd_level = LEVEL_UNKNOWN;
+    CHECK(!qc_valid(&qc, &sig));
+}
+
+/* Fills a baseline statistic with the given samples */
+static void
+bl_fill(bl_stat_t *st, const uint32_t *vals, uint count)
+{
+    uint pos;
+
+    memset(st, 0, sizeof (*st));
+    for (pos = 0; pos < count; pos++) {
+        st->sum   += vals[pos];
+        st->sumsq += (uint64_t) vals[pos] * vals[pos];
+    }
+}
+
+static void
+test_baseline(void)
+{
+    static const uint32_t steady[] = { 1000, 1000, 1000, 1000 };
+    static const uint32_t noisy[] = { 800, 1200, 800, 1200 };
+    static bl_entry_t ents[BL_MAX_ENTRIES];
+    static bl_entry_t loaded[BL_MAX_ENTRIES];
+    uint32_t   sample[3][BL_METRICS];
+    bl_stat_t  st;
+    uint32_t   mean;
+    uint32_t   allowed;
+    uint       run;
+    FILE      *fp;
+
+    bl_tolerance = 10;
+
+    /* Without variance, the tolerance applies: KB/s higher is better */
+    bl_fill(&st, steady, 4);
+    CHECK(!bl_check_metric(&st, 4, 0, 900, &mean, &allowed));
+    CHECK((mean == 1000) && (allowed == 100));
+    CHECK(bl_check_metric(&st, 4, 0, 899, &mean, &allowed));
+    CHECK(!bl_check_metric(&st, 4, 0, 5000, &mean, &allowed));
+
+    /* Latency lower is better */
+    CHECK(!bl_check_metric(&st, 4, 2, 1100, &mean, &allowed));
+    CHECK(bl_check_metric(&st, 4, 2, 1101, &mean, &allowed));
+
+    /* Three standard deviations when larger than the tolerance */
+    bl_fill(&st, noisy, 4);
+    CHECK(!bl_check_metric(&st, 4, 0, 311, &mean, &allowed));
+    CHECK((mean == 1000) && (allowed == 690));  // isqrt(53333) * 3
+    CHECK(bl_check_metric(&st, 4, 0, 309, &mean, &allowed));
+
+    /* but not until there are three runs */
+    bl_fill(&st, noisy, 2);
+    CHECK(bl_check_metric(&st, 2, 0, 899, &mean, &allowed));
+    CHECK(allowed == 100);
+
+    /* Runs are capped at BL_MAX_RUNS without moving a steady mean */
+    memset(ents, 0, sizeof (ents));
+    for (run = 0; run < BL_MAX_RUNS + 10; run++) {
+        memset(sample, 0, sizeof (sample));
+        sample[2][0] = 2000;
+        bl_add(&ents[0], (const uint32_t (*)[BL_METRICS]) sample);
+    }
+    CHECK(ents[0].runs == BL_MAX_RUNS);
+    CHECK(ents[0].stat[2][0].sum / ents[0].runs == 2000);
+    CHECK(!bl_check_metric(&ents[0].stat[2][0], ents[0].runs, 0, 1800,
+                           &mean, &allowed));
+
+    /* A later faster run is followed, weighted against the history */
+    sample[2][0] = 3000;
+    bl_add(&ents[0], (const uint32_t (*)[BL_METRICS]) sample);
+    mean = ents[0].stat[2][0].sum / ents[0].runs;
+    CHECK((mean > 2000) && (mean < 2100));
+
+    /* File format round trip */
+    memcpy(ents[1].drive, "QUANTUM LPS240S ", 16);
+    ents[1].unit    = 6;
+    ents[1].depth   = 4;
+    ents[1].xfer_kb = 64;
+    CHECK(bl_save(ents, 2) == 0);
+    memset(loaded, 0xff, sizeof (loaded));
+    CHECK(bl_load(loaded) == 2);
+    CHECK(memcmp(ents, loaded, 2 * sizeof (ents[0])) == 0);
+
+    /* Files of another version or format are ignored */
+    fp = fopen(BL_FILE, "r+b");
+    fseek(fp, offsetof(bl_hdr_t, version), SEEK_SET);
+    fputc(0x7f, fp);
+    fclose(fp);
+    CHECK(bl_load(loaded) == 0);
+    unlink(BL_FILE);
+    CHECK(bl_load(loaded) == 0);
+}
+
+static void
+test_align(void)
+{
+    static uint8_t buf[ALIGN_GUARD + 64 + ALIGN_GUARD];
+    static uint8_t ref[64];
+    uint8_t       *dst = buf + ALIGN_GUARD;
+    uint           pos;
+
+    for (pos = 0; pos < sizeof (ref); pos++)
+        ref[pos] = pos;
+    memset(buf, ALIGN_GUARD_BYTE, sizeof (buf));
+    memcpy(dst, ref, sizeof (ref));
+    CHECK(align_classify(dst, ref, 64) == '.');
+
+    dst[-1] = 0;
+    CHECK(align_classify(dst, ref, 64) == 'B');
+    dst[-1] = ALIGN_GUARD_BYTE;
+
+    dst[5] ^= 1;
+    CHECK(align_classify(dst, ref, 64) == 'X');
+    dst[5] ^= 1;
+
+    memset(dst + 64 - ALIGN_DELTA, ALIGN_GUARD_BYTE, ALIGN_DELTA);
+    CHECK(align_classify(dst, ref, 64) == 'T');
+    dst[64 - ALIGN_DELTA - 1] = ALIGN_GUARD_BYTE;
+    CHECK(align_classify(dst, ref, 64) == 'X');  // Too short for T
+    memcpy(dst, ref, sizeof (ref));
+
+    CHECK(align_classify(dst, ref, 60) == 'O');  // ref[60] past the end
+    dst[64 + ALIGN_GUARD - 1] = 0;
+    CHECK(align_classify(dst, ref, 64) == 'O');
+}
+
+static void
+test_cia_usec(void)
+{
+    cia_freq = ECLOCK_NTSC;
+    CHECK(cia_usec(0) == 0);
+    CHECK(cia_usec(1) == 1);     // Rounds up
+    CHECK(cia_usec(14) == 11);
+    CHECK(cia_usec(1000000) == ECLOCK_NTSC);
+    cia_freq = ECLOCK_PAL;
+    CHECK(cia_usec(1000) == 710);
+    CHECK(cia_usec(1000000) == ECLOCK_PAL);
+    CHECK(cia_usec(90000) == 63845);  // Near the 16-bit timer range
+}
+
+/* scsi_wait() covers the selection timeout programmed in TPERIOD */
+static void
+test_scsi_wait(void)
+{
+    wdc_khz = 14318;
+    scsi_wait_calibrate(0);
+    CHECK_NEAR(scsi_wait_usec, SCSI_SEL_MSEC * 1000 * 5 / 4, 2);
+    scsi_wait_calibrate(SBIC_TIMEOUT(1000));
+    CHECK_NEAR(scsi_wait_usec, 1000 * 1000 * 5 / 4, 2);
+    scsi_wait_calibrate(0xff);  // 80000 input clocks per unit
+    CHECK_NEAR(scsi_wait_usec, 0xff * 80000.0 / 14318 * 1000 * 5 / 4, 1);
+    wdc_khz = 8000;
+    scsi_wait_calibrate(0xff);
+    CHECK(scsi_wait_usec == SCSI_WAIT_MAX_USEC * 4);
+    wdc_khz = 0;
+    scsi_wait_calibrate(0);
+    CHECK(scsi_wait_usec == SCSI_WAIT_MAX_USEC);
+}
+
+/*
+ * Simulated disk for the transfer tests, at target DISK_ID. Block data
+ * is a pattern of the LBA and byte offset, so data from the wrong block
+ * or offset is caught. READ(10) commands are logged. With disk_rbuf set,
+ * READ BUFFER returns block 0's pattern from a DISK_RBUF_LEN buffer.
+ */
+#define DISK_ID       3
+#define DISK_LOG_MAX  64
+#define DISK_RBUF_LEN 0x10000  // As in the READ BUFFER descriptor below
+
+static uint     disk_rbuf;
+static uint     disk_nlog;
+static uint32_t disk_log[DISK_LOG_MAX][2];  // READ(10) LBA and blocks
+
+static uint8_t
+disk_byte(uint32_t lba, uint32_t off)
+{
+    return (lba * 31 + off * 7 + (off >> 8));
+}
+
+static int
+disk_cmd(uint32_t id, uint32_t lun, const uint8_t *cdb, uint32_t cdblen,
+         uint8_t *data, uint32_t *len)
+{
+    uint32_t lba;
+    uint32_t pos;
+
+    if ((id != DISK_ID) || (lun != 0))
+        return (SIM_SCSI_NO_TARGET);
+    switch (cdb[0]) {
+        case SCSI_TEST_UNIT_READY:
+            *len = 0;
+            return (SCSI_STATUS_GOOD);
+        case SCSI_INQUIRY:
+            if (*len > 36)
+                *len = 36;
+            memset(data, 0, *len);
+            memcpy(data + 8, "SIMDISK DISK            ", *len - 8);
+            return (SCSI_STATUS_GOOD);
+        case SCSI_READ_10:
+            lba = (cdb[2] << 24) | (cdb[3] << 16) | (cdb[4] << 8) | cdb[5];
+            if (disk_nlog < DISK_LOG_MAX) {
+                disk_log[disk_nlog][0] = lba;
+                disk_log[disk_nlog++][1] = (cdb[7] << 8) | cdb[8];
+            }
+            if (*len > ((cdb[7] << 8) | cdb[8]) * SCSI_BLOCK_SIZE)
+                *len = ((cdb[7] << 8) | cdb[8]) * SCSI_BLOCK_SIZE;
+            for (pos = 0; pos < *len; pos++)
+                data[pos] = disk_byte(lba + pos / SCSI_BLOCK_SIZE,
+                                      pos % SCSI_BLOCK_SIZE);
+            return (SCSI_STATUS_GOOD);
+        case SCSI_READ_BUFFER:
+            if (disk_rbuf == 0)
+                break;
+            if (*len > ((cdb[6] << 16) | (cdb[7] << 8) | cdb[8]))
+                *len = (cdb[6] << 16) | (cdb[7] << 8) | cdb[8];
+            if (cdb[1] == READ_BUFFER_DESC) {
+                static const uint8_t desc[4] = { 0, 0x01, 0x00, 0x00 };
+                if (*len > sizeof (desc))
+                    *len = sizeof (desc);
+                memcpy(data, desc, *len);
+                return (SCSI_STATUS_GOOD);
+            }
+            if ((cdb[1] != READ_BUFFER_DATA) || (*len > DISK_RBUF_LEN))
+                break;
+            for (pos = 0; pos < *len; pos++)
+                data[pos] = disk_byte(0, pos);
+            return (SCSI_STATUS_GOOD);
+    }
+    *len = 0;
+    return (SCSI_STATUS_CHECK_CONDITION);
+}
+
+/* Returns the number of bytes of buf which differ from the disk at lba */
+static uint
+disk_check(const uint8_t *buf, uint32_t lba, uint len)
+{
+    uint pos;
+    uint bad = 0;
+
+    for (pos = 0; pos < len; pos++)
+        if (buf[pos] != disk_byte(lba + pos / SCSI_BLOCK_SIZE,
+                                  pos % SCSI_BLOCK_SIZE))
+            bad++;
+    return (bad);
+}
+
+/* All -b paths read the blocks from bench_req_lba(), in order */
+static void
+test_bench(void)
+{
+    bench_workload_t wl = { DISK_ID, 1000, 100, 16, 4 };
+    uint32_t         next = wl.start_lba;
+    uint             blocks = 0;
+    uint             nreq = bench_requests(&wl);
+    uint             req;
+
+    CHECK(nreq == 7);
+    for (req = 0; req < nreq; req++) {
+        CHECK(bench_req_lba(&wl, req, &blocks) == next);
+        next += blocks;
+    }
+    CHECK((next == wl.start_lba + wl.blocks) && (blocks == 4));
+    wl.blocks = 96;
+    CHECK(bench_requests(&wl) == 6);
+    CHECK((bench_req_lba(&wl, 5, &blocks) == 1080) && (blocks == 16));
+    wl.blocks = 100;
+
+    host_scsi_target = disk_cmd;
+    bl_tolerance = 0;
+    disk_nlog = 0;
+    CHECK(bench_compare(&wl) == 0);
+    CHECK(disk_nlog == 3 * nreq);
+    CHECK(memcmp(disk_log[0], disk_log[nreq],
+                 nreq * sizeof (disk_log[0])) == 0);
+    CHECK(memcmp(disk_log[0], disk_log[2 * nreq],
+                 nreq * sizeof (disk_log[0])) == 0);
+    for (req = 0; req < nreq; req++) {
+        CHECK(disk_log[req][0] == bench_req_lba(&wl, req, &blocks));
+        CHECK(disk_log[req][1] == blocks);
+    }
+    CHECK(memcmp(bench_result_drive, "SIMDISK DISK", 12) == 0);
+
+    /* A unit with nothing at its ID fails every path */
+    wl.unit = DISK_ID + 1;
+    CHECK(bench_compare(&wl) != 0);
+    host_scsi_target = NULL;
+}
+
+/* Reads blocks at lba in the transfer mode, returning the status */
+static int
+xfer_read(uint mode, uint target, uint32_t lba, uint blocks, uint8_t *buf)
+{
+    uint8_t cdb[10];
+
+    memset(buf, 0, blocks * SCSI_BLOCK_SIZE);
+    scsi_build_read10(cdb, lba, blocks);
+    return (scsi_xfer_cmd(target, 0, cdb, sizeof (cdb), buf,
+                          blocks * SCSI_BLOCK_SIZE, mode));
+}
+
+/* Each scsi_xfer_cmd() mode moves the right data; -m runs them all */
+static void
+test_xfer_modes(void)
+{
+    static const uint modes[] = {
+        XFER_PIO, XFER_PIO_INTR, XFER_DMA, XFER_DMA_INTR
+    };
+    bench_workload_t wl = { DISK_ID, 300, 64, 8, 1 };
+    struct Interrupt server;
+    uint8_t         *buf = AllocMem(8 * SCSI_BLOCK_SIZE, MEMF_PUBLIC);
+    uint32_t         start;
+    uint             mode;
+
+    host_scsi_target = disk_cmd;
+    memset(&server, 0, sizeof (server));
+    server.is_Code  = (void (*)(void)) lat_server;
+    lat_isr.task    = FindTask(NULL);
+    lat_isr.sigmask = BIT(AllocSignal(-1));
+    CHECK(lat_timer_open() == 0);
+    AddIntServer(INTB_PORTS, &server);
+    sim_bus_regs[SDMAC_CONTR - SDMAC_BASE] = SDMAC_CONTR_INTEN;
+
+    for (mode = 0; mode < ARRAY_SIZE(modes); mode++) {
+        lat_isr.count = 0;
+        CHECK(xfer_read(modes[mode], DISK_ID, 40 + mode, 8, buf) == 0);
+        CHECK(disk_check(buf, 40 + mode, 8 * SCSI_BLOCK_SIZE) == 0);
+        CHECK(lat_isr.count == XFER_IS_INTR(modes[mode]));
+        CHECK(xfer_read(modes[mode], DISK_ID + 1, 0, 1, buf) ==
+              SCSI_SEL_TIMEOUT);
+    }
+
+    /* Without the interrupt, the interrupt modes give up at the deadline */
+    sim_bus_regs[SDMAC_CONTR - SDMAC_BASE] = 0;
+    start = eclock_ticks();
+    CHECK(xfer_read(XFER_DMA_INTR, DISK_ID, 0, 1, buf) == -1);
+    CHECK(eclock_ticks() - start >=
+          (uint64_t) XFER_WAIT_MSEC(SCSI_BLOCK_SIZE) * HOST_ECLOCK / 1000);
+    CHECK(xfer_read(XFER_DMA, DISK_ID, 7, 1, buf) == 0);  // WDC recovered
+    CHECK(disk_check(buf, 7, SCSI_BLOCK_SIZE) == 0);
+
+    RemIntServer(INTB_PORTS, &server);
+    lat_timer_close();
+
+    /* -m: the last mode takes one WDC interrupt per command */
+    CHECK(xfer_mode_compare(&wl) == 0);
+    CHECK(lat_isr.count == bench_requests(&wl));
+    CHECK(sim_bus_regs[SDMAC_CONTR - SDMAC_BASE] == 0);  // Restored
+
+    FreeMem(buf, 8 * SCSI_BLOCK_SIZE);
+    host_scsi_target = NULL;
+}
+
+/*
+ * Simulated targets for -u. Each command takes TTR_CMD_MSEC of simulated
+ * time, so a polling round takes up to TTR_ROUND_MSEC. Target 2 answers selection after 300 ms, reports a UNIT
+ * ATTENTION, then is becoming ready until 800 ms. Target 4 waits for
+ * START STOP UNIT and is ready 300 ms after it. Nothing else responds.
+ */
+#define TTR_CMD_MSEC   25
+#define TTR_ROUND_MSEC (8 * 2 * TTR_CMD_MSEC + 100)
+
+static uint32_t ttr_t0;        // E clock at the bus reset
+static uint32_t ttr_start[8];  // msec of START STOP UNIT, 0 if none
+static uint     ttr_starts[8];
+static uint     ttr_ua[8];     // UNIT ATTENTION pending
+static uint32_t ttr_last[8];   // msec of the last selection
+static uint8_t  ttr_sense[8][3];
+
+static int
+ttr_cmd(uint32_t id, uint32_t lun, const uint8_t *cdb, uint32_t cdblen,
+        uint8_t *data, uint32_t *len)
+{
+    uint32_t msec = (uint64_t) (eclock_ticks() - ttr_t0) * 1000 /
+                    HOST_ECLOCK;
+    uint     ready;
+
+    host_eclock_advance(TTR_CMD_MSEC * HOST_ECLOCK / 1000);
+    ttr_last[id] = msec;
+    if (((id != 2) && (id != 4)) || (lun != 0) || ((id == 2) && (msec < 300)))
+        return (SIM_SCSI_NO_TARGET);
+    if (cdb[0] == SCSI_REQUEST_SENSE) {
+        if (*len > 18)
+            *len = 18;
+        memset(data, 0, *len);
+        data[0]  = 0x70;
+        data[2]  = ttr_sense[id][0];
+        data[12] = ttr_sense[id][1];
+        data[13] = ttr_sense[id][2];
+        return (SCSI_STATUS_GOOD);
+    }
+    *len = 0;
+    if (cdb[0] == SCSI_START_STOP_UNIT) {
+        if (ttr_starts[id]++ == 0)
+            ttr_start[id] = msec;
+        return (SCSI_STATUS_GOOD);
+    }
+    if (id == 2)
+        ready = (msec >= 800);
+    else
+        ready = (ttr_starts[id] != 0) && (msec >= ttr_start[id] + 300);
+    ttr_sense[id][0] = 0x02;  // NOT READY
+    ttr_sense[id][1] = 0x04;
+    ttr_sense[id][2] = ((id == 4) && (ttr_starts[id] == 0)) ? 0x02 : 0x01;
+    if (ttr_ua[id]) {
+        ttr_ua[id] = 0;
+        ttr_sense[id][0] = 0x06;  // UNIT ATTENTION
+        ttr_sense[id][1] = 0x29;  // Power on or reset
+        ttr_sense[id][2] = 0x00;
+    } else if (ready) {
+        return (SCSI_STATUS_GOOD);
+    }
+    return (SCSI_STATUS_CHECK_CONDITION);
+}
+
+static void
+ttr_run(uint max_secs, uint do_start, char *out, size_t len)
+{
+    memset(ttr_start, 0, sizeof (ttr_start));
+    memset(ttr_starts, 0, sizeof (ttr_starts));
+    memset(ttr_last, 0, sizeof (ttr_last));
+    ttr_ua[2] = 1;
+    ttr_ua[4] = 1;
+    sim_wdc_regs[WDC_OWN_ID] = 7;
+    ttr_t0 = eclock_ticks();
+    capture_start();
+    CHECK(measure_time_to_ready(max_secs, do_start) == 0);
+    capture_end(out, len);
+}
+
+/* Returns non-zero if the ready time after pos is within a round of msec */
+static int
+ttr_ready_near(const char *pos, uint32_t msec)
+{
+    uint32_t got = atof(pos) * 1000;
+    return ((got >= msec) && (got <= msec + TTR_ROUND_MSEC));
+}
+
+/* -u follows each target through spin-up and stops polling empty IDs */
+static void
+test_ttr(void)
+{
+    char  out[2048];
+    char *pos;
+
+    host_scsi_target = ttr_cmd;
+    ttr_run(4, 0, out, sizeof (out));
+    pos = strstr(out, "Target 2: ready in ");
+    CHECK(pos != NULL);
+    if (pos != NULL) {
+        CHECK(ttr_ready_near(pos + 19, 800));
+        CHECK(strstr(pos, "No response\n") != NULL);
+        pos = strstr(pos, "UNIT ATTENTION ASC 29 ASCQ 00\n");
+        CHECK(pos != NULL);
+        CHECK((pos != NULL) &&
+              strstr(pos, "NOT READY ASC 04 ASCQ 01\n    ") != NULL);
+        CHECK((pos != NULL) && strstr(pos, "Ready\n") != NULL);
+    }
+    pos = strstr(out, "Target 4: not ready after 4 s");
+    CHECK(pos != NULL);
+    CHECK((pos != NULL) && strstr(pos, "NOT READY ASC 04 ASCQ 02\n") != NULL);
+    CHECK(strstr(out, "Target 1") == NULL);
+    CHECK(ttr_starts[4] == 0);
+
+    /* Empty IDs were dropped after the grace period, target 4 was not */
+    CHECK(ttr_last[1] < TTR_ABSENT_MSEC + TTR_ROUND_MSEC);
+    CHECK(ttr_last[4] >= 3900);
+
+    /* With START UNIT, target 4 is started once and gets ready */
+    ttr_run(4, 1, out, sizeof (out));
+    CHECK((ttr_starts[2] == 1) && (ttr_starts[4] == 1));
+    pos = strstr(out, "Target 4: ready in ");
+    CHECK(pos != NULL);
+    if (pos != NULL)
+        CHECK(ttr_ready_near(pos + 19, ttr_start[4] + 300));
+    CHECK(strstr(out, "Target 2: ready in ") != NULL);
+    CHECK(scsi_sel_msec == SCSI_SEL_MSEC);
+    host_scsi_target = NULL;
+}
+
+/* Returns the -o result row for the offset, or "" if it is missing */
+static const char *
+align_row(const char *out, uint offset)
+{
+    static char row[16];
+    char        want[16];
+    const char *pos;
+
+    snprintf(want, sizeof (want), "\n  %6u  ", offset);
+    pos = strstr(out, want);
+    if (pos == NULL)
+        return ("");
+    sscanf(pos + strlen(want), "%15s", row);
+    return (row);
+}
+
+/*
+ * -o finds nothing wrong with an exact DMA engine, and reports what one
+ * which only moves longwords gets wrong.
+ */
+static void
+test_dma_align(void)
+{
+    char out[4096];
+    int  rc;
+
+    host_scsi_target = disk_cmd;
+    disk_rbuf = 1;
+    capture_start();
+    rc = dma_align_check(DISK_ID, 512);
+    capture_end(out, sizeof (out));
+    CHECK(rc == 0);
+    CHECK(strstr(out, "512 bytes by READ BUFFER, offsets 0-15, "
+                      "lengths -3 to +3") != NULL);
+    CHECK(strcmp(align_row(out, 0), ".......") == 0);
+    CHECK(strcmp(align_row(out, 15), ".......") == 0);
+
+    sim_bus_dma_align = 4;
+    capture_start();
+    rc = dma_align_check(DISK_ID, 512);
+    capture_end(out, sizeof (out));
+    CHECK(rc == 1);
+    CHECK(strcmp(align_row(out, 0), "OOO.OOO") == 0);
+    CHECK(strcmp(align_row(out, 1), "BBBBBBB") == 0);
+    CHECK(strcmp(align_row(out, 8), "OOO.OOO") == 0);
+    CHECK(strstr(out, "108 of 112 DMA reads wrong") != NULL);
+    sim_bus_dma_align = 1;
+
+    /* Without READ BUFFER, only whole blocks can be checked */
+    disk_rbuf = 0;
+    capture_start();
+    CHECK(dma_align_check(DISK_ID, 500) == 1);
+    rc = dma_align_check(DISK_ID, 1024);
+    capture_end(out, sizeof (out));
+    CHECK(rc == 0);
+    CHECK(strstr(out, "length must be a multiple of 512") != NULL);
+    CHECK(strstr(out, "odd lengths skipped") != NULL);
+    CHECK(strcmp(align_row(out, 3), ".") == 0);
+    capture_start();
+    CHECK(dma_align_check(DISK_ID + 1, 512) == 1);
+    capture_end(out, sizeof (out));
+    CHECK(strstr(out, "did not respond to selection") != NULL);
+    host_scsi_target = NULL;
+}
+
+/* Returns the cache usec -C shows for the method and size, or -1 */
+static double
+cache_usec(const char *out, const char *method, uint len)
+{
+    char        want[64];
+    const char *pos;
+
+    snprintf(want, sizeof (want), "  %-16s %7u ", method, len);
+    pos = strstr(out, want);
+    return ((pos == NULL) ? -1 : atof(pos + strlen(want)));
+}
+
+/* -C accounts the time in each size's cache calls to that size */
+static void
+test_cache_cost(void)
+{
+    static const uint sizes[] = { 512, 2048, 8192, 32768, 65536 };
+    char     out[4096];
+    uint32_t total = 0;
+    uint     size;
+    int      rc;
+
+    host_scsi_target = disk_cmd;
+    SysBase->LibNode.lib_Version = 36;
+    capture_start();
+    CHECK(dma_cache_cost(DISK_ID) == 1);
+    capture_end(out, sizeof (out));
+    CHECK(strstr(out, "exec V36 has no CachePreDMA()") != NULL);
+
+    SysBase->LibNode.lib_Version = 40;
+    host_cache_kb_ticks = 200;
+    memset(host_cache_calls, 0, sizeof (host_cache_calls));
+    memset(host_cache_bytes, 0, sizeof (host_cache_bytes));
+    capture_start();
+    rc = dma_cache_cost(DISK_ID);
+    capture_end(out, sizeof (out));
+    CHECK(rc == 0);
+
+    /* Each timed read and the coherency check's read, per method */
+    for (size = 0; size < ARRAY_SIZE(sizes); size++)
+        total += sizes[size] * (CACHE_REPS + 1);
+    CHECK(host_cache_calls[HOST_CACHE_PRE] == 5 * (CACHE_REPS + 1));
+    CHECK(host_cache_calls[HOST_CACHE_POST] == 5 * (CACHE_REPS + 1));
+    CHECK(host_cache_bytes[HOST_CACHE_PRE] == total);
+    CHECK(host_cache_bytes[HOST_CACHE_POST] == total);
+    CHECK(host_cache_calls[HOST_CACHE_CLEAR] == 2 * 5 * (CACHE_REPS + 1) + 1);
+    CHECK(host_cache_bytes[HOST_CACHE_CLEAR] == 2 * total + CACHE_XFER_MAX);
+
+    /* Two calls per read, each costing host_cache_kb_ticks per KB */
+    for (size = 0; size < ARRAY_SIZE(sizes); size++) {
+        double want = 2.0 * sizes[size] / 1024 * host_cache_kb_ticks *
+                      1000000 / HOST_ECLOCK;
+        CHECK_NEAR(cache_usec(out, "CachePre/PostDMA", sizes[size]), want, 5);
+        CHECK_NEAR(cache_usec(out, "CacheClearE", sizes[size]), want, 5);
+        CHECK((cache_usec(out, "None", sizes[size]) >= 0) &&
+              (cache_usec(out, "None", sizes[size]) < 5));
+    }
+    CHECK(strstr(out, "no (") == NULL);  // Simulated DMA is coherent
+    CHECK(dma_cache_mode == DMA_CACHE_PREPOST);
+
+    host_cache_kb_ticks = 0;
+    host_scsi_target = NULL;
+}
+
+static void
+test_tests(void)
+{
+    uint32_t all = BIT(ARRAY_SIZE(tests)) - 1;
+
+    CHECK(test_parse("wdc") == BIT(test_find("wdc", 3)));
+    CHECK(test_parse("default") == test_mask(TEST_DEFAULT));
+    CHECK(test_parse("all") == (all & ~test_mask(TEST_DESTRUCTIVE)));
+    CHECK((test_parse("all") & BIT(test_find("probe", 5))) == 0);
+    CHECK(test_parse("wdc,probe") ==
+          (BIT(test_find("wdc", 3)) | BIT(test_find("probe", 5))));
+    CHECK(test_parse("wdc,bogus") == 0);
+    CHECK(test_parse("wd") == 0);
+    CHECK(test_find("wdcx", 4) < 0);
+}
+
+static void
+test_vcd(void)
+{
+    static const la_sample_t samples[] = {
+        {  0, 0x00, 0xff, 0x00 },  // Bus free
+        { 10, 0x81, 0xfe, 0x08 },  // IO asserted, REQ
+        { 20, 0x81, 0xfe, 0x08 },  // No change
+        { 30, 0x81, 0xff, 0x00 },
+    };
+    static const char expect[] =
+        "$version SDMAC " VER " $end\n"
+        "$timescale 1 us $end\n"
+        "$scope module scsi $end\n"
+        "$var wire 8 d DB $end\n"
+        "$var wire 1 i IO $end\n"
+        "$var wire 1 c CD $end\n"
+        "$var wire 1 m MSG $end\n"
+        "$var wire 1 r REQ $end\n"
+        "$upscope $end\n"
+        "$enddefinitions $end\n"
+        "#0\n$dumpvars\nb00000000 d\n0i\n0c\n0m\n0r\n$end\n"
+        "#10\nb10000001 d\n1i\n1r\n"
+        "#30\n0i\n0r\n"
+        "#30\n";
+    char  got[sizeof (expect) + 64];
+    FILE *fp;
+    long  len;
+
+    CHECK(la_write_vcd("capture.vcd", samples, ARRAY_SIZE(samples),
+                       1000000) == 0);
+    fp = fopen("capture.vcd", "r");
+    len = fread(got, 1, sizeof (got) - 1, fp);
+    fclose(fp);
+    got[(len < 0) ? 0 : len] = '\0';
+    CHECK(strcmp(got, expect) == 0);
+}
+
+static void
+test_wdc_regs(void)
+{
+    uint method;
+
+    for (method = WDC_INDEX_BYTE; method <= WDC_INDEX_LONG; method++) {
+        wdc_index_method = method;
+        sim_wdc_select(WDC_CMD);
+        set_wdc_reg24(WDC_TCOUNT2, 0x123456);  // Most significant first
+        CHECK((sim_wdc_regs[WDC_TCOUNT2] == 0x12) &&
+              (sim_wdc_regs[WDC_TCOUNT1] == 0x34) &&
+              (sim_wdc_regs[WDC_TCOUNT0] == 0x56));
+        set_wdc_reg(WDC_OWN_ID, 0x40 + method);
+        CHECK(sim_wdc_regs[WDC_OWN_ID] == 0x40 + method);
+        CHECK(get_wdc_reg(WDC_TCOUNT1) == 0x34);
+        CHECK(sim_wdc_index() == WDC_CMD);  // Index restored
+    }
+    wdc_index_method = WDC_INDEX_BYTE;
+}
+
+static void
+test_wdc_ext(void)
+{
+    uint8_t buf[0x40];
+    uint    pos;
+
+    for (pos = 0; pos < sizeof (sim_wdc_ext); pos++)
+        sim_wdc_ext[pos] = pos ^ 0x5a;
+    sim_wdc_regs[WDC_CDB1] = 0x11;
+    sim_wdc_regs[WDC_CDB2] = 0x22;
+    sim_wdc_regs[0x3f] = 0x3f;
+    sim_wdc_auxst = 0;
+    sim_wdc_stat_steals = 0;
+
+    /* One command per extended register, and CDB1/CDB2 restored */
+    wdc_ext_cmds = 0;
+    CHECK(get_wdc_regs_extended(0x3f, 5, buf) == 0);
+    CHECK(wdc_ext_cmds == 4);
+    CHECK((buf[0] == 0x3f) && (buf[1] == (0x40 ^ 0x5a)) &&
+          (buf[4] == (0x43 ^ 0x5a)));
+    CHECK((sim_wdc_regs[WDC_CDB1] == 0x11) &&
+          (sim_wdc_regs[WDC_CDB2] == 0x22));
+    CHECK(sim_wdc_stat_steals == 0);
+
+    /* Nothing is issued or consumed while scsi.device owns the WDC */
+    sim_wdc_regs[WDC_SCSI_STAT] = 0x16;
+    sim_wdc_auxst = WDC_AUXST_INT;
+    wdc_ext_cmds = 0;
+    CHECK(get_wdc_regs_extended(0x10, 0x40, buf) == 17);  // 17, 40-4f
+    CHECK(wdc_ext_cmds == 0);
+    CHECK((sim_wdc_auxst == WDC_AUXST_INT) && (sim_wdc_stat_steals == 0));
+    sim_wdc_auxst = WDC_AUXST_BSY;
+    CHECK(get_wdc_regs_extended(0x80, 8, buf) == 8);
+    CHECK((wdc_ext_cmds == 0) && (buf[7] == 0));
+    CHECK((sim_wdc_regs[WDC_CDB1] == 0x11) &&
+          (sim_wdc_regs[WDC_CDB2] == 0x22));
+    sim_wdc_auxst = 0;
+}
+
+static void
+test_index_select(void)
+{
+    uint8_t regs[sizeof (sim_wdc_regs)];
+    uint    mode;
+    uint    pos;
+
+    for (pos = 0; pos < sizeof (sim_wdc_regs); pos++)
+        sim_wdc_regs[pos] = pos * 7 + 1;
+    memcpy(regs, sim_wdc_regs, sizeof (regs));
+    sim_wdc_auxst = 0;
+
+    for (mode = SIM_SASRW_OK; mode <= SIM_SASRW_LANE; mode++) {
+        sim_bus_sasrw = mode;
+        wdc_index_select();
+        CHECK(wdc_index_ns[WDC_INDEX_BYTE] != 0);
+        if (mode == SIM_SASRW_OK) {
+            CHECK(wdc_index_ns[WDC_INDEX_LONG] != 0);
+        } else {
+            CHECK((wdc_index_ns[WDC_INDEX_LONG] == 0) &&
+                  (wdc_index_method == WDC_INDEX_BYTE));
+        }
+        CHECK(memcmp(regs, sim_wdc_regs, sizeof (regs)) == 0);
+    }
+    sim_bus_sasrw = SIM_SASRW_OK;
+
+    /* A busy WDC is checked once, not waited for */
+    sim_wdc_auxst = WDC_AUXST_CIP;
+    host_disable_max = 0;
+    wdc_index_select();
+    CHECK((wdc_index_method == WDC_INDEX_BYTE) &&
+          (wdc_index_ns[WDC_INDEX_BYTE] == 0));
+    CHECK(host_disable_max < cia_usec(1000));
+    CHECK(memcmp(regs, sim_wdc_regs, sizeof (regs)) == 0);
+    sim_wdc_auxst = 0;
+}
+
+/* As on the A3000: the SDMAC registers repeat at +0x100 */
+static uint32_t
+decode_mirror(uint32_t addr)
+{
+    uint32_t off = addr - SDMAC_BASE;
+
+    if (off >= 0x200)
+        return (SIM_BUS_NONE);
+    return (SDMAC_BASE + (off & 0xff));
+}
+
+/* Registers repeat every 4K, except the fully decoded Ramsey ACR */
+static uint32_t
+decode_4k(uint32_t addr)
+{
+    uint32_t off = (addr - SDMAC_BASE) & 0xfff;
+
+    if (off >= 0x100)
+        return (SIM_BUS_NONE);
+    if (((off & ~3) == (RAMSEY_ACR - SDMAC_BASE)) &&
+        (addr - SDMAC_BASE >= 0x1000))
+        return (SIM_BUS_NONE);
+    return (SDMAC_BASE + off);
+}
+
+static uint32_t map_expect[ARRAY_SIZE(map_sigs)];
+static uint     map_clobbered;
+
+/* Interrupts are only enabled with the swept registers intact */
+static void
+map_enable_hook(void)
+{
+    uint sig;
+
+    for (sig = 0; sig < MAP_SIG_WDC; sig++)
+        if (sim_bus_read32(map_sigs[sig].addr) != map_expect[sig])
+            map_clobbered++;
+    if ((sim_wdc_regs[WDC_CDB1] != map_expect[MAP_SIG_WDC]) ||
+        (sim_wdc_index() != WDC_CMD))
+        map_clobbered++;
+}
+
+/* Returns the number of windows in which a register is aliased */
+static uint
+test_map_decode(uint32_t (*decode)(uint32_t addr))
+{
+    static map_window_t map[MAP_WINDOWS];
+    uint16_t            base_ticks;
+    uint                win;
+    uint                sig;
+    uint                bad = 0;
+    uint                aliased = 0;
+
+    map_expect[0] = 0x00123456;
+    map_expect[1] = 0x0000000c;
+    map_expect[2] = 0x00000081;
+    map_expect[MAP_SIG_WDC] = 0x7e;
+    for (sig = 0; sig < MAP_SIG_WDC; sig++)
+        sim_bus_write32(map_sigs[sig].addr, map_expect[sig]);
+    sim_wdc_regs[WDC_CDB1] = map_expect[MAP_SIG_WDC];
+    sim_wdc_select(WDC_CMD);
+
+    sim_bus_decode = decode;
+    map_clobbered = 0;
+    host_enable_hook = map_enable_hook;
+    memset(map, 0, sizeof (map));
+    map_sweep(map);
+    host_enable_hook = NULL;
+    sim_bus_decode = NULL;
+    CHECK(map_clobbered == 0);
+
+    /* Each window is compared with what the decode map says */
+    base_ticks = map[0].ticks;
+    for (win = 1; win < MAP_WINDOWS; win++) {
+        uint32_t base = SDMAC_BASE + win * MAP_WINDOW;
+        uint     slow = (decode(base + 0x20) == SIM_BUS_NONE);
+
+        if ((map[win].ticks > base_ticks * MAP_SLOW_FACTOR) != slow)
+            bad++;
+        for (sig = 0; sig < ARRAY_SIZE(map_sigs); sig++) {
+            const map_sig_t *ms = &map_sigs[sig];
+            uint want = 0;
+
+            if (!slow && (decode(base + (ms->addr - SDMAC_BASE)) == ms->addr))
+                want = (sig == MAP_SIG_WDC) ? MAP_W_BYTE :
+                       (MAP_W_LONG | MAP_W_WORD | MAP_W_BYTE);
+            if (map[win].widths[sig] != want)
+                bad++;
+            if ((sig == 0) && (want != 0))
+                aliased++;
+        }
+    }
+    CHECK(bad == 0);
+    return (aliased);
+}
+
+static void
+test_map(void)
+{
+    CHECK(test_map_decode(decode_mirror) == 1);
+    CHECK(test_map_decode(decode_4k) == 15);
+}
+
+/* scsi.device handles its interrupt once interrupts are enabled */
+static void
+la_enable_hook(void)
+{
+    sim_wdc_auxst = 0;
+}
+
+static void
+test_la_capture(void)
+{
+    static la_sample_t buf[200];
+    uint               fails;
+    uint               skipped;
+    uint               pos;
+    uint               bad = 0;
+
+    sim_wdc_ext[LA_REG_DATA]  = 0x81;
+    sim_wdc_ext[LA_REG_CTRL]  = 0xfe;
+    sim_wdc_ext[LA_REG_STATE] = 0x08;
+    sim_wdc_regs[WDC_CDB1] = 0x11;
+    sim_wdc_regs[WDC_CDB2] = 0x22;
+    sim_wdc_regs[WDC_SCSI_STAT] = 0x16;
+    sim_wdc_auxst = WDC_AUXST_INT;
+    sim_wdc_stat_steals = 0;
+    wdc_ext_cmds = 0;
+
+    host_enable_hook = la_enable_hook;
+    CHECK(la_capture(buf, ARRAY_SIZE(buf), &fails, &skipped) ==
+          ARRAY_SIZE(buf));
+    host_enable_hook = NULL;
+    CHECK((fails == 0) && (skipped == 1));
+    CHECK(wdc_ext_cmds == ARRAY_SIZE(buf) * 3);
+    CHECK(sim_wdc_stat_steals == 0);
+    CHECK((sim_wdc_regs[WDC_CDB1] == 0x11) &&
+          (sim_wdc_regs[WDC_CDB2] == 0x22));
+    for (pos = 0; pos < ARRAY_SIZE(buf); pos++) {
+        if ((buf[pos].data != 0x81) ||
+            (la_decode(&buf[pos]) != (LA_SIG_IO | LA_SIG_REQ)) ||
+            ((pos != 0) && (buf[pos].ticks < buf[pos - 1].ticks)))
+            bad++;
+    }
+    CHECK(bad == 0);
+}
+
+/* Presses ^C after a while */
+static void *
+watch_break(void *arg)
+{
+    (void) arg;
+    usleep(200000);
+    host_break();
+    return (NULL);
+}
+
+static void
+test_watch(void)
+{
+    watch_t   w;
+    pthread_t thread;
+    uint32_t  start;
+    uint      pos;
+
+    memset(&w, 0, sizeof (w));
+    CHECK(watch_parse_regs(&w, "WDC_AUXST,WDC_OWN_ID") == 0);
+    CHECK(watch_parse_regs(&w, "WDC_DATA") == 1);
+    CHECK(watch_parse_regs(&w, "WDC_AUXST,WDC_OWN_ID") == 0);
+    w.ring = calloc(WATCH_RING, sizeof (*w.ring));
+
+    /* Only changes are stored; every change is counted */
+    watch_record(&w, 0, 0, 10);
+    watch_record(&w, 0, 0x80, 20);
+    watch_record(&w, 0, 0x80, 30);
+    watch_record(&w, 1, 0x07, 40);
+    watch_record(&w, 0, 0x00, 50);
+    CHECK(w.head == 3);
+    CHECK((w.ring[0].ticks == 20) && (w.ring[0].value == 0x80) &&
+          (w.ring[0].reg == 0));
+    CHECK((w.ring[1].ticks == 40) && (w.ring[1].reg == 1));
+    CHECK((w.ring[2].ticks == 50) && (w.ring[2].value == 0));
+    CHECK((w.regs[0].changes == 2) && (w.regs[1].changes == 1));
+
+    /* The oldest changes are overwritten, but still counted */
+    for (pos = 0; pos < WATCH_RING + 10; pos++)
+        watch_record(&w, 1, pos & 1, 100 + pos);
+    CHECK(w.head == WATCH_RING + 13);
+    CHECK(w.regs[1].changes == WATCH_RING + 11);
+    CHECK(w.ring[(w.head - 1) % WATCH_RING].ticks == 100 + WATCH_RING + 9);
+    CHECK(w.ring[w.head % WATCH_RING].ticks == 100 + 10);
+    free(w.ring);
+
+    /* ^C stops a slow watch without waiting for a number of samples */
+    pthread_create(&thread, NULL, watch_break, NULL);
+    start = eclock_ticks();
+    CHECK(watch_regs("WDC_AUXST", 30, 1) == 0);
+    CHECK(eclock_ticks() - start < HOST_ECLOCK);
+    pthread_join(thread, NULL);
+    SetSignal(0, SIGBREAKF_CTRL_C);
+}
+
+static trace_entry_t trace_seen;
+
+/* Takes the slot trace_submit() publishes, as an interrupt would see it */
+static void
+trace_enable_hook(void)
+{
+    trace_seen = trace_ring[(trace_head - 1) % TRACE_ENTRIES];
+}
+
+/* A task which leaves the patch code after a while */
+static void *
+trace_leave(void *arg)
+{
+    (void) arg;
+    usleep(200000);
+    trace_users = 0;
+    return (NULL);
+}
+
+/* Rewrites the entry count in the header of a trace dump */
+static void
+trace_set_count(const char *name, uint32_t count)
+{
+    FILE *fp = fopen(name, "r+b");
+
+    count = BE32(count);
+    fseek(fp, offsetof(trace_hdr_t, count), SEEK_SET);
+    fwrite(&count, sizeof (count), 1, fp);
+    fclose(fp);
+}
+
+static void
+test_trace(void)
+{
+    static struct Library scsi;
+    struct List    *devs = &SysBase->DeviceList;
+    struct IOStdReq io[3];
+    struct SCSICmd  cmd;
+    uint8_t         cdb[10] = { 0x28, 0, 0, 0, 0, 0x10, 0, 0, 2, 0 };
+    uint8_t         magic[4];
+    pthread_t       thread;
+    uint32_t        start;
+    FILE           *fp;
+
+    scsi.lib_Node.ln_Name = TRACE_DEVICE;
+    scsi.lib_Node.ln_Succ = (struct Node *) &devs->lh_Tail;
+    devs->lh_Head = &scsi.lib_Node;
+    SetFunction(&scsi, LVO_BEGINIO, (APTR) test_trace);
+    CHECK(trace_start() == &scsi);
+    memset(trace_ring, 0xa5, TRACE_ENTRIES * sizeof (trace_entry_t));
+
+    memset(io, 0, sizeof (io));
+    io[0].io_Command = CMD_READ;
+    io[0].io_Offset  = 4096;
+    io[0].io_Length  = 512;
+    host_enable_hook = trace_enable_hook;
+    trace_submit((struct IORequest *) &io[0]);
+    host_enable_hook = NULL;
+    CHECK((trace_head == 1) && (trace_seen.command == CMD_READ) &&
+          (trace_seen.offset == 4096) && (trace_seen.complete == 0) &&
+          (trace_seen.submit != 0xa5a5a5a5));
+
+    memset(&cmd, 0, sizeof (cmd));
+    cmd.scsi_Command = cdb;
+    cmd.scsi_Length  = 1024;
+    io[1].io_Command = HD_SCSICMD;
+    io[1].io_Data    = &cmd;
+    trace_submit((struct IORequest *) &io[1]);
+    io[2].io_Command = TD_READ64;
+    io[2].io_Actual  = 1;
+    io[2].io_Length  = 512;
+    trace_submit((struct IORequest *) &io[2]);
+    io[0].io_Flags = IOF_QUICK;
+    trace_quick((struct IORequest *) &io[0]);
+    trace_reply((struct Message *) &io[1]);
+    CHECK((trace_ring[0].complete != 0) && (trace_ring[1].complete != 0) &&
+          (trace_ring[2].complete == 0));
+    CHECK((trace_ring[1].offset == 0x10 * 512) &&
+          (trace_ring[1].length == 1024) && (trace_ring[1].scsi_op == 0x28));
+    CHECK(trace_ring[2].offset == 1ULL << 32);
+
+    /* The patches come out at once, but the ring waits for the last user */
+    trace_users = 1;
+    pthread_create(&thread, NULL, trace_leave, NULL);
+    start = eclock_ticks();
+    trace_stop(&scsi);
+    CHECK(eclock_ticks() - start >= HOST_ECLOCK / 10);
+    pthread_join(thread, NULL);
+    CHECK(SetFunction(&scsi, LVO_BEGINIO, NULL) == (APTR) test_trace);
+
+    /* The dump is big-endian on any host */
+    CHECK(trace_write("trace.bin", HOST_ECLOCK) == 0);
+    FreeMem(trace_ring, TRACE_ENTRIES * sizeof (trace_entry_t));
+    fp = fopen("trace.bin", "rb");
+    CHECK((fread(magic, 1, 4, fp) == 4) && (memcmp(magic, "SDtr", 4) == 0));
+    fclose(fp);
+    CHECK(trace_analyze("trace.bin") == 0);
+
+    /* Counts the file can not hold, including one whose size overflows */
+    trace_set_count("trace.bin", 4);
+    CHECK(trace_analyze("trace.bin") == 1);
+    trace_set_count("trace.bin", 0x0aaaaaab);
+    CHECK(trace_analyze("trace.bin") == 1);
+    trace_set_count("trace.bin", 0);
+    CHECK(trace_analyze("trace.bin") == 0);
+    devs->lh_Head = NULL;
+}
+
+/* Writes a snapshot record of the given size in file byte order */
+static void
+snap_put(FILE *fp, const snap_t *snap, uint size)
+{
+    snap_t rec = *snap;
+
+    rec.size = size;
+    snap_order(&rec);
+    fwrite(&rec, (size < sizeof (rec)) ? size : sizeof (rec), 1, fp);
+    while (size-- > sizeof (rec))
+        fputc(0, fp);
+}
+
+static void
+test_snap(void)
+{
+    char    *files[] = { "snap.bin", "bad.bin", "empty.bin" };
+    snap_t   snap;
+    snap_t   got;
+    uint8_t *buf;
+    uint8_t  head[8];
+    long     len;
+    long     off = 0;
+    FILE    *fp;
+
+    memset(&snap, 0, sizeof (snap));
+    snap.magic     = SNAP_MAGIC;
+    snap.version   = SNAP_VERSION;
+    snap.size      = sizeof (snap);
+    snap.time      = 0x12345678;
+    snap.ctrl_type = CTRL_A3000;
+    snap.sdmac_l[(SDMAC_ISTR - SDMAC_BASE) / 4] = 0x00000055;
+    strcpy(snap.label, "a3000");
+    wd_level     = LEVEL_WD33C93A;
+    wd_microcode = 0x09;
+    wdc_khz      = 14318;
+    bench_result_kbps[2] = 3100;
+    CHECK(snap_write("snap.bin", &snap) == 0);
+    CHECK((snap.magic == SNAP_MAGIC) && (snap.wdc_khz == 14318));
+    bench_result_kbps[2] = 0;
+
+    /* Version 1 records are shorter; a later version's are longer */
+    fp = fopen("snap.bin", "ab");
+    snap_put(fp, &snap, SNAP_MIN_SIZE);
+    snap_put(fp, &snap, sizeof (snap) + 16);
+    fclose(fp);
+
+    fp = fopen("snap.bin", "rb");
+    CHECK(fread(head, 1, sizeof (head), fp) == sizeof (head));
+    fclose(fp);
+    CHECK((memcmp(head, "SDSp", 4) == 0) &&
+          (head[6] == (sizeof (snap) >> 8)) &&
+          (head[7] == (sizeof (snap) & 0xff)));
+
+    buf = snap_load("snap.bin", &len);
+    CHECK((buf != NULL) && (len == 2 * sizeof (snap) + 16 + SNAP_MIN_SIZE));
+    CHECK(snap_next(buf, len, &off, &got) == 1);
+    CHECK((got.time == 0x12345678) && (got.wdc_khz == 14318) &&
+          (got.wd_microcode == 0x09) && (got.kbps[2] == 3100) &&
+          (strcmp(got.label, "a3000") == 0));
+    CHECK((snap_next(buf, len, &off, &got) == 1) && (got.kbps[2] == 0) &&
+          (got.sdmac_l[(SDMAC_ISTR - SDMAC_BASE) / 4] == 0x00000055));
+    CHECK((snap_next(buf, len, &off, &got) == 1) && (got.time == 0x12345678));
+    CHECK((snap_next(buf, len, &off, &got) == 0) && (off == len));
+    snap_unload(buf, len);
+
+    /* An odd size, a bad magic, and a partial record are all rejected */
+    fp = fopen("bad.bin", "wb");
+    snap_put(fp, &snap, sizeof (snap) + 1);
+    fclose(fp);
+    buf = snap_load("bad.bin", &len);
+    off = 0;
+    CHECK(snap_next(buf, len, &off, &got) == -1);
+    snap_unload(buf, len);
+    memcpy(&got, &snap, sizeof (got));
+    got.magic = 0;
+    CHECK(snap_next((uint8_t *) &got, sizeof (got), &off, &got) == -1);
+    buf = snap_load("snap.bin", &len);
+    off = 0;
+    CHECK(snap_next(buf, sizeof (snap) + 8, &off, &got) == 1);
+    CHECK(snap_next(buf, sizeof (snap) + 8, &off, &got) == -1);
+    snap_unload(buf, len);
+
+    write_file("empty.bin", "");
+    CHECK(snap_decode(&files[0], 1, 1) == 0);
+    CHECK(snap_decode(&files[2], 1, 0) == 0);
+    CHECK(snap_decode(files, 3, 1) == 1);
+}
+
+int
+main(void)
+{
+    char dir[] = "/tmp/sdmac_test.XXXXXX";
+
+    /* Files such as ENVARC:sdmac.baseline are created in a scratch dir */
+    if ((mkdtemp(dir) == NULL) || (chdir(dir) != 0)) {
+        perror(dir);
+        return (1);
+    }
+    test_stat();
+    test_met();
+    test_script();
+    test_profile();
+    test_qc();
+    test_baseline();
+    test_align();
+    test_cia_usec();
+    test_scsi_wait();
+    test_bench();
+    test_xfer_modes();
+    test_ttr();
+    test_dma_align();
+    test_cache_cost();
+    test_tests();
+    test_vcd();
+    test_la_capture();
+    test_wdc_regs();
+    test_wdc_ext();
+    test_index_select();
+    test_map();
+    test_watch();
+    test_trace();
+    test_snap();
+
+    if (system("rm -rf -- \"$PWD\"") != 0)
+        printf("Failed to remove %s\n", dir);
+    printf("sdmac_test: %u checks, %u failed\n", checks, failures);
+    return (failures != 0);
+}
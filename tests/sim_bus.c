@@ -0,0 +1,195 @@
+/*
+ * sim_bus.c
+ * ---------
+ * Simulated A3000 SDMAC address space for host test builds of sdmac.c,
+ * which route the BUS_* accessors here. The SDMAC and Ramsey registers
+ * at $dd0000-$dd00ff are kept in sim_bus_regs as a big-endian image, so
+ * word and byte reads see the same bytes as on the Amiga. The WDC is
+ * reached through its SASR and SCMD registers (see sim_wdc.c).
+ *
+ * Tests may set sim_bus_decode to simulate partial address decoding.
+ * It returns the register address which an address reaches, or
+ * SIM_BUS_NONE. By default each address in $dd0000-$dd00ff reaches
+ * itself. Where nothing responds, reads return all ones after a bus
+ * timeout, and writes are lost. Each access moves the E clock forward,
+ * so that timeouts can be told apart from normal accesses.
+ *
+ * sim_bus_sasrw simulates CPU cards on which the long write of the WDC
+ * register index to SDMAC_SASRW does not work.
+ *
+ * DMA is started by the ST_DMA strobe and stopped by SP_DMA. While it
+ * runs, data the WDC moves in DMA mode is passed to sim_bus_dma(), which
+ * stores it at the Ramsey ACR address and advances ACR. The FIFO is not
+ * simulated, so ISTR always reports it empty, and reports the WDC
+ * interrupt as INT_S. With INTEN set in CONTR, a WDC interrupt also
+ * raises the PORTS interrupt through host_interrupt().
+ *
+ * sim_bus_dma_align simulates a DMA engine which only moves whole units
+ * of that many bytes: it ignores the low address bits, so data for a
+ * misaligned buffer lands before it, and the last unit is written in
+ * full, past the end of the data.
+ */
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include "amiga_host.h"
+
+#define SIM_SDMAC_BASE  0x00dd0000
+#define SIM_CONTR       0x0b  // SDMAC control
+#define SIM_CONTR_INTEN 0x04
+#define SIM_ACR         0x0c  // Ramsey DMA address
+#define SIM_ST_DMA      0x13  // Start DMA strobe
+#define SIM_ISTR        0x1f  // Interrupt status
+#define SIM_ISTR_FIFOE  0x01
+#define SIM_ISTR_INT_S  0x40
+#define SIM_SP_DMA      0x3f  // Stop DMA strobe
+#define SIM_AUXST_INT   0x80  // WDC interrupt pending
+#define SIM_SASR_R      0x41  // Byte read of WDC register index
+#define SIM_SCMD        0x43  // WDC register data
+#define SIM_SASRW       0x48  // Long write of WDC register index
+#define SIM_SASR_W      0x49  // Byte write of WDC register index
+
+#define SIM_BUS_TICKS          10    // E clock ticks per access
+#define SIM_BUS_TIMEOUT_TICKS  1000  // E clock ticks per bus timeout
+
+uint8_t  sim_bus_regs[0x100];
+uint32_t (*sim_bus_decode)(uint32_t addr);
+uint32_t sim_bus_sasrw = SIM_SASRW_OK;
+
+uint32_t sim_bus_dma_align = 1;
+
+static uint8_t sim_bus_dma_on;  // Between ST_DMA and SP_DMA
+
+/* Returns the offset of addr in sim_bus_regs, or -1 if it does not respond */
+static int
+sim_bus_offset(uint32_t addr, uint32_t width)
+{
+    uint32_t off;
+
+    if (sim_bus_decode != NULL)
+        addr = sim_bus_decode(addr);
+    off = addr - SIM_SDMAC_BASE;
+    if ((addr == SIM_BUS_NONE) || (addr < SIM_SDMAC_BASE) ||
+        (off + width > sizeof (sim_bus_regs))) {
+        host_eclock_advance(SIM_BUS_TIMEOUT_TICKS);
+        return (-1);
+    }
+    host_eclock_advance(SIM_BUS_TICKS);
+    return (off);
+}
+
+uint8_t
+sim_bus_read8(uint32_t addr)
+{
+    int off = sim_bus_offset(addr, 1);
+
+    if (off < 0)
+        return (0xff);
+    if (off == SIM_SASR_R)
+        return (sim_wdc_index());
+    if (off == SIM_SCMD)
+        return (sim_wdc_read());
+    if (off == SIM_ISTR)
+        return (sim_bus_regs[off] | SIM_ISTR_FIFOE |
+                ((sim_wdc_auxst & SIM_AUXST_INT) ? SIM_ISTR_INT_S : 0));
+    return (sim_bus_regs[off]);
+}
+
+uint16_t
+sim_bus_read16(uint32_t addr)
+{
+    int off = sim_bus_offset(addr, 2);
+
+    if (off < 0)
+        return (0xffff);
+    return ((sim_bus_regs[off] << 8) | sim_bus_regs[off + 1]);
+}
+
+uint32_t
+sim_bus_read32(uint32_t addr)
+{
+    int off = sim_bus_offset(addr, 4);
+
+    if (off < 0)
+        return (0xffffffff);
+    return (((uint32_t) sim_bus_regs[off] << 24) |
+            (sim_bus_regs[off + 1] << 16) |
+            (sim_bus_regs[off + 2] << 8) | sim_bus_regs[off + 3]);
+}
+
+void
+sim_bus_write8(uint32_t addr, uint8_t value)
+{
+    int off = sim_bus_offset(addr, 1);
+
+    if (off < 0)
+        return;
+    if (off == SIM_SASR_W)
+        sim_wdc_select(value);
+    else if (off == SIM_SCMD)
+        sim_wdc_write(value);
+    else if (off == SIM_ST_DMA)
+        sim_bus_dma_on = 1;
+    else if (off == SIM_SP_DMA)
+        sim_bus_dma_on = 0;
+    else
+        sim_bus_regs[off] = value;
+}
+
+void
+sim_bus_write32(uint32_t addr, uint32_t value)
+{
+    int off = sim_bus_offset(addr, 4);
+
+    if (off < 0)
+        return;
+    if (off == SIM_SASRW) {
+        if (sim_bus_sasrw == SIM_SASRW_OK)
+            sim_wdc_select(value);
+        else if (sim_bus_sasrw == SIM_SASRW_LANE)
+            sim_wdc_select(value >> 8);
+        return;
+    }
+    sim_bus_regs[off]     = value >> 24;
+    sim_bus_regs[off + 1] = value >> 16;
+    sim_bus_regs[off + 2] = value >> 8;
+    sim_bus_regs[off + 3] = value;
+}
+
+/*
+ * sim_bus_dma
+ * -----------
+ * Stores len bytes moved by the WDC at the DMA address, as the SDMAC
+ * does. Returns the number of bytes stored, which is 0 if DMA has not
+ * been started or the address is not in memory from AllocMem().
+ */
+uint32_t
+sim_bus_dma(const uint8_t *data, uint32_t len)
+{
+    uint32_t acr = (sim_bus_regs[SIM_ACR] << 24) |
+                   (sim_bus_regs[SIM_ACR + 1] << 16) |
+                   (sim_bus_regs[SIM_ACR + 2] << 8) | sim_bus_regs[SIM_ACR + 3];
+    uint32_t mask = sim_bus_dma_align - 1;
+    uint32_t start = acr & ~mask;
+    uint32_t span = ((acr + len + mask) & ~mask) - start;
+    uint8_t *dst = host_dma_ptr(start, span);
+
+    if ((sim_bus_dma_on == 0) || (dst == NULL))
+        return (0);
+    memcpy(dst, data, len);
+    memset(dst + len, 0, span - len);  // Rest of the last unit
+    acr += len;
+    sim_bus_regs[SIM_ACR]     = acr >> 24;
+    sim_bus_regs[SIM_ACR + 1] = acr >> 16;
+    sim_bus_regs[SIM_ACR + 2] = acr >> 8;
+    sim_bus_regs[SIM_ACR + 3] = acr;
+    return (len);
+}
+
+/* Called by sim_wdc.c when the WDC raises its interrupt */
+void
+sim_bus_wdc_int(void)
+{
+    if (sim_bus_regs[SIM_CONTR] & SIM_CONTR_INTEN)
+        host_interrupt();
+}
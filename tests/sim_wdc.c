@@ -0,0 +1,226 @@
+/*
+ * sim_wdc.c
+ * ---------
+ * Simulated WD33C93B for host test builds of sdmac.c. sim_bus.c passes
+ * it the SASR and SCMD accesses, which select a register and read or
+ * write it. As on the real part, the register index then advances
+ * unless it selects the auxiliary status, command, or data register.
+ * The directly addressed registers are kept in sim_wdc_regs. The
+ * GET_REGISTER and SET_REGISTER commands move values between CDB2 and
+ * the extended registers in sim_wdc_ext, and complete at once with the
+ * status the real part reports and an interrupt. The auxiliary status is
+ * sim_wdc_auxst. As on the real part, reading SCSI_STAT clears its INT
+ * bit, and sim_wdc_stat_steals counts reads which did so before any
+ * command was issued here.
+ *
+ * RESET completes at once. SELECT-ATN-AND-TRANSFER runs the CDB in
+ * CDB1 onward (of the length in OWN_ID, as sdmac.c sets it) through
+ * host_scsi_target. Data in DMA mode goes to sim_bus_dma() before the
+ * command completes; otherwise it is read from the DATA register while
+ * AUXST shows DBR, and the command completes with the last byte. The
+ * target status is left in LUN and the unmoved count in TCOUNT.
+ */
+#include <stdint.h>
+#include <stdlib.h>
+#include "amiga_host.h"
+
+#define SIM_OWN_ID          0x00
+#define SIM_CONTROL         0x01
+#define SIM_CDB1            0x03
+#define SIM_CDB2            0x04
+#define SIM_LUN             0x0f
+#define SIM_TCOUNT2         0x12
+#define SIM_DST_ID          0x15
+#define SIM_SCSI_STAT       0x17
+#define SIM_CMD             0x18
+#define SIM_DATA            0x19
+#define SIM_AUXST           0x1f
+#define SIM_AUXST_DBR       0x01
+#define SIM_AUXST_INT       0x80
+#define SIM_CONTROL_DMA     0x80
+#define SIM_RESET           0x00
+#define SIM_SEL_ATN_XFER    0x08
+#define SIM_GET_REGISTER    0x44
+#define SIM_SET_REGISTER    0x45
+#define SIM_SSTAT_SAT_DONE  0x16
+#define SIM_SSTAT_SEL_TMO   0x42
+
+uint8_t  sim_wdc_regs[0x40];
+uint8_t  sim_wdc_ext[0x100];
+uint8_t  sim_wdc_auxst;
+uint32_t sim_wdc_stat_steals;
+
+static uint8_t  sim_wdc_sasr;    // Register index
+static uint8_t  sim_wdc_int;     // Interrupt raised by a simulated command
+static uint8_t *sim_wdc_pio;     // Data waiting to be read, NULL if none
+static uint32_t sim_wdc_pio_pos;
+static uint32_t sim_wdc_pio_len;
+static uint8_t  sim_wdc_status;  // Target status for the end of the data
+
+static void
+sim_wdc_complete(uint8_t sstat)
+{
+    sim_wdc_regs[SIM_SCSI_STAT] = sstat;
+    sim_wdc_auxst |= SIM_AUXST_INT;
+    sim_wdc_int = 1;
+    sim_bus_wdc_int();
+}
+
+static uint32_t
+sim_wdc_tcount(void)
+{
+    return ((sim_wdc_regs[SIM_TCOUNT2] << 16) |
+            (sim_wdc_regs[SIM_TCOUNT2 + 1] << 8) |
+            sim_wdc_regs[SIM_TCOUNT2 + 2]);
+}
+
+static void
+sim_wdc_set_tcount(uint32_t count)
+{
+    sim_wdc_regs[SIM_TCOUNT2]     = count >> 16;
+    sim_wdc_regs[SIM_TCOUNT2 + 1] = count >> 8;
+    sim_wdc_regs[SIM_TCOUNT2 + 2] = count;
+}
+
+/* Ends the data phase and reports the target status */
+static void
+sim_wdc_sat_done(void)
+{
+    free(sim_wdc_pio);
+    sim_wdc_pio = NULL;
+    sim_wdc_auxst &= ~SIM_AUXST_DBR;
+    sim_wdc_regs[SIM_LUN] = sim_wdc_status;
+    sim_wdc_complete(SIM_SSTAT_SAT_DONE);
+}
+
+static void
+sim_wdc_sat(void)
+{
+    uint32_t tcount = sim_wdc_tcount();
+    uint32_t len = tcount;
+    uint8_t *data = calloc(1, tcount + 1);
+    int      status = SIM_SCSI_NO_TARGET;
+
+    free(sim_wdc_pio);
+    sim_wdc_pio = NULL;
+    if (host_scsi_target != NULL)
+        status = host_scsi_target(sim_wdc_regs[SIM_DST_ID] & 7,
+                                  sim_wdc_regs[SIM_LUN] & 7,
+                                  &sim_wdc_regs[SIM_CDB1],
+                                  sim_wdc_regs[SIM_OWN_ID] & 0x0f,
+                                  data, &len);
+    if (status == SIM_SCSI_NO_TARGET) {
+        free(data);
+        sim_wdc_complete(SIM_SSTAT_SEL_TMO);
+        return;
+    }
+    if (len > tcount)
+        len = tcount;
+    sim_wdc_status = status;
+    if (sim_wdc_regs[SIM_CONTROL] & SIM_CONTROL_DMA) {
+        len = sim_bus_dma(data, len);
+        free(data);
+        sim_wdc_set_tcount(tcount - len);
+        sim_wdc_sat_done();
+        return;
+    }
+    sim_wdc_pio     = data;
+    sim_wdc_pio_pos = 0;
+    sim_wdc_pio_len = len;
+    if (len == 0)
+        sim_wdc_sat_done();
+    else
+        sim_wdc_auxst |= SIM_AUXST_DBR;
+}
+
+/* Returns the next byte of the data phase */
+static uint8_t
+sim_wdc_pio_read(void)
+{
+    uint8_t value = sim_wdc_pio[sim_wdc_pio_pos++];
+
+    sim_wdc_set_tcount(sim_wdc_tcount() - 1);
+    if (sim_wdc_pio_pos == sim_wdc_pio_len)
+        sim_wdc_sat_done();
+    return (value);
+}
+
+uint8_t
+sim_wdc_get(uint8_t reg)
+{
+    reg %= sizeof (sim_wdc_regs);
+    if (reg == SIM_AUXST)
+        return (sim_wdc_auxst);
+    if ((reg == SIM_DATA) && (sim_wdc_pio != NULL))
+        return (sim_wdc_pio_read());
+    if ((reg == SIM_SCSI_STAT) && (sim_wdc_auxst & SIM_AUXST_INT)) {
+        if (!sim_wdc_int)
+            sim_wdc_stat_steals++;
+        sim_wdc_auxst &= ~SIM_AUXST_INT;
+        sim_wdc_int = 0;
+    }
+    return (sim_wdc_regs[reg]);
+}
+
+void
+sim_wdc_set(uint8_t reg, uint8_t value)
+{
+    reg %= sizeof (sim_wdc_regs);
+    sim_wdc_regs[reg] = value;
+    if (reg != SIM_CMD)
+        return;
+    switch (value) {
+        case SIM_RESET:
+            free(sim_wdc_pio);
+            sim_wdc_pio = NULL;
+            sim_wdc_auxst &= ~SIM_AUXST_DBR;
+            sim_wdc_complete((sim_wdc_regs[SIM_OWN_ID] & 0x08) ? 0x01 : 0x00);
+            break;
+        case SIM_SEL_ATN_XFER:
+            sim_wdc_sat();
+            break;
+        case SIM_GET_REGISTER:
+            sim_wdc_regs[SIM_CDB2] = sim_wdc_ext[sim_wdc_regs[SIM_CDB1]];
+            sim_wdc_complete(value | 0x10);  // Command complete
+            break;
+        case SIM_SET_REGISTER:
+            sim_wdc_ext[sim_wdc_regs[SIM_CDB1]] = sim_wdc_regs[SIM_CDB2];
+            sim_wdc_complete(value | 0x10);
+            break;
+    }
+}
+
+void
+sim_wdc_select(uint8_t reg)
+{
+    sim_wdc_sasr = reg;
+}
+
+uint8_t
+sim_wdc_index(void)
+{
+    return (sim_wdc_sasr);
+}
+
+static void
+sim_wdc_advance(void)
+{
+    if ((sim_wdc_sasr != SIM_AUXST) && (sim_wdc_sasr != SIM_CMD) &&
+        (sim_wdc_sasr != SIM_DATA))
+        sim_wdc_sasr++;
+}
+
+uint8_t
+sim_wdc_read(void)
+{
+    uint8_t value = sim_wdc_get(sim_wdc_sasr);
+    sim_wdc_advance();
+    return (value);
+}
+
+void
+sim_wdc_write(uint8_t value)
+{
+    sim_wdc_set(sim_wdc_sasr, value);
+    sim_wdc_advance();
+}